@@ -9,23 +9,49 @@
  
 #include "BTreeIndex.h"
 #include "BTreeNode.h"
+#include <algorithm>
+#include <climits>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 #include <iostream>
+#include <iterator>
 
 using namespace std;
 
+template <class KeyType>
+std::map<std::string, typename BTreeIndexT<KeyType>::ClosedIndex> BTreeIndexT<KeyType>::closedIndexes;
+template <class KeyType>
+std::mutex BTreeIndexT<KeyType>::closedMutex;
+
 /*
  * BTreeIndex constructor
  */
-BTreeIndex::BTreeIndex()
+template <class KeyType>
+BTreeIndexT<KeyType>::BTreeIndexT()
 {
 	// Set default values: rootPid 1 is the smallest page that a root can start
 	// Upon adding a root node, minimum valid treeHeight is 1
     rootPid = -1;
 	treeHeight = 0;
 	memset(buffer, 0, sizeof(buffer));
+	memset(logPage, 0, sizeof(logPage));
+	logPagePid = 0;
+	logLinked = false;
+	logDirty = false;
+	writable = false;
+	memset(&openStamp, 0, sizeof(openStamp));
+	openWriters = 0;
+	bulkActive = false;
+	nextFreePid = 0;
+	copyOnWrite = false;
+	publishedVersion = 0;
+	freeListPid = 0;
+	buffered = false;
+	entryCounts = false;
+	countsStale = false;
+	readMode = B_LINK_READS;
+	readRestarts = 0;
 }
 
 /*
@@ -35,9 +61,30 @@ BTreeIndex::BTreeIndex()
  * @param mode[IN] 'r' for read, 'w' for write
  * @return error code. 0 if no error
  */
-RC BTreeIndex::open(const string& indexname, char mode)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::open(const string& indexname, char mode)
 {
 	RC rc;
+	BTreeMetadata meta;
+
+	innerNodes.clear();
+	nextFreePid = 0;
+	copyOnWrite = false;
+	publishedVersion = 0;
+	openSnapshots.clear();
+	retiredPages.clear();
+	freePages.clear();
+	freeListPid = 0;
+	buffered = false;
+	entryCounts = false;
+	countsStale = false;
+	readRestarts = 0;
+	buffers.clear();
+	logPages.clear();
+	logPagePid = 0;
+	logLinked = false;
+	logDirty = false;
+	stats = BTreeStatistics<KeyType>();
 
 	// Open the PageFile
 	if ((rc = pf.open(indexname, mode)) < 0)
@@ -45,6 +92,31 @@ RC BTreeIndex::open(const string& indexname, char mode)
 		//fprintf(stderr, "Error: failed in opening index file in read/write mode");
 		return rc;
 	}
+	indexName = indexname;
+	writable = (mode == 'w' || mode == 'W');
+	pf.getStamp(openStamp);
+
+	// Take page 0 and the non-leaf nodes from the last close() of the file,
+	// if it did not change since. Once it is open for writing, what is left
+	// in memory may not be the file any more
+	bool cached = false;
+	{
+		std::lock_guard<std::mutex> guard(closedMutex);
+		ClosedIndex& closed = closedIndexes[indexname];
+		if (closed.valid && memcmp(&closed.stamp, &openStamp, sizeof(openStamp)) == 0)
+		{
+			memcpy(buffer, closed.metadata, PageFile::PAGE_SIZE);
+			innerNodes = closed.innerNodes;
+			cached = true;
+		}
+		if (writable)
+		{
+			closed.writers++;
+			closed.valid = false;
+			closed.innerNodes.clear();
+		}
+		openWriters = closed.writers;
+	}
 
 	// If file is open for the first time, initialize everything again
 	if (pf.endPid() == 0)
@@ -52,7 +124,7 @@ RC BTreeIndex::open(const string& indexname, char mode)
 		rootPid = -1;
 		treeHeight = 0;
 
-		if ((rc = pf.write(0, buffer)) < 0)
+		if ((rc = writeMetadata()) < 0)
 		{
 			//fprintf(stderr, "Error: failed to write to index file");
 			return rc;
@@ -62,407 +134,3127 @@ RC BTreeIndex::open(const string& indexname, char mode)
 	}
 
 	// Read in metadata saved in page 0
-	if ((rc = pf.read(0, buffer)) < 0)
+	if (!cached && (rc = pf.read(0, buffer)) < 0)
 	{
 		//fprintf(stderr, "Error: failed to load page 0 metadata");
+		pf.close();
 		return rc;
 	}
+	memcpy(&meta, buffer, sizeof(meta));
+
+	// Refuse index files written in another node layout or on another key type
+	// (files from before the format version was stored have zeros there)
+	if (meta.magic != MAGIC || meta.version != FORMAT_VERSION || meta.keyType != KeyTraits<KeyType>::TYPE_ID)
+	{
+		innerNodes.clear();
+		pf.close();
+		return RC_INVALID_FILE_FORMAT;
+	}
 
 	// Load pid and height into index variables
 	// Pid cannot be 0 (stored for metadata) or negative, height must be positive
-	int loadPid;
-	int loadHeight;
-	memcpy(&loadPid, buffer, sizeof(int));
-	memcpy(&loadHeight, buffer + 4, sizeof(int));
-	if (loadPid > 0 && loadHeight >= 0)
+	if (meta.rootPid > 0 && meta.treeHeight >= 0)
+	{
+		rootPid = meta.rootPid;
+		treeHeight = meta.treeHeight;
+	}
+	copyOnWrite = (meta.flags & COPY_ON_WRITE) != 0;
+	buffered = (meta.flags & BUFFERED) != 0;
+	entryCounts = (meta.flags & ENTRY_COUNTS) != 0;
+	countsStale = (meta.flags & COUNTS_STALE) != 0;
+	freeListPid = meta.freeListPid;
+	memcpy(&stats, buffer + sizeof(meta), sizeof(stats));
+
+	// The inserts logged since the buffers were last empty go back into them
+	// (before page 0 is written again below, with the log still in it)
+	if (buffered && meta.logPid > 0 && (rc = readLog(meta.logPid)) < 0)
+	{
+		innerNodes.clear();
+		buffers.clear();
+		logPages.clear();
+		pf.close();
+		return rc;
+	}
+
+	// The free pages go back to allocatePage(). Page 0 drops the list right
+	// away: once its pages are reused, it would no longer be a list
+	if (freeListPid > 0 && (mode == 'w' || mode == 'W'))
 	{
-		rootPid = loadPid;
-		treeHeight = loadHeight;
+		if ((rc = readFreeList()) < 0 || (rc = writeMetadata()) < 0)
+		{
+			innerNodes.clear();
+			freePages.clear();
+			buffers.clear();
+			logPages.clear();
+			pf.close();
+		}
 	}
 
 	return rc;
 }
 
 /*
- * Close the index file.
+ * Copy the non-leaf node at pid from memory (reading it if it is not there).
+ * @param pid[IN] the PageId of the node
+ * @param node[OUT] the node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readInner(PageId pid, BTNonLeafNodeT<KeyType>& node)
+{
+	RC rc;
+
+	{
+		std::shared_lock<std::shared_mutex> guard(innerMutex);
+		typename std::map<PageId, BTNonLeafNodeT<KeyType> >::iterator it = innerNodes.find(pid);
+		if (it != innerNodes.end())
+		{
+			node = it->second;
+			return 0;
+		}
+	}
+
+	if ((rc = node.read(pid, pf)) < 0)
+		return rc;
+
+	// Another thread may have stored the node (or a newer copy) meanwhile
+	std::unique_lock<std::shared_mutex> guard(innerMutex);
+	innerNodes.insert(std::make_pair(pid, node));
+	return 0;
+}
+
+/*
+ * Find the child-node pointer to follow for searchKey in the non-leaf node
+ * at pid, without copying the node out of memory. When a split moved the
+ * keys from searchKey on to a node further right, move right to it first.
+ * @param pid[IN/OUT] the PageId of the node; the node searchKey belongs to
+ * @param searchKey[IN] the key to find; NULL for the last child of the last node
+ * @param childPid[OUT] the pointer to the child node to follow
  * @return error code. 0 if no error
  */
-RC BTreeIndex::close()
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readChildPtr(PageId& pid, const KeyType* searchKey, PageId& childPid)
 {
 	RC rc;
 
-	// Save information related to rootPid and treeHeight in Page 0
-	memcpy(buffer, &rootPid, sizeof(int));
-	memcpy(buffer + 4, &treeHeight, sizeof(int));
-	if ((rc = pf.write(0, buffer)) < 0)
+	for (;;)
 	{
-		//fprintf(stderr, "Error: failed in writing root/height metadata to disk");
+		{
+			std::shared_lock<std::shared_mutex> guard(innerMutex);
+			typename std::map<PageId, BTNonLeafNodeT<KeyType> >::iterator it = innerNodes.find(pid);
+			if (it != innerNodes.end())
+			{
+				BTNonLeafNodeT<KeyType>& node = it->second;
+				if (searchKey != NULL ? node.isPastHighKey(*searchKey) : node.getNextNodePtr() > 0)
+				{
+					pid = node.getNextNodePtr();
+					continue;
+				}
+				if (searchKey == NULL)
+				{
+					childPid = node.getLastChildPtr();
+					return 0;
+				}
+				return node.locateChildPtr(*searchKey, childPid);
+			}
+		}
+
+		// Not in memory yet: read it in, and look again
+		BTNonLeafNodeT<KeyType> node;
+		if ((rc = readInner(pid, node)) < 0)
+			return rc;
+	}
+}
+
+/*
+ * Write the non-leaf node to pid, and to memory.
+ * @param pid[IN] the PageId to write to
+ * @param node[IN] the node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::writeInner(PageId pid, BTNonLeafNodeT<KeyType>& node)
+{
+	RC rc;
+
+	if ((rc = node.write(pid, pf)) < 0)
 		return rc;
+
+	std::unique_lock<std::shared_mutex> guard(innerMutex);
+	innerNodes[pid] = node;
+	return 0;
+}
+
+/*
+ * Close the index file.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::close()
+{
+	RC rc;
+
+	// An index open for reading has nothing to write
+	if (writable)
+	{
+		// The inserts still in a buffer go into the leaves first
+		if ((rc = flushBuffers()) < 0)
+			return rc;
+
+		// The free pages are kept for the next session (and are no
+		// non-leaf nodes any more)
+		for (size_t i = 0; i < freePages.size(); i++)
+			innerNodes.erase(freePages[i]);
+		for (size_t i = 0; i < retiredPages.size(); i++)
+			innerNodes.erase(retiredPages[i].second);
+		if ((rc = writeFreeList()) < 0)
+			return rc;
+
+		// Save information related to rootPid and treeHeight in Page 0
+		if ((rc = writeMetadata()) < 0)
+		{
+			//fprintf(stderr, "Error: failed in writing root/height metadata to disk");
+			return rc;
+		}
 	}
 	
 	// If it successfully wrote Page 0 metadata into disk
 	// Close the index file
+	FileStamp stamp;
+	bool stamped = (pf.getStamp(stamp) == 0);
 	if ((rc = pf.close()) < 0)
 	{
 		//fprintf(stderr, "Error: failed to close the index file");
+		return rc;
 	}
 
+	if (stamped)
+		keepClosedIndex(stamp);
+	innerNodes.clear();
 	return rc;
 }
 
 /*
- * Insert (key, RecordId) pair to the index.
- * @param key[IN] the key for the value inserted into the index
- * @param rid[IN] the RecordId for the record being inserted into the index
+ * Leave page 0 and the non-leaf nodes in memory for the next open() of the
+ * file, unless the file was opened for writing since open(), or changed
+ * since open() while the index was open for reading.
+ * @param stamp[IN] the stamp of the file, as close() leaves it
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::keepClosedIndex(const FileStamp& stamp)
+{
+	std::lock_guard<std::mutex> guard(closedMutex);
+	ClosedIndex& closed = closedIndexes[indexName];
+	if (closed.writers != openWriters || (!writable && memcmp(&stamp, &openStamp, sizeof(stamp)) != 0))
+		return;
+
+	// Readers of the same file add the nodes they read to the ones left
+	if (!writable && closed.valid && memcmp(&closed.stamp, &stamp, sizeof(stamp)) == 0)
+	{
+		closed.innerNodes.insert(innerNodes.begin(), innerNodes.end());
+		return;
+	}
+
+	closed.valid = true;
+	closed.stamp = stamp;
+	packMetadata(closed.metadata);
+	closed.innerNodes = innerNodes;
+}
+
+/*
+ * Write the root pointer, the height and the mode of the index to page 0,
+ * followed by the statistics.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::writeMetadata()
+{
+	char page[PageFile::PAGE_SIZE];
+
+	packMetadata(page);
+	return pf.write(0, page);
+}
+
+/*
+ * Build page 0: the root pointer, the height and the mode of the index,
+ * followed by the statistics.
+ * @param page[OUT] the page
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::packMetadata(char* page)
+{
+	BTreeMetadata meta;
+
+	meta.rootPid = rootPid;
+	meta.treeHeight = treeHeight;
+	meta.magic = MAGIC;
+	meta.version = FORMAT_VERSION;
+	meta.keyType = KeyTraits<KeyType>::TYPE_ID;
+	meta.flags = (copyOnWrite ? COPY_ON_WRITE : 0) | (buffered ? BUFFERED : 0)
+		| (entryCounts ? ENTRY_COUNTS : 0) | (countsStale ? COUNTS_STALE : 0);
+	meta.freeListPid = freeListPid;
+	meta.logPid = logPages.empty() ? 0 : logPages.front();
+	memset(page, 0, PageFile::PAGE_SIZE);
+	memcpy(page, &meta, sizeof(meta));
+	{
+		std::lock_guard<std::mutex> guard(statsMutex);
+		memcpy(page + sizeof(meta), &stats, sizeof(stats));
+	}
+}
+
+/*
+ * Write the free pages to a list of pages taken from them: the last free
+ * page holds the PageIds of the free pages in front of it (as many as fit),
+ * and links to the page written before it.
  * @return error code. 0 if no error
  */
-RC BTreeIndex::insert(int key, const RecordId& rid)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::writeFreeList()
 {
 	RC rc;
-	
-	// Initialize a new tree from the root if it doesn't exist yet
-	if (treeHeight == 0)
+	const int perPage = (PageFile::PAGE_SIZE - sizeof(PageListHeader)) / sizeof(PageId);
+	std::vector<PageId> pages;
+
+	// No snapshot is open any more, so every replaced page is free
+	pages.swap(freePages);
+	for (size_t i = 0; i < retiredPages.size(); i++)
+		pages.push_back(retiredPages[i].second);
+	retiredPages.clear();
+
+	while (!pages.empty())
 	{
-		// Insert key-rid pair into leaf node
-		BTLeafNode rootTree;
-		if ((rc = rootTree.insert(key, rid)) < 0)
-		{
-			//fprintf(stderr, "Error: failed to insert into root leaf node");
+		PageListHeader header;
+		PageId pid = pages.back();
+		pages.pop_back();
+
+		header.nextPid = freeListPid;
+		header.count = std::min((int)pages.size(), perPage);
+		memset(buffer, 0, PageFile::PAGE_SIZE);
+		memcpy(buffer, &header, sizeof(header));
+		memcpy(buffer + sizeof(header), pages.data() + pages.size() - header.count, header.count * sizeof(PageId));
+		pages.resize(pages.size() - header.count);
+
+		if ((rc = pf.write(pid, buffer)) < 0)
 			return rc;
-		}
-		
-		// Set root to 1 if the file was just created; otherwise, set it to last pid available
-		// pid = 0 is used to store metadata about the treeHeight and rootPid
-		if (pf.endPid() == 0)
-			rootPid = 1;
-		else
-			rootPid = pf.endPid();
+		freeListPid = pid;
+	}
 
-		treeHeight++;
+	return 0;
+}
 
-		// Write the tree into the pid of the PageFile
-		if ((rc = rootTree.write(rootPid, pf)) < 0)
-		{
-			//fprintf(stderr, "Error: failed to write new tree");
-		}
+/*
+ * Move the PageIds of the list of free pages, and the pages of the list
+ * themselves, to freePages.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readFreeList()
+{
+	RC rc;
 
-		return rc;
+	while (freeListPid > 0)
+	{
+		PageListHeader header;
+		if ((rc = pf.read(freeListPid, buffer)) < 0)
+			return rc;
+		memcpy(&header, buffer, sizeof(header));
+
+		const PageId* pids = (const PageId*)(buffer + sizeof(header));
+		freePages.insert(freePages.end(), pids, pids + header.count);
+		freePages.push_back(freeListPid);
+		freeListPid = header.nextPid;
+	}
+
+	return 0;
+}
+
+/*
+ * Add an insert to the statistics.
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::addStatistics(const KeyType& key, int entries, bool newKey, int leafEntries, int leaves)
+{
+	std::lock_guard<std::mutex> guard(statsMutex);
+
+	if (entries > 0 && (stats.entryCount == 0 || KeyTraits<KeyType>::less(key, stats.minKey)))
+		stats.minKey = key;
+	if (entries > 0 && (stats.entryCount == 0 || KeyTraits<KeyType>::less(stats.maxKey, key)))
+		stats.maxKey = key;
+	stats.entryCount += entries;
+	stats.distinctKeys += newKey ? 1 : 0;
+	stats.leafEntries += leafEntries;
+	stats.leafCount += leaves;
+}
+
+/*
+ * Copy the statistics out, with the buffered inserts added to the entries.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::getStatistics(BTreeStatistics<KeyType>& stats)
+{
+	// Under bufferMutex, no insert moves from a buffer to a leaf meanwhile
+	std::lock_guard<std::mutex> bufferGuard(bufferMutex);
+	{
+		std::lock_guard<std::mutex> guard(statsMutex);
+		stats = this->stats;
 	}
 
-	// If the tree exists already, traverse it to find where to insert the key-rid pair
-	// Begin after the metadata page 0 -> pidStart = 1; heightStart = 1 from the root
-	int inKey;
-	PageId inPid;
-	if ((rc = insertPair(key, rid, rootPid, 1, inKey, inPid)) < 0)
+	for (typename std::map<PageId, MessageBuffer>::iterator it = buffers.begin(); it != buffers.end(); ++it)
 	{
-		//fprintf(stderr, "Error: failed to insert pair into leaf node");
+		std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+		if (messages.empty())
+			continue;
+		if (stats.entryCount == 0 || KeyTraits<KeyType>::less(messages.front().key, stats.minKey))
+			stats.minKey = messages.front().key;
+		if (stats.entryCount == 0 || KeyTraits<KeyType>::less(stats.maxKey, messages.back().key))
+			stats.maxKey = messages.back().key;
+		stats.entryCount += messages.size();
 	}
+	return 0;
+}
 
-	return rc;
+/*
+ * The entries in the leaves over the entries they have room for, counting
+ * packed entries (see BTLeafNodeT::getMaxEntries()).
+ */
+template <class KeyType>
+double BTreeIndexT<KeyType>::getAverageFill(const BTreeStatistics<KeyType>& stats)
+{
+	if (stats.leafCount == 0)
+		return 0;
+	return (double)stats.leafEntries / ((double)stats.leafCount * BTLeafNodeT<KeyType>::getMaxEntries());
 }
 
-RC BTreeIndex::insertPair(int key, const RecordId& rid, PageId curPid, int curHeight, int& inKey, PageId& inPid)
+/*
+ * Insert (key, RecordId) pair to the index.
+ * @param key[IN] the key for the value inserted into the index
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insert(const KeyType& key, const RecordId& rid)
 {
-	RC rc;
-	inKey = -1;
-	inPid = -1;
+	if (copyOnWrite)
+		return insertCopy(key, rid);
+	if (buffered)
+		return insertBuffered(key, rid);
+
+	IndexEntry<KeyType> entry;
+	entry.key = key;
+	entry.rid = rid;
+	return insertSorted(&entry, 1);
+}
+
+/*
+ * Insert (key, RecordId) pairs sorted by key, a leaf at a time: the pairs
+ * up to the high key of the leaf go into it together, and the leaf is
+ * written once for them, unless one does not fit and the leaf splits.
+ * @param entries[IN] the pairs
+ * @param count[IN] the number of pairs
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertSorted(const IndexEntry<KeyType>* entries, int count)
+{
+	RC rc = 0;
+	std::vector<PageId> path;
+	BTLeafNodeT<KeyType> leaf;
+	PageId leafPid;
+
+	// Without entry counts, the first insert leaves them behind for good
+	// (until recountEntries()), and says so in page 0 before any leaf changes
+	if (!entryCounts && !countsStale && !countsStale.exchange(true) && (rc = writeMetadata()) < 0)
+		return rc;
 
-	// Recursively traverse through the B+ tree until you reach the max height
-	// At the max height we insert at the leaf node level
-	if (curHeight == treeHeight)
+	for (int i = 0; i < count; )
 	{
-		// Read page contents into the leaf node
-		BTLeafNode curLeaf;
-		if ((rc = curLeaf.read(curPid, pf)) < 0)
-		{
-			//fprintf(stderr, "Error: failed to read contents into leaf node (rec)");
+		const KeyType& key = entries[i].key;
+		const RecordId& rid = entries[i].rid;
+
+		if ((rc = findNode(&key, 0, leafPid, &path)) < 0)
 			return rc;
-		}
 
-		// Attempt to insert into leaf node and write into the page file
-		if ((rc = curLeaf.insert(key, rid)) == 0)
+		// Initialize a new tree from the root if it doesn't exist yet
+		if (leafPid == 0)
 		{
-			if ((rc = curLeaf.write(curPid, pf)) < 0)
+			versions.lock(0);
+			if (treeHeight == 0)
 			{
-				//fprintf(stderr, "Error: failed to write into leaf node (rec)");
-				return rc;
-			}
+				// Insert key-rid pair into leaf node, and write it into the
+				// first page after the metadata page 0
+				BTLeafNodeT<KeyType> rootTree;
+				PageId pid = allocatePage();
+				if ((rc = rootTree.insert(key, rid)) == 0 && (rc = rootTree.write(pid, pf)) == 0)
+				{
+					rootPid = pid;
+					treeHeight = 1;
+					addStatistics(key, 1, true, 1, 1);
+				}
 
-			return rc;
-		}
+				versions.unlock(0);
+				if (rc < 0)
+					return rc;
+				i++;
+				continue;
+			}
+			versions.unlock(0);
 
-		// Leaf overflow/insertion into leaf node unsuccessful, so try insertAndSplit algorithm
-		BTLeafNode splitLeaf;
-		int splitKey;
-		if ((rc = curLeaf.insertAndSplit(key, rid, splitLeaf, splitKey)) < 0)
-		{
-			//fprintf(stderr, "Error: failed to insert and split the leaf node (rec)");
-			return rc;
+			// Another thread inserted the first key meanwhile
+			continue;
 		}
 
-		// The splitKey (median key) must propagate up to the parent
-		// Set sibling pointers accordingly for splitLeaf and curLeaf
-		int endPid = pf.endPid();
-		inKey = splitKey;
-		inPid = endPid;
-		splitLeaf.setNextNodePtr(curLeaf.getNextNodePtr());
-		curLeaf.setNextNodePtr(endPid);
-
-		// Write the splitLeaf's contents into the last pid area
-		if ((rc = splitLeaf.write(endPid, pf)) < 0)
-		{
-			//fprintf(stderr, "Error: failed to write split leaf's contents (rec)");
+		// The leaf is read once it is locked
+		if ((rc = lockLeaf(key, leafPid, leaf)) < 0)
 			return rc;
-		}
 
-		// Re-write the curLeaf's modified contents into its pid
-		if ((rc = curLeaf.write(curPid, pf)) < 0)
+		bool dirty = false;
+		int added = 0;
+		while (i < count && !leaf.isPastHighKey(entries[i].key)
+			&& (rc = insertIntoLeaf(leaf, entries[i].key, entries[i].rid, dirty)) == 0)
 		{
-			//fprintf(stderr, "Error: failed to re-write current leaf's contents (rec)");
-			return rc;
+			i++;
+			added++;
 		}
 
-		// Splitting a root requires a new non-leaf node 
-		// The splitLeaf/sibling's first value propagates up to the root
-		if (treeHeight == 1)
+		// Split the leaf if the next pair did not fit. Until its parent has the
+		// first key of the new leaf, the new leaf is reached through the right link
+		KeyType splitKey;
+		PageId splitPid = -1;
+		int splitCount = 0;
+		if (rc == RC_NODE_FULL)
 		{
-			// Initialize the root with the splitKey (median key) pushed up
-			// It has two pid references to the split leaf nodes
-			BTNonLeafNode root;
-			root.initializeRoot(curPid, splitKey, endPid);
-			
-			// Write the root into the rootPid page
-			rootPid = pf.endPid();
-			if ((rc = root.write(rootPid, pf)) < 0)
-			{
-				//fprintf(stderr, "Error: failed to write root contents (rec)");
-				return rc;
-			}
-			
-			treeHeight++;
+			if ((rc = splitLeaf(leaf, leafPid, entries[i].key, entries[i].rid, splitKey, splitPid)) == 0 && entryCounts)
+				rc = countNode(splitPid, 0, splitCount);
+			i++;
+			added++;
 		}
-	}
-	else
-	{
-		// Let's continue to traverse down the B+ tree properly while we haven't reached leaf level
-		// Read nonLeaf node's contents into the page
-		BTNonLeafNode nonLeaf;
-		if ((rc = nonLeaf.read(curPid, pf)) < 0)
+		else if (rc == 0 && dirty)
+			rc = leaf.write(leafPid, pf);
+		if (rc < 0)
 		{
-			//fprintf(stderr, "Error: failed to read nonleaf node's contents (rec)");
+			versions.unlock(leafPid);
 			return rc;
 		}
 
-		// Find the child node for the key
-		PageId childPid;
-		nonLeaf.locateChildPtr(key, childPid);
+		// The leaf stays locked until its parent counts the new entries,
+		// or takes the new leaf
+		if ((rc = insertParent(path, 1, key, added, leafPid, splitKey, splitPid, splitCount)) < 0)
+			return rc;
+	}
+
+	return rc;
+}
+
+/*
+ * Add the entries inserted under the locked node at childPid to the entry
+ * counts of the nodes above it (in entry count mode), and pass the first
+ * key of the node that split off it (if any) up to the parent, until a node
+ * has room for it. Without entry counts, only a split goes up a level.
+ * Every node stays locked until its parent is written: a split copies the
+ * counts of the children that move to the new node, so an insert below
+ * must not count its entries in a parent that is splitting meanwhile.
+ * Nodes are locked from the leaves up, and from left to right on a level,
+ * with page 0 last, so two inserts cannot wait for each other.
+ * @param path[IN] the nodes passed on the way down (see findNode())
+ * @param level[IN] the level of the parent
+ * @param key[IN] a key of the entries inserted, in the range of the child
+ * @param added[IN] the number of entries inserted
+ * @param childPid[IN] the locked child; unlocked on return
+ * @param splitKey[IN] the first key of the new node
+ * @param splitPid[IN] the PageId of the new node; -1 if the child did not split
+ * @param splitCount[IN] the number of entries under the new node
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertParent(const std::vector<PageId>& path, int level, const KeyType& key, int added,
+	PageId childPid, KeyType splitKey, PageId splitPid, int splitCount)
+{
+	RC rc = 0;
+	PageId childSplitPid = 0;  // the locked node that split off the child, if not a leaf
 
-		// Keep going through the tree to insert at node's closer to leaf level
-		inKey = -1;
-		inPid = -1;
-		rc = insertPair(key, rid, childPid, curHeight + 1, inKey, inPid);
+	for (; rc == 0; level++)
+	{
+		// Without entry counts, the nodes above one that did not split stay as they are
+		if (!entryCounts && splitPid <= 0)
+			break;
 
-		// If the node was split, propagate the median key to the parent
-		if (!(inKey == -1 && inPid == -1))
+		PageId pid;
+		if (level < (int)path.size())
+			pid = path[level];
+		else
 		{
-			// Insert median key into nonleaf node parent
-			if ((rc = nonLeaf.insert(inKey, inPid)) == 0)
+			// The child was on the root level when the path was read. If it still
+			// is, it has no parent to count in, but splitting it requires a new
+			// non-leaf node above the level, whose first child is the first node
+			// of the level (the root).
+			versions.lock(0);
+			if (treeHeight == level)
 			{
-				if ((rc = nonLeaf.write(curPid, pf)) < 0)
+				int rootCount = 0;
+				if (splitPid > 0 && (!entryCounts || (rc = countNode(rootPid, level - 1, rootCount)) == 0))
 				{
-					//fprintf(stderr, "Error: failed to write nonleaf node's contents after insert (rec)");
-					return rc;
-				}
+					BTNonLeafNodeT<KeyType> root;
+					root.initializeRoot(rootPid, rootCount, splitKey, splitPid, splitCount);
 
-				return rc;
+					PageId newRoot = allocatePage();
+					if ((rc = writeInner(newRoot, root)) == 0)
+					{
+						rootPid = newRoot;
+						treeHeight = level + 1;
+					}
+				}
+				versions.unlock(0);
+				break;
 			}
+			versions.unlock(0);
 
-			// Failed to insert into nonleaf node parent due to overflow
-			// Insert and split the nonleaf node to push median key to next parent
-			BTNonLeafNode splitNonLeaf;
-			int splitKey;
-			if ((rc = nonLeaf.insertAndSplit(inKey, inPid, splitNonLeaf, splitKey)) < 0)
-			{
-				//fprintf(stderr, "Error: failed to split nonleaf node (rec)");
-				return rc;
-			}
+			// Another split grew the tree meanwhile: find the parent from the new root
+			if ((rc = findNode(&key, level, pid)) < 0)
+				break;
+		}
 
-			int endPid = pf.endPid();
-			inKey = splitKey;
-			inPid = endPid;
+		BTNonLeafNodeT<KeyType> nonLeaf;
+		if ((rc = lockInner(key, pid, nonLeaf)) < 0)
+			break;
 
-			// Re-write modified nonLeaf node's contents
-			if ((rc = nonLeaf.write(curPid, pf)) < 0)
+		// Count the new entries in the child they went to, before the new
+		// node (if any) takes its share of them
+		if (entryCounts)
+			nonLeaf.addChildCount(key, added);
+		PageId newPid = 0;
+		if (splitPid <= 0 || nonLeaf.insert(splitKey, splitPid, splitCount) == 0)
+		{
+			rc = writeInner(pid, nonLeaf);
+			splitPid = -1;
+		}
+		else
+		{
+			// Failed to insert into nonleaf node parent due to overflow
+			// Insert and split the nonleaf node to push median key to next parent.
+			// Write the new node before the node that links to it, and lock it
+			// first: the inserts below it count in it once its parent has it.
+			BTNonLeafNodeT<KeyType> splitNonLeaf;
+			KeyType midKey;
+			newPid = allocatePage();
+			versions.lock(newPid);
+			if ((rc = nonLeaf.insertAndSplit(splitKey, splitPid, splitCount, splitNonLeaf, midKey)) == 0
+				&& (rc = writeInner(newPid, splitNonLeaf)) == 0)
 			{
-				//fprintf(stderr, "Error: failed to write nonleaf node's contents after split (rec)");
-				return rc;
+				nonLeaf.setNextNodePtr(newPid);
+				rc = writeInner(pid, nonLeaf);
 			}
 
-			// Write splitNonLeaf node's contents 
-			if ((rc = splitNonLeaf.write(endPid, pf)) < 0)
-			{
-				//fprintf(stderr, "Error: failed to write split nonleaf node's contents (rec)");
-				return rc;
-			}
+			// The buffered inserts for the keys of the new node go with them
+			if (rc == 0 && buffered)
+				splitBuffer(pid, midKey, newPid);
 
-			// Splitting a root requires a new non-leaf node 
-			// The splitNonLeaf/sibling's first value propagates up to the root
-			if (treeHeight == 1)
-			{
-				// Initialize the root with the splitKey (median key) pushed up
-				// It has two pid references to the split modes
-				BTNonLeafNode root;
-				root.initializeRoot(curPid, splitKey, endPid);
-
-				// Write the root into the rootPid page
-				rootPid = pf.endPid();
-				if ((rc = root.write(rootPid, pf)) < 0)
-				{
-					//fprintf(stderr, "Error: failed to write root contents (rec)");
-					return rc;
-				}
+			splitKey = midKey;
+			splitPid = newPid;
+			splitCount = splitNonLeaf.getEntryCount();
+		}
 
-				treeHeight++;
-			}
-		}	
+		versions.unlock(childPid);
+		if (childSplitPid > 0)
+			versions.unlock(childSplitPid);
+		childPid = pid;
+		childSplitPid = newPid;
 	}
 
+	versions.unlock(childPid);
+	if (childSplitPid > 0)
+		versions.unlock(childSplitPid);
 	return rc;
 }
-/**
- * Run the standard B+Tree key search algorithm and identify the
- * searchKey exists in the leaf node, set IndexCursor to its location
- * (i.e., IndexCursor.pid = PageId of the leaf node, and
- * IndexCursor.eid = the searchKey index entry number.) and return 0.
- * If not, set IndexCursor.pid = PageId of the leaf node and
- * IndexCursor.eid = the index entry immediately after the largest
- * index key that is smaller than searchKey, and return the error
- * code RC_NO_SUCH_RECORD.
- * Using the returned "IndexCursor", you will have to call readForward()
- * to retrieve the actual (key, rid) pair from the index.
- * @param key[IN] the key to find
- * @param cursor[OUT] the cursor pointing to the index entry with
- *                    searchKey or immediately behind the largest key
- *                    smaller than searchKey.
- * @return 0 if searchKey is found. Othewise an error code
+
+/*
+ * Lock the leaf that key belongs to, starting from the leaf at pid: a split
+ * may have moved the key further right since pid was read.
+ * @param key[IN] the key to insert
+ * @param pid[IN/OUT] the PageId of the leaf read; the PageId of the leaf locked
+ * @param leaf[OUT] the locked leaf
+ * @return error code. 0 if no error; the leaf is then locked
  */
-RC BTreeIndex::locate(int searchKey, IndexCursor& cursor)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::lockLeaf(const KeyType& key, PageId& pid, BTLeafNodeT<KeyType>& leaf)
 {
 	RC rc;
-	BTNonLeafNode nonLeafNode;
-	BTLeafNode leafNode;
-	
-	// Traverse down B+ tree by following the child pointers given the searchKey
-	// Keep going down until the leaf node area based on the searchKey
-	int curHeight = 1;
-	PageId nextChild = rootPid;
-	while (curHeight != treeHeight)
+
+	for (;;)
 	{
-		// Read in nonleaf node data
-		if ((rc = nonLeafNode.read(nextChild, pf)) < 0)
+		versions.lock(pid);
+		if ((rc = leaf.read(pid, pf)) < 0)
 		{
-			//fprintf(stderr, "Error: failed to read in nonleaf node data");
+			versions.unlock(pid);
 			return rc;
 		}
+		if (!leaf.isPastHighKey(key))
+			return 0;
+
+		versions.unlock(pid);
+		pid = leaf.getNextNodePtr();
+	}
+}
+
+/*
+ * Lock the non-leaf node that key belongs to, starting from the node at pid
+ * and moving right like lockLeaf().
+ * @param key[IN] the key to insert
+ * @param pid[IN/OUT] the PageId of the node to start from; the PageId of the node locked
+ * @param node[OUT] the locked node
+ * @return error code. 0 if no error; the node is then locked
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::lockInner(const KeyType& key, PageId& pid, BTNonLeafNodeT<KeyType>& node)
+{
+	RC rc;
 
-		// Traverse down to the next level/child based on searchKey
-		if ((rc = nonLeafNode.locateChildPtr(searchKey, nextChild)) < 0)
+	for (;;)
+	{
+		versions.lock(pid);
+		if ((rc = readInner(pid, node)) < 0)
 		{
-			//fprintf(stderr, "Error: failed to locate next child");
+			versions.unlock(pid);
 			return rc;
 		}
+		if (!node.isPastHighKey(key))
+			return 0;
 
-		curHeight++;
+		versions.unlock(pid);
+		pid = node.getNextNodePtr();
 	}
+}
 
-	// We have now reached a leaf node that may have the searchKey, so attempt to locate it
-	// First, read in the leaf node data
-	if ((rc = leafNode.read(nextChild, pf)) < 0)
-	{
-		//fprintf(stderr, "Error: failed to read in leaf node data");
-		return rc;
+/*
+ * Insert (key, rid) into the locked leaf, unless the leaf has to be split.
+ * The caller writes the leaf if dirty is set.
+ * @return error code. 0 if no error. RC_NODE_FULL if the leaf has to be split
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertIntoLeaf(BTLeafNodeT<KeyType>& leaf, const KeyType& key, const RecordId& rid, bool& dirty)
+{
+	RC rc;
+
+	// A key that is already in the leaf may have, or need, a posting list
+	int eid;
+	bool found = (leaf.locate(key, eid) == 0);
+	if (found)
+	{
+		KeyType runKey;
+		RecordId runRid;
+		leaf.readEntry(eid, runKey, runRid);
+
+		// The key already has a posting list: the leaf does not change,
+		// unless the list gets a new first page instead (copy-on-write)
+		if (runRid.pid < 0)
+		{
+			if (!copyOnWrite)
+			{
+				if ((rc = appendPosting(-runRid.pid, rid)) < 0)
+					return rc;
+				addStatistics(key, 1, false, 0, 0);
+				return 0;
+			}
+
+			PageId headPid;
+			if ((rc = prependPosting(-runRid.pid, rid, headPid)) < 0)
+				return rc;
+			runRid.pid = -headPid;
+			runRid.sid = 0;
+			if ((rc = leaf.collapse(eid, 1, runRid)) < 0)
+				return rc;
+			addStatistics(key, 1, false, 0, 0);
+			dirty = true;
+			return 0;
+		}
+
+		// Count the copies of the key in this leaf. After a split that found
+		// no boundary between two keys (see BTLeafNodeT::insertAndSplit()),
+		// the run goes on in the next leaf; those copies stay where they are
+		int run = 1;
+		while (leaf.readEntry(eid + run, runKey, runRid) == 0 && KeyTraits<KeyType>::equal(runKey, key))
+			run++;
+
+		// Enough copies: move their RecordIds to a new posting list,
+		// and replace them in the leaf by a single entry referencing it
+		if (run + 1 >= POSTING_THRESHOLD)
+		{
+			BTPostingNode head;
+			PageId headPid = allocatePage();
+			head.setTailPtr(headPid);
+			if ((rc = head.write(headPid, pf)) < 0)
+				return rc;
+
+			for (int i = 0; i < run; i++)
+			{
+				leaf.readEntry(eid + i, runKey, runRid);
+				if ((rc = appendPosting(headPid, runRid)) < 0)
+					return rc;
+			}
+			if ((rc = appendPosting(headPid, rid)) < 0)
+				return rc;
+
+			RecordId ref;
+			ref.pid = -headPid;
+			ref.sid = 0;
+			if ((rc = leaf.collapse(eid, run, ref)) < 0)
+				return rc;
+
+			addStatistics(key, 1, false, 1 - run, 0);
+			dirty = true;
+			return 0;
+		}
+	}
+
+	// Attempt to insert into leaf node. A full leaf is split by the caller,
+	// which inserts the pair into one of the two leaves
+	if ((rc = leaf.insert(key, rid)) < 0 && rc != RC_NODE_FULL)
+		return rc;
+	addStatistics(key, 1, !found, 1, rc == RC_NODE_FULL ? 1 : 0);
+	if (rc < 0)
+		return rc;
+	dirty = true;
+	return 0;
+}
+
+/*
+ * Insert (key, rid) into the full, locked leaf at pid by splitting it.
+ * @param splitKey[OUT] the first key of the new leaf
+ * @param splitPid[OUT] the PageId of the new leaf
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::splitLeaf(BTLeafNodeT<KeyType>& leaf, PageId pid, const KeyType& key, const RecordId& rid, KeyType& splitKey, PageId& splitPid)
+{
+	RC rc;
+
+	BTLeafNodeT<KeyType> sibling;
+	if ((rc = leaf.insertAndSplit(key, rid, sibling, splitKey)) < 0)
+		return rc;
+
+	// Set sibling pointers accordingly for the new leaf and the split one
+	// (insertAndSplit() already moved the high key and the next pointer over)
+	splitPid = allocatePage();
+	PageId nextPid = sibling.getNextNodePtr();
+	sibling.setPrevNodePtr(pid);
+	leaf.setNextNodePtr(splitPid);
+
+	// Write the new leaf before any pointer to it, so that a scan
+	// that follows one finds it complete
+	if ((rc = sibling.write(splitPid, pf)) < 0)
+		return rc;
+
+	// The leaf behind the split now has the new leaf in front of it.
+	// Leaves are only ever locked from left to right, so this cannot deadlock.
+	// (Copy-on-write leaves the leaf behind as it is, see BTreeIndexT.)
+	if (nextPid > 0 && !copyOnWrite)
+	{
+		BTLeafNodeT<KeyType> nextLeaf;
+		versions.lock(nextPid);
+		if ((rc = nextLeaf.read(nextPid, pf)) == 0)
+		{
+			nextLeaf.setPrevNodePtr(splitPid);
+			rc = nextLeaf.write(nextPid, pf);
+		}
+		versions.unlock(nextPid);
+		if (rc < 0)
+			return rc;
+	}
+
+	return leaf.write(pid, pf);
+}
+
+/*
+ * Reserve a new page: a page freed by copy-on-write, or one at the end of the
+ * file. Pages handed out but not written yet are past pf.endPid(), so
+ * nextFreePid keeps track of them.
+ * @return the PageId of the page
+ */
+template <class KeyType>
+PageId BTreeIndexT<KeyType>::allocatePage()
+{
+	std::lock_guard<std::mutex> guard(allocMutex);
+
+	if (!freePages.empty())
+	{
+		PageId pid = freePages.back();
+		freePages.pop_back();
+		return pid;
+	}
+
+	PageId pid = pf.endPid();
+	if (pid < nextFreePid)
+		pid = nextFreePid;
+	nextFreePid = pid + 1;
+	return pid;
+}
+
+/*
+ * Append rid to the posting list starting at headPid.
+ * @param headPid[IN] the PageId of the first page of the posting list
+ * @param rid[IN] the RecordId to append
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::appendPosting(PageId headPid, const RecordId& rid)
+{
+	RC rc;
+	BTPostingNode head;
+	BTPostingNode tailPage;
+
+	// The first page keeps track of the last page, where rid is appended
+	if ((rc = head.read(headPid, pf)) < 0)
+		return rc;
+
+	PageId tailPid = head.getTailPtr();
+	BTPostingNode& tail = (tailPid == headPid) ? head : tailPage;
+	if (tailPid != headPid && (rc = tail.read(tailPid, pf)) < 0)
+		return rc;
+
+	if (tail.append(rid) == 0)
+		return tail.write(tailPid, pf);
+
+	// The last page is full: start a new page and link it at the end of the list
+	BTPostingNode page;
+	PageId newPid = allocatePage();
+	if ((rc = page.append(rid)) < 0)
+		return rc;
+	if ((rc = page.write(newPid, pf)) < 0)
+		return rc;
+
+	tail.setNextNodePtr(newPid);
+	if (tailPid != headPid && (rc = tail.write(tailPid, pf)) < 0)
+		return rc;
+
+	head.setTailPtr(newPid);
+	return head.write(headPid, pf);
+}
+
+/*
+ * Add rid to the posting list starting at headPid without changing any of its pages.
+ * @param headPid[IN] the PageId of the first page of the posting list
+ * @param rid[IN] the RecordId to add
+ * @param newHeadPid[OUT] the PageId of the new first page
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::prependPosting(PageId headPid, const RecordId& rid, PageId& newHeadPid)
+{
+	RC rc;
+	BTPostingNode head;
+
+	if ((rc = head.read(headPid, pf)) < 0)
+		return rc;
+
+	newHeadPid = allocatePage();
+
+	// Copy the first page with rid added; it replaces the page
+	if (head.append(rid) == 0)
+	{
+		if (head.getTailPtr() == headPid)
+			head.setTailPtr(newHeadPid);
+		replacedPages.push_back(headPid);
+		return head.write(newHeadPid, pf);
+	}
+
+	// The first page is full: put a new one in front of it
+	BTPostingNode page;
+	if ((rc = page.append(rid)) < 0)
+		return rc;
+	page.setNextNodePtr(headPid);
+	page.setTailPtr(head.getTailPtr());
+	return page.write(newHeadPid, pf);
+}
+
+/*
+ * Insert (key, rid) into a copy-on-write index. Only this insert changes the
+ * tree until it publishes the new root, so the nodes on the way down stay as
+ * they are: the leaf is changed (or split) in a copy on a new page, and every
+ * node above it is copied with the pointer to the copy of its child.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertCopy(const KeyType& key, const RecordId& rid)
+{
+	RC rc;
+	std::lock_guard<std::mutex> writer(writeMutex);
+
+	replacedPages.clear();
+
+	// The first key goes into a new root leaf
+	if (treeHeight == 0)
+	{
+		BTLeafNodeT<KeyType> rootTree;
+		PageId pid = allocatePage();
+		if ((rc = rootTree.insert(key, rid)) < 0 || (rc = rootTree.write(pid, pf)) < 0)
+			return rc;
+		addStatistics(key, 1, true, 1, 1);
+		return publish(pid, 1);
+	}
+
+	std::vector<PageId> path;
+	BTLeafNodeT<KeyType> leaf;
+	PageId oldPid;
+	if ((rc = findNode(&key, 0, oldPid, &path)) < 0 || (rc = leaf.read(oldPid, pf)) < 0)
+		return rc;
+
+	PageId newPid = allocatePage();
+	replacedPages.push_back(oldPid);
+
+	KeyType splitKey;
+	PageId splitPid = -1;
+	bool dirty;
+	if ((rc = insertIntoLeaf(leaf, key, rid, dirty)) == RC_NODE_FULL)
+		rc = splitLeaf(leaf, newPid, key, rid, splitKey, splitPid);
+	else if (rc == 0)
+		rc = leaf.write(newPid, pf);
+	if (rc < 0)
+		return rc;
+
+	int splitCount = 0;
+	if (splitPid > 0 && (rc = countNode(splitPid, 0, splitCount)) < 0)
+		return rc;
+
+	for (int level = 1; level < (int)path.size(); level++)
+	{
+		BTNonLeafNodeT<KeyType> node;
+		if ((rc = readInner(path[level], node)) < 0)
+			return rc;
+		if ((rc = node.replaceChildPtr(oldPid, newPid)) < 0)
+			return rc;
+		node.addChildCount(key, 1);
+
+		oldPid = path[level];
+		newPid = allocatePage();
+		replacedPages.push_back(oldPid);
+
+		// The first key of the new child goes into the copy too,
+		// which splits when it is full
+		if (splitPid > 0 && node.insert(splitKey, splitPid, splitCount) == 0)
+		{
+			splitPid = -1;
+		}
+		else if (splitPid > 0)
+		{
+			BTNonLeafNodeT<KeyType> sibling;
+			KeyType midKey;
+			PageId siblingPid = allocatePage();
+			if ((rc = node.insertAndSplit(splitKey, splitPid, splitCount, sibling, midKey)) < 0
+				|| (rc = writeInner(siblingPid, sibling)) < 0)
+				return rc;
+			node.setNextNodePtr(siblingPid);
+
+			splitKey = midKey;
+			splitPid = siblingPid;
+			splitCount = sibling.getEntryCount();
+		}
+
+		if ((rc = writeInner(newPid, node)) < 0)
+			return rc;
+	}
+
+	// Splitting the root requires a new root above the two halves
+	int height = path.size();
+	if (splitPid > 0)
+	{
+		int rootCount;
+		if ((rc = countNode(newPid, height - 1, rootCount)) < 0)
+			return rc;
+
+		BTNonLeafNodeT<KeyType> root;
+		root.initializeRoot(newPid, rootCount, splitKey, splitPid, splitCount);
+
+		newPid = allocatePage();
+		if ((rc = writeInner(newPid, root)) < 0)
+			return rc;
+		height++;
+	}
+
+	return publish(newPid, height);
+}
+
+/*
+ * Make newRoot the root of the next version of a copy-on-write index.
+ * Readers that are not in a snapshot see the root pointer and the height
+ * change together through the version of page 0 (see findNode()).
+ * Page 0 is written before the replaced pages can be freed: until then,
+ * the root in the file is of the version before, which still uses them.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::publish(PageId newRoot, int height)
+{
+	RC rc;
+
+	{
+		std::lock_guard<std::mutex> guard(snapshotMutex);
+
+		versions.lock(0);
+		rootPid = newRoot;
+		treeHeight = height;
+		versions.unlock(0);
+
+		// The replaced pages are in every version before this one
+		publishedVersion++;
+		for (size_t i = 0; i < replacedPages.size(); i++)
+			retiredPages.push_back(std::make_pair(publishedVersion, replacedPages[i]));
+		replacedPages.clear();
+	}
+
+	if ((rc = writeMetadata()) < 0)
+		return rc;
+	freeUnusedPages();
+	return 0;
+}
+
+/*
+ * Move the replaced pages that no open snapshot uses any more to freePages.
+ * A page replaced by version v is in the versions before v, so it is free
+ * once the oldest open snapshot is of version v or later.
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::freeUnusedPages()
+{
+	std::vector<PageId> unused;
+
+	{
+		std::lock_guard<std::mutex> guard(snapshotMutex);
+
+		unsigned long long oldest = openSnapshots.empty() ? publishedVersion : openSnapshots.begin()->first;
+		size_t kept = 0;
+		for (size_t i = 0; i < retiredPages.size(); i++)
+		{
+			if (retiredPages[i].first <= oldest)
+				unused.push_back(retiredPages[i].second);
+			else
+				retiredPages[kept++] = retiredPages[i];
+		}
+		retiredPages.resize(kept);
+	}
+	if (unused.empty())
+		return;
+
+	// A freed non-leaf node leaves memory with its page
+	{
+		std::unique_lock<std::shared_mutex> guard(innerMutex);
+		for (size_t i = 0; i < unused.size(); i++)
+			innerNodes.erase(unused[i]);
+	}
+
+	std::lock_guard<std::mutex> guard(allocMutex);
+	freePages.insert(freePages.end(), unused.begin(), unused.end());
+}
+
+/*
+ * Switch the index to copy-on-write mode, for good.
+ * @return error code. 0 if no error. RC_INVALID_FILE_MODE in buffered mode
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::enableCopyOnWrite()
+{
+	if (buffered)
+		return RC_INVALID_FILE_MODE;
+
+	copyOnWrite = true;
+	return writeMetadata();
+}
+
+/*
+ * Open a snapshot of the current version of a copy-on-write index.
+ * @param snapshot[OUT] the snapshot
+ * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index is
+ *         not in copy-on-write mode
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::openSnapshot(BTreeSnapshot& snapshot)
+{
+	if (!copyOnWrite)
+		return RC_INVALID_FILE_MODE;
+
+	std::lock_guard<std::mutex> guard(snapshotMutex);
+	snapshot.rootPid = rootPid;
+	snapshot.treeHeight = treeHeight;
+	snapshot.version = publishedVersion;
+	openSnapshots[publishedVersion]++;
+
+	return 0;
+}
+
+/*
+ * Close a snapshot, and free the pages that only it still used.
+ * @param snapshot[IN] the snapshot returned by openSnapshot()
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::closeSnapshot(const BTreeSnapshot& snapshot)
+{
+	{
+		std::lock_guard<std::mutex> guard(snapshotMutex);
+		std::map<unsigned long long, int>::iterator it = openSnapshots.find(snapshot.version);
+		if (it == openSnapshots.end())
+			return;
+		if (--it->second > 0)
+			return;
+		openSnapshots.erase(it);
+	}
+
+	freeUnusedPages();
+}
+
+/*
+ * Switch the index to buffered mode.
+ * @return error code. 0 if no error. RC_INVALID_FILE_MODE in copy-on-write mode
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::enableBuffering()
+{
+	if (copyOnWrite)
+		return RC_INVALID_FILE_MODE;
+
+	buffered = true;
+	return writeMetadata();
+}
+
+/*
+ * Switch the index to entry count mode, after counting the entries again
+ * if they are stale.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::enableEntryCounts()
+{
+	entryCounts = true;
+	if (countsStale)
+		return recountEntries();
+	return writeMetadata();
+}
+
+/*
+ * Bring the entry counts of the non-leaf nodes up to date, if they are
+ * stale, and clear the mark in page 0.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::recountEntries()
+{
+	RC rc;
+	int count;
+
+	if (!countsStale)
+		return 0;
+	if (treeHeight > 1 && (rc = recountNode(rootPid, treeHeight - 1, count)) < 0)
+		return rc;
+
+	countsStale = false;
+	return writeMetadata();
+}
+
+/*
+ * Count the entries under the node at pid on level from the leaves up,
+ * following the child pointers, and write every non-leaf node with a
+ * count that changed.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::recountNode(PageId pid, int level, int& count)
+{
+	RC rc;
+
+	if (level == 0)
+		return countNode(pid, 0, count);
+
+	BTNonLeafNodeT<KeyType> node;
+	if ((rc = readInner(pid, node)) < 0)
+		return rc;
+
+	bool changed = false;
+	count = 0;
+	for (int i = 0; i <= node.getKeyCount(); i++)
+	{
+		int n;
+		if ((rc = recountNode(node.getChildPtr(i), level - 1, n)) < 0)
+			return rc;
+		if (node.getChildCount(i) != n)
+		{
+			node.setChildCount(i, n);
+			changed = true;
+		}
+		count += n;
+	}
+
+	return changed ? writeInner(pid, node) : 0;
+}
+
+/*
+ * Insert (key, rid) into the buffer of the root, once it is in the insert
+ * log. A tree of a single leaf has no buffer: the insert goes into the leaf.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::insertBuffered(const KeyType& key, const RecordId& rid)
+{
+	RC rc;
+	std::lock_guard<std::mutex> writer(writeMutex);
+	std::lock_guard<std::mutex> guard(bufferMutex);
+
+	IndexEntry<KeyType> entry;
+	entry.key = key;
+	entry.rid = rid;
+	if (treeHeight < 2)
+		return insertSorted(&entry, 1);
+
+	// The insert is durable once its page of the log is written: when the
+	// page is full, or on syncLog()
+	if ((rc = logInsert(entry)) < 0)
+		return rc;
+
+	MessageBuffer& root = buffers[rootPid];
+	root.level = treeHeight - 1;
+	root.messages.insert(std::upper_bound(root.messages.begin(), root.messages.end(), entry), entry);
+
+	if ((rc = flushBuffer(rootPid, treeHeight - 1, false)) < 0)
+		return rc;
+
+	// A log that grows without bound would take as long to read back at open()
+	if ((int)logPages.size() >= LOG_PAGES)
+		return emptyBuffers();
+	return 0;
+}
+
+/*
+ * Move the inserts out of the buffer of the non-leaf node at pid, those for
+ * the child with the most of them first, until the buffer holds no more than
+ * BUFFER_CAPACITY (or, if all, none). A child above the leaves inserts them
+ * into its leaf together; another child takes them into its buffer, which
+ * may fill up in turn.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushBuffer(PageId pid, int level, bool all)
+{
+	RC rc;
+
+	for (;;)
+	{
+		// The buffer is looked up again every time: moving inserts down may
+		// split the node, and move some of its inserts to the new node
+		typename std::map<PageId, MessageBuffer>::iterator it = buffers.find(pid);
+		if (it == buffers.end() || (!all && (int)it->second.messages.size() <= BUFFER_CAPACITY))
+			return 0;
+		std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+
+		BTNonLeafNodeT<KeyType> node;
+		if ((rc = readInner(pid, node)) < 0)
+			return rc;
+
+		// The inserts are sorted, so those for a child come one after another
+		size_t first = 0, last = 0;
+		PageId target = 0;
+		for (size_t begin = 0, end; begin < messages.size(); begin = end)
+		{
+			PageId child, next;
+			node.locateChildPtr(messages[begin].key, child);
+			for (end = begin + 1; end < messages.size(); end++)
+			{
+				node.locateChildPtr(messages[end].key, next);
+				if (next != child)
+					break;
+			}
+			if (end - begin > last - first)
+			{
+				first = begin;
+				last = end;
+				target = child;
+			}
+		}
+
+		std::vector< IndexEntry<KeyType> > batch(messages.begin() + first, messages.begin() + last);
+		messages.erase(messages.begin() + first, messages.begin() + last);
+		if (messages.empty())
+			buffers.erase(it);
+
+		if (level == 1)
+		{
+			if ((rc = insertSorted(&batch[0], batch.size())) < 0)
+				return rc;
+			continue;
+		}
+
+		MessageBuffer& below = buffers[target];
+		std::vector< IndexEntry<KeyType> > merged(below.messages.size() + batch.size());
+		std::merge(below.messages.begin(), below.messages.end(), batch.begin(), batch.end(), merged.begin());
+		below.level = level - 1;
+		below.messages.swap(merged);
+		if ((rc = flushBuffer(target, level - 1, all)) < 0)
+			return rc;
+	}
+}
+
+/*
+ * Move the inserts for keys from midKey on to the buffer of the node at
+ * newPid, which took the keys from midKey on of the node at pid.
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::splitBuffer(PageId pid, const KeyType& midKey, PageId newPid)
+{
+	typename std::map<PageId, MessageBuffer>::iterator it = buffers.find(pid);
+	if (it == buffers.end())
+		return;
+	std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+
+	size_t cut = messages.size();
+	while (cut > 0 && !KeyTraits<KeyType>::less(messages[cut - 1].key, midKey))
+		cut--;
+	if (cut == messages.size())
+		return;
+
+	MessageBuffer& moved = buffers[newPid];
+	moved.level = it->second.level;
+	moved.messages.assign(messages.begin() + cut, messages.end());
+	messages.resize(cut);
+	if (messages.empty())
+		buffers.erase(it);
+}
+
+/*
+ * Insert every buffered insert into the leaves, and drop the insert log.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::flushBuffers()
+{
+	if (!buffered)
+		return 0;
+
+	std::lock_guard<std::mutex> writer(writeMutex);
+	std::lock_guard<std::mutex> guard(bufferMutex);
+
+	return emptyBuffers();
+}
+
+/*
+ * Insert every buffered insert into the leaves, from the highest buffers
+ * down: the inserts of a buffer only go to the buffers below it (or to the
+ * node that splits off it). Then every insert of the log is in a leaf.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::emptyBuffers()
+{
+	RC rc;
+
+	while (!buffers.empty())
+	{
+		typename std::map<PageId, MessageBuffer>::iterator top = buffers.begin();
+		for (typename std::map<PageId, MessageBuffer>::iterator it = buffers.begin(); it != buffers.end(); ++it)
+		{
+			if (it->second.level > top->second.level)
+				top = it;
+		}
+		if ((rc = flushBuffer(top->first, top->second.level, true)) < 0)
+			return rc;
+	}
+
+	return clearLog();
+}
+
+/*
+ * Append the buffered inserts of key to matches, from the buffers of the
+ * non-leaf nodes on the way down to its leaf.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findBuffered(const KeyType& key, std::vector< IndexEntry<KeyType> >& matches)
+{
+	RC rc;
+	PageId pid;
+	int height;
+
+	readRoot(NULL, pid, height);
+	for (int level = height - 1; level > 0; level--)
+	{
+		typename std::map<PageId, MessageBuffer>::iterator it = buffers.find(pid);
+		if (it != buffers.end())
+		{
+			std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+			IndexEntry<KeyType> probe;
+			probe.key = key;
+			probe.rid.pid = INT_MIN;
+			probe.rid.sid = INT_MIN;
+
+			typename std::vector< IndexEntry<KeyType> >::iterator m = std::lower_bound(messages.begin(), messages.end(), probe);
+			for (; m != messages.end() && KeyTraits<KeyType>::equal(m->key, key); ++m)
+				matches.push_back(*m);
+		}
+
+		PageId child;
+		if ((rc = readChildPtr(pid, &key, child)) < 0)
+			return rc;
+		pid = child;
+	}
+
+	return 0;
+}
+
+/*
+ * Collect the buffered inserts that go to the leaf at pid. The inserts of a
+ * buffer are sorted, so those for the leaf are next to each other, around
+ * the first key of the leaf; each buffer on the way down to the leaf is
+ * searched from there in both directions, while the inserts go to the leaf.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findPending(PageId pid, BTLeafNodeT<KeyType>& leaf, std::vector< IndexEntry<KeyType> >& pending)
+{
+	RC rc;
+	PageId nodePid, target;
+	int height;
+	IndexEntry<KeyType> probe;
+
+	pending.clear();
+	if (buffers.empty() || leaf.getKeyCount() == 0)
+		return 0;
+	if ((rc = leaf.readEntry(0, probe.key, probe.rid)) < 0)
+		return rc;
+	probe.rid.pid = INT_MIN;
+	probe.rid.sid = INT_MIN;
+
+	readRoot(NULL, nodePid, height);
+	for (int level = height - 1; level > 0; level--)
+	{
+		typename std::map<PageId, MessageBuffer>::iterator it = buffers.find(nodePid);
+		if (it != buffers.end())
+		{
+			std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+			size_t first = std::lower_bound(messages.begin(), messages.end(), probe) - messages.begin();
+			size_t last = first;
+
+			for (; first > 0; first--)
+			{
+				if ((rc = findNode(&messages[first - 1].key, 0, target)) < 0)
+					return rc;
+				if (target != pid)
+					break;
+			}
+			for (; last < messages.size(); last++)
+			{
+				if ((rc = findNode(&messages[last].key, 0, target)) < 0)
+					return rc;
+				if (target != pid)
+					break;
+			}
+			pending.insert(pending.end(), messages.begin() + first, messages.begin() + last);
+		}
+
+		PageId child;
+		if ((rc = readChildPtr(nodePid, &probe.key, child)) < 0)
+			return rc;
+		nodePid = child;
+	}
+
+	// Sorted like the inserts of a single buffer
+	std::sort(pending.begin(), pending.end());
+	return 0;
+}
+
+/*
+ * Count the buffered inserts below key in every buffer.
+ */
+template <class KeyType>
+int BTreeIndexT<KeyType>::countBuffered(const KeyType* key, bool inclusive)
+{
+	IndexEntry<KeyType> probe;
+	int count = 0;
+
+	if (key != NULL)
+	{
+		probe.key = *key;
+		probe.rid.pid = inclusive ? INT_MAX : INT_MIN;
+		probe.rid.sid = inclusive ? INT_MAX : INT_MIN;
+	}
+
+	for (typename std::map<PageId, MessageBuffer>::iterator it = buffers.begin(); it != buffers.end(); ++it)
+	{
+		std::vector< IndexEntry<KeyType> >& messages = it->second.messages;
+		if (key == NULL)
+			count += messages.size();
+		else if (inclusive)
+			count += std::upper_bound(messages.begin(), messages.end(), probe) - messages.begin();
+		else
+			count += std::lower_bound(messages.begin(), messages.end(), probe) - messages.begin();
+	}
+
+	return count;
+}
+
+/*
+ * Append an insert to the last page of the insert log, in memory. The page
+ * is written once it is full (see writeLog()); a full page is followed by
+ * a new one, which is not on disk, nor linked to, until it is written.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::logInsert(const IndexEntry<KeyType>& entry)
+{
+	const int perPage = (PageFile::PAGE_SIZE - sizeof(PageListHeader)) / sizeof(IndexEntry<KeyType>);
+	PageListHeader header;
+
+	if (logPagePid > 0)
+		memcpy(&header, logPage, sizeof(header));
+	if (logPagePid == 0 || header.count == perPage)
+	{
+		logPagePid = allocatePage();
+		logLinked = false;
+		header.nextPid = 0;
+		header.count = 0;
+		memset(logPage, 0, PageFile::PAGE_SIZE);
+	}
+
+	memcpy(logPage + sizeof(header) + header.count * sizeof(entry), &entry, sizeof(entry));
+	header.count++;
+	memcpy(logPage, &header, sizeof(header));
+	logDirty = true;
+
+	return header.count == perPage ? writeLog() : 0;
+}
+
+/*
+ * Write the last page of the insert log, if inserts were appended to it
+ * since it was last written. A new page is written first, and only then
+ * linked to from the page in front of it (or from page 0, for the first
+ * page), so the log read back at open() never links to an unwritten page.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::writeLog()
+{
+	RC rc;
+
+	if (!logDirty)
+		return 0;
+	if ((rc = pf.write(logPagePid, logPage)) < 0)
+		return rc;
+
+	if (!logLinked && logPages.empty())
+	{
+		logPages.push_back(logPagePid);
+		if ((rc = writeMetadata()) < 0)
+		{
+			logPages.clear();
+			return rc;
+		}
+	}
+	else if (!logLinked)
+	{
+		char page[PageFile::PAGE_SIZE];
+		PageListHeader header;
+		if ((rc = pf.read(logPages.back(), page)) < 0)
+			return rc;
+		memcpy(&header, page, sizeof(header));
+		header.nextPid = logPagePid;
+		memcpy(page, &header, sizeof(header));
+		if ((rc = pf.write(logPages.back(), page)) < 0)
+			return rc;
+		logPages.push_back(logPagePid);
+	}
+
+	logLinked = true;
+	logDirty = false;
+	return 0;
+}
+
+/*
+ * Write the inserts of the insert log that are still in memory only.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::syncLog()
+{
+	std::lock_guard<std::mutex> guard(bufferMutex);
+	return writeLog();
+}
+
+/*
+ * Drop the insert log: page 0 no longer links to it, and then its pages are free.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::clearLog()
+{
+	RC rc;
+	std::vector<PageId> pages;
+
+	if (logPagePid == 0)
+		return 0;
+
+	pages.swap(logPages);
+	if (!pages.empty() && (rc = writeMetadata()) < 0)
+	{
+		logPages.swap(pages);
+		return rc;
+	}
+
+	// The last page, if it was never written, is not in the list yet
+	if (!logLinked)
+		pages.push_back(logPagePid);
+	logPagePid = 0;
+	logLinked = false;
+	logDirty = false;
+
+	std::lock_guard<std::mutex> guard(allocMutex);
+	freePages.insert(freePages.end(), pages.begin(), pages.end());
+	return 0;
+}
+
+/*
+ * Read the insert log. The log keeps every insert since the buffers were
+ * last empty, including those that reached a leaf since: the inserts that
+ * locateMany() finds in the leaves are left out of the buffer.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readLog(PageId pid)
+{
+	RC rc;
+	std::vector< IndexEntry<KeyType> > logged, found, missing;
+	std::vector<KeyType> keys;
+
+	while (pid > 0)
+	{
+		PageListHeader header;
+		if ((rc = pf.read(pid, logPage)) < 0)
+			return rc;
+		memcpy(&header, logPage, sizeof(header));
+
+		const IndexEntry<KeyType>* entries = (const IndexEntry<KeyType>*)(logPage + sizeof(header));
+		logged.insert(logged.end(), entries, entries + header.count);
+		logPages.push_back(pid);
+		pid = header.nextPid;
+	}
+
+	// Later inserts go on filling the last page
+	logPagePid = logPages.back();
+	logLinked = true;
+	logDirty = false;
+
+	std::sort(logged.begin(), logged.end());
+	for (size_t i = 0; i < logged.size(); i++)
+	{
+		if (keys.empty() || !KeyTraits<KeyType>::equal(keys.back(), logged[i].key))
+			keys.push_back(logged[i].key);
+	}
+	if (!keys.empty() && (rc = locateMany(&keys[0], keys.size(), found)) < 0)
+		return rc;
+
+	std::sort(found.begin(), found.end());
+	std::set_difference(logged.begin(), logged.end(), found.begin(), found.end(), std::back_inserter(missing));
+	if (missing.empty())
+		return 0;
+
+	MessageBuffer& root = buffers[rootPid];
+	root.level = treeHeight - 1;
+	root.messages.swap(missing);
+	return 0;
+}
+
+/*
+ * Start building the index bottom-up from (key, RecordId) pairs sorted by key.
+ * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::beginBulkLoad(double fillFactor)
+{
+	// The leaves are built from scratch, so there must be nothing to merge with
+	if (treeHeight != 0 || bulkActive)
+		return RC_INVALID_FILE_MODE;
+
+	bulkActive = true;
+	bulkFill = (fillFactor > 0 && fillFactor <= 1) ? fillFactor : 1.0;
+	bulkLeaf = BTLeafNodeT<KeyType>();
+	bulkLeafPid = 0;
+	bulkLeafKeys.clear();
+	bulkLeafPids.clear();
+	bulkLeafCounts.clear();
+	bulkRunRids.clear();
+	bulkRunPosting = 0;
+	bulkRunCount = 0;
+
+	return 0;
+}
+
+/*
+ * Add the next (key, RecordId) pair of a bulk load.
+ * The RecordIds of a key are collected first, so that all of them go into
+ * one leaf, or into a posting list once there are POSTING_THRESHOLD of them.
+ * @param key[IN] the key; not smaller than the key of the previous pair
+ * @param rid[IN] the RecordId for the record being inserted into the index
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkInsert(const KeyType& key, const RecordId& rid)
+{
+	RC rc;
+
+	if (!bulkActive)
+		return RC_INVALID_FILE_MODE;
+
+	if (bulkRunCount > 0 && !KeyTraits<KeyType>::equal(key, bulkRunKey))
+	{
+		if (KeyTraits<KeyType>::less(key, bulkRunKey))
+			return RC_INVALID_ATTRIBUTE;
+
+		// A new key: the previous one is complete
+		if ((rc = bulkFlushRun()) < 0)
+			return rc;
+	}
+
+	bulkRunKey = key;
+	bulkRunCount++;
+
+	if (bulkRunPosting > 0)
+		return appendPosting(bulkRunPosting, rid);
+
+	bulkRunRids.push_back(rid);
+	if (bulkRunCount < POSTING_THRESHOLD)
+		return 0;
+
+	// Enough copies of the key: move them to a posting list
+	BTPostingNode head;
+	bulkRunPosting = allocatePage();
+	head.setTailPtr(bulkRunPosting);
+	if ((rc = head.write(bulkRunPosting, pf)) < 0)
+		return rc;
+
+	for (size_t i = 0; i < bulkRunRids.size(); i++)
+	{
+		if ((rc = appendPosting(bulkRunPosting, bulkRunRids[i])) < 0)
+			return rc;
+	}
+	bulkRunRids.clear();
+
+	return 0;
+}
+
+/*
+ * Add the current run of equal keys to the leaf being filled:
+ * either all of its RecordIds, or a single entry referencing its posting list.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkFlushRun()
+{
+	RC rc = 0;
+
+	if (bulkRunCount == 0)
+		return 0;
+
+	if (bulkRunPosting > 0)
+	{
+		RecordId ref;
+		ref.pid = -bulkRunPosting;
+		ref.sid = 0;
+		rc = bulkAddEntries(bulkRunKey, &ref, 1);
+	}
+	else
+	{
+		rc = bulkAddEntries(bulkRunKey, &bulkRunRids[0], bulkRunRids.size());
+	}
+	if (rc == 0)
+	{
+		bulkLeafCounts.back() += bulkRunCount;
+		addStatistics(bulkRunKey, bulkRunCount, true, bulkRunPosting > 0 ? 1 : bulkRunCount, 0);
+	}
+
+	bulkRunRids.clear();
+	bulkRunPosting = 0;
+	bulkRunCount = 0;
+
+	return rc;
+}
+
+/*
+ * Add count entries of key to the leaf being filled. The entries all go
+ * into the same leaf; if they do not fit, they start the next leaf.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkAddEntries(const KeyType& key, const RecordId* rids, int count)
+{
+	RC rc;
+	int target = (int)(bulkFill * BTLeafNodeT<KeyType>::getMaxEntries());
+	if (target < 1)
+		target = 1;
+
+	// Try the leaf being filled, and roll it back if the entries do not all fit
+	if (bulkLeafPid > 0 && bulkLeaf.getKeyCount() + count <= target)
+	{
+		BTLeafNodeT<KeyType> saved = bulkLeaf;
+		int i;
+		for (i = 0; i < count; i++)
+		{
+			if (bulkLeaf.insert(key, rids[i]) < 0)
+				break;
+		}
+		if (i == count)
+			return 0;
+		bulkLeaf = saved;
+	}
+
+	if ((rc = bulkNextLeaf(key)) < 0)
+		return rc;
+
+	for (int i = 0; i < count; i++)
+	{
+		if ((rc = bulkLeaf.insert(key, rids[i])) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Write the leaf being filled and start the next one, whose first key is firstKey.
+ * The page of the new leaf is taken right away, so that the leaves are in
+ * sequential pages and the previous leaf can point to it.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::bulkNextLeaf(const KeyType& firstKey)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> next;
+	PageId nextPid = allocatePage();
+
+	next.setPrevNodePtr(bulkLeafPid);
+	if ((rc = next.write(nextPid, pf)) < 0)
+		return rc;
+
+	if (bulkLeafPid > 0)
+	{
+		bulkLeaf.setHighKey(firstKey);
+		bulkLeaf.setNextNodePtr(nextPid);
+		if ((rc = bulkLeaf.write(bulkLeafPid, pf)) < 0)
+			return rc;
+	}
+
+	bulkLeaf = next;
+	bulkLeafPid = nextPid;
+	bulkLeafKeys.push_back(firstKey);
+	bulkLeafPids.push_back(nextPid);
+	bulkLeafCounts.push_back(0);
+	addStatistics(firstKey, 0, false, 0, 1);
+
+	return 0;
+}
+
+/*
+ * Finish a bulk load: write the last leaf and build the non-leaf levels
+ * bottom-up. Every level is split into as few nodes as the fill factor
+ * allows, with the children spread evenly over them.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::endBulkLoad()
+{
+	RC rc;
+
+	if (!bulkActive)
+		return RC_INVALID_FILE_MODE;
+	bulkActive = false;
+
+	if ((rc = bulkFlushRun()) < 0)
+		return rc;
+
+	// Nothing was loaded
+	if (bulkLeafPid == 0)
+		return 0;
+
+	if ((rc = bulkLeaf.write(bulkLeafPid, pf)) < 0)
+		return rc;
+
+	// The first key and the PageId of every node of the level being built on
+	// (and the number of entries under it)
+	std::vector<KeyType> keys;
+	std::vector<PageId> pids;
+	std::vector<int> counts;
+	keys.swap(bulkLeafKeys);
+	pids.swap(bulkLeafPids);
+	counts.swap(bulkLeafCounts);
+	int height = 1;
+
+	int perNode = (int)(bulkFill * (BTNonLeafNodeT<KeyType>::getMaxKeys() + 1));
+	if (perNode < 2)
+		perNode = 2;
+
+	while (pids.size() > 1)
+	{
+		int children = pids.size();
+		int nodes = (children + perNode - 1) / perNode;
+		std::vector<KeyType> parentKeys;
+		std::vector<PageId> parentPids;
+		std::vector<int> parentCounts;
+
+		// Every node is written once the next node of the level has a PageId,
+		// so that it links to it
+		BTNonLeafNodeT<KeyType> prev;
+		PageId prevPid = 0;
+
+		int next = 0;
+		for (int n = 0; n < nodes; n++)
+		{
+			// The first (children % nodes) nodes take one extra child
+			int count = children / nodes + (n < children % nodes ? 1 : 0);
+
+			BTNonLeafNodeT<KeyType> node;
+			node.initializeRoot(pids[next], 0, keys[next + 1], pids[next + 1], 0);
+			for (int i = next + 2; i < next + count; i++)
+			{
+				if ((rc = node.insert(keys[i], pids[i], 0)) < 0)
+					return rc;
+			}
+			for (int i = 0; i < count; i++)
+				node.setChildCount(i, counts[next + i]);
+
+			PageId pid = allocatePage();
+			if (prevPid > 0)
+			{
+				prev.setHighKey(keys[next]);
+				prev.setNextNodePtr(pid);
+				if ((rc = writeInner(prevPid, prev)) < 0)
+					return rc;
+			}
+			prev = node;
+			prevPid = pid;
+
+			parentKeys.push_back(keys[next]);
+			parentPids.push_back(pid);
+			parentCounts.push_back(node.getEntryCount());
+			next += count;
+		}
+		if ((rc = writeInner(prevPid, prev)) < 0)
+			return rc;
+
+		keys.swap(parentKeys);
+		pids.swap(parentPids);
+		counts.swap(parentCounts);
+		height++;
+	}
+
+	rootPid = pids[0];
+	treeHeight = height;
+
+	return 0;
+}
+
+/**
+ * Run the standard B+Tree key search algorithm and identify the
+ * searchKey exists in the leaf node, set IndexCursor to its location
+ * (i.e., IndexCursor.pid = PageId of the leaf node, and
+ * IndexCursor.eid = the searchKey index entry number.) and return 0.
+ * If not, set IndexCursor.pid = PageId of the leaf node and
+ * IndexCursor.eid = the index entry immediately after the largest
+ * index key that is smaller than searchKey, and return the error
+ * code RC_NO_SUCH_RECORD.
+ * Using the returned "IndexCursor", you will have to call readForward()
+ * to retrieve the actual (key, rid) pair from the index.
+ * @param key[IN] the key to find
+ * @param cursor[OUT] the cursor pointing to the index entry with
+ *                    searchKey or immediately behind the largest key
+ *                    smaller than searchKey.
+ * @return 0 if searchKey is found. Othewise an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locate(const KeyType& searchKey, IndexCursor& cursor, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> leafNode;
+
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = locate(searchKey, cursor, &current);
+		closeSnapshot(current);
+		return rc;
+	}
+
+	// Find and read in the leaf node that may have the searchKey
+	PageId nextChild;
+	cursor.postPid = 0;
+	cursor.postEid = 0;
+	if ((rc = findLeaf(&searchKey, nextChild, leafNode, NULL, snapshot)) < 0)
+		return rc;
+
+	// An empty tree has no leaf node for the cursor to point to
+	if (nextChild == 0)
+	{
+		cursor.pid = 0;
+		cursor.eid = 0;
+		return RC_NO_SUCH_RECORD;
+	}
+
+	// Locate and extract the eid of the searchKey if it exists in the leaf node
+	int eid;
+	if ((rc = leafNode.locate(searchKey, eid)) < 0)
+	{
+		//fprintf(stderr, "Error: failed to locate the searchKey in the leaf node");
+		
+		// Set the IndexCursor to proper fields
+		// (index entry immediately after the largest index key that is smaller than searchKey and current pid)
+		cursor.eid = eid;
+		cursor.pid = nextChild;
+
+		// Every key in this leaf is smaller than searchKey, so the entry right
+		// behind the largest smaller key is the first entry of the next leaf
+		PageId nextPid;
+		if (eid == leafNode.getKeyCount())
+		{
+			RC next = nextLeafPtr(leafNode, nextPid, snapshot);
+			if (next < 0)
+				return next;
+			if (nextPid > 0)
+			{
+				cursor.eid = 0;
+				cursor.pid = nextPid;
+			}
+		}
+	
+		return rc;
+	}
+
+	// Set the IndexCursor to the proper fields (extracted eid and current pid)
+	cursor.eid = eid;
+	cursor.pid = nextChild;
+
+	return rc;
+}
+
+/*
+ * Read the (key, rid) pair at the location specified by the index cursor,
+ * and move foward the cursor to the next entry.
+ * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+ * @param key[OUT] the key stored at the index cursor location.
+ * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readForward(IndexCursor& cursor, KeyType& key, RecordId& rid, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> leafNode;
+
+	// Cursor's page id is out of range: page 0 holds the metadata,
+	// and the last leaf node has no next sibling
+	if (cursor.pid <= 0)
+		return RC_END_OF_TREE;
+
+	// Read in data from the leaf node
+	if ((rc = leafNode.read(cursor.pid, pf)) < 0)
+	{
+		//fprintf(stderr, "Error: failed to read in leaf node data");
+		return rc;
+	}
+
+	// Read in key-rid pair from eid value
+	if ((rc = leafNode.readEntry(cursor.eid, key, rid)) < 0)
+	{
+		//fprintf(stderr, "Error: failed to read in key-rid pair from eid");
+		return rc;
+	}
+
+	// A negative pid references the posting list of the key:
+	// return its RecordIds one at a time before moving on to the next entry
+	if (rid.pid < 0)
+	{
+		BTPostingNode posting;
+
+		if (cursor.postPid <= 0)
+		{
+			cursor.postPid = -rid.pid;
+			cursor.postEid = 0;
+		}
+
+		if ((rc = posting.read(cursor.postPid, pf)) < 0)
+			return rc;
+		if ((rc = posting.readEntry(cursor.postEid, rid)) < 0)
+			return rc;
+
+		// Stay on this entry until the last RecordId of the list is read
+		if (++cursor.postEid < posting.getCount())
+			return 0;
+		cursor.postPid = posting.getNextNodePtr();
+		cursor.postEid = 0;
+		if (cursor.postPid > 0)
+			return 0;
+	}
+	
+	// Move forward the cursor to the next entry
+	if (cursor.eid + 1 < leafNode.getKeyCount())
+	{
+		cursor.eid++;
+	}
+	else // If it goes beyond the maximum eid entry, reset the eid to 0 and advance to the next page
+	{
+		cursor.eid = 0;
+		rc = nextLeafPtr(leafNode, cursor.pid, snapshot);
+	}
+
+	return rc;
+}
+
+
+/*
+ * Read the root pointer and the height of snapshot or, if it is NULL, of
+ * the current version: the two are read together, under the version of page 0.
+ */
+template <class KeyType>
+void BTreeIndexT<KeyType>::readRoot(const BTreeSnapshot* snapshot, PageId& pid, int& height)
+{
+	PageVersions::Version version;
+
+	if (snapshot != NULL)
+	{
+		pid = snapshot->rootPid;
+		height = snapshot->treeHeight;
+		return;
+	}
+
+	do
+	{
+		version = versions.readLock(0);
+		pid = rootPid;
+		height = treeHeight;
+	} while (!versions.validate(0, version));
+}
+
+/*
+ * Follow the child pointers for searchKey from the root down to the node
+ * at level (the leaves are level 0), in snapshot if it is not NULL.
+ * The nodes are not locked.
+ * A node that a split moved searchKey out of since its parent was read
+ * links to the node it moved to, so the descent moves right instead of
+ * starting over.
+ * @param searchKey[IN] the key to find; NULL to go down to the last node
+ * @param level[IN] the level to stop at
+ * @param pid[OUT] the PageId of the node on level that searchKey belongs to
+ *                 (or one left of it, see lockLeaf()); 0 if the index is empty
+ * @param path[OUT] if not NULL, path[l] is the node passed on level l, from
+ *                  the root level down to level; the tree height is path->size()
+ * @param snapshot[IN] the version to look in; NULL for the current one
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findNode(const KeyType* searchKey, int level, PageId& pid, std::vector<PageId>* path, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	int height;
+
+	readRoot(snapshot, pid, height);
+
+	if (path != NULL)
+		path->assign(height, 0);
+	if (height == 0)
+	{
+		pid = 0;
+		return 0;
+	}
+
+	// Traverse down B+ tree by following the child pointers given the searchKey
+	for (int curLevel = height - 1; curLevel > level; curLevel--)
+	{
+		PageId child;
+		if ((rc = readChildPtr(pid, searchKey, child)) < 0)
+			return rc;
+		if (path != NULL)
+			(*path)[curLevel] = pid;
+		pid = child;
+	}
+	if (path != NULL)
+		(*path)[level] = pid;
+
+	return 0;
+}
+
+/*
+ * Follow the child pointers for searchKey from the root down to a leaf,
+ * and read the leaf, moving right along the leaves like findNode().
+ * @param searchKey[IN] the key to find; NULL to go down to the last leaf
+ * @param pid[OUT] the PageId of the leaf where searchKey belongs; 0 if the index is empty
+ * @param leaf[OUT] the leaf
+ * @param path[OUT] if not NULL, the nodes passed on every level (see findNode())
+ * @param snapshot[IN] the version to look in; NULL for the current one
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findLeaf(const KeyType* searchKey, PageId& pid, BTLeafNodeT<KeyType>& leaf, std::vector<PageId>* path,
+	const BTreeSnapshot* snapshot, std::vector< IndexEntry<KeyType> >* pending)
+{
+	RC rc;
+
+	// Under bufferMutex, no insert moves from a buffer to the leaf in between
+	std::unique_lock<std::mutex> bufferGuard(bufferMutex, std::defer_lock);
+	if (pending != NULL)
+	{
+		pending->clear();
+		if (buffered)
+			bufferGuard.lock();
+	}
+
+	// A snapshot does not change, so there is nothing to validate in it
+	if (snapshot == NULL && readMode == OPTIMISTIC_READS)
+	{
+		if ((rc = findLeafOptimistic(searchKey, pid, leaf, path)) < 0 || pid == 0)
+			return rc;
+	}
+	else
+	{
+		if ((rc = findNode(searchKey, 0, pid, path, snapshot)) < 0 || pid == 0)
+			return rc;
+
+		for (;;)
+		{
+			if ((rc = leaf.read(pid, pf)) < 0)
+				return rc;
+			if (searchKey != NULL ? !leaf.isPastHighKey(*searchKey) : leaf.getNextNodePtr() <= 0)
+				break;
+			pid = leaf.getNextNodePtr();
+		}
+	}
+
+	if (pending != NULL && buffered)
+		return findPending(pid, leaf, *pending);
+	return 0;
+}
+
+/*
+ * Follow the child pointers for searchKey from the root down to a leaf,
+ * and read the leaf, with optimistic lock coupling. The version of every
+ * node is taken before it is read and checked after; the version of its
+ * parent is checked once the version of the node is taken, so that the
+ * pointer followed was still valid. A writer keeps a node locked until
+ * its parent is written (see insertParent()), so a check fails whenever a
+ * node or its parent changed meanwhile: the descent then starts over from
+ * the root, and so does one that finds searchKey past the high key of a
+ * node, instead of moving right.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findLeafOptimistic(const KeyType* searchKey, PageId& pid, BTLeafNodeT<KeyType>& leaf, std::vector<PageId>* path)
+{
+	RC rc;
+
+	for (;; readRestarts++)
+	{
+		// Page 0 stands for the root pointer and the height
+		PageId parentPid = 0;
+		PageVersions::Version parentVersion = versions.readLock(0);
+		pid = rootPid;
+		int height = treeHeight;
+		if (!versions.validate(0, parentVersion))
+			continue;
+		if (path != NULL)
+			path->assign(height, 0);
+		if (height == 0)
+		{
+			pid = 0;
+			return 0;
+		}
+
+		bool valid = true;
+		for (int level = height - 1; valid && level >= 0; level--)
+		{
+			PageVersions::Version version = versions.readLock(pid);
+			if (!versions.validate(parentPid, parentVersion))
+			{
+				valid = false;
+				break;
+			}
+			if (path != NULL)
+				(*path)[level] = pid;
+
+			PageId child = 0;
+			if (level > 0)
+			{
+				BTNonLeafNodeT<KeyType> node;
+				if ((rc = readInner(pid, node)) < 0)
+					return rc;
+				if (searchKey != NULL ? node.isPastHighKey(*searchKey) : node.getNextNodePtr() > 0)
+					valid = false;
+				else if (searchKey == NULL)
+					child = node.getLastChildPtr();
+				else if ((rc = node.locateChildPtr(*searchKey, child)) < 0)
+					return rc;
+			}
+			else
+			{
+				if ((rc = leaf.read(pid, pf)) < 0)
+					return rc;
+				if (searchKey != NULL ? leaf.isPastHighKey(*searchKey) : leaf.getNextNodePtr() > 0)
+					valid = false;
+			}
+
+			valid = valid && versions.validate(pid, version);
+			parentPid = pid;
+			parentVersion = version;
+			if (level > 0)
+				pid = child;
+		}
+
+		if (valid)
+			return 0;
+	}
+}
+
+/*
+ * Set how lookups go down the tree.
+ * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE for an unknown mode
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::setReadMode(int mode)
+{
+	if (mode != B_LINK_READS && mode != OPTIMISTIC_READS)
+		return RC_INVALID_ATTRIBUTE;
+
+	readMode = mode;
+	return 0;
+}
+
+/*
+ * Read the leaf in front of the leaf at pid. A split may have put a new leaf
+ * between the two since the prev pointer was read, so follow the leaves
+ * forward until the one whose next leaf is pid.
+ * @param prevPid[IN/OUT] the prev pointer of the leaf at pid; the PageId of the leaf read
+ * @param pid[IN] the leaf to go back from
+ * @param leaf[OUT] the leaf in front of it
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readPrevLeaf(PageId& prevPid, PageId pid, BTLeafNodeT<KeyType>& leaf)
+{
+	RC rc;
+
+	if ((rc = leaf.read(prevPid, pf)) < 0)
+		return rc;
+	while (leaf.getNextNodePtr() != pid && leaf.getNextNodePtr() > 0)
+	{
+		prevPid = leaf.getNextNodePtr();
+		if ((rc = leaf.read(prevPid, pf)) < 0)
+			return rc;
 	}
 
-	// Locate and extract the eid of the searchKey if it exists in the leaf node
-	int eid;
-	if ((rc = leafNode.locate(searchKey, eid)) < 0)
+	return 0;
+}
+
+/*
+ * Follow the child pointers from the root of snapshot down to the leaf
+ * with the largest keys smaller than key.
+ * @param key[IN] the key whose predecessor is looked up
+ * @param snapshot[IN] the version to look in; NULL for the current one
+ * @param pid[OUT] the PageId of the leaf
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::findLeafBefore(const KeyType& key, const BTreeSnapshot* snapshot, PageId& pid)
+{
+	RC rc;
+	int height;
+
+	readRoot(snapshot, pid, height);
+	for (int level = height - 1; level > 0; level--)
 	{
-		//fprintf(stderr, "Error: failed to locate the searchKey in the leaf node");
-		
-		
-		// Set the IndexCursor to proper fields
-		// (index entry immediately after the largest index key that is smaller than searchKey and current pid)
-		cursor.eid = eid;
-		cursor.pid = nextChild;
-		
-	
+		BTNonLeafNodeT<KeyType> node;
+		if ((rc = readInner(pid, node)) < 0)
+			return rc;
+		if ((rc = node.locateChildPtrBefore(key, pid)) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Find the leaf behind leaf: its next pointer or, in a copy-on-write index,
+ * the leaf its high key belongs to in the snapshot.
+ * @param leaf[IN] the leaf
+ * @param pid[OUT] the PageId of the next leaf; 0 if there is none
+ * @param snapshot[IN] the version to look in
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::nextLeafPtr(BTLeafNodeT<KeyType>& leaf, PageId& pid, const BTreeSnapshot* snapshot)
+{
+	KeyType highKey;
+
+	pid = 0;
+	if (!leaf.getHighKey(highKey))
+		return 0;
+	if (!copyOnWrite)
+	{
+		pid = leaf.getNextNodePtr();
+		return 0;
+	}
+
+	return findNode(&highKey, 0, pid, NULL, snapshot);
+}
+
+/*
+ * Find the leaf in front of leaf: its prev pointer or, in a copy-on-write
+ * index, the leaf with the keys in front of its first key in the snapshot.
+ * The prev pointer of the first leaf is 0 in every version.
+ * @param leaf[IN] the leaf
+ * @param pid[OUT] the PageId of the previous leaf; 0 if there is none
+ * @param snapshot[IN] the version to look in
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::prevLeafPtr(BTLeafNodeT<KeyType>& leaf, PageId& pid, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	KeyType firstKey;
+	RecordId rid;
+
+	pid = leaf.getPrevNodePtr();
+	if (pid <= 0)
+	{
+		pid = 0;
+		return 0;
+	}
+	if (!copyOnWrite)
+		return 0;
+
+	if ((rc = leaf.readEntry(0, firstKey, rid)) < 0)
+		return rc;
+	return findLeafBefore(firstKey, snapshot, pid);
+}
+
+/*
+ * Replace the leaf at pid by the leaf behind it (dir > 0) or in front of it (dir < 0).
+ * Going back along the prev pointers, a split may have put a new leaf in
+ * between (see readPrevLeaf()); a copy-on-write snapshot does not change.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readSiblingLeaf(int dir, PageId& pid, BTLeafNodeT<KeyType>& leaf, const BTreeSnapshot* snapshot,
+	std::vector< IndexEntry<KeyType> >* pending)
+{
+	RC rc;
+	PageId sibling;
+
+	std::unique_lock<std::mutex> bufferGuard(bufferMutex, std::defer_lock);
+	if (pending != NULL)
+	{
+		pending->clear();
+		if (buffered)
+			bufferGuard.lock();
+	}
+
+	if ((rc = dir > 0 ? nextLeafPtr(leaf, sibling, snapshot) : prevLeafPtr(leaf, sibling, snapshot)) < 0)
+		return rc;
+	if (sibling == 0)
+	{
+		pid = 0;
+		return 0;
+	}
+
+	if (dir < 0 && !copyOnWrite)
+		rc = readPrevLeaf(sibling, pid, leaf);
+	else
+		rc = leaf.read(sibling, pf);
+	pid = sibling;
+
+	if (rc == 0 && pending != NULL && buffered)
+		return findPending(pid, leaf, *pending);
+	return rc;
+}
+
+/*
+ * Set the cursor to the last entry with a key smaller than searchKey
+ * (or, if inclusive, not greater than it).
+ * @param searchKey[IN] the upper bound
+ * @param inclusive[IN] true to also accept searchKey itself
+ * @param cursor[OUT] the cursor pointing to the entry; cursor.pid is 0 if
+ *                    every key is greater than (or equal to) searchKey
+ * @return 0 if the entry has searchKey. Otherwise RC_NO_SUCH_RECORD or an error code
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateBefore(const KeyType& searchKey, bool inclusive, IndexCursor& cursor, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> leafNode;
+	PageId pid;
+
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = locateBefore(searchKey, inclusive, cursor, &current);
+		closeSnapshot(current);
+		return rc;
+	}
+
+	cursor.pid = 0;
+	cursor.eid = 0;
+	cursor.postPid = 0;
+	cursor.postEid = 0;
+
+	if ((rc = findLeaf(&searchKey, pid, leafNode, NULL, snapshot)) < 0)
+		return rc;
+	if (pid == 0)
+		return RC_NO_SUCH_RECORD;
+
+	// The entry in front of the first key past the bound; when the bound is
+	// below every key of the leaf, it is the last entry of the previous leaf
+	int eid = leafNode.countBelow(searchKey, inclusive) - 1;
+	if (eid < 0)
+	{
+		if ((rc = readSiblingLeaf(-1, pid, leafNode, snapshot)) < 0)
+			return rc;
+		if (pid == 0)
+			return RC_NO_SUCH_RECORD;
+		eid = leafNode.getKeyCount() - 1;
+	}
+
+	cursor.pid = pid;
+	cursor.eid = eid;
+
+	KeyType key;
+	RecordId rid;
+	if ((rc = leafNode.readEntry(eid, key, rid)) < 0)
+		return rc;
+	return KeyTraits<KeyType>::equal(key, searchKey) ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Set the cursor to the entry with the largest key, by following the
+ * last child pointer of every non-leaf node.
+ * @param cursor[OUT] the cursor pointing to the last entry; cursor.pid is 0 if the index is empty
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateLast(IndexCursor& cursor, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	BTLeafNodeT<KeyType> leafNode;
+	PageId pid;
+
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = locateLast(cursor, &current);
+		closeSnapshot(current);
+		return rc;
+	}
+
+	cursor.pid = 0;
+	cursor.eid = 0;
+	cursor.postPid = 0;
+	cursor.postEid = 0;
+
+	if ((rc = findLeaf(NULL, pid, leafNode, NULL, snapshot)) < 0 || pid == 0)
+		return rc;
+	cursor.pid = pid;
+	cursor.eid = leafNode.getKeyCount() - 1;
+
+	return 0;
+}
+
+/*
+ * Count the RecordIds of the entries of leaf from first to last (exclusive):
+ * one for an entry, and as many as its posting list has for a posting list.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countRids(BTLeafNodeT<KeyType>& leaf, int first, int last, int& count)
+{
+	RC rc;
+	BTPostingNode page;
+
+	count = last - first;
+	if (!leaf.hasPostings())
+		return 0;
+
+	KeyType key;
+	RecordId rid;
+	for (int eid = first; eid < last; eid++)
+	{
+		leaf.readEntry(eid, key, rid);
+		if (rid.pid >= 0)
+			continue;
+
+		count--;
+		for (PageId pid = -rid.pid; pid > 0; pid = page.getNextNodePtr())
+		{
+			if ((rc = page.read(pid, pf)) < 0)
+				return rc;
+			count += page.getCount();
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Count the entries under the node at pid on level: the RecordIds of a leaf,
+ * the entry counts of the children of a non-leaf node.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countNode(PageId pid, int level, int& count)
+{
+	RC rc;
+
+	if (level > 0)
+	{
+		BTNonLeafNodeT<KeyType> node;
+		if ((rc = readInner(pid, node)) < 0)
+			return rc;
+		count = node.getEntryCount();
+		return 0;
+	}
+
+	BTLeafNodeT<KeyType> leaf;
+	if ((rc = leaf.read(pid, pf)) < 0)
+		return rc;
+	return countRids(leaf, 0, leaf.getKeyCount(), count);
+}
+
+/*
+ * Count the entries with a key smaller than key (or, if inclusive, not
+ * greater than it), on the way down to its leaf: the children in front of
+ * the one followed on every level count as a whole, so only the entries of
+ * the leaf are counted one by one. A node that a split moved key out of
+ * counts as a whole too, before moving right.
+ * @param key[IN] the key; NULL to count every entry
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countBelow(const KeyType* key, bool inclusive, int& count, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	PageId pid;
+	int height, n;
+
+	// The counts of the non-leaf nodes are no use once they are stale
+	if (countsStale)
+		return countLeaves(NULL, false, key, inclusive, count, snapshot);
+
+	count = 0;
+	readRoot(snapshot, pid, height);
+	if (height == 0)
+		return 0;
+
+	for (int level = height - 1; level > 0; level--)
+	{
+		BTNonLeafNodeT<KeyType> node;
+		for (;;)
+		{
+			if ((rc = readInner(pid, node)) < 0)
+				return rc;
+			if (key != NULL ? !node.isPastHighKey(*key) : node.getNextNodePtr() <= 0)
+				break;
+			count += node.getEntryCount();
+			pid = node.getNextNodePtr();
+		}
+
+		// Every entry is under the last node of the level
+		if (key == NULL)
+		{
+			count += node.getEntryCount();
+			return 0;
+		}
+
+		node.locateChildPtr(*key, pid, n);
+		count += n;
+	}
+
+	BTLeafNodeT<KeyType> leaf;
+	for (;;)
+	{
+		if ((rc = leaf.read(pid, pf)) < 0)
+			return rc;
+		if (key != NULL ? !leaf.isPastHighKey(*key) : leaf.getNextNodePtr() <= 0)
+			break;
+		if ((rc = countRids(leaf, 0, leaf.getKeyCount(), n)) < 0)
+			return rc;
+		count += n;
+		pid = leaf.getNextNodePtr();
+	}
+
+	if ((rc = countRids(leaf, 0, key != NULL ? leaf.countBelow(*key, inclusive) : leaf.getKeyCount(), n)) < 0)
+		return rc;
+	count += n;
+	return 0;
+}
+
+/*
+ * Count the entries with a key in a range one leaf at a time, from the leaf
+ * of lo (or from the first leaf: the first child of every level leads to
+ * it) to the leaf of hi.
+ * @param lo[IN] the lower bound; NULL for none
+ * @param hi[IN] the upper bound; NULL for none
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countLeaves(const KeyType* lo, bool loInclusive, const KeyType* hi, bool hiInclusive,
+	int& count, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	PageId pid;
+	BTLeafNodeT<KeyType> leaf;
+	int height, n;
+
+	count = 0;
+	if (lo != NULL)
+	{
+		if ((rc = findLeaf(lo, pid, leaf, NULL, snapshot)) < 0 || pid == 0)
+			return rc;
+	}
+	else
+	{
+		readRoot(snapshot, pid, height);
+		if (height == 0)
+			return 0;
+		for (int level = height - 1; level > 0; level--)
+		{
+			BTNonLeafNodeT<KeyType> node;
+			if ((rc = readInner(pid, node)) < 0)
+				return rc;
+			pid = node.getChildPtr(0);
+		}
+		if ((rc = leaf.read(pid, pf)) < 0)
+			return rc;
+	}
+
+	int first = (lo != NULL) ? leaf.countBelow(*lo, !loInclusive) : 0;
+	for (;;)
+	{
+		bool lastLeaf = (hi != NULL && !leaf.isPastHighKey(*hi));
+		int last = lastLeaf ? leaf.countBelow(*hi, hiInclusive) : leaf.getKeyCount();
+		if (last > first)
+		{
+			if ((rc = countRids(leaf, first, last, n)) < 0)
+				return rc;
+			count += n;
+		}
+		if (lastLeaf)
+			break;
+
+		if ((rc = nextLeafPtr(leaf, pid, snapshot)) < 0)
+			return rc;
+		if (pid == 0 || (rc = leaf.read(pid, pf)) < 0)
+			return rc;
+		first = 0;
+	}
+
+	return 0;
+}
+
+/*
+ * Count the entries with a key smaller than key (or, if inclusive, not
+ * greater than it), from the entry counts of the non-leaf nodes.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::rank(const KeyType& key, bool inclusive, int& count, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = countBelow(&key, inclusive, count, &current);
+		closeSnapshot(current);
+		return rc;
+	}
+
+	// Under bufferMutex, no insert moves from a buffer to a leaf meanwhile
+	std::unique_lock<std::mutex> bufferGuard(bufferMutex, std::defer_lock);
+	if (buffered)
+		bufferGuard.lock();
+
+	if ((rc = countBelow(&key, inclusive, count, snapshot)) < 0)
+		return rc;
+	if (buffered)
+		count += countBuffered(&key, inclusive);
+	return 0;
+}
+
+/*
+ * Count the entries with a key in a range, as the difference of the
+ * entries below its upper bound and below its lower bound.
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::countRange(const KeyType* lo, bool loInclusive, const KeyType* hi, bool hiInclusive,
+	int& count, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+	int below = 0;
+
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = countRange(lo, loInclusive, hi, hiInclusive, count, &current);
+		closeSnapshot(current);
+		return rc;
+	}
+
+	std::unique_lock<std::mutex> bufferGuard(bufferMutex, std::defer_lock);
+	if (buffered)
+		bufferGuard.lock();
+
+	// An entry is at or above lo if it is not below it. Stale entry counts
+	// are no use: the leaves of the range are counted instead
+	if (countsStale)
+	{
+		if ((rc = countLeaves(lo, loInclusive, hi, hiInclusive, count, snapshot)) < 0)
+			return rc;
+	}
+	else
+	{
+		if ((rc = countBelow(hi, hiInclusive, count, snapshot)) < 0)
+			return rc;
+		if (lo != NULL && (rc = countBelow(lo, !loInclusive, below, snapshot)) < 0)
+			return rc;
+	}
+	if (buffered)
+	{
+		count += countBuffered(hi, hiInclusive);
+		below += (lo != NULL) ? countBuffered(lo, !loInclusive) : 0;
+	}
+
+	// The two descents may see different inserts of other threads
+	count -= below;
+	if (count < 0)
+		count = 0;
+	return 0;
+}
+
+/*
+ * Find the index entries of many keys at once.
+ * @param keys[IN] the keys to find, sorted in ascending order
+ * @param count[IN] the number of keys
+ * @param matches[OUT] the (key, rid) pairs found are appended to it, in key order
+ * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE if the keys are not sorted
+ */
+template <class KeyType>
+RC BTreeIndexT<KeyType>::locateMany(const KeyType* keys, int count, std::vector< IndexEntry<KeyType> >& matches, const BTreeSnapshot* snapshot)
+{
+	RC rc;
+
+	for (int i = 1; i < count; i++)
+	{
+		if (KeyTraits<KeyType>::less(keys[i], keys[i - 1]))
+			return RC_INVALID_ATTRIBUTE;
+	}
+	if (count == 0)
+		return 0;
+	// A copy-on-write index is read in a snapshot, for this call at least
+	if (snapshot == NULL && copyOnWrite)
+	{
+		BTreeSnapshot current;
+		if ((rc = openSnapshot(current)) < 0)
+			return rc;
+		rc = locateMany(keys, count, matches, &current);
+		closeSnapshot(current);
 		return rc;
 	}
 
-	// Set the IndexCursor to the proper fields (extracted eid and current pid)
-	cursor.eid = eid;
-	cursor.pid = nextChild;
+	// Buffered inserts stay where they are until the batch is done (a plain
+	// mutex: lookups that keep overlapping would hold off a shared_mutex writer)
+	std::unique_lock<std::mutex> bufferGuard(bufferMutex, std::defer_lock);
+	if (buffered)
+		bufferGuard.lock();
+
+	BTLeafNodeT<KeyType> leaf;
+	PageId leafPid = 0;
+	KeyType highKey;          // the high key of the leaf in memory
+	bool hasHighKey = false;  // false for the last leaf
+	KeyType key;
+	RecordId rid;
+
+	for (int i = 0; i < count; i++)
+	{
+		if (i > 0 && KeyTraits<KeyType>::equal(keys[i], keys[i - 1]))
+			continue;
+
+		// The previous key belongs in the leaf in memory, so a key up to its
+		// high key does too (or did, when the leaf was read: like a cursor,
+		// the batch may miss an entry inserted by another thread since).
+		// A key past the high key is looked for in the next leaf, and only
+		// a key past the high key of that one too goes down from the root
+		if (leafPid != 0 && hasHighKey && KeyTraits<KeyType>::less(highKey, keys[i]))
+		{
+			if ((rc = readSiblingLeaf(1, leafPid, leaf, snapshot)) < 0)
+				return rc;
+			hasHighKey = leaf.getHighKey(highKey);
+			if (hasHighKey && KeyTraits<KeyType>::less(highKey, keys[i]))
+				leafPid = 0;
+		}
+		if (leafPid == 0)
+		{
+			if ((rc = findLeaf(&keys[i], leafPid, leaf, NULL, snapshot)) < 0)
+				return rc;
+			if (leafPid == 0)
+				return 0;
+			hasHighKey = leaf.getHighKey(highKey);
+		}
+
+		// Collect the entries of the key: a few plain entries, or one that
+		// references a posting list. A run that a split could only cut in
+		// two (see BTLeafNodeT::insertAndSplit()) fills the rest of the leaf
+		// and goes on in the next one, whose first key is the high key
+		int eid;
+		if (leaf.locate(keys[i], eid) < 0)
+			eid = leaf.getKeyCount();
+		for (;;)
+		{
+			for (; eid < leaf.getKeyCount(); eid++)
+			{
+				leaf.readEntry(eid, key, rid);
+				if (!KeyTraits<KeyType>::equal(key, keys[i]))
+					break;
+
+				IndexEntry<KeyType> match;
+				match.key = key;
+				if (rid.pid >= 0)
+				{
+					match.rid = rid;
+					matches.push_back(match);
+					continue;
+				}
 
-	return rc;
+				BTPostingNode posting;
+				for (PageId pid = -rid.pid; pid > 0; pid = posting.getNextNodePtr())
+				{
+					if ((rc = posting.read(pid, pf)) < 0)
+						return rc;
+					for (int j = 0; j < posting.getCount(); j++)
+					{
+						posting.readEntry(j, match.rid);
+						matches.push_back(match);
+					}
+				}
+			}
+
+			if (eid < leaf.getKeyCount() || !hasHighKey || !KeyTraits<KeyType>::equal(highKey, keys[i]))
+				break;
+			if ((rc = readSiblingLeaf(1, leafPid, leaf, snapshot)) < 0)
+				return rc;
+			if (leafPid == 0)
+				break;
+			hasHighKey = leaf.getHighKey(highKey);
+			eid = 0;
+		}
+
+		// The inserts of the key still on their way down come after the
+		// entries in the leaf, sorted, as BTreeCursorT returns them
+		if (buffered)
+		{
+			size_t first = matches.size();
+			if ((rc = findBuffered(keys[i], matches)) < 0)
+				return rc;
+			std::sort(matches.begin() + first, matches.end());
+		}
+	}
+
+	return 0;
 }
 
 /*
  * Read the (key, rid) pair at the location specified by the index cursor,
- * and move foward the cursor to the next entry.
+ * and move the cursor back to the previous entry.
+ * A cursor with eid = -1 points to the last entry of its leaf: that is where
+ * the cursor goes when it moves back past the first entry of a leaf.
  * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
- * @param key[OUT] the key stored at the index cursor location.
- * @param rid[OUT] the RecordId stored at the index cursor location.
+ * @param key[OUT] the key stored at the index cursor location
+ * @param rid[OUT] the RecordId stored at the index cursor location
  * @return error code. 0 if no error
  */
-RC BTreeIndex::readForward(IndexCursor& cursor, int& key, RecordId& rid)
+template <class KeyType>
+RC BTreeIndexT<KeyType>::readBackward(IndexCursor& cursor, KeyType& key, RecordId& rid, const BTreeSnapshot* snapshot)
 {
 	RC rc;
-	BTLeafNode leafNode;
+	BTLeafNodeT<KeyType> leafNode;
+
+	// The first leaf node has no previous sibling
+	if (cursor.pid <= 0)
+		return RC_END_OF_TREE;
 
-	// Read in data from the leaf node
 	if ((rc = leafNode.read(cursor.pid, pf)) < 0)
-	{
-		//fprintf(stderr, "Error: failed to read in leaf node data");
 		return rc;
-	}
-
-	// Read in key-rid pair from eid value
+	if (cursor.eid < 0)
+		cursor.eid = leafNode.getKeyCount() - 1;
 	if ((rc = leafNode.readEntry(cursor.eid, key, rid)) < 0)
-	{
-		//fprintf(stderr, "Error: failed to read in key-rid pair from eid");
 		return rc;
+
+	// The RecordIds of a posting list come in the order of the list,
+	// before the cursor moves on to the previous entry
+	if (rid.pid < 0)
+	{
+		BTPostingNode posting;
+
+		if (cursor.postPid <= 0)
+		{
+			cursor.postPid = -rid.pid;
+			cursor.postEid = 0;
+		}
+
+		if ((rc = posting.read(cursor.postPid, pf)) < 0)
+			return rc;
+		if ((rc = posting.readEntry(cursor.postEid, rid)) < 0)
+			return rc;
+
+		if (++cursor.postEid < posting.getCount())
+			return 0;
+		cursor.postPid = posting.getNextNodePtr();
+		cursor.postEid = 0;
+		if (cursor.postPid > 0)
+			return 0;
 	}
 
-	// Cursor's page id is out of range
-	if (cursor.pid <= 0)
-		return RC_INVALID_CURSOR;
-	
-	// Move forward the cursor to the next entry
-	if (cursor.eid + 1 < leafNode.getKeyCount())
+	// Move back the cursor to the previous entry, the last one of the previous leaf
+	// after the first entry
+	if (cursor.eid > 0)
 	{
-		cursor.eid++;
+		cursor.eid--;
 	}
-	else // If it goes beyond the maximum eid entry, reset the eid to 0 and advance to the next page
+	else
 	{
-		cursor.eid = 0;
-		cursor.pid = leafNode.getNextNodePtr();
+		cursor.eid = -1;
+		return prevLeafPtr(leafNode, cursor.pid, snapshot);
 	}
 
-	return rc;
+	return 0;
 }
 
-
-PageId BTreeIndex::getRoot()
+template <class KeyType>
+PageId BTreeIndexT<KeyType>::getRoot()
 {
 	return rootPid;
 }
 
-int BTreeIndex::getHeight()
+template <class KeyType>
+int BTreeIndexT<KeyType>::getHeight()
 {
 	return treeHeight;
 }
 
-void BTreeIndex::print()
+template <class KeyType>
+void BTreeIndexT<KeyType>::print()
 {
 	/*
 	if (treeHeight == 1)
@@ -513,3 +3305,504 @@ void BTreeIndex::print()
 	}
 	*/
 }
+
+/*
+ * BTreeCursor constructor: the cursor is not at any entry until seek()
+ */
+template <class KeyType>
+BTreeCursorT<KeyType>::BTreeCursorT(BTreeIndexT<KeyType>& index)
+	: index(index)
+{
+	pos.pid = -1;
+	pos.eid = 0;
+	pos.postPid = 0;
+	pos.postEid = 0;
+	step = 0;
+	leafPid = 0;
+	postingPid = 0;
+	pend = 0;
+	onPending = false;
+	pinned = false;
+}
+
+template <class KeyType>
+BTreeCursorT<KeyType>::~BTreeCursorT()
+{
+	if (pinned)
+		index.closeSnapshot(snapshot);
+}
+
+/*
+ * Open a snapshot for the next seek, closing the one of the previous seek.
+ * A page of the old snapshot may have been reused in the new one, so the
+ * pages in memory are read again.
+ */
+template <class KeyType>
+const BTreeSnapshot* BTreeCursorT<KeyType>::pin()
+{
+	if (pinned)
+		index.closeSnapshot(snapshot);
+	pinned = index.openSnapshot(snapshot) == 0;
+	leafPid = 0;
+	postingPid = 0;
+
+	return pinned ? &snapshot : NULL;
+}
+
+/*
+ * Move the cursor to the first entry with a key not smaller than searchKey.
+ * The leaf is read with the inserts on their way to it, so the position is
+ * found in both with a single search each.
+ * @param searchKey[IN] the key to find
+ * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if not. Otherwise an error code
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::seek(const KeyType& searchKey)
+{
+	RC rc;
+	const BTreeSnapshot* current = pin();
+
+	step = 0;
+	pos.postPid = 0;
+	pos.postEid = 0;
+	if ((rc = index.findLeaf(&searchKey, leafPid, leaf, NULL, current, &pending)) < 0)
+	{
+		pos.pid = -1;
+		leafPid = 0;
+		return rc;
+	}
+	pos.pid = leafPid;
+	pos.eid = (leafPid > 0) ? leaf.countBelow(searchKey, false) : 0;
+	pend = pendingBelow(searchKey, false);
+
+	// When every key of the leaf is smaller, settle() goes on to the next leaf
+	if ((rc = settle(1)) < 0)
+		return rc;
+	return (pos.pid > 0 && KeyTraits<KeyType>::equal(curKey, searchKey)) ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Move the cursor to the last entry with a key smaller than searchKey
+ * (or, if inclusive, not greater than it).
+ * @return 0 if the entry has searchKey. RC_NO_SUCH_RECORD if not. Otherwise an error code
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::seekBefore(const KeyType& searchKey, bool inclusive)
+{
+	RC rc;
+	const BTreeSnapshot* current = pin();
+
+	step = 0;
+	pos.postPid = 0;
+	pos.postEid = 0;
+	if ((rc = index.findLeaf(&searchKey, leafPid, leaf, NULL, current, &pending)) < 0)
+	{
+		pos.pid = -1;
+		leafPid = 0;
+		return rc;
+	}
+	pos.pid = leafPid;
+	pos.eid = (leafPid > 0) ? leaf.countBelow(searchKey, inclusive) : 0;
+	pend = pendingBelow(searchKey, inclusive);
+	if ((rc = settle(-1)) < 0)
+		return rc;
+
+	// A run of equal keys may start in the leaf in front, when a split fell
+	// inside it: step back over the entries of that leaf past the bound
+	while (pos.pid > 0 && (inclusive ? KeyTraits<KeyType>::less(searchKey, curKey) : !KeyTraits<KeyType>::less(curKey, searchKey)))
+	{
+		pos.postPid = 0;
+		pos.postEid = 0;
+		if ((rc = settle(-1)) < 0)
+			return rc;
+	}
+	return (pos.pid > 0 && KeyTraits<KeyType>::equal(curKey, searchKey)) ? 0 : RC_NO_SUCH_RECORD;
+}
+
+/*
+ * Move the cursor to the entry with the largest key.
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::seekLast()
+{
+	RC rc;
+	const BTreeSnapshot* current = pin();
+
+	step = 0;
+	pos.postPid = 0;
+	pos.postEid = 0;
+	if ((rc = index.findLeaf(NULL, leafPid, leaf, NULL, current, &pending)) < 0)
+	{
+		pos.pid = -1;
+		leafPid = 0;
+		return rc;
+	}
+	pos.pid = leafPid;
+	pos.eid = (leafPid > 0) ? leaf.getKeyCount() : 0;
+	pend = pending.size();
+
+	return settle(-1);
+}
+
+template <class KeyType>
+RC BTreeCursorT<KeyType>::peek(KeyType& key, RecordId& rid)
+{
+	RC rc;
+
+	if (pos.pid < 0)
+		return RC_INVALID_CURSOR;
+	if (step != 0 && (rc = load()) < 0)
+		return rc;
+	if (pos.pid == 0)
+		return RC_END_OF_TREE;
+
+	key = curKey;
+	rid = curRid;
+	return 0;
+}
+
+template <class KeyType>
+RC BTreeCursorT<KeyType>::next(KeyType& key, RecordId& rid)
+{
+	RC rc;
+
+	if ((rc = peek(key, rid)) < 0)
+		return rc;
+
+	// Step past the entry on the next call, so that an error reading the
+	// next page is reported with the entry it prevents from being read
+	step = 1;
+	return 0;
+}
+
+template <class KeyType>
+RC BTreeCursorT<KeyType>::prev(KeyType& key, RecordId& rid)
+{
+	RC rc;
+
+	if ((rc = peek(key, rid)) < 0)
+		return rc;
+
+	step = -1;
+	return 0;
+}
+
+/*
+ * Step past the entry returned by next() or prev(), if any, and read the next
+ * entry in that direction into curKey and curRid. The leaf and posting pages
+ * are read only when pos moves onto a page other than the one in memory.
+ * @return error code. 0 if no error (also at either end of the tree, with pos.pid = 0)
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::load()
+{
+	int dir = step;
+
+	if (step != 0)
+	{
+		step = 0;
+
+		// Inside a posting list: move to its next RecordId (in either direction,
+		// the RecordIds of a key come in the order of the list), then to the next entry
+		if (!onPending && pos.postPid > 0)
+		{
+			if (++pos.postEid >= posting.getCount())
+			{
+				pos.postPid = posting.getNextNodePtr();
+				pos.postEid = 0;
+			}
+			if (pos.postPid > 0)
+				return readEntry();
+		}
+		pos.postPid = 0;
+		pos.postEid = 0;
+
+		// pos.eid and pend count the entries in front of the current one:
+		// going forward, it joins them; going back, they already leave it out
+		if (dir > 0)
+		{
+			if (onPending)
+				pend++;
+			else
+				pos.eid++;
+		}
+	}
+
+	return settle(dir);
+}
+
+/*
+ * Choose the next entry in direction dir among the entries of the leaf and
+ * the pending inserts: going forward, the smaller of entry pos.eid and
+ * pending[pend]; going back, the larger of the two in front of them. An
+ * insert still on its way comes after the entries of the leaf with its key.
+ * @return error code. 0 if no error (also at either end of the tree, with pos.pid = 0)
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::settle(int dir)
+{
+	RC rc;
+	KeyType key;
+	RecordId rid;
+
+	while (pos.pid > 0)
+	{
+		int keys = leaf.getKeyCount();
+		int inserts = pending.size();
+
+		if (dir >= 0 && (pos.eid < keys || pend < inserts))
+		{
+			onPending = (pend < inserts);
+			if (onPending && pos.eid < keys)
+			{
+				if ((rc = leaf.readEntry(pos.eid, key, rid)) < 0)
+					return rc;
+				onPending = KeyTraits<KeyType>::less(pending[pend].key, key);
+			}
+			break;
+		}
+		if (dir < 0 && (pos.eid > 0 || pend > 0))
+		{
+			onPending = (pend > 0);
+			if (onPending && pos.eid > 0)
+			{
+				if ((rc = leaf.readEntry(pos.eid - 1, key, rid)) < 0)
+					return rc;
+				onPending = !KeyTraits<KeyType>::less(pending[pend - 1].key, key);
+			}
+			if (onPending)
+				pend--;
+			else
+				pos.eid--;
+			break;
+		}
+
+		// Past the last entry, go to the first one of the next leaf;
+		// in front of the first one, to the last one of the previous leaf
+		int side = (dir < 0) ? -1 : 1;
+		if ((rc = index.readSiblingLeaf(side, leafPid, leaf, pinned ? &snapshot : NULL, &pending)) < 0)
+			return rc;
+		pos.pid = leafPid;
+		pos.eid = (side < 0) ? leaf.getKeyCount() : 0;
+		pend = (side < 0) ? pending.size() : 0;
+		pos.postPid = 0;
+		pos.postEid = 0;
+	}
+	if (pos.pid <= 0)
+	{
+		pos.pid = 0;
+		return 0;
+	}
+
+	return readEntry();
+}
+
+/*
+ * Read the current entry: pending[pend], or entry pos.eid of the leaf (at
+ * RecordId pos.postEid of page pos.postPid of its posting list, if it has one).
+ * @return error code. 0 if no error
+ */
+template <class KeyType>
+RC BTreeCursorT<KeyType>::readEntry()
+{
+	RC rc;
+
+	if (onPending)
+	{
+		curKey = pending[pend].key;
+		curRid = pending[pend].rid;
+		return 0;
+	}
+
+	if ((rc = leaf.readEntry(pos.eid, curKey, curRid)) < 0)
+		return rc;
+
+	// A negative pid references the posting list of the key
+	if (curRid.pid < 0)
+	{
+		if (pos.postPid <= 0)
+		{
+			pos.postPid = -curRid.pid;
+			pos.postEid = 0;
+		}
+		if (pos.postPid != postingPid)
+		{
+			if ((rc = posting.read(pos.postPid, index.pf)) < 0)
+				return rc;
+			postingPid = pos.postPid;
+		}
+		if ((rc = posting.readEntry(pos.postEid, curRid)) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * Binary search of the pending inserts, like BTLeafNodeT::countBelow().
+ */
+template <class KeyType>
+int BTreeCursorT<KeyType>::pendingBelow(const KeyType& key, bool inclusive)
+{
+	int lo = 0, hi = pending.size();
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (inclusive ? !KeyTraits<KeyType>::less(key, pending[mid].key) : KeyTraits<KeyType>::less(pending[mid].key, key))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+template <class KeyType>
+RC BTreeCursorT<KeyType>::scanBatch(const KeyType& hi, bool inclusive, IndexEntry<KeyType>* out, int max, int& count)
+{
+	RC rc;
+	PageId endPid = 0; // the leaf that end and pendEnd were computed for
+	int end = 0;       // the number of entries of that leaf in the range
+	int pendEnd = 0;   // the number of its pending inserts in the range
+
+	count = 0;
+	if (pos.pid < 0)
+		return RC_INVALID_CURSOR;
+	if (step != 0 && (rc = load()) < 0)
+		return rc;
+
+	while (count < max && pos.pid > 0)
+	{
+		// The range ends in this leaf unless its last key is in it
+		if (endPid != leafPid)
+		{
+			end = leaf.countBelow(hi, inclusive);
+			pendEnd = pendingBelow(hi, inclusive);
+			endPid = leafPid;
+		}
+		if (onPending ? pend >= pendEnd : pos.eid >= end)
+			break;
+
+		// RecordIds of a posting list come from the posting page one at a
+		// time, and so do the pending inserts
+		if (onPending || pos.postPid > 0)
+		{
+			out[count].key = curKey;
+			out[count].rid = curRid;
+			count++;
+			step = 1;
+		}
+		else
+		{
+			// Copy the entries in front of the end of the range (or the next
+			// posting list, or the next pending insert), then let load() read
+			// the entry the copy stopped at
+			int stop = end;
+			if (pend < (int)pending.size())
+				stop = std::min(stop, leaf.countBelow(pending[pend].key, true));
+			for (; count < max && pos.eid < stop; pos.eid++)
+			{
+				leaf.readEntry(pos.eid, out[count].key, out[count].rid);
+				if (out[count].rid.pid < 0)
+					break;
+				count++;
+			}
+		}
+
+		if ((rc = load()) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+template <class KeyType>
+RC BTreeCursorT<KeyType>::countRange(const KeyType& hi, bool inclusive, int& count)
+{
+	RC rc;
+	BTPostingNode page;
+
+	count = 0;
+	if (pos.pid < 0)
+		return RC_INVALID_CURSOR;
+	if (step != 0 && (rc = load()) < 0)
+		return rc;
+
+	while (pos.pid > 0)
+	{
+		int end = leaf.countBelow(hi, inclusive);
+		int pendEnd = pendingBelow(hi, inclusive);
+		if (onPending ? pend >= pendEnd : pos.eid >= end)
+			break;
+
+		// Inside a posting list: count the rest of it and step past its entry
+		if (!onPending && pos.postPid > 0)
+		{
+			count += posting.getCount() - pos.postEid;
+			for (PageId pid = posting.getNextNodePtr(); pid > 0; pid = page.getNextNodePtr())
+			{
+				if ((rc = page.read(pid, index.pf)) < 0)
+					return rc;
+				count += page.getCount();
+			}
+			pos.eid++;
+		}
+		pos.postPid = 0;
+		pos.postEid = 0;
+
+		// The pending inserts in the range count once each
+		if (pend < pendEnd)
+		{
+			count += pendEnd - pend;
+			pend = pendEnd;
+		}
+
+		// Every entry of the leaf from pos.eid to end counts once,
+		// and a posting list as many times as it has RecordIds
+		if (pos.eid < end)
+		{
+			count += end - pos.eid;
+			if (leaf.hasPostings())
+			{
+				KeyType key;
+				RecordId rid;
+				for (int eid = pos.eid; eid < end; eid++)
+				{
+					leaf.readEntry(eid, key, rid);
+					if (rid.pid >= 0)
+						continue;
+
+					count--;
+					for (PageId pid = -rid.pid; pid > 0; pid = page.getNextNodePtr())
+					{
+						if ((rc = page.read(pid, index.pf)) < 0)
+							return rc;
+						count += page.getCount();
+					}
+				}
+			}
+			pos.eid = end;
+		}
+
+		// Move on to the entry at the end of the range, maybe in the next leaf
+		if ((rc = load()) < 0)
+			return rc;
+	}
+
+	return 0;
+}
+
+/*
+ * The key types indexes are built on (see BTreeNode.cc).
+ */
+template class BTreeIndexT<int>;
+template class BTreeIndexT<long long>;
+template class BTreeIndexT< FixedString<16> >;
+template class BTreeIndexT<IntPair>;
+template class BTreeIndexT< KeyValue<28> >;
+
+template class BTreeCursorT<int>;
+template class BTreeCursorT<long long>;
+template class BTreeCursorT< FixedString<16> >;
+template class BTreeCursorT<IntPair>;
+template class BTreeCursorT< KeyValue<28> >;
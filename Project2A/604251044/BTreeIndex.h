@@ -13,11 +13,22 @@
 #include "Bruinbase.h"
 #include "PageFile.h"
 #include "RecordFile.h"
+#include "BTreeKey.h"
+#include "BTreeNode.h"
+#include "PageVersions.h"
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <vector>
             
 /**
  * The data structure to point to a particular entry at a b+tree leaf node.
  * An IndexCursor consists of pid (PageId of the leaf node) and 
  * eid (the location of the index entry inside the node).
+ * When the entry is a posting list of a duplicated key, postPid and
+ * postEid point to the next RecordId of the list.
  * IndexCursor is used for index lookup and traversal.
  */
 typedef struct {
@@ -25,22 +36,202 @@ typedef struct {
   PageId  pid;  
   // The entry number inside the node
   int     eid;  
+  // PageId of the posting page inside the posting list of the entry; 0 if not inside one
+  PageId  postPid;
+  // The entry number inside the posting page
+  int     postEid;
 } IndexCursor;
 
 /**
- * Implements a B-Tree index for bruinbase.
- * 
+ * A version of a copy-on-write index, as opened by BTreeIndexT::openSnapshot().
+ * The pages of the version are not changed or reused until it is closed.
  */
-class BTreeIndex {
+typedef struct {
+  // PageId of the root node of the version
+  PageId              rootPid;
+  // The height of the tree of the version
+  int                 treeHeight;
+  // The number of inserts published before the version
+  unsigned long long  version;
+} BTreeSnapshot;
+
+/**
+ * The content of page 0 of an index file. The magic number and the format
+ * version identify the page layout of the nodes, so that index files
+ * written by an older version of bruinbase are not misread.
+ */
+typedef struct {
+  PageId  rootPid;     // the PageId of the root node
+  int     treeHeight;  // the height of the tree
+  int     magic;       // BTreeIndex::MAGIC
+  int     version;     // BTreeIndex::FORMAT_VERSION
+  int     keyType;     // KeyTraits<KeyType>::TYPE_ID of the key type of the index
+  int     flags;       // BTreeIndex::COPY_ON_WRITE, BUFFERED, ENTRY_COUNTS and COUNTS_STALE: the mode of the index
+  PageId  freeListPid; // the first page of the list of free pages; 0 if there is none
+  PageId  logPid;      // the first page of the insert log of a buffered index; 0 if it is empty
+} BTreeMetadata;
+
+/**
+ * The header of a page of a list of pages rooted in page 0: the list of
+ * free pages, followed by count PageIds of free pages (the pages of the
+ * list are free pages too), or the insert log, followed by count
+ * IndexEntry pairs.
+ */
+typedef struct {
+  PageId  nextPid;     // the next page of the list; 0 for the last one
+  int     count;       // the number of PageIds (IndexEntry pairs) on the page
+} PageListHeader;
+
+/**
+ * Statistics of an index, kept up to date by every insert and stored in
+ * page 0 behind the BTreeMetadata, so that the planner can use them
+ * without reading the tree.
+ */
+template <class KeyType>
+struct BTreeStatistics {
+  int      entryCount;    // the number of (key, RecordId) entries, every RecordId of a posting list included
+  int      distinctKeys;  // the number of distinct keys
+  int      leafCount;     // the number of leaves
+  int      leafEntries;   // the number of entries in the leaves; a posting list takes one
+  KeyType  minKey;        // the smallest key, if entryCount > 0
+  KeyType  maxKey;        // the largest key, if entryCount > 0
+};
+
+/**
+ * A (key, RecordId) pair, as sorted for a bulk load of the index.
+ * Pairs are ordered by key, then by RecordId, so that the RecordIds
+ * of a duplicated key stay in table order.
+ */
+template <class KeyType>
+struct IndexEntry {
+  KeyType   key;
+  RecordId  rid;
+
+  bool operator<(const IndexEntry& other) const
+  {
+    if (KeyTraits<KeyType>::less(key, other.key)) return true;
+    if (KeyTraits<KeyType>::less(other.key, key)) return false;
+    return rid < other.rid;
+  }
+};
+
+template <class KeyType>
+class BTreeCursorT;
+
+/**
+ * Implements a B-Tree index for bruinbase, on keys of KeyType.
+ * BTreeIndex is the index on the int key column; other key types
+ * (see BTreeKey.h) use the same nodes through KeyTraits<KeyType>.
+ *
+ * Once the index is open, several threads may insert, locate and scan it
+ * at the same time. The tree is a B-link tree: every node, leaf or not,
+ * links to its right sibling on the same level and keeps a high key, the
+ * first key of that sibling. A split writes the new right node first and
+ * then the node that splits, which links to it, and only then adds the
+ * new node to the parent; in between, a descent that finds its key at or
+ * past the high key of a node moves right to the sibling. An insert locks the nodes it changes from the
+ * leaf up (see PageVersions), and keeps each one locked until its parent
+ * is written. A node is never locked while a node above it is. Page 0
+ * guards the root pointer and the height. open(), close() and bulk loads
+ * need the index to themselves.
+ *
+ * The non-leaf nodes stay in memory: a descent reads a non-leaf node from
+ * the file only the first time it passes it, and every non-leaf node the
+ * index writes goes through writeInner(), which keeps the copy in memory
+ * up to date. close() leaves page 0 and the non-leaf nodes in memory for
+ * the next open() of the file in the process, which takes them if nothing
+ * opened the file for writing in between and the file has the same size
+ * and time of last write. Opening the index then reads no page, and a
+ * lookup reads its leaf alone.
+ *
+ * Every non-leaf node keeps the number of entries under each of its
+ * children, for rank() and countRange(). A bulk load sets the counts. In
+ * entry count mode (see enableEntryCounts()), every insert adds to them,
+ * so it writes every node on its path, and holds each one locked until
+ * its parent is written. Otherwise an insert writes the nodes above its
+ * leaf only when the leaf splits; the first one marks the counts stale in
+ * page 0, and rank() and countRange() count the leaves instead until
+ * recountEntries() brings the counts up to date. A copy-on-write insert
+ * copies every node on its path anyway, and adds to the counts.
+ *
+ * Lookups go down the tree in one of two ways (see setReadMode()). By
+ * default, a reader follows the B-link pointers: it never waits and never
+ * starts over, and moves right past a split instead. With optimistic lock
+ * coupling (OPTIMISTIC_READS), a reader checks the version of every node
+ * it passes, and starts over from the root when one changed, or when its
+ * key is past the high key of a node. B-link reads are the default since
+ * every node an insert writes gets a new version: in entry count mode
+ * that is every node on the path, root included, so every insert sends
+ * the optimistic readers in flight back to the root. Without entry
+ * counts, an insert changes its leaf alone unless the leaf splits, and
+ * optimistic readers start over far less often. Either way, a non-leaf
+ * node is copied out of memory whole, under innerMutex, so a reader never
+ * sees one half written; readers in a copy-on-write snapshot never check.
+ *
+ * In copy-on-write mode (see enableCopyOnWrite()), inserts do not change
+ * any node in place. One insert at a time writes the leaf and every node
+ * above it to new pages, and publishes the new root in page 0. A reader
+ * opens a snapshot and keeps reading the version it started with, however
+ * many inserts are published meanwhile: the pages of a version are reused
+ * only once no snapshot of it, or of an older version, is open. close()
+ * saves the pages left free in a list rooted in page 0, and open() takes
+ * them back, so the file does not grow from one session to the next.
+ * Leaves are copied without their neighbours, so the sibling pointers of a
+ * leaf are left as they were; a scan moves to the next leaf by looking up
+ * the high key of the leaf from the root of its snapshot instead.
+ *
+ * In buffered mode (see enableBuffering()), every non-leaf node has a
+ * buffer of inserts on their way down, kept in memory with the node. An
+ * insert goes into the buffer of the root. A buffer that fills up moves
+ * the inserts for the child with the most of them to the buffer of that
+ * child, and the buffers above the leaves insert theirs into a leaf
+ * together: the leaf is read and written once for all of them, instead of
+ * once per insert. The lookups do not empty the buffers: locateMany()
+ * looks in the buffers on its way down to the leaves, BTreeCursorT merges
+ * the inserts on their way to a leaf with the entries of the leaf, and
+ * rank(), countRange() and getStatistics() count the buffered inserts
+ * too. Only the IndexCursor functions (locate(), readForward() and so on)
+ * see the leaves alone. One insert at a time changes the buffers.
+ *
+ * Every buffered insert is also appended to an insert log rooted in page 0.
+ * The inserts are grouped: the last page of the log is kept in memory, and
+ * written once it is full or on syncLog(), so a page of the log costs two
+ * writes (itself, and the link to it) for every page worth of inserts,
+ * instead of one write per insert. open() puts the inserts of the log that
+ * are not in a leaf back into the buffer of the root, so an index that was
+ * not closed loses only the inserts since the log was last written. The
+ * log is dropped whenever every buffer is empty: on close(), on
+ * flushBuffers(), and once it reaches LOG_PAGES pages.
+ */
+template <class KeyType>
+class BTreeIndexT {
  public:
-  BTreeIndex();
+  static const int MAGIC = 0x42545849;  // "BTXI"
+  static const int COPY_ON_WRITE = 1;   // BTreeMetadata flag
+  static const int BUFFERED = 2;        // BTreeMetadata flag
+  static const int ENTRY_COUNTS = 4;    // BTreeMetadata flag: inserts keep the entry counts up to date
+  static const int COUNTS_STALE = 8;    // BTreeMetadata flag: the entry counts miss some inserts
+  static const int B_LINK_READS = 0;    // setReadMode(): move right past splits
+  static const int OPTIMISTIC_READS = 1;  // setReadMode(): validate versions, start over on a change
+  static const int BUFFER_CAPACITY = 4096;  // the inserts a buffer holds before some move down
+  static const int LOG_PAGES = 1024;     // the pages the insert log grows to before the buffers are emptied
+  static const int FORMAT_VERSION = 11; // 1: interleaved entries, 2: key array + payload array, 3: packed leaves,
+                                        // 4: posting lists, 5: key type in the metadata, 6: previous leaf pointers,
+                                        // 7: right links and high keys in every node,
+                                        // 8: entry counts of the children in non-leaf nodes,
+                                        // 9: statistics in page 0, 10: list of free pages,
+                                        // 11: insert log of a buffered index
+
+  BTreeIndexT();
 
   /**
    * Open the index file in read or write mode.
    * Under 'w' mode, the index file should be created if it does not exist.
+   * An index file in another format, or on another key type, is not opened.
    * @param indexname[IN] the name of the index file
    * @param mode[IN] 'r' for read, 'w' for write
-   * @return error code. 0 if no error
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if the
+   *         file was written in an older index format or on another key type
    */
   RC open(const std::string& indexname, char mode);
 
@@ -56,7 +247,111 @@ class BTreeIndex {
    * @param rid[IN] the RecordId for the record being inserted into the index
    * @return error code. 0 if no error
    */
-  RC insert(int key, const RecordId& rid);
+  RC insert(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Switch the index to copy-on-write mode. The mode is stored in the index
+   * file and cannot be switched off, since inserts in this mode leave the
+   * sibling pointers of the leaves behind. Needs the index to itself, like open().
+   * @return error code. 0 if no error
+   */
+  RC enableCopyOnWrite();
+
+  /**
+   * Switch the index to buffered mode. The mode is stored in the index file;
+   * the buffers themselves are kept in memory, with the inserts in them
+   * logged to the file, and are emptied into the leaves when the index is
+   * closed. Needs the index to itself, like open().
+   * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index
+   *         is in copy-on-write mode
+   */
+  RC enableBuffering();
+
+  /**
+   * Make every insert keep the entry counts of the non-leaf nodes up to date,
+   * counting the entries again first if they are stale. The mode is stored
+   * in the index file. Needs the index to itself, like open().
+   * @return error code. 0 if no error
+   */
+  RC enableEntryCounts();
+
+  /**
+   * Count the entries under every child of every non-leaf node again, if
+   * inserts left the counts stale: reads every node once, and writes the
+   * non-leaf nodes whose counts changed. Needs the index to itself, like open().
+   * @return error code. 0 if no error
+   */
+  RC recountEntries();
+
+  /**
+   * Set how lookups, scans and counts that do not read a snapshot go down
+   * to a leaf: B_LINK_READS (the default) or OPTIMISTIC_READS. The mode is
+   * not stored in the index file. Set it before other threads use the index.
+   * @param mode[IN] the read mode
+   * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE for an unknown mode
+   */
+  RC setReadMode(int mode);
+
+  /**
+   * @return the number of times an optimistic descent started over from
+   *         the root since the index was opened
+   */
+  unsigned long long getReadRestarts() const { return readRestarts; }
+
+  /**
+   * Insert every (key, RecordId) pair waiting in a buffer into the leaves,
+   * and drop the insert log.
+   * @return error code. 0 if no error
+   */
+  RC flushBuffers();
+
+  /**
+   * Write the buffered inserts that the insert log holds in memory only, so
+   * that an index that is not closed does not lose them.
+   * @return error code. 0 if no error
+   */
+  RC syncLog();
+
+  /**
+   * Open a snapshot of the current version of a copy-on-write index. Passed
+   * to the lookup functions below, it makes them read that version only.
+   * Every snapshot opened must be closed.
+   * @param snapshot[OUT] the snapshot
+   * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index
+   *         is not in copy-on-write mode
+   */
+  RC openSnapshot(BTreeSnapshot& snapshot);
+
+  /**
+   * Close a snapshot, letting inserts reuse the pages only it still used.
+   * @param snapshot[IN] the snapshot returned by openSnapshot()
+   */
+  void closeSnapshot(const BTreeSnapshot& snapshot);
+
+  /**
+   * Start building the index bottom-up from (key, RecordId) pairs sorted by key.
+   * The pairs are passed to bulkInsert() in order, and endBulkLoad() builds the
+   * non-leaf levels. Leaves are filled up to fillFactor of their capacity and
+   * written one after another, so they end up in sequential pages.
+   * The index must be empty.
+   * @param fillFactor[IN] the fraction of each node to fill, in (0, 1]
+   * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index is not empty
+   */
+  RC beginBulkLoad(double fillFactor = 1.0);
+
+  /**
+   * Add the next (key, RecordId) pair of a bulk load.
+   * @param key[IN] the key; not smaller than the key of the previous pair
+   * @param rid[IN] the RecordId for the record being inserted into the index
+   * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE if the key is out of order
+   */
+  RC bulkInsert(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Finish a bulk load: write the last leaf and build the non-leaf levels.
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
 
   /**
    * Run the standard B+Tree key search algorithm and identify the
@@ -70,23 +365,123 @@ class BTreeIndex {
    * code RC_NO_SUCH_RECORD.
    * Using the returned "IndexCursor", you will have to call readForward()
    * to retrieve the actual (key, rid) pair from the index.
+   * In a buffered index, only the leaves are searched: the inserts still in
+   * a buffer are found by BTreeCursorT::seek() and locateMany().
    * @param key[IN] the key to find
    * @param cursor[OUT] the cursor pointing to the index entry with 
    *                    searchKey or immediately behind the largest key 
    *                    smaller than searchKey.
+   * @param snapshot[IN] the version of a copy-on-write index to look in;
+   *                     NULL for the current one (here and below)
    * @return 0 if searchKey is found. Othewise, an error code
    */
-  RC locate(int searchKey, IndexCursor& cursor);
+  RC locate(const KeyType& searchKey, IndexCursor& cursor, const BTreeSnapshot* snapshot = NULL);
 
   /**
    * Read the (key, rid) pair at the location specified by the index cursor,
    * and move foward the cursor to the next entry.
+   * The RecordIds of a key kept in a posting list are returned one at a time.
+   * The leaf is read again for every entry, so an insert from another thread
+   * may make the cursor skip or repeat entries; BTreeCursorT does not.
+   * In a copy-on-write index, the cursor stays valid only while the
+   * snapshot it was located in is open.
+   * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
+   * @param key[OUT] the key stored at the index cursor location
+   * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error
+   */
+  RC readForward(IndexCursor& cursor, KeyType& key, RecordId& rid, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Set the cursor to the last index entry with a key smaller than searchKey
+   * (or, if inclusive, not greater than it): the starting point of a scan in
+   * descending key order with readBackward().
+   * @param searchKey[IN] the upper bound
+   * @param inclusive[IN] true to also accept searchKey itself
+   * @param cursor[OUT] the cursor pointing to the entry; cursor.pid is 0 if
+   *                    there is no such entry
+   * @return 0 if the entry has searchKey. Otherwise RC_NO_SUCH_RECORD or an error code
+   */
+  RC locateBefore(const KeyType& searchKey, bool inclusive, IndexCursor& cursor, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Set the cursor to the index entry with the largest key.
+   * Reads one node per level, like locate().
+   * @param cursor[OUT] the cursor pointing to the last entry; cursor.pid is 0 if the index is empty
+   * @return error code. 0 if no error
+   */
+  RC locateLast(IndexCursor& cursor, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Count the index entries with a key smaller than key (or, if inclusive,
+   * not greater than it). Reads one leaf (and the posting lists in it),
+   * however many entries there are: the non-leaf nodes keep the number of
+   * entries under each child. While inserts have left those counts stale
+   * (see recountEntries()), every leaf up to the one of key is read instead. In a
+   * buffered index, the inserts still in a buffer count too.
+   * @param key[IN] the key
+   * @param inclusive[IN] true to also count the entries with key
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC rank(const KeyType& key, bool inclusive, int& count, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Count the index entries with a key in a range, from the entry counts of
+   * the non-leaf nodes, like rank(): two descents instead of a scan. While
+   * the counts are stale, the leaves of the range are read instead.
+   * Every RecordId of a posting list counts.
+   * @param lo[IN] the lower bound; NULL for none
+   * @param loInclusive[IN] true to also count the entries with key lo
+   * @param hi[IN] the upper bound; NULL for none
+   * @param hiInclusive[IN] true to also count the entries with key hi
+   * @param count[OUT] the number of entries
+   * @return error code. 0 if no error
+   */
+  RC countRange(const KeyType* lo, bool loInclusive, const KeyType* hi, bool hiInclusive,
+                int& count, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Find the index entries of many keys at once, for IN lists and join probes.
+   * The keys are looked up in order, and the leaf of the previous key is kept
+   * in memory: a key up to its last key is looked up there, without going down
+   * the tree again. A batch of keys then reads one page per distinct leaf it touches.
+   * @param keys[IN] the keys to find, sorted in ascending order (duplicates are looked up once)
+   * @param count[IN] the number of keys
+   * @param matches[OUT] the (key, rid) pairs found are appended to it, in key order,
+   *                     including every RecordId of a posting list; the pairs of
+   *                     a key come in the order a BTreeCursorT returns them
+   * @return error code. 0 if no error. RC_INVALID_ATTRIBUTE if the keys are not sorted
+   */
+  RC locateMany(const KeyType* keys, int count, std::vector< IndexEntry<KeyType> >& matches, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Read the (key, rid) pair at the location specified by the index cursor,
+   * and move the cursor back to the previous entry.
+   * The RecordIds of a key kept in a posting list are returned one at a time,
+   * in the order of the list. As with readForward(), an insert from another
+   * thread may make the cursor skip or repeat entries.
    * @param cursor[IN/OUT] the cursor pointing to an leaf-node index entry in the b+tree
    * @param key[OUT] the key stored at the index cursor location
    * @param rid[OUT] the RecordId stored at the index cursor location
+   * @return error code. 0 if no error. RC_END_OF_TREE in front of the first entry
+   */
+  RC readBackward(IndexCursor& cursor, KeyType& key, RecordId& rid, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Read the statistics of the index, without reading any page: open()
+   * read them with page 0, or took them from memory. The inserts
+   * still in a buffer count in entryCount, minKey and maxKey, but not in
+   * distinctKeys, leafCount and leafEntries, which describe the leaves.
+   * @param stats[OUT] the statistics
    * @return error code. 0 if no error
    */
-  RC readForward(IndexCursor& cursor, int& key, RecordId& rid);
+  RC getStatistics(BTreeStatistics<KeyType>& stats);
+
+  /**
+   * @return the average fraction of a leaf in use, from the statistics
+   */
+  static double getAverageFill(const BTreeStatistics<KeyType>& stats);
 
   /*
    * Helper Functions: Getters	
@@ -94,12 +489,6 @@ class BTreeIndex {
   PageId getRoot();
   int getHeight();
 
-  /*
-   * Helper Function: Recursive Insert
-   */
-
-  RC insertPair(int key, const RecordId& rid, PageId curPid, int curHeight, int& inKey, PageId& inPid);
-  
   /*
    * Helper Function: Print
    */
@@ -107,10 +496,470 @@ class BTreeIndex {
 
   
  private:
+  /**
+   * A key is moved from the leaf node to a posting list once it has this
+   * many RecordIds. The leaf keeps a single entry for it, whose rid is
+   * { -(PageId of the first posting page), 0 }.
+   */
+  static const int POSTING_THRESHOLD = 8;
+
+  friend class BTreeCursorT<KeyType>;
+
+  /**
+   * Append rid to the posting list starting at headPid.
+   * @param headPid[IN] the PageId of the first page of the posting list
+   * @param rid[IN] the RecordId to append
+   * @return error code. 0 if no error
+   */
+  RC appendPosting(PageId headPid, const RecordId& rid);
+
+  /**
+   * Add rid to the posting list starting at headPid without changing any of
+   * its pages, for copy-on-write: the first page is copied with rid added,
+   * or, when it is full, a new first page with rid is put in front of it.
+   * RecordIds added this way come before the older pages of the list.
+   * @param headPid[IN] the PageId of the first page of the posting list
+   * @param rid[IN] the RecordId to add
+   * @param newHeadPid[OUT] the PageId of the new first page
+   * @return error code. 0 if no error
+   */
+  RC prependPosting(PageId headPid, const RecordId& rid, PageId& newHeadPid);
+
+  /**
+   * Insert (key, rid) into a copy-on-write index and publish the new version.
+   * @return error code. 0 if no error
+   */
+  RC insertCopy(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Make newRoot the root of the index, as the next version of a
+   * copy-on-write index, and write it to page 0. The pages replaced by
+   * the insert (replacedPages) are freed once no snapshot uses them.
+   * Writing page 0 is what makes the insert durable, so it is written for
+   * every insert: one page write on top of the height of the tree.
+   * @return error code. 0 if no error
+   */
+  RC publish(PageId newRoot, int height);
+
+  /**
+   * Move the replaced pages that no open snapshot uses any more to freePages.
+   */
+  void freeUnusedPages();
+
+  /**
+   * Write the root pointer, the height and the mode of the index to page 0.
+   * @return error code. 0 if no error
+   */
+  RC writeMetadata();
+
+  /**
+   * Write freePages (and the pages replaced by copy-on-write inserts) to a
+   * list of free pages, and root it in freeListPid. Needs the index to itself.
+   * @return error code. 0 if no error
+   */
+  RC writeFreeList();
+
+  /**
+   * Move the pages of the list of free pages rooted in freeListPid to
+   * freePages, pages of the list included, and empty the list.
+   * @return error code. 0 if no error
+   */
+  RC readFreeList();
+
+  /**
+   * Read the root pointer and the height of the index, or of snapshot if not NULL.
+   */
+  void readRoot(const BTreeSnapshot* snapshot, PageId& pid, int& height);
+
+  /**
+   * Follow the child pointers for searchKey from the root down to the node
+   * at level (0 for the leaves), moving right past splits.
+   * @param searchKey[IN] the key to find; NULL to go down to the last node
+   * @param level[IN] the level to stop at
+   * @param pid[OUT] the PageId of the node reached; 0 if the index is empty
+   * @param path[OUT] if not NULL, the node passed on every level, by level
+   * @return error code. 0 if no error
+   */
+  RC findNode(const KeyType* searchKey, int level, PageId& pid, std::vector<PageId>* path = NULL, const BTreeSnapshot* snapshot = NULL);
+
+  /**
+   * Follow the child pointers for searchKey from the root down to a leaf,
+   * and read the leaf.
+   * @param searchKey[IN] the key to find; NULL to go down to the last leaf
+   * @param pid[OUT] the PageId of the leaf where searchKey belongs; 0 if the index is empty
+   * @param leaf[OUT] the leaf
+   * @param path[OUT] if not NULL, the node passed on every level, by level
+   *                  (path[0] is a leaf, the last one is the root)
+   * @param snapshot[IN] the version to look in; NULL for the current one
+   * @param pending[OUT] if not NULL, the buffered inserts on their way to the
+   *                     leaf (see findPending()), read together with the leaf
+   * @return error code. 0 if no error
+   */
+  RC findLeaf(const KeyType* searchKey, PageId& pid, BTLeafNodeT<KeyType>& leaf, std::vector<PageId>* path = NULL,
+              const BTreeSnapshot* snapshot = NULL, std::vector< IndexEntry<KeyType> >* pending = NULL);
+
+  /**
+   * Go down to the leaf of searchKey like findLeaf(), in the current version,
+   * checking the version of every node passed, and starting over from the
+   * root when one changed (see OPTIMISTIC_READS).
+   * @return error code. 0 if no error
+   */
+  RC findLeafOptimistic(const KeyType* searchKey, PageId& pid, BTLeafNodeT<KeyType>& leaf, std::vector<PageId>* path);
+
+  /**
+   * Follow the child pointers from the root of snapshot down to the leaf
+   * with the keys right in front of key.
+   * @param key[IN] the key whose predecessor is looked up
+   * @param snapshot[IN] the version to look in; NULL for the current one
+   * @param pid[OUT] the PageId of the leaf
+   * @return error code. 0 if no error
+   */
+  RC findLeafBefore(const KeyType& key, const BTreeSnapshot* snapshot, PageId& pid);
+
+  /**
+   * Find the leaf behind (in front of) leaf. The sibling pointers of the leaf
+   * are followed, except in a copy-on-write index: there the leaf behind is
+   * found by looking up the high key of leaf, and the leaf in front by
+   * looking up the keys in front of its first key.
+   * @param leaf[IN] the leaf
+   * @param pid[OUT] the PageId of the next (previous) leaf; 0 if there is none
+   * @param snapshot[IN] the version to look in; NULL for the current one
+   * @return error code. 0 if no error
+   */
+  RC nextLeafPtr(BTLeafNodeT<KeyType>& leaf, PageId& pid, const BTreeSnapshot* snapshot);
+  RC prevLeafPtr(BTLeafNodeT<KeyType>& leaf, PageId& pid, const BTreeSnapshot* snapshot);
+
+  /**
+   * Replace the leaf at pid by the leaf behind it (dir > 0) or in front of it (dir < 0).
+   * @param dir[IN] the direction to move in
+   * @param pid[IN/OUT] the PageId of the leaf; 0 past either end
+   * @param leaf[IN/OUT] the leaf
+   * @param snapshot[IN] the version to look in; NULL for the current one
+   * @param pending[OUT] if not NULL, the buffered inserts on their way to the
+   *                     new leaf (see findPending()), read together with it
+   * @return error code. 0 if no error
+   */
+  RC readSiblingLeaf(int dir, PageId& pid, BTLeafNodeT<KeyType>& leaf, const BTreeSnapshot* snapshot,
+                     std::vector< IndexEntry<KeyType> >* pending = NULL);
+
+  /**
+   * Lock the leaf (non-leaf node) that key belongs to, starting from the one
+   * at pid and moving right past the splits since pid was read.
+   * @param key[IN] the key to insert
+   * @param pid[IN/OUT] the node to start from; the node locked
+   * @param leaf[OUT] the locked node
+   * @return error code. 0 if no error
+   */
+  RC lockLeaf(const KeyType& key, PageId& pid, BTLeafNodeT<KeyType>& leaf);
+  RC lockInner(const KeyType& key, PageId& pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * Insert (key, rid) into the locked leaf, unless the leaf has to be split.
+   * The leaf is not written: dirty is set if it changed.
+   * @return error code. 0 if no error. RC_NODE_FULL if the leaf has to be
+   *         split; the leaf is not changed then
+   */
+  RC insertIntoLeaf(BTLeafNodeT<KeyType>& leaf, const KeyType& key, const RecordId& rid, bool& dirty);
+
+  /**
+   * Insert (key, RecordId) pairs sorted by key. The pairs that go into the
+   * same leaf are inserted together, and the leaf is written once for them
+   * (and again after a split).
+   * @param entries[IN] the pairs
+   * @param count[IN] the number of pairs
+   * @return error code. 0 if no error
+   */
+  RC insertSorted(const IndexEntry<KeyType>* entries, int count);
+
+  /**
+   * Count the entries inserted under the locked node at childPid in every
+   * node above it (with entry counts on), and pass the first key of a new
+   * node that split off it up to the parent level, and on up until a node
+   * has room for it. Each node is unlocked once its parent is written.
+   * @param path[IN] the nodes passed on the way down to the child (see findNode())
+   * @param level[IN] the level of the parent
+   * @param key[IN] a key of the entries inserted
+   * @param added[IN] the number of entries inserted
+   * @param childPid[IN] the locked child
+   * @param splitKey[IN] the first key of the new node
+   * @param splitPid[IN] the PageId of the new node; -1 if none
+   * @param splitCount[IN] the number of entries under the new node
+   * @return error code. 0 if no error
+   */
+  RC insertParent(const std::vector<PageId>& path, int level, const KeyType& key, int added,
+                  PageId childPid, KeyType splitKey, PageId splitPid, int splitCount);
+
+  /**
+   * Add an insert to the statistics.
+   * @param key[IN] the key inserted
+   * @param entries[IN] the number of RecordIds inserted
+   * @param newKey[IN] true if the index did not have key
+   * @param leafEntries[IN] the change in the number of entries in the leaves
+   * @param leaves[IN] the number of new leaves
+   */
+  void addStatistics(const KeyType& key, int entries, bool newKey, int leafEntries, int leaves);
+
+  /**
+   * Count the RecordIds of the entries of leaf from first up to last,
+   * including every RecordId of a posting list.
+   * @return error code. 0 if no error
+   */
+  RC countRids(BTLeafNodeT<KeyType>& leaf, int first, int last, int& count);
+
+  /**
+   * Count the entries under the node at pid on level (0 for a leaf).
+   * @return error code. 0 if no error
+   */
+  RC countNode(PageId pid, int level, int& count);
+
+  /**
+   * Count the entries with a key smaller than key (or, if inclusive, not
+   * greater than it) on the way down to its leaf; every entry if key is NULL.
+   * @return error code. 0 if no error
+   */
+  RC countBelow(const KeyType* key, bool inclusive, int& count, const BTreeSnapshot* snapshot);
+
+  /**
+   * Count the entries with a key in a range like countRange(), from the
+   * leaves alone, for when the entry counts are stale: reads every leaf
+   * of the range (from the first leaf if lo is NULL).
+   * @return error code. 0 if no error
+   */
+  RC countLeaves(const KeyType* lo, bool loInclusive, const KeyType* hi, bool hiInclusive,
+                 int& count, const BTreeSnapshot* snapshot);
+
+  /**
+   * Count the entries under the node at pid on level again, and write the
+   * non-leaf nodes below (and at) pid whose counts change.
+   * @param count[OUT] the number of entries under the node
+   * @return error code. 0 if no error
+   */
+  RC recountNode(PageId pid, int level, int& count);
+
+  /**
+   * Insert (key, rid) into the buffer of the root of a buffered index,
+   * and move inserts down from the buffers that fill up.
+   * @return error code. 0 if no error
+   */
+  RC insertBuffered(const KeyType& key, const RecordId& rid);
+
+  /**
+   * Move the inserts for one child at a time out of the buffer of the
+   * non-leaf node at pid, until it holds no more than BUFFER_CAPACITY
+   * (or, if all, none at all). Needs bufferMutex.
+   * @param pid[IN] the node
+   * @param level[IN] the level of the node
+   * @param all[IN] true to empty the buffer
+   * @return error code. 0 if no error
+   */
+  RC flushBuffer(PageId pid, int level, bool all);
+
+  /**
+   * Move the inserts for keys from midKey on out of the buffer of the node at
+   * pid, into the buffer of the node at newPid that split off it. Needs bufferMutex.
+   */
+  void splitBuffer(PageId pid, const KeyType& midKey, PageId newPid);
+
+  /**
+   * Append the (key, RecordId) pairs for key waiting in the buffers on the
+   * way down to its leaf to matches. Needs bufferMutex.
+   * @return error code. 0 if no error
+   */
+  RC findBuffered(const KeyType& key, std::vector< IndexEntry<KeyType> >& matches);
+
+  /**
+   * Collect the buffered inserts that go to the leaf at pid, from the
+   * buffers on the way down to it. Needs bufferMutex.
+   * @param pid[IN] the PageId of the leaf
+   * @param leaf[IN] the leaf
+   * @param pending[OUT] the inserts, sorted
+   * @return error code. 0 if no error
+   */
+  RC findPending(PageId pid, BTLeafNodeT<KeyType>& leaf, std::vector< IndexEntry<KeyType> >& pending);
+
+  /**
+   * Count the buffered inserts with a key smaller than key (or, if inclusive,
+   * not greater than it); every one if key is NULL. Needs bufferMutex.
+   */
+  int countBuffered(const KeyType* key, bool inclusive);
+
+  /**
+   * Insert every buffered insert into the leaves and drop the insert log.
+   * Needs writeMutex and bufferMutex.
+   * @return error code. 0 if no error
+   */
+  RC emptyBuffers();
+
+  /**
+   * Append an insert to the last page of the insert log, and write the
+   * page if it is full. Needs bufferMutex.
+   * @return error code. 0 if no error
+   */
+  RC logInsert(const IndexEntry<KeyType>& entry);
+
+  /**
+   * Write the last page of the insert log if it has inserts not written yet,
+   * and link to it if it is new. Needs bufferMutex.
+   * @return error code. 0 if no error
+   */
+  RC writeLog();
+
+  /**
+   * Drop the insert log from page 0 and free its pages, once every buffer
+   * is empty. Needs bufferMutex.
+   * @return error code. 0 if no error
+   */
+  RC clearLog();
+
+  /**
+   * Read the insert log starting at pid, and put the inserts in it that are
+   * not in a leaf into the buffer of the root. Needs the index to itself.
+   * @return error code. 0 if no error
+   */
+  RC readLog(PageId pid);
+
+  /**
+   * Insert (key, rid) into the full, locked leaf at pid by splitting it.
+   * The new leaf is written before the leaf that links to it. The leaf
+   * behind it is locked while its previous leaf pointer is updated.
+   * @param splitKey[OUT] the first key of the new leaf
+   * @param splitPid[OUT] the PageId of the new leaf
+   * @return error code. 0 if no error
+   */
+  RC splitLeaf(BTLeafNodeT<KeyType>& leaf, PageId pid, const KeyType& key, const RecordId& rid, KeyType& splitKey, PageId& splitPid);
+
+  /**
+   * Read the leaf in front of the leaf at pid. A split may have put a new
+   * leaf between the two since the prev pointer was read, so the leaves are
+   * followed forward until the one whose next leaf is pid.
+   * @param prevPid[IN/OUT] the prev pointer of the leaf at pid; the PageId of the leaf read
+   * @param pid[IN] the leaf to go back from
+   * @param leaf[OUT] the leaf in front of it
+   * @return error code. 0 if no error
+   */
+  RC readPrevLeaf(PageId& prevPid, PageId pid, BTLeafNodeT<KeyType>& leaf);
+
+  /**
+   * Reserve a new page at the end of the file for a node or a posting page.
+   * @return the PageId of the page
+   */
+  PageId allocatePage();
+
+  /**
+   * Build page 0: the metadata, followed by the statistics.
+   * @param page[OUT] the page
+   */
+  void packMetadata(char* page);
+
+  /**
+   * Leave page 0 and the non-leaf nodes in memory, in closedIndexes, for
+   * the next open() of the file. Nothing is left if the file was opened for
+   * writing since open(), or, for an index open for reading, if the file
+   * changed since open().
+   * @param stamp[IN] the stamp of the file, as close() leaves it
+   */
+  void keepClosedIndex(const FileStamp& stamp);
+
+  /**
+   * Copy the non-leaf node at pid from memory (reading it if it is not there).
+   * @param pid[IN] the PageId of the node
+   * @param node[OUT] the node
+   * @return error code. 0 if no error
+   */
+  RC readInner(PageId pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * Find the child-node pointer to follow for searchKey in the non-leaf node
+   * at pid, without copying the node out of memory, moving right past splits.
+   * @param pid[IN/OUT] the PageId of the node; the node searchKey belongs to
+   * @param searchKey[IN] the key to find; NULL for the last child
+   * @param childPid[OUT] the pointer to the child node to follow
+   * @return error code. 0 if no error
+   */
+  RC readChildPtr(PageId& pid, const KeyType* searchKey, PageId& childPid);
+
+  /**
+   * Write the non-leaf node to pid, and to memory.
+   * @param pid[IN] the PageId to write to
+   * @param node[IN] the node
+   * @return error code. 0 if no error
+   */
+  RC writeInner(PageId pid, BTNonLeafNodeT<KeyType>& node);
+
+  /**
+   * Bulk load helpers: add the entries of one key to the leaf being filled,
+   * and write the leaf and start the next one.
+   */
+  RC bulkFlushRun();
+  RC bulkAddEntries(const KeyType& key, const RecordId* rids, int count);
+  RC bulkNextLeaf(const KeyType& firstKey);
+
+  /// State of a bulk load
+  bool bulkActive;                       /// true between beginBulkLoad() and endBulkLoad()
+  double bulkFill;                       /// the fill factor of the nodes
+  BTLeafNodeT<KeyType> bulkLeaf;         /// the leaf being filled
+  PageId bulkLeafPid;                    /// its PageId; 0 before the first leaf
+  std::vector<KeyType> bulkLeafKeys;     /// the first key of every leaf written so far
+  std::vector<PageId> bulkLeafPids;      /// the PageId of every leaf written so far
+  std::vector<int> bulkLeafCounts;       /// the number of RecordIds in every leaf written so far
+  KeyType bulkRunKey;                    /// the key of the current run of equal keys
+  std::vector<RecordId> bulkRunRids;     /// its RecordIds, until it moves to a posting list
+  PageId bulkRunPosting;                 /// the first page of its posting list; 0 if none
+  int bulkRunCount;                      /// the number of RecordIds in the run
+
   PageFile pf;         /// the PageFile used to store the actual b+tree in disk
+  std::string indexName;                 /// the name of the index file
+  bool writable;                         /// true if the file is open for writing
+  FileStamp openStamp;              /// the file, as open() found it
+  unsigned long openWriters;             /// ClosedIndex::writers, as open() found it
+  std::map<PageId, BTNonLeafNodeT<KeyType> > innerNodes;  /// the non-leaf nodes read or written so far, by PageId
+  std::shared_mutex innerMutex;          /// guards innerNodes
+
+  /// What close() leaves in memory for the next open() of the same file
+  struct ClosedIndex {
+    bool valid;                          /// true if the rest holds the file stamp describes
+    FileStamp stamp;                /// the file, as close() left it
+    char metadata[PageFile::PAGE_SIZE];  /// page 0
+    std::map<PageId, BTNonLeafNodeT<KeyType> > innerNodes;  /// the non-leaf nodes
+    unsigned long writers;               /// the opens of the file for writing so far
+  };
+  static std::map<std::string, ClosedIndex> closedIndexes;  /// by name of the index file
+  static std::mutex closedMutex;         /// guards closedIndexes
+  PageVersions versions;                 /// the lock of every page; page 0 guards rootPid and treeHeight
+  bool copyOnWrite;                      /// true in copy-on-write mode
+  std::mutex writeMutex;                 /// lets one copy-on-write or buffered insert run at a time
+  std::vector<PageId> replacedPages;     /// the pages the copy-on-write insert in progress replaces
+  std::mutex snapshotMutex;              /// guards the snapshot state below
+  unsigned long long publishedVersion;   /// the version of the current root
+  std::map<unsigned long long, int> openSnapshots;  /// the number of snapshots open on every version
+  std::vector< std::pair<unsigned long long, PageId> > retiredPages;  /// replaced pages, with the first version without them
+  std::vector<PageId> freePages;         /// pages no version uses any more, for allocatePage() (guarded by allocMutex)
+  PageId freeListPid;                    /// the first page of the list of free pages in the file; 0 if none
+  std::mutex allocMutex;                 /// guards nextFreePid
+  BTreeStatistics<KeyType> stats;        /// the statistics, written to page 0 with the metadata
+  std::mutex statsMutex;                 /// guards stats
 
-  PageId   rootPid;    /// the PageId of the root node
-  int      treeHeight; /// the height of the tree
+  /// The buffer of a non-leaf node in buffered mode
+  struct MessageBuffer {
+    int level;                                     /// the level of the node
+    std::vector< IndexEntry<KeyType> > messages;   /// the inserts, sorted
+  };
+  bool buffered;                         /// true in buffered mode
+  bool entryCounts;                      /// true if every insert updates the entry counts
+  std::atomic<bool> countsStale;         /// true once an insert has left the entry counts behind
+  int readMode;                          /// B_LINK_READS or OPTIMISTIC_READS
+  std::atomic<unsigned long long> readRestarts;  /// the optimistic descents started over
+  std::map<PageId, MessageBuffer> buffers;  /// the buffers that are not empty, by PageId of the node
+  std::mutex bufferMutex;                /// guards buffers and the insert log
+  std::vector<PageId> logPages;          /// the pages of the insert log linked from page 0, in order
+  char logPage[PageFile::PAGE_SIZE];     /// the last page of the insert log
+  PageId logPagePid;                     /// its PageId; 0 if the log is empty
+  bool logLinked;                        /// true once it is written and in logPages
+  bool logDirty;                         /// true if it has inserts not written yet
+  PageId nextFreePid;                    /// the page allocatePage() returns next, unless the file is longer
+
+  std::atomic<PageId> rootPid;    /// the PageId of the root node
+  std::atomic<int>    treeHeight; /// the height of the tree
   /// Note that the content of the above two variables will be gone when
   /// this class is destructed. Make sure to store the values of the two 
   /// variables in disk, so that they can be reconstructed when the index
@@ -119,4 +968,187 @@ class BTreeIndex {
   char buffer[PageFile::PAGE_SIZE];
 };
 
+typedef BTreeIndexT<int> BTreeIndex;
+
+/**
+ * A cursor over the (key, RecordId) pairs of a BTreeIndexT in key order.
+ * readForward() reads the leaf of its IndexCursor again for every entry;
+ * the cursor keeps the current leaf (and posting page) in memory instead,
+ * and reads a page only when it moves past the end of the one it holds.
+ * The index must stay open while the cursor is used. Other threads may
+ * insert meanwhile: every leaf is read whole, so each entry is returned at
+ * most once, but an entry inserted after the cursor read its leaf may be missed.
+ * In a copy-on-write index, every seek opens a snapshot, and the cursor
+ * reads that version only, until the next seek or until it is destroyed.
+ * In a buffered index, the cursor reads the inserts on their way to a leaf
+ * with the leaf, and merges them with its entries: an insert that has not
+ * reached its leaf yet comes after the entries of the leaf with its key.
+ */
+template <class KeyType>
+class BTreeCursorT {
+ public:
+  BTreeCursorT(BTreeIndexT<KeyType>& index);
+  ~BTreeCursorT();
+
+  /**
+   * Move the cursor to the first entry with a key not smaller than searchKey.
+   * @param searchKey[IN] the key to find
+   * @return 0 if searchKey is found. RC_NO_SUCH_RECORD if not (the cursor is
+   *         then at the first greater key, or past the end). Otherwise an error code
+   */
+  RC seek(const KeyType& searchKey);
+
+  /**
+   * Move the cursor to the last entry with a key smaller than searchKey
+   * (or, if inclusive, not greater than it), to scan backward with prev().
+   * @param searchKey[IN] the upper bound
+   * @param inclusive[IN] true to also accept searchKey itself
+   * @return 0 if the entry has searchKey. RC_NO_SUCH_RECORD if not (the cursor is
+   *         then at the first smaller key, or in front of the first entry).
+   *         Otherwise an error code
+   */
+  RC seekBefore(const KeyType& searchKey, bool inclusive);
+
+  /**
+   * Move the cursor to the entry with the largest key.
+   * @return error code. 0 if no error
+   */
+  RC seekLast();
+
+  /**
+   * Read the (key, rid) pair at the cursor without moving it.
+   * @param key[OUT] the key at the cursor
+   * @param rid[OUT] the RecordId at the cursor
+   * @return error code. 0 if no error. RC_END_OF_TREE past the last entry,
+   *         RC_INVALID_CURSOR before the first seek()
+   */
+  RC peek(KeyType& key, RecordId& rid);
+
+  /**
+   * Read the (key, rid) pair at the cursor and move the cursor to the next one.
+   * The RecordIds of a key kept in a posting list are returned one at a time.
+   * @param key[OUT] the key at the cursor
+   * @param rid[OUT] the RecordId at the cursor
+   * @return error code. 0 if no error. RC_END_OF_TREE past the last entry,
+   *         RC_INVALID_CURSOR before the first seek()
+   */
+  RC next(KeyType& key, RecordId& rid);
+
+  /**
+   * Read the (key, rid) pair at the cursor and move the cursor to the previous one.
+   * A scan in descending key order reads the same pages as one in ascending order.
+   * The RecordIds of a key kept in a posting list come in the order of the list.
+   * @param key[OUT] the key at the cursor
+   * @param rid[OUT] the RecordId at the cursor
+   * @return error code. 0 if no error. RC_END_OF_TREE in front of the first entry,
+   *         RC_INVALID_CURSOR before the first seek()
+   */
+  RC prev(KeyType& key, RecordId& rid);
+
+  /**
+   * Read the next (key, RecordId) pairs up to the upper bound hi into out,
+   * at most max of them, and move the cursor past them. The bound is checked
+   * once per leaf, by finding the end of the range in the leaf with a single
+   * search; the entries in front of it are copied without comparing keys.
+   * Fewer than max pairs are returned only when the range (or the index) ends,
+   * so a scan calls scanBatch() until count < max.
+   * @param hi[IN] the upper bound of the keys
+   * @param inclusive[IN] true if keys equal to hi are in the range
+   * @param out[OUT] the array to fill
+   * @param max[IN] the size of out
+   * @param count[OUT] the number of pairs stored in out
+   * @return error code. 0 if no error. RC_INVALID_CURSOR before the first seek()
+   */
+  RC scanBatch(const KeyType& hi, bool inclusive, IndexEntry<KeyType>* out, int max, int& count);
+
+  /**
+   * Count the (key, RecordId) pairs up to the upper bound hi, and move the
+   * cursor past them. The entries of a leaf in the range are counted by
+   * subtracting positions in the leaf; only the posting lists in the range
+   * are visited, and only their pages are read (not their RecordIds).
+   * @param hi[IN] the upper bound of the keys
+   * @param inclusive[IN] true if keys equal to hi are in the range
+   * @param count[OUT] the number of pairs
+   * @return error code. 0 if no error. RC_INVALID_CURSOR before the first seek()
+   */
+  RC countRange(const KeyType& hi, bool inclusive, int& count);
+
+ private:
+  /**
+   * Step past the current entry if next() or prev() returned it, then read
+   * the entry at pos, crossing to the neighbour leaf when pos is outside of its leaf.
+   */
+  RC load();
+
+  /**
+   * Choose the entry at pos among the leaf and the pending inserts (the first
+   * one in front of neither pos.eid nor pend for dir >= 0; the last one in
+   * front of them for dir < 0), crossing to the neighbour leaf while there
+   * is none, and read it.
+   */
+  RC settle(int dir);
+
+  /**
+   * Read the entry chosen by settle() into curKey and curRid.
+   */
+  RC readEntry();
+
+  /**
+   * @return the number of pending inserts with a key smaller than key
+   *         (or, if inclusive, not greater than it)
+   */
+  int pendingBelow(const KeyType& key, bool inclusive);
+
+  /**
+   * Open a snapshot of a copy-on-write index for the next seek, closing the previous one.
+   * @return the snapshot; NULL if the index is not in copy-on-write mode
+   */
+  const BTreeSnapshot* pin();
+
+  BTreeIndexT<KeyType>& index;
+  BTreeSnapshot snapshot;        /// the version the cursor reads, in a copy-on-write index
+  bool pinned;                   /// true while snapshot is open
+  IndexCursor pos;               /// the position in the tree; pos.pid is 0 past either end, -1 before seek()
+                                 /// pos.eid is the number of entries of the leaf in front of the current one
+  int step;                      /// 1 (-1) if next() (prev()) returned the entry at pos; move on before reading again
+
+  BTLeafNodeT<KeyType> leaf;     /// the leaf holding pos
+  PageId leafPid;                /// its PageId; 0 if none is read yet
+  std::vector< IndexEntry<KeyType> > pending;  /// the buffered inserts on their way to the leaf, sorted
+  int pend;                      /// the number of pending inserts in front of the current entry
+  bool onPending;                /// true if the current entry is pending[pend], not entry pos.eid of the leaf
+  BTPostingNode posting;         /// the posting page holding pos, when the entry has a posting list
+  PageId postingPid;             /// its PageId; 0 if none is read yet
+
+  KeyType curKey;                /// the entry at pos
+  RecordId curRid;
+
+  // Not copyable: the snapshot is closed once
+  BTreeCursorT(const BTreeCursorT&);
+  BTreeCursorT& operator=(const BTreeCursorT&);
+};
+
+typedef BTreeCursorT<int> BTreeCursor;
+
+/**
+ * The index on the value column of a table, <table>.vidx. A value is
+ * indexed by its first VALUE_PREFIX bytes, so the values of an entry
+ * must be read from the table to tell apart longer values with the same prefix.
+ */
+const int VALUE_PREFIX = 16;
+typedef FixedString<VALUE_PREFIX> ValueKey;
+typedef BTreeIndexT<ValueKey> ValueIndex;
+typedef BTreeCursorT<ValueKey> ValueCursor;
+
+/**
+ * The covering index of a table, <table>.cidx: a B+tree on the key and
+ * the first COVERED_VALUE bytes of the value, so that a range of tuples
+ * is read from its leaves instead of the table. Only the values that do
+ * not fit must be read from the table.
+ */
+const int COVERED_VALUE = 28;
+typedef KeyValue<COVERED_VALUE> CoveringKey;
+typedef BTreeIndexT<CoveringKey> CoveringIndex;
+typedef BTreeCursorT<CoveringKey> CoveringCursor;
+
 #endif /* BTREEINDEX_H */
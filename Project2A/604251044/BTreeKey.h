@@ -0,0 +1,196 @@
+/*
+* Copyright (C) 2008 by The Regents of the University of California
+* Redistribution of this file is permitted under the terms of the GNU
+* Public License (GPL).
+*/
+
+#ifndef BTREEKEY_H
+#define BTREEKEY_H
+
+#include <cstring>
+#include <string>
+#include <ostream>
+#include "KeySearch.h"
+
+/**
+* The key types a B+tree can be built on. A key is stored in a node as its
+* fixed-size in-memory image, so key types are plain structs without pointers.
+*/
+
+/**
+* FixedString<N>: a string of at most N bytes, zero padded.
+* Longer strings are cut at N bytes, so an index on them holds a prefix of the value.
+*/
+template <int N>
+struct FixedString {
+	char data[N];
+
+	FixedString() { memset(data, 0, N); }
+	FixedString(const char* s) { memset(data, 0, N); memcpy(data, s, strnlen(s, N)); }
+	FixedString(const std::string& s) { memset(data, 0, N); memcpy(data, s.data(), s.size() < (size_t)N ? s.size() : (size_t)N); }
+
+	std::string str() const { return std::string(data, strnlen(data, N)); }
+};
+
+/**
+* IntPair: a composite key of two ints, ordered by first, then by second.
+*/
+struct IntPair {
+	int first;
+	int second;
+
+	IntPair() : first(0), second(0) { }
+	IntPair(int f, int s) : first(f), second(s) { }
+};
+
+/**
+* KeyValue<N>: a key and the first N bytes of its value, ordered by key, then
+* by value. A covering index keeps the values of a table in its keys this way.
+*/
+template <int N>
+struct KeyValue {
+	int key;
+	FixedString<N> value;
+
+	KeyValue() : key(0) { }
+	KeyValue(int k, const std::string& v) : key(k), value(v) { }
+};
+
+template <int N>
+std::ostream& operator<<(std::ostream& os, const FixedString<N>& key) { return os << key.str(); }
+
+template <int N>
+std::ostream& operator<<(std::ostream& os, const KeyValue<N>& key)
+{
+	return os << "(" << key.key << "," << key.value.str() << ")";
+}
+
+inline std::ostream& operator<<(std::ostream& os, const IntPair& key)
+{
+	return os << "(" << key.first << "," << key.second << ")";
+}
+
+template <class KeyType>
+struct KeyTraits;
+
+/**
+* KeyTraitsBase<KeyType>: how the B+tree compares and searches keys of KeyType.
+* A key type gets its traits by specializing KeyTraits and overriding less()
+* and TYPE_ID; the rest is shared. Only int keys can be packed in a leaf
+* (see BTLeafNodeT), so the packing functions here are never reached.
+*/
+template <class KeyType>
+struct KeyTraitsBase {
+	// Whether a leaf may store the keys as 16-bit deltas from a base key
+	static const bool PACKABLE = false;
+
+	/**
+	* Count the keys smaller than (or, if inclusive, not greater than) key
+	* in an array of count sorted keys, with a branch-free binary search.
+	*/
+	static int countBelow(const char* keys, int count, const KeyType& key, bool inclusive);
+
+	static bool equal(const KeyType& a, const KeyType& b)
+	{
+		return !KeyTraits<KeyType>::less(a, b) && !KeyTraits<KeyType>::less(b, a);
+	}
+
+	static bool fitsDelta(int, const KeyType&) { return false; }
+	static int baseOf(const KeyType&) { return 0; }
+	static unsigned short deltaOf(int, const KeyType&) { return 0; }
+	static KeyType fromDelta(int, unsigned short) { return KeyType(); }
+	static int countDeltasBelow(const char*, int, int, const KeyType&, bool)
+	{
+		return 0;
+	}
+};
+
+template <>
+struct KeyTraits<int> : public KeyTraitsBase<int> {
+	static const int TYPE_ID = 1;
+	static const bool PACKABLE = true;
+
+	static bool less(int a, int b) { return a < b; }
+	static bool equal(int a, int b) { return a == b; }
+
+	// int keys are searched a block at a time with SIMD compares when the CPU has them
+	static int countBelow(const char* keys, int count, int key, bool inclusive)
+	{
+		return countKeysBelow(keys, count, key, inclusive);
+	}
+
+	static bool fitsDelta(int base, int key)
+	{
+		long long delta = (long long)key - base;
+		return delta >= 0 && delta <= 0xFFFF;
+	}
+	static int baseOf(int key) { return key; }
+	static unsigned short deltaOf(int base, int key) { return key - base; }
+	static int fromDelta(int base, unsigned short delta) { return base + delta; }
+	static int countDeltasBelow(const char* deltas, int count, int base, int key, bool inclusive)
+	{
+		return ::countDeltasBelow(deltas, count, base, key, inclusive);
+	}
+};
+
+template <>
+struct KeyTraits<long long> : public KeyTraitsBase<long long> {
+	static const int TYPE_ID = 2;
+
+	static bool less(long long a, long long b) { return a < b; }
+};
+
+template <int N>
+struct KeyTraits< FixedString<N> > : public KeyTraitsBase< FixedString<N> > {
+	static const int TYPE_ID = 3 | (N << 8);
+
+	static bool less(const FixedString<N>& a, const FixedString<N>& b)
+	{
+		return memcmp(a.data, b.data, N) < 0;
+	}
+};
+
+template <>
+struct KeyTraits<IntPair> : public KeyTraitsBase<IntPair> {
+	static const int TYPE_ID = 4;
+
+	static bool less(const IntPair& a, const IntPair& b)
+	{
+		return a.first < b.first || (a.first == b.first && a.second < b.second);
+	}
+};
+
+template <int N>
+struct KeyTraits< KeyValue<N> > : public KeyTraitsBase< KeyValue<N> > {
+	static const int TYPE_ID = 5 | (N << 8);
+
+	static bool less(const KeyValue<N>& a, const KeyValue<N>& b)
+	{
+		return a.key < b.key || (a.key == b.key && memcmp(a.value.data, b.value.data, N) < 0);
+	}
+};
+
+template <class KeyType>
+int KeyTraitsBase<KeyType>::countBelow(const char* keys, int count, const KeyType& key, bool inclusive)
+{
+	if (count == 0) return 0;
+
+	// lo advances by half when the key in front of the upper half is still below key;
+	// the mask keeps the comparison result out of the branches
+	int lo = 0;
+	int n = count;
+	KeyType k;
+	while (n > 1) {
+		int half = n / 2;
+		memcpy(&k, keys + (lo + half - 1) * sizeof(KeyType), sizeof(KeyType));
+		bool below = inclusive ? !KeyTraits<KeyType>::less(key, k) : KeyTraits<KeyType>::less(k, key);
+		lo += half & -(int)below;
+		n -= half;
+	}
+
+	memcpy(&k, keys + lo * sizeof(KeyType), sizeof(KeyType));
+	bool below = inclusive ? !KeyTraits<KeyType>::less(key, k) : KeyTraits<KeyType>::less(k, key);
+	return lo + below;
+}
+
+#endif /* BTREEKEY_H */
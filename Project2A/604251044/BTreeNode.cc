@@ -1,16 +1,17 @@
 #include "BTreeNode.h"
+#include "KeySearch.h"
 #include <iostream>
 #include <cstring>
-#include <cstdlib>
 
 using namespace std;
 
 /**
 * Constructor: initialize empty leaf node
 */
-BTLeafNode::BTLeafNode()
+template <class KeyType>
+BTLeafNodeT<KeyType>::BTLeafNodeT()
 {
-	m_numKeys = 0;
+	// An all-zero page is an empty node: key count 0 and no next sibling
 	memset(buffer, 0, sizeof(buffer));
 }
 
@@ -20,7 +21,8 @@ BTLeafNode::BTLeafNode()
 * @param pf[IN] PageFile to read from
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTLeafNode::read(PageId pid, const PageFile& pf)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::read(PageId pid, const PageFile& pf)
 {
 	RC rc;
 
@@ -36,7 +38,8 @@ RC BTLeafNode::read(PageId pid, const PageFile& pf)
 * @param pf[IN] PageFile to write to
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTLeafNode::write(PageId pid, PageFile& pf)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::write(PageId pid, PageFile& pf)
 {
 	RC rc;
 
@@ -50,98 +53,275 @@ RC BTLeafNode::write(PageId pid, PageFile& pf)
 * Return the number of keys stored in the node.
 * @return the number of keys in the node
 */
-int BTLeafNode::getKeyCount()
+template <class KeyType>
+int BTLeafNodeT<KeyType>::getKeyCount()
 {
-	int keyCount = 0;
-	int kvPairSize = sizeof(int) + sizeof(RecordId);
-	char * tempBuffer = buffer;
+	short keyCount;
 
-	// Each key-RecordId pair is 12 bytes
-	// Max number of keys: 80; Max key-value pair byte usage: 80*12=960
-	// Largest possible index of pair to be inserted: 960-12=948
-	// Loop through the buffer to check the number of keys
-	for (int n = 0; n <= 948; n += kvPairSize)
+	// The key count is kept in the node header
+	memcpy(&keyCount, buffer + offsetof(BTLeafHeader, keyCount), sizeof(short));
+
+	return keyCount;
+}
+
+/*
+* Store the number of keys in the node header.
+* @param count[IN] the new number of keys
+*/
+template <class KeyType>
+void BTLeafNodeT<KeyType>::setKeyCount(int count)
+{
+	short keyCount = count;
+	memcpy(buffer + offsetof(BTLeafHeader, keyCount), &keyCount, sizeof(short));
+}
+
+/*
+* Return the format of the node (PLAIN or PACKED).
+*/
+template <class KeyType>
+short BTLeafNodeT<KeyType>::getFormat()
+{
+	short format;
+	memcpy(&format, buffer + offsetof(BTLeafHeader, format), sizeof(short));
+	return format;
+}
+
+/*
+* Decode the key of the eid-th entry.
+*/
+template <class KeyType>
+KeyType BTLeafNodeT<KeyType>::keyAt(int eid)
+{
+	if (getFormat() == PACKED)
 	{
-		// Check if the nth key is valid and not null (== 0), meaning it was not empty
-		int nKey;
-		memcpy(&nKey, tempBuffer, sizeof(int));
-		if (nKey == 0)
-			break;
-
-		// Increment key count for every valid key and iterate to next key-value pair
-		keyCount++;
-		tempBuffer += kvPairSize;
+		int baseKey;
+		unsigned short delta;
+		memcpy(&baseKey, buffer + offsetof(BTLeafHeader, baseKey), sizeof(int));
+		memcpy(&delta, buffer + KEYS_OFFSET + eid * sizeof(unsigned short), sizeof(unsigned short));
+		return KeyTraits<KeyType>::fromDelta(baseKey, delta);
 	}
 
-	return keyCount;
+	KeyType key;
+	memcpy(&key, buffer + KEYS_OFFSET + eid * sizeof(KeyType), sizeof(KeyType));
+	return key;
 }
 
 /*
-* Insert a (key, rid) pair to the node.
-* @param key[IN] the key to insert
-* @param rid[IN] the RecordId to insert
-* @return 0 if successful. Return an error code if the node is full.
+* Decode the rid of the eid-th entry.
 */
-RC BTLeafNode::insert(int key, const RecordId& rid)
+template <class KeyType>
+void BTLeafNodeT<KeyType>::ridAt(int eid, RecordId& rid)
 {
-	RC rc;
-	PageId nextNode = getNextNodePtr();
-	int kvPairSize = sizeof(int) + sizeof(RecordId);
-	int maxKVPairs = 80;
+	if (getFormat() == PACKED)
+	{
+		PageId basePid;
+		unsigned int packed;
+		memcpy(&basePid, buffer + offsetof(BTLeafHeader, basePid), sizeof(PageId));
+		memcpy(&packed, buffer + PACKED_RIDS_OFFSET + eid * sizeof(unsigned int), sizeof(unsigned int));
+		rid.pid = basePid + (PageId)(packed >> SID_BITS);
+		rid.sid = packed & ((1 << SID_BITS) - 1);
+		return;
+	}
 
-	// If adding one more key-rid pair overflows the node's max capacity (80 pairs)
-	// return that the node is full
-	if (getKeyCount() + 1 > maxKVPairs)
+	memcpy(&rid, buffer + RIDS_OFFSET + eid * sizeof(RecordId), sizeof(RecordId));
+}
+
+/*
+* Decode all of the entries into keys and rids.
+*/
+template <class KeyType>
+void BTLeafNodeT<KeyType>::decodeAll(KeyType* keys, RecordId* rids)
+{
+	int keyCount = getKeyCount();
+
+	if (getFormat() == PLAIN)
 	{
-		rc = RC_NODE_FULL;
+		memcpy(keys, buffer + KEYS_OFFSET, keyCount * sizeof(KeyType));
+		memcpy(rids, buffer + RIDS_OFFSET, keyCount * sizeof(RecordId));
+		return;
 	}
-	else
+
+	for (int i = 0; i < keyCount; i++)
+	{
+		keys[i] = keyAt(i);
+		ridAt(i, rids[i]);
+	}
+}
+
+/*
+* Check whether the count sorted (key, rid) pairs can be stored in the PACKED format:
+* the keys must span at most MAX_KEY_DELTA, the pids at most MAX_PID_DELTA
+* and every sid must fit in SID_BITS.
+*/
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::canPack(const KeyType* keys, const RecordId* rids, int count)
+{
+	if (!KeyTraits<KeyType>::PACKABLE || count > MAX_PACKED_KEYS)
+		return false;
+	if (count == 0)
+		return true;
+
+	int baseKey = KeyTraits<KeyType>::baseOf(keys[0]);
+	if (!KeyTraits<KeyType>::fitsDelta(baseKey, keys[count - 1]))
+		return false;
+
+	PageId minPid = rids[0].pid;
+	PageId maxPid = rids[0].pid;
+	for (int i = 0; i < count; i++)
 	{
-		// Check where to insert the key-rid pair into the node
-		char * tempBuffer = buffer;
+		if (rids[i].sid < 0 || rids[i].sid >= (1 << SID_BITS))
+			return false;
+		if (rids[i].pid < minPid) minPid = rids[i].pid;
+		if (rids[i].pid > maxPid) maxPid = rids[i].pid;
+	}
 
-		int idx;
-		for (idx = 0; idx < 948; idx += kvPairSize)
-		{
-			int nKey;
-			memcpy(&nKey, tempBuffer, sizeof(int));
+	return (long long)maxPid - minPid <= MAX_PID_DELTA;
+}
+
+/*
+* Check whether the count sorted (key, rid) pairs fit in a node in any format.
+*/
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::fits(const KeyType* keys, const RecordId* rids, int count)
+{
+	return count <= MAX_KEYS || canPack(keys, rids, count);
+}
 
-			// Check if the key is less than one of the node's keys or if the node's key is empty
-			// the index will be where to insert the key-value pair after shifting everything over 
-			if (nKey == 0 || key <= nKey)
-				break;
+/*
+* Replace the entries of the node with the count sorted (key, rid) pairs,
+* packed if they can be, plain otherwise. The sibling pointers are kept.
+* @return 0 if successful. RC_NODE_FULL if the entries do not fit in any format.
+*/
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::store(const KeyType* keys, const RecordId* rids, int count)
+{
+	PageId nextPid = getNextNodePtr();
+	PageId prevPid = getPrevNodePtr();
+	char highKey[sizeof(KeyType)];
+	memcpy(highKey, buffer + HIGH_KEY_OFFSET, sizeof(KeyType));
+	BTLeafHeader header;
+
+	// Prefer the packed format, it leaves room for twice as many entries
+	// (a node that cannot be packed is stored plain and packed again once it fills up)
+	if (canPack(keys, rids, count))
+	{
+		header.format = PACKED;
+		header.baseKey = count > 0 ? KeyTraits<KeyType>::baseOf(keys[0]) : 0;
+		header.basePid = count > 0 ? rids[0].pid : 0;
+		for (int i = 0; i < count; i++)
+			if (rids[i].pid < header.basePid) header.basePid = rids[i].pid;
+	}
+	else if (count <= MAX_KEYS)
+	{
+		header.format = PLAIN;
+		header.baseKey = 0;
+		header.basePid = 0;
+	}
+	else
+	{
+		return RC_NODE_FULL;
+	}
+
+	// Clear the node and write the header and the entries
+	memset(buffer, 0, sizeof(buffer));
+	header.keyCount = count;
+	header.nextPid = nextPid;
+	header.prevPid = prevPid;
+	memcpy(buffer, &header, sizeof(header));
+	memcpy(buffer + HIGH_KEY_OFFSET, highKey, sizeof(KeyType));
 
-			tempBuffer += kvPairSize;
+	if (header.format == PLAIN)
+	{
+		memcpy(buffer + KEYS_OFFSET, keys, count * sizeof(KeyType));
+		memcpy(buffer + RIDS_OFFSET, rids, count * sizeof(RecordId));
+	}
+	else
+	{
+		for (int i = 0; i < count; i++)
+		{
+			unsigned short delta = KeyTraits<KeyType>::deltaOf(header.baseKey, keys[i]);
+			unsigned int packed = ((unsigned int)(rids[i].pid - header.basePid) << SID_BITS) | rids[i].sid;
+			memcpy(buffer + KEYS_OFFSET + i * sizeof(unsigned short), &delta, sizeof(unsigned short));
+			memcpy(buffer + PACKED_RIDS_OFFSET + i * sizeof(unsigned int), &packed, sizeof(unsigned int));
 		}
+	}
 
-		// After finding the index location (idx) to insert the key-rid pair
-		// let's use another buffer to shift everything over
-		char * insertBuffer = (char *)malloc(PageFile::PAGE_SIZE);
-		memset(insertBuffer, 0, PageFile::PAGE_SIZE);
+	return 0;
+}
 
-		// Make sure the insertBuffer has all the values up until the index insert location
-		memcpy(insertBuffer, buffer, idx);
+/*
+* Insert a (key, rid) pair to the node.
+* @param key[IN] the key to insert
+* @param rid[IN] the RecordId to insert
+* @return 0 if successful. Return an error code if the node is full.
+*/
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::insert(const KeyType& key, const RecordId& rid)
+{
+	int keyCount = getKeyCount();
+	short format = getFormat();
 
-		// Insert key-value pair into proper index location
-		memcpy(insertBuffer + idx, &key, sizeof(int));
-		memcpy(insertBuffer + idx + sizeof(int), &rid, sizeof(RecordId));
+	// Check where to insert the key-rid pair into the node:
+	// in front of the first key that is greater than or equal to it
+	if (format == PLAIN && keyCount < MAX_KEYS)
+	{
+		int idx = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, keyCount, key, false);
+		char * keys = buffer + KEYS_OFFSET + idx * sizeof(KeyType);
+		char * rids = buffer + RIDS_OFFSET + idx * sizeof(RecordId);
 
-		// Copy the rest of the values after the index insert location to shift everything over
-		// Also put in the nextNode in the last four bytes of the insertBuffer
-		memcpy(insertBuffer + idx + kvPairSize, buffer + idx, getKeyCount() * kvPairSize - idx);
-		memcpy(insertBuffer + PageFile::PAGE_SIZE - sizeof(PageId), &nextNode, sizeof(PageId));
+		// Shift the keys and rids from idx on over by one entry in place
+		// (the arrays have room for MAX_KEYS entries, so the last one stays inside its array)
+		memmove(keys + sizeof(KeyType), keys, (keyCount - idx) * sizeof(KeyType));
+		memmove(rids + sizeof(RecordId), rids, (keyCount - idx) * sizeof(RecordId));
 
-		// Update the old buffer to the insertBuffer with properly inserted key-rid pair
-		// Deallocate the buffer that aided the insertion
-		memcpy(buffer, insertBuffer, PageFile::PAGE_SIZE);
-		free(insertBuffer);
+		// Insert the key and the rid into the gap
+		memcpy(keys, &key, sizeof(KeyType));
+		memcpy(rids, &rid, sizeof(RecordId));
 
+		setKeyCount(keyCount + 1);
+		return 0;
+	}
 
-		m_numKeys++;
-		rc = 0;
+	if (format == PACKED && keyCount < MAX_PACKED_KEYS)
+	{
+		BTLeafHeader header;
+		memcpy(&header, buffer, sizeof(header));
+		long long pidDelta = (long long)rid.pid - header.basePid;
+
+		// A pair within the range of the base key and pid is shifted in the same way
+		if (KeyTraits<KeyType>::fitsDelta(header.baseKey, key) && pidDelta >= 0 && pidDelta <= MAX_PID_DELTA
+			&& rid.sid >= 0 && rid.sid < (1 << SID_BITS))
+		{
+			int idx = KeyTraits<KeyType>::countDeltasBelow(buffer + KEYS_OFFSET, keyCount, header.baseKey, key, false);
+			char * deltas = buffer + KEYS_OFFSET + idx * sizeof(unsigned short);
+			char * rids = buffer + PACKED_RIDS_OFFSET + idx * sizeof(unsigned int);
+			unsigned short delta = KeyTraits<KeyType>::deltaOf(header.baseKey, key);
+			unsigned int packed = ((unsigned int)pidDelta << SID_BITS) | rid.sid;
+
+			memmove(deltas + sizeof(unsigned short), deltas, (keyCount - idx) * sizeof(unsigned short));
+			memmove(rids + sizeof(unsigned int), rids, (keyCount - idx) * sizeof(unsigned int));
+			memcpy(deltas, &delta, sizeof(unsigned short));
+			memcpy(rids, &packed, sizeof(unsigned int));
+
+			setKeyCount(keyCount + 1);
+			return 0;
+		}
 	}
 
-	return rc;
+	// Otherwise the node has to be encoded again: a full plain node may be packed,
+	// and a packed node may need a new base or fall back to the plain format.
+	// If the entries fit in neither, the node is full.
+	KeyType keys[MAX_PACKED_KEYS + 1];
+	RecordId rids[MAX_PACKED_KEYS + 1];
+	decodeAll(keys, rids);
+
+	int idx = KeyTraits<KeyType>::countBelow((char *)keys, keyCount, key, false);
+	memmove(keys + idx + 1, keys + idx, (keyCount - idx) * sizeof(KeyType));
+	memmove(rids + idx + 1, rids + idx, (keyCount - idx) * sizeof(RecordId));
+	keys[idx] = key;
+	rids[idx] = rid;
+
+	return store(keys, rids, keyCount + 1);
 }
 
 /*
@@ -154,64 +334,69 @@ RC BTLeafNode::insert(int key, const RecordId& rid)
 * @param siblingKey[OUT] the first key in the sibling node after split.
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
-	BTLeafNode& sibling, int& siblingKey)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::insertAndSplit(const KeyType& key, const RecordId& rid,
+	BTLeafNodeT& sibling, KeyType& siblingKey)
 {
-	RC rc;
-	PageId nextNode = getNextNodePtr();
-	int kvPairSize = sizeof(int) + sizeof(RecordId);
-	int maxKVPairs = 80;
+	int keyCount = getKeyCount();
 
 	// Node must be full before performing leaf overflow split algorithm
-	if (!(getKeyCount() + 1 > maxKVPairs))
-	{
-		rc = RC_INVALID_FILE_FORMAT;
-	} // The new sibling to split key-rid pairs with must be empty first before proceeding
-	else if (sibling.getKeyCount() != 0)
-	{
-		rc = RC_INVALID_ATTRIBUTE;
-	}
-	else
+	// (a node with less than MAX_KEYS entries always takes one more)
+	if (keyCount < MAX_KEYS)
+		return RC_INVALID_FILE_FORMAT;
+
+	// The new sibling to split key-rid pairs with must be empty first before proceeding
+	if (sibling.getKeyCount() != 0)
+		return RC_INVALID_ATTRIBUTE;
+
+	// Decode the entries together with the new pair, in order
+	KeyType keys[MAX_PACKED_KEYS + 1];
+	RecordId rids[MAX_PACKED_KEYS + 1];
+	decodeAll(keys, rids);
+
+	int idx = KeyTraits<KeyType>::countBelow((char *)keys, keyCount, key, false);
+	memmove(keys + idx + 1, keys + idx, (keyCount - idx) * sizeof(KeyType));
+	memmove(rids + idx + 1, rids + idx, (keyCount - idx) * sizeof(RecordId));
+	keys[idx] = key;
+	rids[idx] = rid;
+	int n = keyCount + 1;
+
+	// Find the position to split the the node in two, starting from the middle.
+	// Move the split point to the closest boundary between two different keys,
+	// so that all copies of a key stay in one node and the first key of the
+	// sibling separates the two nodes strictly, and where both halves fit.
+	// (A single run of one key has no boundary; it is split in the middle.)
+	int halfKeys = -1;
+	for (int d = 0; d < n && halfKeys < 0; d++)
 	{
-		// Clear sibling before adding the other half of the keys into it
-		memset(sibling.buffer, 0, sizeof(sibling.buffer));
-		// cout << sibling.buffer << endl;
-
-		// Find the number of half keys and the position to split the the node in two
-		int halfKeys = ((int)((getKeyCount() + 1) / 2));
-		int halfPos = halfKeys * kvPairSize;
-
-		// Copy second half of original node's pairs into sibling's node
-		// 1024 - 4 (nextnodeptr) - 60 (filler between nextnodeptr and max total pair index: 960) - halfPos (up to 480)
-		// Set the number of keys and its next node pointer properly
-		memcpy(sibling.buffer, buffer + halfPos, PageFile::PAGE_SIZE - sizeof(PageId) - 60 - halfPos);
-		sibling.m_numKeys = getKeyCount() - halfKeys;
-		sibling.setNextNodePtr(getNextNodePtr());
-
-		// Clear second half of the original node's buffer up to the pid
-		memset(buffer + halfPos, 0, PageFile::PAGE_SIZE - sizeof(PageId) - halfPos);
-		m_numKeys = halfKeys;
-
-		// Check whether to insert the key-rid pair into the first half or the second half in the sibling
-		int firstSiblingKey;
-		memcpy(&firstSiblingKey, sibling.buffer, sizeof(int));
-
-		// If the key to insert is less than the first key in the second half
-		// insert into the first half
-		if (key < firstSiblingKey)
-			insert(key, rid);
-		else // otherwise, insert into the sibling/second half
-			sibling.insert(key, rid);
-
-		// Copy the first key in the sibling node after the split into siblingKey
-		memcpy(&siblingKey, sibling.buffer, sizeof(int));
-
-		/// Can also get rid from sibling.buffer+sizeof(int)
-
-		rc = 0;
+		int cand[2] = { n / 2 - d, n / 2 + d };
+		for (int c = 0; c < 2 && halfKeys < 0; c++)
+		{
+			int h = cand[c];
+			if (h > 0 && h < n && !KeyTraits<KeyType>::equal(keys[h - 1], keys[h])
+				&& fits(keys, rids, h) && fits(keys + h, rids + h, n - h))
+				halfKeys = h;
+		}
 	}
-
-	return rc;
+	if (halfKeys < 0)
+		halfKeys = n / 2;
+	if (!fits(keys, rids, halfKeys) || !fits(keys + halfKeys, rids + halfKeys, n - halfKeys))
+		return RC_NODE_FULL;
+
+	// Clear sibling and store the second half straight into it,
+	// then store the first half back into this node
+	memset(sibling.buffer, 0, sizeof(sibling.buffer));
+	sibling.setNextNodePtr(getNextNodePtr());
+	memcpy(sibling.buffer + HIGH_KEY_OFFSET, buffer + HIGH_KEY_OFFSET, sizeof(KeyType));
+	sibling.store(keys + halfKeys, rids + halfKeys, n - halfKeys);
+	store(keys, rids, halfKeys);
+
+	// The first key in the sibling node after the split goes into siblingKey,
+	// and separates the keys of this node from the sibling's
+	siblingKey = keys[halfKeys];
+	setHighKey(siblingKey);
+
+	return 0;
 }
 
 /**
@@ -225,44 +410,61 @@ RC BTLeafNode::insertAndSplit(int key, const RecordId& rid,
 behind the largest key smaller than searchKey.
 * @return 0 if searchKey is found. Otherwise return an error code.
 */
-RC BTLeafNode::locate(int searchKey, int& eid)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::locate(const KeyType& searchKey, int& eid)
 {
-	RC rc;
-	int kvPairSize = sizeof(int) + sizeof(RecordId);
-	char * tempBuffer = buffer;
+	int keyCount = getKeyCount();
 
-	int n;
-	for (n = 0; n < getKeyCount()*kvPairSize; n += kvPairSize)
-	{
-		int nKey;
-		memcpy(&nKey, tempBuffer, sizeof(int));
-		if (nKey >= searchKey) // == before
-		{
-			// if searchKey exists, then set the eid to the index entry of the searchKey
-			eid = n / kvPairSize;
-			rc = 0;
+	// The first key not smaller than searchKey is either searchKey itself
+	// or the entry immediately after the largest key smaller than searchKey.
+	// If all of the keys are less than the search key, eid is past the last entry.
+	eid = countBelow(searchKey, false);
 
-			return rc; // break before
-		}
-		else if (nKey > searchKey)
-		{
-			// if index key is greater than the search key, set eid to the largest index key smaller than the searchKey
-			eid = (n - 1) / kvPairSize;
-			rc = RC_NO_SUCH_RECORD;
-			break;
-		}
+	// (eid == keyCount still falls inside the buffer, so the read is safe either way)
+	bool found = (eid < keyCount) & KeyTraits<KeyType>::equal(keyAt(eid), searchKey);
+	return found ? 0 : RC_NO_SUCH_RECORD;
+}
 
-		tempBuffer += kvPairSize;
+/*
+* Count the keys smaller than (or, if inclusive, not greater than) searchKey.
+* A packed node is searched on its deltas without decoding them.
+*/
+template <class KeyType>
+int BTLeafNodeT<KeyType>::countBelow(const KeyType& searchKey, bool inclusive)
+{
+	if (getFormat() == PACKED)
+	{
+		int baseKey;
+		memcpy(&baseKey, buffer + offsetof(BTLeafHeader, baseKey), sizeof(int));
+		return KeyTraits<KeyType>::countDeltasBelow(buffer + KEYS_OFFSET, getKeyCount(), baseKey, searchKey, inclusive);
 	}
-	/*
-	// All of the keys were less than the search key so set eid to the last index entry of the buffer
-	if (n == getKeyCount())
+	return KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, getKeyCount(), searchKey, inclusive);
+}
+
+/*
+* Check whether any entry references a posting list.
+* The rids of a packed node are deltas from the smallest pid, so only the
+* base pid needs to be checked; a plain node checks every rid.
+*/
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::hasPostings()
+{
+	if (getFormat() == PACKED)
 	{
-		eid = (n - 1) / kvPairSize;
-		rc = RC_NO_SUCH_RECORD;
-	}*/
-	eid = getKeyCount(); 
-	return 0; // return rc before
+		PageId basePid;
+		memcpy(&basePid, buffer + offsetof(BTLeafHeader, basePid), sizeof(PageId));
+		return getKeyCount() > 0 && basePid < 0;
+	}
+
+	int keyCount = getKeyCount();
+	for (int eid = 0; eid < keyCount; eid++)
+	{
+		PageId pid;
+		memcpy(&pid, buffer + RIDS_OFFSET + eid * sizeof(RecordId), sizeof(PageId));
+		if (pid < 0)
+			return true;
+	}
+	return false;
 }
 
 /*
@@ -272,7 +474,8 @@ RC BTLeafNode::locate(int searchKey, int& eid)
 * @param rid[OUT] the RecordId from the entry
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::readEntry(int eid, KeyType& key, RecordId& rid)
 {
 	RC rc;
 
@@ -283,17 +486,9 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 	}
 	else
 	{
-		// Size of key-value pair is sizeof(RecordId) = 8 bytes + sizeof(key) = 4 bytes, so 12 bytes
-		int kvPairSize = sizeof(int) + sizeof(RecordId);
-
-		// Compute the offset of the kvPair from the beginning of the buffer
-		int offset = eid * kvPairSize;
-
-		char * tempBuffer = buffer;
-
-		// Copy key-RecordId pair data into function parameters
-		memcpy(&key, tempBuffer + offset, sizeof(int));
-		memcpy(&rid, tempBuffer + offset + sizeof(int), sizeof(RecordId));
+		// Decode the eid-th key and RecordId from their arrays into function parameters
+		key = keyAt(eid);
+		ridAt(eid, rid);
 
 		rc = 0;
 	}
@@ -301,18 +496,46 @@ RC BTLeafNode::readEntry(int eid, int& key, RecordId& rid)
 	return rc;
 }
 
+/*
+* Replace the count entries from eid on, which all have the same key,
+* by a single entry of that key with rid.
+* @param eid[IN] the first entry to replace
+* @param count[IN] the number of entries to replace
+* @param rid[IN] the RecordId of the entry that replaces them
+* @return 0 if successful. Return an error code if there is an error.
+*/
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::collapse(int eid, int count, const RecordId& rid)
+{
+	int keyCount = getKeyCount();
+
+	if (eid < 0 || count < 1 || eid + count > keyCount)
+		return RC_NO_SUCH_RECORD;
+
+	// Decode the entries, drop all but the first of the run and store them again
+	// (the node only gets smaller, so the entries still fit)
+	KeyType keys[MAX_PACKED_KEYS + 1];
+	RecordId rids[MAX_PACKED_KEYS + 1];
+	decodeAll(keys, rids);
+
+	rids[eid] = rid;
+	memmove(keys + eid + 1, keys + eid + count, (keyCount - eid - count) * sizeof(KeyType));
+	memmove(rids + eid + 1, rids + eid + count, (keyCount - eid - count) * sizeof(RecordId));
+
+	return store(keys, rids, keyCount - count + 1);
+}
+
 /*
 * Return the pid of the next sibling node.
 * @return the PageId of the next sibling node
 */
-PageId BTLeafNode::getNextNodePtr()
+template <class KeyType>
+PageId BTLeafNodeT<KeyType>::getNextNodePtr()
 {
-	// Assume no next sibling node first
-	PageId pid = -1;
-	char * tempBuffer = buffer;
+	PageId pid;
 
-	// Copy the pid from the last four bytes of the buffer that holds the next sibling node if any
-	memcpy(&pid, tempBuffer + PageFile::PAGE_SIZE - sizeof(PageId), sizeof(PageId));
+	// Copy the pid of the next sibling node (0 if there is none) from the node header
+	memcpy(&pid, buffer + offsetof(BTLeafHeader, nextPid), sizeof(PageId));
 
 	return pid;
 }
@@ -322,38 +545,93 @@ PageId BTLeafNode::getNextNodePtr()
 * @param pid[IN] the PageId of the next sibling node
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTLeafNode::setNextNodePtr(PageId pid)
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::setNextNodePtr(PageId pid)
 {
-	RC rc;
-
 	// pid is invalid and out of range
 	if (pid < 0)
-		rc = RC_INVALID_PID;
+		return RC_INVALID_PID;
 
-	// Copy pid of the next sibling into last 4 bytes of the leaf node
-	char * tempBuffer = buffer;
-	memcpy(tempBuffer + PageFile::PAGE_SIZE - sizeof(PageId), &pid, sizeof(PageId));
+	// Copy pid of the next sibling into the node header
+	memcpy(buffer + offsetof(BTLeafHeader, nextPid), &pid, sizeof(PageId));
 
-	rc = 0;
-	return rc;
+	return 0;
+}
+
+/*
+* Return the pid of the previous sibling node.
+* @return the PageId of the previous sibling node
+*/
+template <class KeyType>
+PageId BTLeafNodeT<KeyType>::getPrevNodePtr()
+{
+	PageId pid;
+
+	memcpy(&pid, buffer + offsetof(BTLeafHeader, prevPid), sizeof(PageId));
+
+	return pid;
 }
 
-void BTLeafNode::print()
+/*
+* Set the pid of the previous sibling node.
+* @param pid[IN] the PageId of the previous sibling node
+* @return 0 if successful. Return an error code if there is an error.
+*/
+template <class KeyType>
+RC BTLeafNodeT<KeyType>::setPrevNodePtr(PageId pid)
 {
-	int kvPairSize = sizeof(int) + sizeof(RecordId);
+	if (pid < 0)
+		return RC_INVALID_PID;
 
-	char * tempBuffer = buffer;
+	memcpy(buffer + offsetof(BTLeafHeader, prevPid), &pid, sizeof(PageId));
 
-	for (int i = 0; i < getKeyCount()*kvPairSize; i += kvPairSize)
-	{
-		// Takes current key from buffer
-		int currKey;
-		memcpy(&currKey, tempBuffer, sizeof(int));
+	return 0;
+}
 
-		cout << currKey << " ";
+/*
+* Return the high key of the node. Only a node with a next sibling has one.
+* @param key[OUT] the high key
+* @return true if the node has a high key, false for the last node
+*/
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::getHighKey(KeyType& key)
+{
+	if (getNextNodePtr() <= 0)
+		return false;
+
+	memcpy(&key, buffer + HIGH_KEY_OFFSET, sizeof(KeyType));
+	return true;
+}
+
+/*
+* Set the high key of the node.
+* @param key[IN] the high key
+*/
+template <class KeyType>
+void BTLeafNodeT<KeyType>::setHighKey(const KeyType& key)
+{
+	memcpy(buffer + HIGH_KEY_OFFSET, &key, sizeof(KeyType));
+}
 
-		// Advance to next key value pair
-		tempBuffer += kvPairSize;
+/*
+* Check whether searchKey belongs to a node to the right of this one.
+* @param searchKey[IN] the key being looked up
+* @return true if the node has a high key and searchKey is not smaller than it
+*/
+template <class KeyType>
+bool BTLeafNodeT<KeyType>::isPastHighKey(const KeyType& searchKey)
+{
+	KeyType highKey;
+	return getHighKey(highKey) && !KeyTraits<KeyType>::less(searchKey, highKey);
+}
+
+template <class KeyType>
+void BTLeafNodeT<KeyType>::print()
+{
+	for (int i = 0; i < getKeyCount(); i++)
+	{
+		// Decodes current key from buffer
+		cout << keyAt(i) << " ";
 	}
 
 	cout << "\n";
@@ -362,9 +640,10 @@ void BTLeafNode::print()
 /**
 * Constructor: initialize empty non-leaf node
 */
-BTNonLeafNode::BTNonLeafNode()
+template <class KeyType>
+BTNonLeafNodeT<KeyType>::BTNonLeafNodeT()
 {
-	m_numKeys = 0;
+	// An all-zero page is an empty node with key count 0
 	memset(buffer, 0, sizeof(buffer));
 }
 
@@ -375,7 +654,8 @@ BTNonLeafNode::BTNonLeafNode()
 * @param pf[IN] PageFile to read from
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::read(PageId pid, const PageFile& pf)
 {
 	RC rc;
 
@@ -391,7 +671,8 @@ RC BTNonLeafNode::read(PageId pid, const PageFile& pf)
 * @param pf[IN] PageFile to write to
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::write(PageId pid, PageFile& pf)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::write(PageId pid, PageFile& pf)
 {
 	RC rc;
 
@@ -405,92 +686,69 @@ RC BTNonLeafNode::write(PageId pid, PageFile& pf)
 * Return the number of keys stored in the node.
 * @return the number of keys in the node
 */
-int BTNonLeafNode::getKeyCount()
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getKeyCount()
 {
-	int keyCount = 0;
-	int kvPairSize = sizeof(int) + sizeof(PageId);
-	char * tempBuffer = buffer + 4;
+	int keyCount;
 
-	// Each key-PageId pair is 8 bytes
-	// Max number of keys: 80; Max key-value pair byte usage: 80*8 = 640
-	// First four bytes are for pid of non-leaf node
-	// Largest possible index of pair to be inserted: 644-8 = 636
-	// Loop through the buffer to check the number of keys
-	for (int n = 4; n <= 636; n += kvPairSize)
-	{
-		// Check if the nth key is valid and not null (== 0), meaning it was not empty
-		int nKey;
-		memcpy(&nKey, tempBuffer, sizeof(int));
-		if (nKey == 0)
-			break;
-
-		// Increment key count for every valid key and iterate to next key-value pair
-		keyCount++;
-		tempBuffer += kvPairSize;
-	}
+	// The key count is kept in the node header
+	memcpy(&keyCount, buffer + offsetof(BTNonLeafHeader, keyCount), sizeof(int));
 
 	return keyCount;
 }
 
+/*
+* Store the number of keys in the node header.
+* @param count[IN] the new number of keys
+*/
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::setKeyCount(int count)
+{
+	memcpy(buffer + offsetof(BTNonLeafHeader, keyCount), &count, sizeof(int));
+}
+
 
 /*
-* Insert a (key, pid) pair to the node.
+* Insert a (key, pid) pair to the node. The child in front of key split,
+* and count of its entries went to pid.
 * @param key[IN] the key to insert
 * @param pid[IN] the PageId to insert
+* @param count[IN] the number of entries under pid
 * @return 0 if successful. Return an error code if the node is full.
 */
-RC BTNonLeafNode::insert(int key, PageId pid)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::insert(const KeyType& key, PageId pid, int count)
 {
 	RC rc;
-	int kvPairSize = sizeof(int) + sizeof(PageId);
-	int maxKVPairs = 80;
+	int keyCount = getKeyCount();
 
-	// If adding one more key-pid pair overflows the node's max capacity (80 pairs)
+	// If adding one more key-pid pair overflows the node's max capacity
 	// return that the node is full
-	if (getKeyCount() + 1 > maxKVPairs)
+	if (keyCount + 1 > MAX_KEYS)
 	{
 		rc = RC_NODE_FULL;
 	}
 	else
 	{
-		// Check where to insert the key-pid pair into the node
-		char * tempBuffer = buffer + 4;
-
-		int idx;
-		for (idx = 4; idx < 636; idx += kvPairSize)
-		{
-			int nKey;
-			memcpy(&nKey, tempBuffer, sizeof(int));
-
-			// Check if the key is less than one of the node's keys or if the node's key is empty
-			// the index will be where to insert the key-value pair after shifting everything over 
-			if (nKey == 0 || key <= nKey)
-				break;
-
-			tempBuffer += kvPairSize;
-		}
-
-		// After finding the index location (idx) to insert the key-pid pair
-		// let's use another buffer to shift everything over
-		char * insertBuffer = (char *)malloc(PageFile::PAGE_SIZE);
-		memset(insertBuffer, 0, PageFile::PAGE_SIZE);
-
-		// Make sure the insertBuffer has all the values up until the index insert location
-		memcpy(insertBuffer, buffer, idx);
-
-		// Insert key-value pair into proper index location
-		memcpy(insertBuffer + idx, &key, sizeof(int));
-		memcpy(insertBuffer + idx + sizeof(int), &pid, sizeof(PageId));
-
-		// Copy the rest of the values after the index insert location to shift everything over
-		memcpy(insertBuffer + idx + kvPairSize, buffer + idx, getKeyCount() * kvPairSize - idx + 4);
-
-		// Update the old buffer to the insertBuffer with properly inserted key-pid pair
-		// Deallocate the buffer that aided the insertion
-		memcpy(buffer, insertBuffer, PageFile::PAGE_SIZE);
-		free(insertBuffer);
-
-		m_numKeys++;
+		// Check where to insert the key-pid pair into the node:
+		// in front of the first key that is greater than or equal to it
+		int idx = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, keyCount, key, false);
+		char * keys = buffer + KEYS_OFFSET + idx * sizeof(KeyType);
+		char * pids = buffer + PIDS_OFFSET + (idx + 1) * sizeof(PageId);
+		char * counts = buffer + COUNTS_OFFSET + (idx + 1) * sizeof(int);
+
+		// Shift the keys from idx on and the pids (and counts) behind them over by one entry in place
+		memmove(keys + sizeof(KeyType), keys, (keyCount - idx) * sizeof(KeyType));
+		memmove(pids + sizeof(PageId), pids, (keyCount - idx) * sizeof(PageId));
+		memmove(counts + sizeof(int), counts, (keyCount - idx) * sizeof(int));
+
+		// Insert the key at idx; its pid goes behind it, right after the pid in front of the key
+		memcpy(keys, &key, sizeof(KeyType));
+		memcpy(pids, &pid, sizeof(PageId));
+		memcpy(counts, &count, sizeof(int));
+
+		setKeyCount(keyCount + 1);
+		setChildCount(idx, getChildCount(idx) - count);
 		rc = 0;
 	}
 
@@ -503,18 +761,19 @@ RC BTNonLeafNode::insert(int key, PageId pid)
 * The middle key after the split is returned in midKey.
 * @param key[IN] the key to insert
 * @param pid[IN] the PageId to insert
+* @param count[IN] the number of entries under pid
 * @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
 * @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::insertAndSplit(const KeyType& key, PageId pid, int count, BTNonLeafNodeT& sibling, KeyType& midKey)
 {
 	RC rc;
-	int kvPairSize = sizeof(int) + sizeof(PageId);
-	int maxKVPairs = 80;
+	int keyCount = getKeyCount();
 
 	// Node must be full before performing non-leaf overflow split algorithm
-	if (!(getKeyCount() + 1 > maxKVPairs))
+	if (!(keyCount + 1 > MAX_KEYS))
 	{
 		rc = RC_INVALID_FILE_FORMAT;
 	} // The new sibling to split key-pid pairs with must be empty first before proceeding
@@ -524,91 +783,91 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 	}
 	else
 	{
-		// Clear sibling before adding the other half of the keys into it
+		// Clear sibling before adding the other half of the keys into it.
+		// It goes between this node and its right sibling, so it takes over
+		// the high key; the middle key becomes the high key of this node.
 		memset(sibling.buffer, 0, sizeof(sibling.buffer));
+		sibling.setNextNodePtr(getNextNodePtr());
+		memcpy(sibling.buffer + HIGH_KEY_OFFSET, buffer + HIGH_KEY_OFFSET, sizeof(KeyType));
 
-		// Find the number of half keys and the position to split the the node in two
-		int halfKeys = ((int)((getKeyCount() + 1) / 2));
-		int halfPos = halfKeys * kvPairSize + 4;
+		// Find the number of half keys to split the the node in two
+		int halfKeys = (keyCount + 1) / 2;
+		char * keys = buffer + KEYS_OFFSET;
+		char * pids = buffer + PIDS_OFFSET;
+		char * counts = buffer + COUNTS_OFFSET;
 
 		// Retrieve the last key of the first half and the first key of the second half
 		// use these two keys and the given key to insert to determine the middle key to push up
-		int lastFHKey = 0;
-		int firstSHKey = 0;
+		KeyType lastFHKey;
+		KeyType firstSHKey;
 
-		memcpy(&lastFHKey, buffer + halfPos - 8, sizeof(int));
-		memcpy(&firstSHKey, buffer + halfPos, sizeof(int));
+		memcpy(&lastFHKey, keys + (halfKeys - 1) * sizeof(KeyType), sizeof(KeyType));
+		memcpy(&firstSHKey, keys + halfKeys * sizeof(KeyType), sizeof(KeyType));
 
-		//cout << lastFHKey << endl;
-		//cout << firstSHKey << endl;
-		//print();
+		// Number of keys that stay in this node
+		int leftKeys;
 
 		// First second half key is the middle key
-		if (key > firstSHKey)
+		if (KeyTraits<KeyType>::less(firstSHKey, key))
 		{
-			// Shift everything to the right by copying all the keys to the right of the 
-			// halfPos except for the first key-value pair
-			// we will insert the sibling pid into the first four bytes and the second half key-pid pairs after
-			// Since we have 80 keys and 4 byte offset for initial pid, that fills up 644 Bytes maximum.
-			// We must do 1024 - 380(filler) - halfPos (up to 320) for number of bytes to copy - 8 for first key-pid pair in second half 
-			memcpy(sibling.buffer + 4, buffer + halfPos, PageFile::PAGE_SIZE - 380 - halfPos - 4);
-			sibling.m_numKeys = getKeyCount() - halfKeys - 1;
-
-			// Place value of first second half key into midKey
-			memcpy(&midKey, buffer + halfPos, sizeof(int));
-
-			// Make sure you copy sibling pid into first four bytes
-			memcpy(sibling.buffer, buffer + halfPos + 4, sizeof(PageId));
-
-			// Zero out the second half of the original buffer
-			memset(buffer + halfPos, 0, PageFile::PAGE_SIZE - halfPos);
-			m_numKeys = halfKeys;
-
-			// Insert the key-pid pair somewhere into the second half/sibling's node
-			sibling.insert(key, pid);
-
+			// The pid behind the middle key becomes the sibling's first pid,
+			// and the keys and pids after it fill the rest of the sibling
+			midKey = firstSHKey;
+			memcpy(sibling.buffer + KEYS_OFFSET, keys + (halfKeys + 1) * sizeof(KeyType),
+				(keyCount - halfKeys - 1) * sizeof(KeyType));
+			memcpy(sibling.buffer + PIDS_OFFSET, pids + (halfKeys + 1) * sizeof(PageId),
+				(keyCount - halfKeys) * sizeof(PageId));
+			memcpy(sibling.buffer + COUNTS_OFFSET, counts + (halfKeys + 1) * sizeof(int),
+				(keyCount - halfKeys) * sizeof(int));
+			sibling.setKeyCount(keyCount - halfKeys - 1);
+			leftKeys = halfKeys;
 		} // Last key of the first half is the middle key 
-		else if (key < lastFHKey)
+		else if (KeyTraits<KeyType>::less(key, lastFHKey))
 		{
-			// Move everything on the right of the halfPos into the sibling buffer
-			// First four bytes are for first pid
-			// Number of bytes to copy: 1024 - 380(filler) - halfPos(up to 320)
-			memcpy(sibling.buffer + 4, buffer + halfPos, PageFile::PAGE_SIZE - 380 - halfPos - 4);
-			sibling.m_numKeys = getKeyCount() - halfKeys;
-
-			// Place value of the last key of the first half into midKey
-			memcpy(&midKey, buffer + halfPos - 8, sizeof(int));
-
-			// Make sure you copy sibling pid into first four bytes
-			memcpy(sibling.buffer, buffer + halfPos - 4, sizeof(PageId));
-
-			// Zero out the second half of the original buffer
-			memset(buffer + halfPos, 0, PageFile::PAGE_SIZE - halfPos);
-			m_numKeys = halfKeys - 1;
-
-			// Insert the key-pid pair somewhere into the first half/original node
-			insert(key, pid);
-
+			// The pid behind the middle key becomes the sibling's first pid,
+			// and the keys and pids of the second half fill the rest of the sibling
+			midKey = lastFHKey;
+			memcpy(sibling.buffer + KEYS_OFFSET, keys + halfKeys * sizeof(KeyType),
+				(keyCount - halfKeys) * sizeof(KeyType));
+			memcpy(sibling.buffer + PIDS_OFFSET, pids + halfKeys * sizeof(PageId),
+				(keyCount - halfKeys + 1) * sizeof(PageId));
+			memcpy(sibling.buffer + COUNTS_OFFSET, counts + halfKeys * sizeof(int),
+				(keyCount - halfKeys + 1) * sizeof(int));
+			sibling.setKeyCount(keyCount - halfKeys);
+			leftKeys = halfKeys - 1;
 		} // Key to be inserted is the middle key
 		else
 		{
-			// Move everything on the right side of the halfPos into the sibling buffer
-			// First four bytes are for first pid
-			// Number of bytes to copy: 1024 - 380(filler) - halfPos(up to 320)
-			memcpy(sibling.buffer + 4, buffer + halfPos, PageFile::PAGE_SIZE - 380 - halfPos - 4);
-			sibling.m_numKeys = getKeyCount() - halfKeys;
-
-			// Place value of key to insert into midKey
+			// The inserted pid becomes the sibling's first pid,
+			// and the keys and pids of the second half fill the rest of the sibling
 			midKey = key;
+			memcpy(sibling.buffer + PIDS_OFFSET, &pid, sizeof(PageId));
+			memcpy(sibling.buffer + COUNTS_OFFSET, &count, sizeof(int));
+			memcpy(sibling.buffer + KEYS_OFFSET, keys + halfKeys * sizeof(KeyType),
+				(keyCount - halfKeys) * sizeof(KeyType));
+			memcpy(sibling.buffer + PIDS_OFFSET + sizeof(PageId), pids + (halfKeys + 1) * sizeof(PageId),
+				(keyCount - halfKeys) * sizeof(PageId));
+			memcpy(sibling.buffer + COUNTS_OFFSET + sizeof(int), counts + (halfKeys + 1) * sizeof(int),
+				(keyCount - halfKeys) * sizeof(int));
+			sibling.setKeyCount(keyCount - halfKeys);
+			leftKeys = halfKeys;
+
+			// The entries of pid came from the last child that stays here
+			setChildCount(halfKeys, getChildCount(halfKeys) - count);
+		}
 
-			// Make sure you copy sibling pid into first four bytes
-			memcpy(sibling.buffer, &pid, sizeof(PageId));
-
-			// Zero out the second half of the original buffer
-			memset(buffer + halfPos, 0, PageFile::PAGE_SIZE - halfPos);
-			m_numKeys = halfKeys;
+		// Zero out the keys, pids and counts that moved out of the original node
+		memset(keys + leftKeys * sizeof(KeyType), 0, (keyCount - leftKeys) * sizeof(KeyType));
+		memset(pids + (leftKeys + 1) * sizeof(PageId), 0, (keyCount - leftKeys) * sizeof(PageId));
+		memset(counts + (leftKeys + 1) * sizeof(int), 0, (keyCount - leftKeys) * sizeof(int));
+		setKeyCount(leftKeys);
 
-		}
+		// Insert the key-pid pair into the half it belongs to
+		if (KeyTraits<KeyType>::less(firstSHKey, key))
+			sibling.insert(key, pid, count);
+		else if (KeyTraits<KeyType>::less(key, lastFHKey))
+			insert(key, pid, count);
+		setHighKey(midKey);
 
 		rc = 0;
 	}
@@ -623,84 +882,424 @@ RC BTNonLeafNode::insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, in
 * @param pid[OUT] the pointer to the child node to follow.
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::locateChildPtr(int searchKey, PageId& pid)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::locateChildPtr(const KeyType& searchKey, PageId& pid)
 {
-	RC rc;
-	int kvPairSize = sizeof(int) + sizeof(PageId);
-	char * tempBuffer = buffer + 4;
+	// Follow the pid in front of the first key that is greater than searchKey
+	int n = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, getKeyCount(), searchKey, true);
+
+	// The pid in front of the nth key is the nth pid
+	memcpy(&pid, buffer + PIDS_OFFSET + n * sizeof(PageId), sizeof(PageId));
+
+	return 0;
+}
+
+/*
+* Find the child-node pointer to follow for searchKey, and the number of
+* entries under the children in front of it.
+* @param searchKey[IN] the searchKey that is being looked up
+* @param pid[OUT] the pointer to the child node to follow
+* @param before[OUT] the number of entries under the children in front of pid
+* @return 0 if successful. Return an error code if there is an error.
+*/
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::locateChildPtr(const KeyType& searchKey, PageId& pid, int& before)
+{
+	int n = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, getKeyCount(), searchKey, true);
+
+	memcpy(&pid, buffer + PIDS_OFFSET + n * sizeof(PageId), sizeof(PageId));
+	before = 0;
+	for (int i = 0; i < n; i++)
+		before += getChildCount(i);
+
+	return 0;
+}
+
+/*
+* Find the child-node pointer to the keys right in front of searchKey.
+* @param searchKey[IN] the key whose predecessor is looked up
+* @param pid[OUT] the pointer to the child node to follow
+* @return 0 if successful. Return an error code if there is an error.
+*/
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::locateChildPtrBefore(const KeyType& searchKey, PageId& pid)
+{
+	// Follow the pid in front of the first key that is not smaller than searchKey
+	int n = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, getKeyCount(), searchKey, false);
+
+	memcpy(&pid, buffer + PIDS_OFFSET + n * sizeof(PageId), sizeof(PageId));
+
+	return 0;
+}
+
+/*
+* Return the child-node pointer behind the last key, the child with the largest keys.
+* @return the PageId of the last child
+*/
+template <class KeyType>
+PageId BTNonLeafNodeT<KeyType>::getLastChildPtr()
+{
+	PageId pid;
+
+	memcpy(&pid, buffer + PIDS_OFFSET + getKeyCount() * sizeof(PageId), sizeof(PageId));
+
+	return pid;
+}
+
+/*
+* Return the ith child-node pointer, for i from 0 to getKeyCount().
+* @param i[IN] the position of the pointer
+* @return the PageId of the ith child
+*/
+template <class KeyType>
+PageId BTNonLeafNodeT<KeyType>::getChildPtr(int i)
+{
+	PageId pid;
+
+	memcpy(&pid, buffer + PIDS_OFFSET + i * sizeof(PageId), sizeof(PageId));
 
-	int n;
-	for (n = 4; n < getKeyCount() * kvPairSize + 4; n += kvPairSize)
+	return pid;
+}
+
+/*
+* Replace the child-node pointer oldPid by newPid.
+* @param oldPid[IN] the PageId of the child
+* @param newPid[IN] the PageId of its copy
+* @return 0 if successful. RC_INVALID_PID if no child is at oldPid.
+*/
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::replaceChildPtr(PageId oldPid, PageId newPid)
+{
+	for (int i = 0; i <= getKeyCount(); i++)
 	{
-		int nKey;
-		memcpy(&nKey, tempBuffer, sizeof(int));
-		if (n == 4 && nKey > searchKey) // n == 8
+		if (getChildPtr(i) == oldPid)
 		{
-			// searchKey is less than the first key so return first pid in first four bytes
-			memcpy(&pid, buffer, sizeof(PageId));
-
-			rc = 0;
-			return rc;
+			memcpy(buffer + PIDS_OFFSET + i * sizeof(PageId), &newPid, sizeof(PageId));
+			return 0;
 		}
-		else if (nKey > searchKey)
-		{
-			// return the pid of the key just before the one that is greater than searchKey
-			memcpy(&pid, tempBuffer - 4, sizeof(PageId));
+	}
 
-			rc = 0;
-			return rc;
-		}
+	return RC_INVALID_PID;
+}
 
-		tempBuffer += kvPairSize;
-	}
+/*
+* Return the number of entries under the ith child, for i from 0 to getKeyCount().
+* @param i[IN] the position of the child
+* @return the number of entries under the ith child
+*/
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getChildCount(int i)
+{
+	int count;
 
-	// searchKey is greater than all the keys in the buffer so return last possible pid
-	memcpy(&pid, tempBuffer - 4, sizeof(PageId));
+	memcpy(&count, buffer + COUNTS_OFFSET + i * sizeof(int), sizeof(int));
 
-	rc = 0;
-	return rc;
+	return count;
+}
+
+/*
+* Set the number of entries under the ith child.
+* @param i[IN] the position of the child
+* @param count[IN] the number of entries under it
+*/
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::setChildCount(int i, int count)
+{
+	memcpy(buffer + COUNTS_OFFSET + i * sizeof(int), &count, sizeof(int));
+}
+
+/*
+* Add delta to the number of entries under the child searchKey belongs to.
+* @param searchKey[IN] the key of the entries inserted
+* @param delta[IN] the number of entries inserted
+*/
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::addChildCount(const KeyType& searchKey, int delta)
+{
+	// The same child as locateChildPtr() follows
+	int n = KeyTraits<KeyType>::countBelow(buffer + KEYS_OFFSET, getKeyCount(), searchKey, true);
+
+	setChildCount(n, getChildCount(n) + delta);
+}
+
+/*
+* Return the number of entries under all of the children of the node.
+* @return the number of entries under the node
+*/
+template <class KeyType>
+int BTNonLeafNodeT<KeyType>::getEntryCount()
+{
+	int count = 0;
+
+	for (int i = 0; i <= getKeyCount(); i++)
+		count += getChildCount(i);
+
+	return count;
+}
+
+/*
+* Return the pid of the right sibling on the same level.
+* @return the PageId of the right sibling; 0 for the last node of the level
+*/
+template <class KeyType>
+PageId BTNonLeafNodeT<KeyType>::getNextNodePtr()
+{
+	PageId pid;
+
+	memcpy(&pid, buffer + offsetof(BTNonLeafHeader, nextPid), sizeof(PageId));
+
+	return pid;
+}
+
+/*
+* Set the pid of the right sibling on the same level.
+* @param pid[IN] the PageId of the right sibling
+* @return 0 if successful. Return an error code if there is an error.
+*/
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::setNextNodePtr(PageId pid)
+{
+	if (pid < 0)
+		return RC_INVALID_PID;
+
+	memcpy(buffer + offsetof(BTNonLeafHeader, nextPid), &pid, sizeof(PageId));
+
+	return 0;
+}
+
+/*
+* Return the high key of the node. Only a node with a right sibling has one.
+* @param key[OUT] the high key
+* @return true if the node has a high key, false for the last node of its level
+*/
+template <class KeyType>
+bool BTNonLeafNodeT<KeyType>::getHighKey(KeyType& key)
+{
+	if (getNextNodePtr() <= 0)
+		return false;
+
+	memcpy(&key, buffer + HIGH_KEY_OFFSET, sizeof(KeyType));
+	return true;
+}
+
+/*
+* Set the high key of the node.
+* @param key[IN] the high key
+*/
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::setHighKey(const KeyType& key)
+{
+	memcpy(buffer + HIGH_KEY_OFFSET, &key, sizeof(KeyType));
+}
+
+/*
+* Check whether searchKey belongs under a node to the right of this one.
+* @param searchKey[IN] the key being looked up
+* @return true if the node has a high key and searchKey is not smaller than it
+*/
+template <class KeyType>
+bool BTNonLeafNodeT<KeyType>::isPastHighKey(const KeyType& searchKey)
+{
+	KeyType highKey;
+	return getHighKey(highKey) && !KeyTraits<KeyType>::less(searchKey, highKey);
 }
 
 /*
 * Initialize the root node with (pid1, key, pid2).
 * @param pid1[IN] the first PageId to insert
+* @param count1[IN] the number of entries under pid1
 * @param key[IN] the key that should be inserted between the two PageIds
 * @param pid2[IN] the PageId to insert behind the key
+* @param count2[IN] the number of entries under pid2
 * @return 0 if successful. Return an error code if there is an error.
 */
-RC BTNonLeafNode::initializeRoot(PageId pid1, int key, PageId pid2)
+template <class KeyType>
+RC BTNonLeafNodeT<KeyType>::initializeRoot(PageId pid1, int count1, const KeyType& key, PageId pid2, int count2)
 {
 	RC rc;
 
 	// Make sure buffer is clean
 	memset(buffer, 0, sizeof(buffer));
 
-	// Initialize first pid to insert in first four bytes
-	memcpy(buffer, &pid1, sizeof(PageId));
+	// Initialize first pid at the front of the pid array, with the entries
+	// of both children: insert() moves those of pid2 over to it
+	memcpy(buffer + PIDS_OFFSET, &pid1, sizeof(PageId));
+	setChildCount(0, count1 + count2);
 
 	// Insert first key-pid pair into buffer
-	rc = insert(key, pid2);
+	rc = insert(key, pid2, count2);
 
 	return rc;
 }
 
-void BTNonLeafNode::print()
+template <class KeyType>
+void BTNonLeafNodeT<KeyType>::print()
 {
-	int kvPairSize = sizeof(int) + sizeof(PageId);
-
-	char * tempBuffer = buffer + 4;
-
-	for (int i = 4; i < getKeyCount()*kvPairSize; i += kvPairSize)
+	for (int i = 0; i < getKeyCount(); i++)
 	{
 		// Takes current key from buffer
-		int currKey;
-		memcpy(&currKey, tempBuffer, sizeof(int));
+		KeyType currKey;
+		memcpy(&currKey, buffer + KEYS_OFFSET + i * sizeof(KeyType), sizeof(KeyType));
 
 		cout << currKey << " ";
-
-		// Advance to next key value pair
-		tempBuffer += kvPairSize;
 	}
 
 	cout << "\n";
-}
\ No newline at end of file
+}
+
+/**
+* Constructor: initialize empty posting page
+*/
+BTPostingNode::BTPostingNode()
+{
+	// An all-zero page is an empty posting page with no next page
+	memset(buffer, 0, sizeof(buffer));
+}
+
+/*
+* Read the content of the node from the page pid in the PageFile pf.
+* @param pid[IN] the PageId to read
+* @param pf[IN] PageFile to read from
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTPostingNode::read(PageId pid, const PageFile& pf)
+{
+	return pf.read(pid, buffer);
+}
+
+/*
+* Write the content of the node to the page pid in the PageFile pf.
+* @param pid[IN] the PageId to write to
+* @param pf[IN] PageFile to write to
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTPostingNode::write(PageId pid, PageFile& pf)
+{
+	return pf.write(pid, buffer);
+}
+
+/*
+* Return the number of RecordIds stored in the page.
+* @return the number of RecordIds in the page
+*/
+int BTPostingNode::getCount()
+{
+	int count;
+	memcpy(&count, buffer + offsetof(BTPostingHeader, count), sizeof(int));
+	return count;
+}
+
+/*
+* Append rid to the page.
+* @param rid[IN] the RecordId to append
+* @return 0 if successful. RC_NODE_FULL if the page is full or
+*         rid cannot be packed relative to the base pid of the page.
+*/
+RC BTPostingNode::append(const RecordId& rid)
+{
+	int count = getCount();
+	PageId basePid;
+
+	if (count >= MAX_RIDS)
+		return RC_NODE_FULL;
+
+	// The first RecordId of the page sets the base pid
+	if (count == 0)
+		memcpy(buffer + offsetof(BTPostingHeader, basePid), &rid.pid, sizeof(PageId));
+	memcpy(&basePid, buffer + offsetof(BTPostingHeader, basePid), sizeof(PageId));
+
+	// A RecordId that cannot be packed goes to a new page
+	long long pidDelta = (long long)rid.pid - basePid;
+	if (pidDelta < 0 || pidDelta > MAX_PID_DELTA || rid.sid < 0 || rid.sid >= (1 << SID_BITS))
+		return RC_NODE_FULL;
+
+	unsigned int packed = ((unsigned int)pidDelta << SID_BITS) | rid.sid;
+	memcpy(buffer + RIDS_OFFSET + count * sizeof(unsigned int), &packed, sizeof(unsigned int));
+
+	count++;
+	memcpy(buffer + offsetof(BTPostingHeader, count), &count, sizeof(int));
+
+	return 0;
+}
+
+/*
+* Read the RecordId of the eid entry.
+* @param eid[IN] the entry number to read
+* @param rid[OUT] the RecordId of the entry
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTPostingNode::readEntry(int eid, RecordId& rid)
+{
+	if (eid < 0 || eid >= getCount())
+		return RC_NO_SUCH_RECORD;
+
+	PageId basePid;
+	unsigned int packed;
+	memcpy(&basePid, buffer + offsetof(BTPostingHeader, basePid), sizeof(PageId));
+	memcpy(&packed, buffer + RIDS_OFFSET + eid * sizeof(unsigned int), sizeof(unsigned int));
+	rid.pid = basePid + (PageId)(packed >> SID_BITS);
+	rid.sid = packed & ((1 << SID_BITS) - 1);
+
+	return 0;
+}
+
+/*
+* Return the pid of the next page of the posting list (0 if there is none).
+* @return the PageId of the next page
+*/
+PageId BTPostingNode::getNextNodePtr()
+{
+	PageId pid;
+	memcpy(&pid, buffer + offsetof(BTPostingHeader, nextPid), sizeof(PageId));
+	return pid;
+}
+
+/*
+* Set the pid of the next page of the posting list.
+* @param pid[IN] the PageId of the next page
+* @return 0 if successful. Return an error code if there is an error.
+*/
+RC BTPostingNode::setNextNodePtr(PageId pid)
+{
+	if (pid < 0)
+		return RC_INVALID_PID;
+
+	memcpy(buffer + offsetof(BTPostingHeader, nextPid), &pid, sizeof(PageId));
+	return 0;
+}
+
+/*
+* Return the pid of the last page of the posting list.
+* @return the PageId of the last page
+*/
+PageId BTPostingNode::getTailPtr()
+{
+	PageId pid;
+	memcpy(&pid, buffer + offsetof(BTPostingHeader, tailPid), sizeof(PageId));
+	return pid;
+}
+
+/*
+* Set the pid of the last page of the posting list.
+* @param pid[IN] the PageId of the last page
+*/
+void BTPostingNode::setTailPtr(PageId pid)
+{
+	memcpy(buffer + offsetof(BTPostingHeader, tailPid), &pid, sizeof(PageId));
+}
+
+/*
+* The key types B+trees are built on. The member definitions stay in this file,
+* so every key type used by an index is instantiated here.
+*/
+template class BTLeafNodeT<int>;
+template class BTLeafNodeT<long long>;
+template class BTLeafNodeT< FixedString<16> >;
+template class BTLeafNodeT<IntPair>;
+template class BTLeafNodeT< KeyValue<28> >;
+
+template class BTNonLeafNodeT<int>;
+template class BTNonLeafNodeT<long long>;
+template class BTNonLeafNodeT< FixedString<16> >;
+template class BTNonLeafNodeT<IntPair>;
+template class BTNonLeafNodeT< KeyValue<28> >;
@@ -10,18 +10,58 @@
 #ifndef BTREENODE_H
 #define BTREENODE_H
 
+#include <cstddef>
 #include "RecordFile.h"
 #include "PageFile.h"
+#include "BTreeKey.h"
 
 /**
-* BTLeafNode: The class representing a B+tree leaf node.
+* The header at the front of a leaf node page.
+* It is followed by the high key of the node (see BTLeafNodeT::getHighKey()),
+* the array of keys and then the array of RecordIds,
+* either plain or packed relative to baseKey and basePid (see BTLeafNodeT).
 */
-class BTLeafNode {
+typedef struct {
+	short   keyCount; // number of (key, rid) entries in the node
+	short   format;   // BTLeafNodeT::PLAIN or BTLeafNodeT::PACKED
+	PageId  nextPid;  // PageId of the next sibling; 0 for the last leaf
+	PageId  prevPid;  // PageId of the previous sibling; 0 for the first leaf
+	int     baseKey;  // PACKED: the key that the key deltas are relative to
+	PageId  basePid;  // PACKED: the PageId that the rid pid deltas are relative to
+} BTLeafHeader;
+
+/**
+* The header at the front of a non-leaf node page.
+* It is followed by the high key of the node, the array of keys, the array
+* of child PageIds and then the array of their entry counts.
+*/
+typedef struct {
+	int     keyCount; // number of keys in the node (one less than the children)
+	PageId  nextPid;  // PageId of the right sibling on the same level; 0 for the last node
+} BTNonLeafHeader;
+
+/**
+* The header at the front of a posting page.
+* It is followed by the array of packed RecordIds ((pid - basePid) << 4 | sid).
+*/
+typedef struct {
+	int     count;    // number of RecordIds in the page
+	PageId  nextPid;  // PageId of the next posting page of the list; 0 for the last one
+	PageId  tailPid;  // first page of a list: PageId of the last page, where RecordIds are appended
+	PageId  basePid;  // the PageId that the pid deltas are relative to
+} BTPostingHeader;
+
+/**
+* BTLeafNodeT: The class representing a B+tree leaf node with keys of KeyType.
+* The keys are compared and searched through KeyTraits<KeyType>.
+*/
+template <class KeyType>
+class BTLeafNodeT {
 public:
 	/**
 	* Constructor: initialize empty leaf node
 	*/
-	BTLeafNode();
+	BTLeafNodeT();
 
 	/**
 	* Insert the (key, rid) pair to the node.
@@ -30,12 +70,14 @@ public:
 	* @param rid[IN] the RecordId to insert
 	* @return 0 if successful. Return an error code if the node is full.
 	*/
-	RC insert(int key, const RecordId& rid);
+	RC insert(const KeyType& key, const RecordId& rid);
 
 	/**
 	* Insert the (key, rid) pair to the node
 	* and split the node half and half with sibling.
-	* The first key of the sibling node is returned in siblingKey.
+	* The first key of the sibling node is returned in siblingKey, and becomes
+	* the high key of this node; the sibling takes over the old high key and
+	* next node pointer. The caller links this node to the sibling.
 	* Remember that all keys inside a B+tree node should be kept sorted.
 	* @param key[IN] the key to insert.
 	* @param rid[IN] the RecordId to insert.
@@ -43,7 +85,7 @@ public:
 	* @param siblingKey[OUT] the first key in the sibling node after split.
 	* @return 0 if successful. Return an error code if there is an error.
 	*/
-	RC insertAndSplit(int key, const RecordId& rid, BTLeafNode& sibling, int& siblingKey);
+	RC insertAndSplit(const KeyType& key, const RecordId& rid, BTLeafNodeT& sibling, KeyType& siblingKey);
 
 	/**
 	* If searchKey exists in the node, set eid to the index entry
@@ -56,7 +98,24 @@ public:
 	behind the largest key smaller than searchKey.
 	* @return 0 if searchKey is found. If not, RC_NO_SEARCH_RECORD.
 	*/
-	RC locate(int searchKey, int& eid);
+	RC locate(const KeyType& searchKey, int& eid);
+
+	/**
+	* Count the keys smaller than (or, if inclusive, not greater than) searchKey.
+	* Since the keys are sorted, this is also the index of the first entry
+	* behind them.
+	* @param searchKey[IN] the key to compare against
+	* @param inclusive[IN] true to also count the keys equal to searchKey
+	* @return the number of keys smaller than (or equal to) searchKey
+	*/
+	int countBelow(const KeyType& searchKey, bool inclusive);
+
+	/**
+	* Check whether any entry of the node references a posting list.
+	* When none does, every entry is a single (key, rid) pair.
+	* @return true if an entry has a posting list
+	*/
+	bool hasPostings();
 
 	/**
 	* Read the (key, rid) pair from the eid entry.
@@ -65,7 +124,18 @@ public:
 	* @param rid[OUT] the RecordId from the slot
 	* @return 0 if successful. Return an error code if there is an error.
 	*/
-	RC readEntry(int eid, int& key, RecordId& rid);
+	RC readEntry(int eid, KeyType& key, RecordId& rid);
+
+	/**
+	* Replace the count entries from eid on, which all have the same key,
+	* by a single entry of that key with rid.
+	* Used to replace the copies of a duplicated key with a reference to its posting list.
+	* @param eid[IN] the first entry to replace
+	* @param count[IN] the number of entries to replace
+	* @param rid[IN] the RecordId of the entry that replaces them
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC collapse(int eid, int count, const RecordId& rid);
 
 	/**
 	* Return the pid of the next slibling node.
@@ -81,6 +151,41 @@ public:
 	*/
 	RC setNextNodePtr(PageId pid);
 
+	/**
+	* Return the pid of the previous sibling node.
+	* @return the PageId of the previous sibling node; 0 for the first leaf
+	*/
+	PageId getPrevNodePtr();
+
+	/**
+	* Set the previous sibling node PageId.
+	* @param pid[IN] the PageId of the previous sibling node
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC setPrevNodePtr(PageId pid);
+
+	/**
+	* Return the high key of the node: the keys of the node are smaller than it,
+	* and the keys of the nodes to its right are not. The last node has none.
+	* @param key[OUT] the high key
+	* @return true if the node has a high key, false for the last node
+	*/
+	bool getHighKey(KeyType& key);
+
+	/**
+	* Set the high key of the node. It is only used while the node has a next sibling.
+	* @param key[IN] the high key
+	*/
+	void setHighKey(const KeyType& key);
+
+	/**
+	* Check whether searchKey belongs to a node to the right of this one: a
+	* split moved it there after the pointer to this node was read.
+	* @param searchKey[IN] the key being looked up
+	* @return true if the node has a high key and searchKey is not smaller than it
+	*/
+	bool isPastHighKey(const KeyType& searchKey);
+
 	/**
 	* Return the number of keys stored in the node.
 	* @return the number of keys in the node
@@ -105,8 +210,84 @@ public:
 
 	void print();
 
+	/**
+	* Return the maximum number of entries a leaf can hold, when its entries can be packed.
+	* @return the maximum number of entries in a leaf node
+	*/
+	static int getMaxEntries() { return MAX_PACKED_KEYS; }
+
 private:
-	int m_numKeys;
+	/**
+	* Leaf node formats
+	*/
+	static const short PLAIN = 0;
+	static const short PACKED = 1;
+
+	/**
+	* PLAIN page layout: the BTLeafHeader, the high key, the array of keys, then the
+	* array of RecordIds. The keys are contiguous so that a search can compare a
+	* block of keys at once.
+	*/
+	static const int HIGH_KEY_OFFSET = sizeof(BTLeafHeader);
+	static const int KEYS_OFFSET = HIGH_KEY_OFFSET + sizeof(KeyType);
+	static const int MAX_KEYS = (PageFile::PAGE_SIZE - KEYS_OFFSET) / (sizeof(KeyType) + sizeof(RecordId));
+	static const int RIDS_OFFSET = KEYS_OFFSET + MAX_KEYS * sizeof(KeyType);
+
+	/**
+	* PACKED page layout: the BTLeafHeader, the high key, an array of 16-bit key deltas
+	* (key - baseKey), then an array of 32-bit rids ((pid - basePid) << 4 | sid).
+	* A leaf is packed when its keys span less than 64K and its sids are below 16,
+	* which holds for dense keys such as the movie ids. Only int keys are packed.
+	* A node split must be able to store both halves, and a half of at most
+	* MAX_KEYS entries always fits in the plain format, hence the 2 * MAX_KEYS - 1 cap.
+	*/
+	static const int PACKED_ENTRY_SIZE = sizeof(unsigned short) + sizeof(unsigned int);
+	static const int MAX_PACKED_KEYS = !KeyTraits<KeyType>::PACKABLE ? MAX_KEYS :
+		(PageFile::PAGE_SIZE - KEYS_OFFSET) / PACKED_ENTRY_SIZE < 2 * MAX_KEYS - 1 ?
+		(PageFile::PAGE_SIZE - KEYS_OFFSET) / PACKED_ENTRY_SIZE : 2 * MAX_KEYS - 1;
+	static const int PACKED_RIDS_OFFSET = KEYS_OFFSET + MAX_PACKED_KEYS * sizeof(unsigned short);
+	static const int SID_BITS = 4;
+	static const int MAX_PID_DELTA = (1 << (32 - SID_BITS)) - 1;
+
+	/**
+	* Return the format of the node (PLAIN or PACKED).
+	*/
+	short getFormat();
+
+	/**
+	* Decode the key and the rid of the eid-th entry.
+	*/
+	KeyType keyAt(int eid);
+	void ridAt(int eid, RecordId& rid);
+
+	/**
+	* Decode all of the entries into keys and rids.
+	*/
+	void decodeAll(KeyType* keys, RecordId* rids);
+
+	/**
+	* Check whether the count sorted (key, rid) pairs can be stored in the PACKED format.
+	*/
+	static bool canPack(const KeyType* keys, const RecordId* rids, int count);
+
+	/**
+	* Check whether the count sorted (key, rid) pairs fit in a node in any format.
+	*/
+	static bool fits(const KeyType* keys, const RecordId* rids, int count);
+
+	/**
+	* Replace the entries of the node with the count sorted (key, rid) pairs,
+	* packed if they can be, plain otherwise. The sibling pointers and the high key are kept.
+	* @return 0 if successful. RC_NODE_FULL if the entries do not fit in any format.
+	*/
+	RC store(const KeyType* keys, const RecordId* rids, int count);
+
+	/**
+	* Store the number of keys in the node header.
+	* @param count[IN] the new number of keys
+	*/
+	void setKeyCount(int count);
+
 	/**
 	* The main memory buffer for loading the content of the disk page
 	* that contains the node.
@@ -114,39 +295,47 @@ private:
 	char buffer[PageFile::PAGE_SIZE];
 };
 
+typedef BTLeafNodeT<int> BTLeafNode;
+
 
 /**
-* BTNonLeafNode: The class representing a B+tree nonleaf node.
+* BTNonLeafNodeT: The class representing a B+tree nonleaf node with keys of KeyType.
 */
-class BTNonLeafNode {
+template <class KeyType>
+class BTNonLeafNodeT {
 public:
 	/**
 	* Constructor: initialize empty non-leaf node
 	*/
-	BTNonLeafNode();
+	BTNonLeafNodeT();
 
 	/**
-	* Insert a (key, pid) pair to the node.
+	* Insert a (key, pid) pair to the node, for a child that split off the
+	* child in front of key: count of the entries of that child move to pid.
 	* Remember that all keys inside a B+tree node should be kept sorted.
 	* @param key[IN] the key to insert
 	* @param pid[IN] the PageId to insert
+	* @param count[IN] the number of entries under pid
 	* @return 0 if successful. Return an error code if the node is full.
 	*/
-	RC insert(int key, PageId pid);
+	RC insert(const KeyType& key, PageId pid, int count);
 
 	/**
-	* Insert the (key, pid) pair to the node
+	* Insert the (key, pid) pair to the node, like insert(),
 	* and split the node half and half with sibling.
 	* The sibling node MUST be empty when this function is called.
-	* The middle key after the split is returned in midKey.
+	* The middle key after the split is returned in midKey, and becomes the
+	* high key of this node; the sibling takes over the old high key and
+	* right sibling pointer. The caller links this node to the sibling.
 	* Remember that all keys inside a B+tree node should be kept sorted.
 	* @param key[IN] the key to insert
 	* @param pid[IN] the PageId to insert
+	* @param count[IN] the number of entries under pid
 	* @param sibling[IN] the sibling node to split with. This node MUST be empty when this function is called.
 	* @param midKey[OUT] the key in the middle after the split. This key should be inserted to the parent node.
 	* @return 0 if successful. Return an error code if there is an error.
 	*/
-	RC insertAndSplit(int key, PageId pid, BTNonLeafNode& sibling, int& midKey);
+	RC insertAndSplit(const KeyType& key, PageId pid, int count, BTNonLeafNodeT& sibling, KeyType& midKey);
 
 	/**
 	* Given the searchKey, find the child-node pointer to follow and
@@ -156,16 +345,122 @@ public:
 	* @param pid[OUT] the pointer to the child node to follow.
 	* @return 0 if successful. Return an error code if there is an error.
 	*/
-	RC locateChildPtr(int searchKey, PageId& pid);
+	RC locateChildPtr(const KeyType& searchKey, PageId& pid);
+
+	/**
+	* Find the child-node pointer to follow for searchKey, like locateChildPtr(),
+	* and the number of entries under the children in front of it.
+	* @param searchKey[IN] the searchKey that is being looked up
+	* @param pid[OUT] the pointer to the child node to follow
+	* @param before[OUT] the number of entries under the children in front of pid
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC locateChildPtr(const KeyType& searchKey, PageId& pid, int& before);
+
+	/**
+	* Find the child-node pointer to the keys right in front of searchKey:
+	* like locateChildPtr(), but a key equal to searchKey goes left.
+	* @param searchKey[IN] the key whose predecessor is looked up
+	* @param pid[OUT] the pointer to the child node to follow
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC locateChildPtrBefore(const KeyType& searchKey, PageId& pid);
+
+	/**
+	* Return the child-node pointer behind the last key.
+	* Following it at every level leads to the last leaf.
+	* @return the PageId of the child with the largest keys
+	*/
+	PageId getLastChildPtr();
+
+	/**
+	* Return the ith child-node pointer, for i from 0 to getKeyCount().
+	* @param i[IN] the position of the pointer
+	* @return the PageId of the ith child
+	*/
+	PageId getChildPtr(int i);
+
+	/**
+	* Replace the child-node pointer oldPid by newPid, for a child that
+	* was copied to another page.
+	* @param oldPid[IN] the PageId of the child
+	* @param newPid[IN] the PageId of its copy
+	* @return 0 if successful. RC_INVALID_PID if no child is at oldPid.
+	*/
+	RC replaceChildPtr(PageId oldPid, PageId newPid);
+
+	/**
+	* Return the number of (key, RecordId) pairs under the ith child, for i
+	* from 0 to getKeyCount(); every RecordId of a posting list counts.
+	* @param i[IN] the position of the child
+	* @return the number of entries under the ith child
+	*/
+	int getChildCount(int i);
+
+	/**
+	* Set the number of entries under the ith child.
+	* @param i[IN] the position of the child
+	* @param count[IN] the number of entries under it
+	*/
+	void setChildCount(int i, int count);
+
+	/**
+	* Add delta to the number of entries under the child searchKey belongs to.
+	* @param searchKey[IN] the key of the entries inserted
+	* @param delta[IN] the number of entries inserted
+	*/
+	void addChildCount(const KeyType& searchKey, int delta);
+
+	/**
+	* Return the number of entries under all of the children of the node.
+	* @return the number of entries under the node
+	*/
+	int getEntryCount();
+
+	/**
+	* Return the pid of the right sibling on the same level.
+	* @return the PageId of the right sibling; 0 for the last node of the level
+	*/
+	PageId getNextNodePtr();
+
+	/**
+	* Set the pid of the right sibling on the same level.
+	* @param pid[IN] the PageId of the right sibling
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC setNextNodePtr(PageId pid);
+
+	/**
+	* Return the high key of the node: the keys under the node are smaller
+	* than it, and the keys under the nodes to its right are not.
+	* @param key[OUT] the high key
+	* @return true if the node has a high key, false for the last node of its level
+	*/
+	bool getHighKey(KeyType& key);
+
+	/**
+	* Set the high key of the node. It is only used while the node has a right sibling.
+	* @param key[IN] the high key
+	*/
+	void setHighKey(const KeyType& key);
+
+	/**
+	* Check whether searchKey belongs under a node to the right of this one.
+	* @param searchKey[IN] the key being looked up
+	* @return true if the node has a high key and searchKey is not smaller than it
+	*/
+	bool isPastHighKey(const KeyType& searchKey);
 
 	/**
 	* Initialize the root node with (pid1, key, pid2).
 	* @param pid1[IN] the first PageId to insert
+	* @param count1[IN] the number of entries under pid1
 	* @param key[IN] the key that should be inserted between the two PageIds
 	* @param pid2[IN] the PageId to insert behind the key
+	* @param count2[IN] the number of entries under pid2
 	* @return 0 if successful. Return an error code if there is an error.
 	*/
-	RC initializeRoot(PageId pid1, int key, PageId pid2);
+	RC initializeRoot(PageId pid1, int count1, const KeyType& key, PageId pid2, int count2);
 
 	/**
 	* Return the number of keys stored in the node.
@@ -191,9 +486,130 @@ public:
 
 	void print();
 
+	/**
+	* Return the maximum number of keys a non-leaf node can hold.
+	* @return the maximum number of keys in a non-leaf node
+	*/
+	static int getMaxKeys() { return MAX_KEYS; }
 	
 private:
-	int m_numKeys;
+	/**
+	* Page layout: the BTNonLeafHeader, the high key, the array of keys, the
+	* array of child PageIds, then the array of child entry counts. The ith pid
+	* points to the child with the keys in front of the ith key, and the last
+	* pid to the one behind all keys. The ith count is the number of entries
+	* under the ith child, so that the entries in a key range are counted
+	* from the counts on the way down to its ends, without reading the leaves between.
+	*/
+	static const int HIGH_KEY_OFFSET = sizeof(BTNonLeafHeader);
+	static const int KEYS_OFFSET = HIGH_KEY_OFFSET + sizeof(KeyType);
+	static const int MAX_KEYS = (PageFile::PAGE_SIZE - KEYS_OFFSET - sizeof(PageId) - sizeof(int)) / (sizeof(KeyType) + sizeof(PageId) + sizeof(int));
+	static const int PIDS_OFFSET = KEYS_OFFSET + MAX_KEYS * sizeof(KeyType);
+	static const int COUNTS_OFFSET = PIDS_OFFSET + (MAX_KEYS + 1) * sizeof(PageId);
+
+	/**
+	* Store the number of keys in the node header.
+	* @param count[IN] the new number of keys
+	*/
+	void setKeyCount(int count);
+
+	/**
+	* The main memory buffer for loading the content of the disk page
+	* that contains the node.
+	*/
+	char buffer[PageFile::PAGE_SIZE];
+};
+
+typedef BTNonLeafNodeT<int> BTNonLeafNode;
+
+/**
+* BTPostingNode: The class representing a page of a posting list, which holds
+* the RecordIds of a heavily duplicated key outside of the leaf nodes.
+* The leaf node keeps a single entry for the key whose rid references the
+* first page of the list with a negative pid (see BTreeIndex).
+*/
+class BTPostingNode {
+public:
+	/**
+	* Constructor: initialize empty posting page
+	*/
+	BTPostingNode();
+
+	/**
+	* Append rid to the page.
+	* @param rid[IN] the RecordId to append
+	* @return 0 if successful. RC_NODE_FULL if the page is full or
+	*         rid cannot be packed relative to the base pid of the page.
+	*/
+	RC append(const RecordId& rid);
+
+	/**
+	* Read the RecordId of the eid entry.
+	* @param eid[IN] the entry number to read
+	* @param rid[OUT] the RecordId of the entry
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC readEntry(int eid, RecordId& rid);
+
+	/**
+	* Return the number of RecordIds stored in the page.
+	* @return the number of RecordIds in the page
+	*/
+	int getCount();
+
+	/**
+	* Return the pid of the next page of the posting list (0 if there is none).
+	* @return the PageId of the next page
+	*/
+	PageId getNextNodePtr();
+
+	/**
+	* Set the pid of the next page of the posting list.
+	* @param pid[IN] the PageId of the next page
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC setNextNodePtr(PageId pid);
+
+	/**
+	* Return the pid of the last page of the posting list.
+	* Only kept up to date in the first page of the list.
+	* @return the PageId of the last page
+	*/
+	PageId getTailPtr();
+
+	/**
+	* Set the pid of the last page of the posting list.
+	* @param pid[IN] the PageId of the last page
+	*/
+	void setTailPtr(PageId pid);
+
+	/**
+	* Read the content of the node from the page pid in the PageFile pf.
+	* @param pid[IN] the PageId to read
+	* @param pf[IN] PageFile to read from
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC read(PageId pid, const PageFile& pf);
+
+	/**
+	* Write the content of the node to the page pid in the PageFile pf.
+	* @param pid[IN] the PageId to write to
+	* @param pf[IN] PageFile to write to
+	* @return 0 if successful. Return an error code if there is an error.
+	*/
+	RC write(PageId pid, PageFile& pf);
+
+private:
+	/**
+	* Page layout: the BTPostingHeader, then the array of packed RecordIds.
+	* Rows are appended to the table in pid order, so the pids of a key
+	* mostly grow from the first one and pack into 32 bits.
+	*/
+	static const int RIDS_OFFSET = sizeof(BTPostingHeader);
+	static const int MAX_RIDS = (PageFile::PAGE_SIZE - sizeof(BTPostingHeader)) / sizeof(unsigned int);
+	static const int SID_BITS = 4;
+	static const int MAX_PID_DELTA = (1 << (32 - SID_BITS)) - 1;
+
 	/**
 	* The main memory buffer for loading the content of the disk page
 	* that contains the node.
@@ -0,0 +1,347 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "ExternalSort.h"
+#include "BTreeIndex.h"
+#include "HashIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+template <class Record, class Compare>
+ExternalSort<Record, Compare>::ExternalSort(const string& tempName, int memoryPages, const Compare& compare)
+	: name(tempName), compare(compare)
+{
+	// one page for each run being merged and one for the merged output
+	// leaves at least a two-way merge
+	this->memoryPages = max(memoryPages, 3);
+	bufferCapacity = this->memoryPages * RECORDS_PER_PAGE;
+	bufferPos = 0;
+
+	fileOpen[0] = fileOpen[1] = false;
+	current = 0;
+	runCount = 0;
+	mergePasses = 0;
+	sorted = false;
+	winner = 0;
+}
+
+template <class Record, class Compare>
+ExternalSort<Record, Compare>::~ExternalSort()
+{
+	close();
+}
+
+template <class Record, class Compare>
+string ExternalSort<Record, Compare>::fileName(int i) const
+{
+	return name + (i == 0 ? ".sort0" : ".sort1");
+}
+
+/*
+ * Create runFile[i] empty; a file left behind by an earlier sort is overwritten.
+ */
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::createFile(int i)
+{
+	RC rc;
+
+	remove(fileName(i).c_str());
+	if ((rc = runFile[i].open(fileName(i), 'w')) < 0)
+		return rc;
+	fileOpen[i] = true;
+	return 0;
+}
+
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::add(const Record& record)
+{
+	RC rc;
+
+	if (sorted) return RC_INVALID_FILE_MODE;
+
+	buffer.push_back(record);
+	if ((int)buffer.size() == bufferCapacity && (rc = flushBuffer()) < 0)
+		return rc;
+	return 0;
+}
+
+/*
+ * Sort the buffer and append it to runFile[current] as a new run.
+ */
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::flushBuffer()
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+
+	if (!fileOpen[current] && (rc = createFile(current)) < 0)
+		return rc;
+
+	stable_sort(buffer.begin(), buffer.end(), compare);
+
+	Run run;
+	run.firstPid = runFile[current].endPid();
+	run.recordCount = buffer.size();
+
+	PageId pid = run.firstPid;
+	for (size_t i = 0; i < buffer.size(); i += RECORDS_PER_PAGE)
+	{
+		size_t n = min(buffer.size() - i, (size_t)RECORDS_PER_PAGE);
+		memset(page, 0, sizeof(page));
+		memcpy(page, &buffer[i], n * sizeof(Record));
+		if ((rc = runFile[current].write(pid++, page)) < 0)
+			return rc;
+	}
+
+	runs.push_back(run);
+	runCount++;
+	buffer.clear();
+	return 0;
+}
+
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::sort()
+{
+	RC rc;
+
+	if (sorted) return 0;
+	sorted = true;
+
+	// Everything fit in the buffer: no run was written, sort in place
+	if (runs.empty())
+	{
+		stable_sort(buffer.begin(), buffer.end(), compare);
+		bufferPos = 0;
+		return 0;
+	}
+
+	if (!buffer.empty() && (rc = flushBuffer()) < 0)
+		return rc;
+	vector<Record>().swap(buffer);
+
+	// The last merge reads one page of every run, and returns its output
+	// from next() instead of writing it; merge until the runs fit in memory
+	while ((int)runs.size() > memoryPages)
+	{
+		if ((rc = mergePass()) < 0)
+			return rc;
+	}
+
+	return startMerge(0, runs.size());
+}
+
+/*
+ * Merge the runs of runFile[current], (memoryPages - 1) at a time, into
+ * longer runs in the other run file, which then becomes the current one.
+ */
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::mergePass()
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	int output = 1 - current;
+	int fanIn = memoryPages - 1;
+	vector<Run> merged;
+
+	if ((rc = createFile(output)) < 0)
+		return rc;
+
+	for (int first = 0; first < (int)runs.size(); first += fanIn)
+	{
+		if ((rc = startMerge(first, min(fanIn, (int)runs.size() - first))) < 0)
+			return rc;
+
+		Run run;
+		run.firstPid = runFile[output].endPid();
+		run.recordCount = 0;
+
+		PageId pid = run.firstPid;
+		memset(page, 0, sizeof(page));
+		while (!readers[winner].done)
+		{
+			memcpy(page + (run.recordCount % RECORDS_PER_PAGE) * sizeof(Record), &readers[winner].front, sizeof(Record));
+			run.recordCount++;
+			if (run.recordCount % RECORDS_PER_PAGE == 0)
+			{
+				if ((rc = runFile[output].write(pid++, page)) < 0)
+					return rc;
+				memset(page, 0, sizeof(page));
+			}
+
+			if ((rc = advance(readers[winner])) < 0)
+				return rc;
+			replay();
+		}
+		if (run.recordCount % RECORDS_PER_PAGE != 0 && (rc = runFile[output].write(pid, page)) < 0)
+			return rc;
+
+		merged.push_back(run);
+	}
+
+	// The input runs are no longer needed
+	runFile[current].close();
+	fileOpen[current] = false;
+	remove(fileName(current).c_str());
+
+	current = output;
+	runs.swap(merged);
+	mergePasses++;
+	return 0;
+}
+
+/*
+ * Set up a loser tree over runs[first .. first + count - 1] of runFile[current].
+ */
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::startMerge(int first, int count)
+{
+	RC rc;
+
+	readers.resize(count);
+	for (int i = 0; i < count; i++)
+	{
+		readers[i].run = runs[first + i];
+		readers[i].readCount = 0;
+		readers[i].done = false;
+		if ((rc = advance(readers[i])) < 0)
+			return rc;
+	}
+
+	loser.assign(count, -1);
+	winner = (count == 1) ? 0 : buildTree(1);
+	return 0;
+}
+
+/*
+ * Move reader to the next record of its run, reading the next page when
+ * the current one is used up.
+ */
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::advance(RunReader& reader)
+{
+	RC rc;
+
+	if (reader.readCount == reader.run.recordCount)
+	{
+		reader.done = true;
+		return 0;
+	}
+
+	int slot = reader.readCount % RECORDS_PER_PAGE;
+	if (slot == 0 && (rc = runFile[current].read(reader.run.firstPid + reader.readCount / RECORDS_PER_PAGE, reader.page)) < 0)
+		return rc;
+
+	memcpy(&reader.front, reader.page + slot * sizeof(Record), sizeof(Record));
+	reader.readCount++;
+	return 0;
+}
+
+/*
+ * Whether run a comes out before run b. A finished run loses to every run,
+ * and equal records come out of the earlier run first, which keeps the sort stable.
+ */
+template <class Record, class Compare>
+bool ExternalSort<Record, Compare>::beats(int a, int b) const
+{
+	if (readers[a].done) return false;
+	if (readers[b].done) return true;
+	if (compare(readers[a].front, readers[b].front)) return true;
+	if (compare(readers[b].front, readers[a].front)) return false;
+	return a < b;
+}
+
+/*
+ * Play the matches below node and return the winner. With k runs, nodes
+ * 1..k-1 are the internal nodes and node k + i is the leaf of run i.
+ */
+template <class Record, class Compare>
+int ExternalSort<Record, Compare>::buildTree(int node)
+{
+	int k = readers.size();
+	if (node >= k) return node - k;
+
+	int a = buildTree(2 * node);
+	int b = buildTree(2 * node + 1);
+	if (beats(a, b))
+	{
+		loser[node] = b;
+		return a;
+	}
+	loser[node] = a;
+	return b;
+}
+
+/*
+ * The front of the winning run changed: replay its matches on the way up
+ * from its leaf. Each match is against the loser stored at the node, so
+ * only log2(k) comparisons are needed.
+ */
+template <class Record, class Compare>
+void ExternalSort<Record, Compare>::replay()
+{
+	int k = readers.size();
+	int s = winner;
+
+	for (int node = (s + k) / 2; node > 0; node /= 2)
+	{
+		if (beats(loser[node], s))
+			swap(loser[node], s);
+	}
+	winner = s;
+}
+
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::next(Record& record)
+{
+	RC rc;
+
+	if (!sorted) return RC_INVALID_FILE_MODE;
+
+	if (runs.empty())
+	{
+		if (bufferPos == buffer.size()) return RC_NO_SUCH_RECORD;
+		record = buffer[bufferPos++];
+		return 0;
+	}
+
+	if (readers[winner].done) return RC_NO_SUCH_RECORD;
+	record = readers[winner].front;
+	if ((rc = advance(readers[winner])) < 0)
+		return rc;
+	replay();
+	return 0;
+}
+
+template <class Record, class Compare>
+RC ExternalSort<Record, Compare>::close()
+{
+	for (int i = 0; i < 2; i++)
+	{
+		if (fileOpen[i])
+		{
+			runFile[i].close();
+			fileOpen[i] = false;
+			remove(fileName(i).c_str());
+		}
+	}
+
+	vector<Record>().swap(buffer);
+	bufferPos = 0;
+	runs.clear();
+	readers.clear();
+	loser.clear();
+	sorted = false;
+	return 0;
+}
+
+// The records bruinbase sorts
+template class ExternalSort< IndexEntry<int> >;
+template class ExternalSort< IndexEntry<ValueKey> >;
+template class ExternalSort< IndexEntry<CoveringKey> >;
+template class ExternalSort< HashEntry, HashBucketOrder >;
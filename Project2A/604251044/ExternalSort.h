@@ -0,0 +1,144 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef EXTERNALSORT_H
+#define EXTERNALSORT_H
+
+#include <functional>
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * Sorts a stream of fixed-size records within a memory budget.
+ * Records are collected in memory until the budget is used up, and each
+ * full buffer is sorted and written out as a run to a temporary PageFile.
+ * The runs are then merged with a loser tree, reading one page of each run
+ * at a time; when there are more runs than the budget has pages for, extra
+ * merge passes combine them into longer runs first. The last merge is not written out:
+ * next() returns its records directly. Input that fits in the budget is
+ * sorted in memory and never touches the disk.
+ *
+ * Record must be a plain struct that can be copied with memcpy, and
+ * Compare a strict weak ordering on it. Equal records come out in the
+ * order they were added.
+ *
+ * Usage: add() every record, call sort(), then call next() until it
+ * returns RC_NO_SUCH_RECORD. The temporary files are removed by close()
+ * (or when the object is destroyed).
+ */
+template <class Record, class Compare = std::less<Record> >
+class ExternalSort {
+ public:
+  static const int RECORDS_PER_PAGE = PageFile::PAGE_SIZE / sizeof(Record);
+  static const int DEFAULT_MEMORY_PAGES = 64;  // 64KB
+
+  /**
+   * @param tempName[IN] the prefix of the temporary run files; the files are
+   *                     named tempName.sort0 and tempName.sort1
+   * @param memoryPages[IN] the memory budget in pages (at least 3): the size of
+   *                        the sort buffer, and the number of runs merged at once
+   * @param compare[IN] the ordering of the records
+   */
+  ExternalSort(const std::string& tempName, int memoryPages = DEFAULT_MEMORY_PAGES,
+               const Compare& compare = Compare());
+  ~ExternalSort();
+
+  /**
+   * Add a record to the input. Writes a run out when the buffer is full.
+   * @param record[IN] the record to add
+   * @return error code. 0 if no error
+   */
+  RC add(const Record& record);
+
+  /**
+   * Finish the input and prepare the sorted output: sort the last buffer,
+   * and merge the runs down to at most memoryPages runs.
+   * @return error code. 0 if no error
+   */
+  RC sort();
+
+  /**
+   * Return the next record in sorted order.
+   * @param record[OUT] the next record
+   * @return error code. 0 if no error. RC_NO_SUCH_RECORD after the last record
+   */
+  RC next(Record& record);
+
+  /**
+   * Remove the temporary files and drop all records.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * @return the number of runs written out by add() and sort(); 0 if the
+   *         input was sorted in memory
+   */
+  int getRunCount() const { return runCount; }
+
+  /**
+   * @return the number of merge passes that wrote their output to disk
+   */
+  int getMergePassCount() const { return mergePasses; }
+
+ private:
+  /**
+   * A sorted run stored in consecutive pages of a run file.
+   * Every page but the last holds RECORDS_PER_PAGE records.
+   */
+  struct Run {
+    PageId firstPid;
+    int    recordCount;
+  };
+
+  /**
+   * The read position of one run during a merge. It holds the page
+   * currently being read, and the record at the front of the run.
+   */
+  struct RunReader {
+    Run    run;
+    int    readCount;   // the number of records of the run read so far
+    bool   done;        // true when the run has no records left
+    Record front;       // the smallest record of the run not yet returned
+    char   page[PageFile::PAGE_SIZE];
+  };
+
+  std::string fileName(int i) const;
+  RC createFile(int i);
+  RC flushBuffer();
+  RC mergePass();
+  RC startMerge(int first, int count);
+  RC advance(RunReader& reader);
+  bool beats(int a, int b) const;
+  int buildTree(int node);
+  void replay();
+
+  std::string name;
+  int memoryPages;
+  int bufferCapacity;       // the number of records the sort buffer holds
+  Compare compare;
+
+  std::vector<Record> buffer;  // the records of the run being collected
+  size_t bufferPos;            // the next record of buffer to return when nothing was spilled
+
+  PageFile runFile[2];      // the runs of the current pass, and the output of a merge pass
+  bool fileOpen[2];
+  int current;              // the runFile holding the current runs
+  std::vector<Run> runs;    // the runs in runFile[current]
+  int runCount;
+  int mergePasses;
+  bool sorted;
+
+  // The loser tree of the merge in progress: loser[1..k-1] hold the run that
+  // lost the match at each internal node, and winner the run with the smallest front
+  std::vector<RunReader> readers;
+  std::vector<int> loser;
+  int winner;
+};
+
+#endif /* EXTERNALSORT_H */
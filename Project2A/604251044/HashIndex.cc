@@ -0,0 +1,429 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "HashIndex.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+// A bucket page is the number of entries in it, the next page of the bucket
+// in the overflow file (-1 if none), then the entries
+static const int BUCKET_HEADER = sizeof(int) + sizeof(PageId);
+
+static int getCount(const char* page)
+{
+	int count;
+	memcpy(&count, page, sizeof(int));
+	return count;
+}
+
+static PageId getNext(const char* page)
+{
+	PageId next;
+	memcpy(&next, page + sizeof(int), sizeof(PageId));
+	return next;
+}
+
+static void setHeader(char* page, int count, PageId next)
+{
+	memcpy(page, &count, sizeof(int));
+	memcpy(page + sizeof(int), &next, sizeof(PageId));
+}
+
+static HashEntry* entryPtr(char* page, int n)
+{
+	return (HashEntry*)(page + BUCKET_HEADER) + n;
+}
+
+/*
+ * Mix the bits of a key, so that the low bits that pick a bucket depend on all of them.
+ */
+static unsigned hashKey(int key)
+{
+	unsigned h = (unsigned)key;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+int HashIndex::bucketOf(int key, int level, int next)
+{
+	unsigned h = hashKey(key);
+	int bucket = h & ((1u << level) - 1);
+
+	// The buckets before next were split this round, on one more bit
+	if (bucket < next)
+		bucket = h & ((2u << level) - 1);
+	return bucket;
+}
+
+bool HashBucketOrder::operator()(const HashEntry& a, const HashEntry& b) const
+{
+	return HashIndex::bucketOf(a.key, level, next) < HashIndex::bucketOf(b.key, level, next);
+}
+
+HashIndex::HashIndex()
+{
+	memset(&meta, 0, sizeof(meta));
+	overflowEnd = 0;
+	mode = 'r';
+	sorter = NULL;
+}
+
+HashIndex::~HashIndex()
+{
+	delete sorter;
+}
+
+/*
+ * Open the index file and its overflow file; a new index has one empty bucket.
+ */
+RC HashIndex::open(const string& indexname, char mode)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+
+	name = indexname;
+	this->mode = (mode == 'w' || mode == 'W') ? 'w' : 'r';
+	if ((rc = pf.open(indexname, mode)) < 0)
+		return rc;
+	if ((rc = overflow.open(indexname + ".ovf", mode)) < 0) {
+		pf.close();
+		return rc;
+	}
+	overflowEnd = overflow.endPid();
+
+	if (pf.endPid() == 0) {
+		meta.magic = MAGIC;
+		meta.version = FORMAT_VERSION;
+		meta.level = 0;
+		meta.next = 0;
+		meta.entryCount = 0;
+		meta.freeOverflow = -1;
+
+		memset(page, 0, sizeof(page));
+		setHeader(page, 0, -1);
+		if (this->mode != 'w')
+			rc = RC_INVALID_FILE_FORMAT;
+		else if ((rc = writeMetadata()) == 0)
+			rc = pf.write(1, page);
+	} else if ((rc = pf.read(0, page)) == 0) {
+		memcpy(&meta, page, sizeof(meta));
+		if (meta.magic != MAGIC || meta.version != FORMAT_VERSION)
+			rc = RC_INVALID_FILE_FORMAT;
+	}
+
+	if (rc < 0) {
+		overflow.close();
+		pf.close();
+	}
+	return rc;
+}
+
+RC HashIndex::close()
+{
+	RC rc = 0, tmp;
+
+	delete sorter;
+	sorter = NULL;
+
+	if (mode == 'w')
+		rc = writeMetadata();
+	if ((tmp = overflow.close()) < 0 && rc == 0)
+		rc = tmp;
+	if ((tmp = pf.close()) < 0 && rc == 0)
+		rc = tmp;
+	return rc;
+}
+
+RC HashIndex::writeMetadata()
+{
+	char page[PageFile::PAGE_SIZE];
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, &meta, sizeof(meta));
+	return pf.write(0, page);
+}
+
+/*
+ * Insert an entry into the first page of its bucket with room for it,
+ * adding an overflow page to the bucket if all are full.
+ */
+RC HashIndex::insert(int key, const RecordId& rid)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	PageFile* file = &pf;
+	PageId pid = bucketOf(key, meta.level, meta.next) + 1;
+	HashEntry entry;
+
+	if (mode != 'w')
+		return RC_INVALID_FILE_MODE;
+
+	entry.key = key;
+	entry.rid = rid;
+	for (;;) {
+		if ((rc = file->read(pid, page)) < 0)
+			return rc;
+
+		int count = getCount(page);
+		PageId next = getNext(page);
+		if (count < BUCKET_CAPACITY) {
+			*entryPtr(page, count) = entry;
+			setHeader(page, count + 1, next);
+			if ((rc = file->write(pid, page)) < 0)
+				return rc;
+			break;
+		}
+
+		if (next < 0) {
+			// The new overflow page is written before the page that links to it
+			char newPage[PageFile::PAGE_SIZE];
+			memset(newPage, 0, sizeof(newPage));
+			*entryPtr(newPage, 0) = entry;
+			setHeader(newPage, 1, -1);
+			if ((rc = allocateOverflow(next)) < 0 || (rc = overflow.write(next, newPage)) < 0)
+				return rc;
+
+			setHeader(page, count, next);
+			if ((rc = file->write(pid, page)) < 0)
+				return rc;
+			break;
+		}
+
+		file = &overflow;
+		pid = next;
+	}
+
+	meta.entryCount++;
+	if ((long long)meta.entryCount * 100 > (long long)MAX_FILL * BUCKET_CAPACITY * getBucketCount())
+		return split();
+	return 0;
+}
+
+RC HashIndex::lookup(int key, vector<RecordId>& rids)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	PageFile* file = &pf;
+	PageId pid = bucketOf(key, meta.level, meta.next) + 1;
+
+	while (pid >= 0) {
+		if ((rc = file->read(pid, page)) < 0)
+			return rc;
+
+		int count = getCount(page);
+		for (int i = 0; i < count; i++) {
+			HashEntry* entry = entryPtr(page, i);
+			if (entry->key == key)
+				rids.push_back(entry->rid);
+		}
+
+		file = &overflow;
+		pid = getNext(page);
+	}
+	return 0;
+}
+
+/*
+ * Read every entry of a bucket, and the overflow pages that hold them.
+ */
+RC HashIndex::readChain(int bucket, vector<HashEntry>& entries, vector<PageId>& overflowPids)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	PageFile* file = &pf;
+	PageId pid = bucket + 1;
+
+	while (pid >= 0) {
+		if ((rc = file->read(pid, page)) < 0)
+			return rc;
+
+		int count = getCount(page);
+		entries.insert(entries.end(), entryPtr(page, 0), entryPtr(page, count));
+
+		pid = getNext(page);
+		if (pid >= 0)
+			overflowPids.push_back(pid);
+		file = &overflow;
+	}
+	return 0;
+}
+
+/*
+ * Write the entries of a bucket into its page and as many new overflow
+ * pages as they need.
+ */
+RC HashIndex::writeChain(int bucket, const vector<HashEntry>& entries)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	PageFile* file = &pf;
+	PageId pid = bucket + 1;
+	size_t pos = 0;
+
+	do {
+		int count = min((size_t)BUCKET_CAPACITY, entries.size() - pos);
+		PageId next = -1;
+		if (pos + count < entries.size() && (rc = allocateOverflow(next)) < 0)
+			return rc;
+
+		memset(page, 0, sizeof(page));
+		setHeader(page, count, next);
+		if (count > 0)
+			memcpy(entryPtr(page, 0), &entries[pos], count * sizeof(HashEntry));
+		if ((rc = file->write(pid, page)) < 0)
+			return rc;
+
+		pos += count;
+		file = &overflow;
+		pid = next;
+	} while (pid >= 0);
+
+	return 0;
+}
+
+/*
+ * Take a page of the overflow file: a freed one if any, or a new one at the end.
+ */
+RC HashIndex::allocateOverflow(PageId& pid)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+
+	if (meta.freeOverflow < 0) {
+		pid = overflowEnd++;
+		return 0;
+	}
+
+	pid = meta.freeOverflow;
+	if ((rc = overflow.read(pid, page)) < 0)
+		return rc;
+	meta.freeOverflow = getNext(page);
+	return 0;
+}
+
+/*
+ * Split the bucket at next: the entries whose hash has the next bit set
+ * move to a new bucket at the end. The overflow pages of the bucket are
+ * freed, and both buckets are written again from scratch.
+ */
+RC HashIndex::split()
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	vector<HashEntry> entries, stay, moved;
+	vector<PageId> overflowPids;
+	int bucket = meta.next;
+	int newBucket = bucket + (1 << meta.level);
+
+	if ((rc = readChain(bucket, entries, overflowPids)) < 0)
+		return rc;
+	for (size_t i = 0; i < overflowPids.size(); i++) {
+		memset(page, 0, sizeof(page));
+		setHeader(page, 0, meta.freeOverflow);
+		if ((rc = overflow.write(overflowPids[i], page)) < 0)
+			return rc;
+		meta.freeOverflow = overflowPids[i];
+	}
+
+	if (++meta.next == (1 << meta.level)) {
+		meta.level++;
+		meta.next = 0;
+	}
+	for (size_t i = 0; i < entries.size(); i++) {
+		if (bucketOf(entries[i].key, meta.level, meta.next) == bucket)
+			stay.push_back(entries[i]);
+		else
+			moved.push_back(entries[i]);
+	}
+
+	if ((rc = writeChain(newBucket, moved)) < 0)
+		return rc;
+	return writeChain(bucket, stay);
+}
+
+/*
+ * Size the buckets for count entries at MAX_FILL, and start collecting the pairs.
+ * The number of buckets is a power of two: until a bucket is split, it gets
+ * the keys of two buckets that were, and would overflow where they do not.
+ */
+RC HashIndex::beginBulkLoad(int count)
+{
+	if (mode != 'w')
+		return RC_INVALID_FILE_MODE;
+	if (meta.entryCount != 0 || getBucketCount() != 1 || sorter != NULL)
+		return RC_INVALID_FILE_MODE;
+
+	meta.level = 0;
+	meta.next = 0;
+	while ((long long)MAX_FILL * BUCKET_CAPACITY * (1LL << meta.level) < (long long)count * 100)
+		meta.level++;
+
+	typedef ExternalSort<HashEntry, HashBucketOrder> BucketSort;
+	sorter = new BucketSort(name, BucketSort::DEFAULT_MEMORY_PAGES, HashBucketOrder(meta.level, meta.next));
+	return 0;
+}
+
+RC HashIndex::bulkInsert(int key, const RecordId& rid)
+{
+	HashEntry entry;
+
+	if (sorter == NULL)
+		return RC_INVALID_FILE_MODE;
+
+	entry.key = key;
+	entry.rid = rid;
+	return sorter->add(entry);
+}
+
+/*
+ * Write the buckets in order, each from the run of sorted pairs that falls in it.
+ */
+RC HashIndex::endBulkLoad()
+{
+	RC rc;
+	HashEntry entry;
+	vector<HashEntry> entries;
+	int bucket = 0;
+
+	if (sorter == NULL)
+		return RC_INVALID_FILE_MODE;
+	if ((rc = sorter->sort()) < 0)
+		goto end_bulk_load;
+
+	while ((rc = sorter->next(entry)) == 0) {
+		int entryBucket = bucketOf(entry.key, meta.level, meta.next);
+		for (; bucket < entryBucket; bucket++) {
+			if ((rc = writeChain(bucket, entries)) < 0)
+				goto end_bulk_load;
+			entries.clear();
+		}
+		entries.push_back(entry);
+		meta.entryCount++;
+	}
+
+	// only the end of the sorted pairs ends the load; a failed read of a run
+	// would leave the index without the pairs behind it
+	if (rc != RC_NO_SUCH_RECORD)
+		goto end_bulk_load;
+	for (; bucket < getBucketCount(); bucket++) {
+		if ((rc = writeChain(bucket, entries)) < 0)
+			goto end_bulk_load;
+		entries.clear();
+	}
+	rc = writeMetadata();
+
+end_bulk_load:
+	delete sorter;
+	sorter = NULL;
+	return rc;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef HASHINDEX_H
+#define HASHINDEX_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+#include "RecordFile.h"
+#include "ExternalSort.h"
+
+/**
+ * A (key, RecordId) pair in a bucket of a HashIndex.
+ */
+typedef struct {
+  int       key;
+  RecordId  rid;
+} HashEntry;
+
+/**
+ * The content of page 0 of a hash index file.
+ */
+typedef struct {
+  int     magic;         // HashIndex::MAGIC
+  int     version;       // HashIndex::FORMAT_VERSION
+  int     level;         // the round of splits: 2^level buckets when it started
+  int     next;          // the next bucket to split in this round
+  int     entryCount;    // the number of entries in the index
+  PageId  freeOverflow;  // the first free page of the overflow file; -1 if none
+} HashMetadata;
+
+/**
+ * Orders HashEntry records by the bucket of their key, for the bulk load
+ * of a HashIndex with 2^level + next buckets.
+ */
+struct HashBucketOrder {
+  int level;
+  int next;
+
+  HashBucketOrder(int level = 0, int next = 0) : level(level), next(next) { }
+  bool operator()(const HashEntry& a, const HashEntry& b) const;
+};
+
+/**
+ * A hash index on the key column of a table, by linear hashing.
+ *
+ * Bucket b is page b + 1 of the index file, so the bucket of a key is read
+ * straight from the metadata in page 0, without a directory: an equality
+ * lookup reads one index page, unless the bucket has overflowed. A bucket
+ * that is full links to overflow pages, kept in a separate file
+ * (<index>.ovf) so that the buckets stay in consecutive pages.
+ *
+ * The index grows one bucket at a time: whenever the entries fill more than
+ * MAX_FILL percent of the buckets, the bucket at next is split into itself
+ * and a new last bucket, with one more bit of the hash.
+ */
+class HashIndex {
+ public:
+  static const int MAGIC = 0x48494458;            // "HIDX"
+  static const int FORMAT_VERSION = 1;
+  static const int BUCKET_CAPACITY = (PageFile::PAGE_SIZE - sizeof(int) - sizeof(PageId)) / sizeof(HashEntry);
+  static const int MAX_FILL = 75;                 // percent of the bucket capacity
+
+  HashIndex();
+  ~HashIndex();
+
+  /**
+   * Open the index file in read or write mode.
+   * Under 'w' mode, the index file is created if it does not exist.
+   * @param indexname[IN] the name of the index file
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if the file
+   *         is not a hash index of this version of bruinbase
+   */
+  RC open(const std::string& indexname, char mode);
+
+  /**
+   * Write the metadata out, and close the index.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert a (key, RecordId) pair into the index.
+   * @param key[IN] the key
+   * @param rid[IN] the RecordId of the record
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const RecordId& rid);
+
+  /**
+   * Find the RecordIds of every entry with key.
+   * @param key[IN] the key to find
+   * @param rids[OUT] the RecordIds found are appended to it, in insertion order
+   * @return error code. 0 if no error
+   */
+  RC lookup(int key, std::vector<RecordId>& rids);
+
+  /**
+   * Start building the index from (key, RecordId) pairs in any order.
+   * The buckets are sized for count entries up front, and endBulkLoad()
+   * writes each one once, after sorting the pairs by bucket.
+   * The index must be empty.
+   * @param count[IN] the number of pairs that will be passed to bulkInsert()
+   * @return error code. 0 if no error. RC_INVALID_FILE_MODE if the index is not empty
+   */
+  RC beginBulkLoad(int count);
+
+  /**
+   * Add a (key, RecordId) pair to a bulk load.
+   * @return error code. 0 if no error
+   */
+  RC bulkInsert(int key, const RecordId& rid);
+
+  /**
+   * Finish a bulk load: write out every bucket.
+   * @return error code. 0 if no error
+   */
+  RC endBulkLoad();
+
+  /**
+   * @return the bucket of key in an index with 2^level + next buckets
+   */
+  static int bucketOf(int key, int level, int next);
+
+  /**
+   * @return the number of entries in the index
+   */
+  int getEntryCount() const { return meta.entryCount; }
+
+  /**
+   * @return the number of buckets
+   */
+  int getBucketCount() const { return (1 << meta.level) + meta.next; }
+
+ private:
+  RC writeMetadata();
+  RC readChain(int bucket, std::vector<HashEntry>& entries, std::vector<PageId>& overflowPids);
+  RC writeChain(int bucket, const std::vector<HashEntry>& entries);
+  RC allocateOverflow(PageId& pid);
+  RC split();
+
+  std::string name;    /// the name of the index file
+  PageFile pf;         /// page 0 is the metadata, page b + 1 is bucket b
+  PageFile overflow;   /// the overflow pages of the buckets
+  PageId overflowEnd;  /// the first page of the overflow file never used
+  HashMetadata meta;
+  char mode;
+  ExternalSort<HashEntry, HashBucketOrder>* sorter;  /// the pairs of a bulk load
+};
+
+#endif /* HASHINDEX_H */
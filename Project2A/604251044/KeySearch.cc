@@ -0,0 +1,259 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "KeySearch.h"
+#include <climits>
+#include <cstring>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYSEARCH_X86
+#include <immintrin.h>
+#endif
+
+/*
+ * Scalar search: each step halves the range and picks the half without a
+ * branch on the comparison, so the loop runs log2(count) times for every key.
+ * Keys smaller than bound are counted.
+ */
+static int countBelowScalar(const char* keys, int count, int bound)
+{
+  if (count == 0) return 0;
+
+  // lo advances by half when the key in front of the upper half is still
+  // smaller than bound; the mask keeps the comparison result out of the branches
+  int lo = 0;
+  int n = count;
+  while (n > 1) {
+    int half = n / 2;
+    int midKey;
+    memcpy(&midKey, keys + (lo + half - 1) * sizeof(int), sizeof(int));
+    lo += half & -(int)(midKey < bound);
+    n -= half;
+  }
+
+  int lastKey;
+  memcpy(&lastKey, keys + lo * sizeof(int), sizeof(int));
+  return lo + (lastKey < bound);
+}
+
+/*
+ * Scalar search over 16-bit deltas, the same as countBelowScalar().
+ */
+static int countDeltasBelowScalar(const char* deltas, int count, int bound)
+{
+  if (count == 0) return 0;
+
+  int lo = 0;
+  int n = count;
+  while (n > 1) {
+    int half = n / 2;
+    unsigned short midDelta;
+    memcpy(&midDelta, deltas + (lo + half - 1) * sizeof(unsigned short), sizeof(unsigned short));
+    lo += half & -(int)(midDelta < bound);
+    n -= half;
+  }
+
+  unsigned short lastDelta;
+  memcpy(&lastDelta, deltas + lo * sizeof(unsigned short), sizeof(unsigned short));
+  return lo + (lastDelta < bound);
+}
+
+#ifdef KEYSEARCH_X86
+
+/*
+ * SSE4.2 search: compare four keys at a time against the broadcast bound
+ * and add up the lanes that are smaller. The keys are sorted, so counting
+ * every smaller key gives the same answer as a search, without any branch
+ * depending on the keys.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static int countBelowSSE(const char* keys, int count, int bound)
+{
+  __m128i b = _mm_set1_epi32(bound);
+  int below = 0;
+  int i = 0;
+
+  for (; i + 4 <= count; i += 4) {
+    __m128i k = _mm_loadu_si128((const __m128i*)(keys + i * sizeof(int)));
+    __m128i lt = _mm_cmpgt_epi32(b, k);
+    below += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+  }
+
+  // the last (count % 4) keys
+  for (; i < count; i++) {
+    int key;
+    memcpy(&key, keys + i * sizeof(int), sizeof(int));
+    below += (key < bound);
+  }
+
+  return below;
+}
+
+/*
+ * AVX2 search: the same as the SSE4.2 search, eight keys at a time.
+ */
+__attribute__((target("avx2,popcnt")))
+static int countBelowAVX2(const char* keys, int count, int bound)
+{
+  __m256i b = _mm256_set1_epi32(bound);
+  int below = 0;
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m256i k = _mm256_loadu_si256((const __m256i*)(keys + i * sizeof(int)));
+    __m256i lt = _mm256_cmpgt_epi32(b, k);
+    below += __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(lt)));
+  }
+
+  // a block of four, then the last (count % 4) keys
+  if (i + 4 <= count) {
+    __m128i k = _mm_loadu_si128((const __m128i*)(keys + i * sizeof(int)));
+    __m128i lt = _mm_cmpgt_epi32(_mm256_castsi256_si128(b), k);
+    below += __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(lt)));
+    i += 4;
+  }
+  for (; i < count; i++) {
+    int key;
+    memcpy(&key, keys + i * sizeof(int), sizeof(int));
+    below += (key < bound);
+  }
+
+  return below;
+}
+
+/*
+ * SSE4.2 search over 16-bit deltas: the same as countBelowSSE(), eight
+ * deltas at a time. There is no unsigned 16-bit compare, so the deltas and
+ * the bound are flipped into signed range by toggling their top bit.
+ * The byte mask has two bits per delta.
+ */
+__attribute__((target("sse4.2,popcnt")))
+static int countDeltasBelowSSE(const char* deltas, int count, int bound)
+{
+  __m128i flip = _mm_set1_epi16((short)0x8000);
+  __m128i b = _mm_set1_epi16((short)(bound ^ 0x8000));
+  int below = 0;
+  int i = 0;
+
+  for (; i + 8 <= count; i += 8) {
+    __m128i d = _mm_loadu_si128((const __m128i*)(deltas + i * sizeof(unsigned short)));
+    __m128i lt = _mm_cmpgt_epi16(b, _mm_xor_si128(d, flip));
+    below += __builtin_popcount(_mm_movemask_epi8(lt));
+  }
+  below /= 2;
+
+  // the last (count % 8) deltas
+  for (; i < count; i++) {
+    unsigned short delta;
+    memcpy(&delta, deltas + i * sizeof(unsigned short), sizeof(unsigned short));
+    below += (delta < bound);
+  }
+
+  return below;
+}
+
+/*
+ * AVX2 search over 16-bit deltas: the same as the SSE4.2 one, sixteen
+ * deltas at a time.
+ */
+__attribute__((target("avx2,popcnt")))
+static int countDeltasBelowAVX2(const char* deltas, int count, int bound)
+{
+  __m256i flip = _mm256_set1_epi16((short)0x8000);
+  __m256i b = _mm256_set1_epi16((short)(bound ^ 0x8000));
+  int below = 0;
+  int i = 0;
+
+  for (; i + 16 <= count; i += 16) {
+    __m256i d = _mm256_loadu_si256((const __m256i*)(deltas + i * sizeof(unsigned short)));
+    __m256i lt = _mm256_cmpgt_epi16(b, _mm256_xor_si256(d, flip));
+    below += __builtin_popcount(_mm256_movemask_epi8(lt));
+  }
+
+  // a block of eight, then the last (count % 8) deltas
+  if (i + 8 <= count) {
+    __m128i d = _mm_loadu_si128((const __m128i*)(deltas + i * sizeof(unsigned short)));
+    __m128i lt = _mm_cmpgt_epi16(_mm256_castsi256_si128(b), _mm_xor_si128(d, _mm256_castsi256_si128(flip)));
+    below += __builtin_popcount(_mm_movemask_epi8(lt));
+    i += 8;
+  }
+  below /= 2;
+
+  for (; i < count; i++) {
+    unsigned short delta;
+    memcpy(&delta, deltas + i * sizeof(unsigned short), sizeof(unsigned short));
+    below += (delta < bound);
+  }
+
+  return below;
+}
+
+#endif // KEYSEARCH_X86
+
+/*
+ * pick the widest search the CPU supports. __builtin_cpu_supports() reads
+ * the CPUID feature bits, so the binary runs on CPUs without AVX2 as well.
+ */
+static CountBelowFunc pickCountBelow()
+{
+#ifdef KEYSEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    return countBelowAVX2;
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+    return countBelowSSE;
+#endif
+  return countBelowScalar;
+}
+
+static CountBelowFunc pickCountDeltasBelow()
+{
+#ifdef KEYSEARCH_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt"))
+    return countDeltasBelowAVX2;
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt"))
+    return countDeltasBelowSSE;
+#endif
+  return countDeltasBelowScalar;
+}
+
+int countKeysBelow(const char* keys, int count, int searchKey, bool inclusive)
+{
+  static const CountBelowFunc countBelow = pickCountBelow();
+
+  // Keys smaller than bound are counted: searchKey + 1 turns <= into <
+  // (searchKey == INT_MAX counts everything when inclusive)
+  if (inclusive && searchKey == INT_MAX) return count;
+  int bound = inclusive ? searchKey + 1 : searchKey;
+
+  return countBelow(keys, count, bound);
+}
+
+int countDeltasBelow(const char* deltas, int count, int base, int searchKey, bool inclusive)
+{
+  static const CountBelowFunc countBelow = pickCountDeltasBelow();
+
+  // Turn the search key into a bound on the deltas: every delta is below a
+  // bound past 0xFFFF, and none is below a bound of 0 or less
+  long long bound = (long long)searchKey - base + (inclusive ? 1 : 0);
+  if (bound <= 0) return 0;
+  if (bound > 0xFFFF) return count;
+
+  return countBelow(deltas, count, (int)bound);
+}
+
+CountBelowFunc findKeySearch(const char* name)
+{
+  if (strcmp(name, "binary") == 0) return countBelowScalar;
+#ifdef KEYSEARCH_X86
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("popcnt")) return NULL;
+  if (strcmp(name, "sse4.2") == 0 && __builtin_cpu_supports("sse4.2")) return countBelowSSE;
+  if (strcmp(name, "avx2") == 0 && __builtin_cpu_supports("avx2")) return countBelowAVX2;
+#endif
+  return NULL;
+}
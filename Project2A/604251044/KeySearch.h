@@ -0,0 +1,57 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef KEYSEARCH_H
+#define KEYSEARCH_H
+
+/**
+ * Count the keys smaller than searchKey (or, if inclusive, not greater
+ * than it) in an array of int keys sorted in ascending order.
+ * Since the keys are sorted, the count is also the position of the first
+ * key greater than (or equal to) searchKey.
+ *
+ * On x86 CPUs with AVX2 or SSE4.2 (detected once through CPUID) the keys
+ * are compared against the broadcast searchKey a block at a time and the
+ * comparison masks are added up with popcount; otherwise a branch-free
+ * binary search is used.
+ *
+ * @param keys[IN] the array of int keys; it does not need to be aligned
+ * @param count[IN] the number of keys in the array
+ * @param searchKey[IN] the key to compare against
+ * @param inclusive[IN] true to also count the keys equal to searchKey
+ * @return the number of keys smaller than (or equal to) searchKey
+ */
+int countKeysBelow(const char* keys, int count, int searchKey, bool inclusive);
+
+/**
+ * The same as countKeysBelow() for an array of 16-bit unsigned deltas from
+ * base, as stored in a packed leaf node. The deltas are compared eight
+ * (SSE4.2) or sixteen (AVX2) at a time.
+ *
+ * @param deltas[IN] the array of deltas (key - base) sorted in ascending order
+ * @param count[IN] the number of deltas in the array
+ * @param base[IN] the key that the deltas are relative to
+ * @param searchKey[IN] the key to compare against
+ * @param inclusive[IN] true to also count the keys equal to searchKey
+ * @return the number of keys smaller than (or equal to) searchKey
+ */
+int countDeltasBelow(const char* deltas, int count, int base, int searchKey, bool inclusive);
+
+/**
+ * A search over an array of int keys sorted in ascending order: the number
+ * of keys smaller than bound.
+ */
+typedef int (*CountBelowFunc)(const char* keys, int count, int bound);
+
+/**
+ * Look up one of the searches that countKeysBelow() picks from, so that a
+ * benchmark can time each of them.
+ * @param name[IN] "binary" for the branch-free binary search, "sse4.2" or "avx2"
+ * @return the search; NULL if the name is unknown or the CPU lacks the instructions
+ */
+CountBelowFunc findKeySearch(const char* name);
+
+#endif /* KEYSEARCH_H */
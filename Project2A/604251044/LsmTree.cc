@@ -0,0 +1,667 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "LsmTree.h"
+#include "RecordFile.h"
+#include <climits>
+#include <cstring>
+#include <unistd.h>
+
+using namespace std;
+
+// A data page is the number of tuples in it, then the tuples, each one
+// [int key][unsigned char length][length bytes of value]
+static const int TUPLE_HEADER = sizeof(int) + 1;
+
+// A block index page is the number of entries in it, then (first key, pid) pairs
+static const int INDEX_ENTRY = sizeof(int) + sizeof(PageId);
+static const int INDEX_FANOUT = (PageFile::PAGE_SIZE - sizeof(int)) / INDEX_ENTRY;
+
+static const int BLOOM_PAGE_BITS = PageFile::PAGE_SIZE * 8;
+
+/*
+ * Mix the bits of a key, with a different result for every seed.
+ */
+static unsigned hashKey(int key, unsigned seed)
+{
+	unsigned h = (unsigned)key * 0x9e3779b1u ^ seed * 0x85ebca6bu;
+	h ^= h >> 16;
+	h *= 0x85ebca6bu;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+/*
+ * The bits of a key in a Bloom filter are all in one page, so that a test
+ * reads one page. bloomPage() is that page; bloomBit(i) is the i'th bit in it.
+ */
+static int bloomPage(int key, int pages)
+{
+	return hashKey(key, 0) % pages;
+}
+
+static int bloomBit(int key, int i)
+{
+	unsigned a = hashKey(key, 1), b = hashKey(key, 2) | 1;
+	return (a + i * b) % BLOOM_PAGE_BITS;
+}
+
+/*
+ * Read the tuple at offset of a data page, and return the offset of the next one.
+ */
+static int readTuple(const char* page, int offset, int& key, string* value)
+{
+	memcpy(&key, page + offset, sizeof(int));
+	int length = (unsigned char)page[offset + sizeof(int)];
+	if (value != NULL) value->assign(page + offset + TUPLE_HEADER, length);
+	return offset + TUPLE_HEADER + length;
+}
+
+static int getCount(const char* page)
+{
+	int count;
+	memcpy(&count, page, sizeof(int));
+	return count;
+}
+
+/*
+ * The size tier of a run: runs of the memtable are in tier 0, and a merge
+ * of MERGE_FANOUT runs of a tier is in the next one.
+ */
+static int tier(const LsmRunInfo& info)
+{
+	int t = 0;
+	int p = info.dataPages / (LsmTree::MEMTABLE_SIZE / PageFile::PAGE_SIZE);
+	while (p >= LsmTree::MERGE_FANOUT) {
+		p /= LsmTree::MERGE_FANOUT;
+		t++;
+	}
+	return t;
+}
+
+LsmTree::LsmTree()
+{
+	mode = 'r';
+	isOpen = false;
+	nextRunId = 0;
+	head.next.assign(MAX_LEVEL, (MemNode*)NULL);
+	memLevels = 1;
+	memBytes = 0;
+	random = 2463534242u;
+}
+
+LsmTree::~LsmTree()
+{
+	if (isOpen) close();
+	clearMemtable();
+}
+
+string LsmTree::runName(int id) const
+{
+	return name + "." + to_string(id);
+}
+
+/*
+ * Open the manifest, and every run listed in it.
+ */
+RC LsmTree::open(const string& table, char mode)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	LsmManifestHeader header;
+
+	if (isOpen) return RC_FILE_OPEN_FAILED;
+
+	name = table + ".lsm";
+	this->mode = (mode == 'w' || mode == 'W') ? 'w' : 'r';
+	if ((rc = pf.open(name, mode)) < 0) return rc;
+
+	runs.clear();
+	if (pf.endPid() == 0) {
+		// A new table in 'w' mode: write an empty manifest
+		nextRunId = 0;
+		if (this->mode != 'w') rc = RC_INVALID_FILE_FORMAT;
+		else rc = writeManifest();
+		if (rc < 0) { pf.close(); return rc; }
+	} else {
+		if ((rc = pf.read(0, page)) < 0) { pf.close(); return rc; }
+		memcpy(&header, page, sizeof(header));
+		if (header.magic != MAGIC || header.version != FORMAT_VERSION
+			|| header.runCount < 0 || header.runCount > MAX_RUNS) {
+			pf.close();
+			return RC_INVALID_FILE_FORMAT;
+		}
+		nextRunId = header.nextRunId;
+		runs.resize(header.runCount);
+		memcpy(&runs[0], page + sizeof(header), header.runCount * sizeof(LsmRunInfo));
+	}
+
+	// Runs are never written again once listed, so they are opened to read
+	for (size_t i = 0; i < runs.size(); i++) {
+		PageFile* file = new PageFile();
+		if ((rc = file->open(runName(runs[i].id), 'r')) < 0) {
+			delete file;
+			for (size_t j = 0; j < runFiles.size(); j++) {
+				runFiles[j]->close();
+				delete runFiles[j];
+			}
+			runFiles.clear();
+			runs.clear();
+			pf.close();
+			return rc;
+		}
+		runFiles.push_back(file);
+	}
+
+	isOpen = true;
+	return 0;
+}
+
+/*
+ * Write the memtable out, and close the run files and the manifest.
+ */
+RC LsmTree::close()
+{
+	RC rc = 0, tmp;
+
+	if (!isOpen) return RC_FILE_CLOSE_FAILED;
+
+	if (mode == 'w') rc = flush();
+	for (size_t i = 0; i < runFiles.size(); i++) {
+		if ((tmp = runFiles[i]->close()) < 0 && rc == 0) rc = tmp;
+		delete runFiles[i];
+	}
+	runFiles.clear();
+	runs.clear();
+	clearMemtable();
+	if ((tmp = pf.close()) < 0 && rc == 0) rc = tmp;
+	isOpen = false;
+	return rc;
+}
+
+RC LsmTree::writeManifest()
+{
+	char page[PageFile::PAGE_SIZE];
+	LsmManifestHeader header;
+
+	header.magic = MAGIC;
+	header.version = FORMAT_VERSION;
+	header.runCount = runs.size();
+	header.nextRunId = nextRunId;
+
+	memset(page, 0, sizeof(page));
+	memcpy(page, &header, sizeof(header));
+	if (!runs.empty())
+		memcpy(page + sizeof(header), &runs[0], runs.size() * sizeof(LsmRunInfo));
+	return pf.write(0, page);
+}
+
+/*
+ * Insert a tuple into the skip list after the tuples with the same key, so
+ * that they stay in insertion order.
+ */
+RC LsmTree::insert(int key, const string& value)
+{
+	if (!isOpen || mode != 'w') return RC_INVALID_FILE_MODE;
+
+	MemNode* update[MAX_LEVEL];
+	MemNode* x = &head;
+	for (int level = memLevels - 1; level >= 0; level--) {
+		while (x->next[level] != NULL && x->next[level]->key <= key)
+			x = x->next[level];
+		update[level] = x;
+	}
+
+	// Each node is on the next level up with probability 1/4
+	int levels = 1;
+	while (levels < MAX_LEVEL) {
+		random ^= random << 13;
+		random ^= random >> 17;
+		random ^= random << 5;
+		if ((random & 3) != 0) break;
+		levels++;
+	}
+	for (; memLevels < levels; memLevels++)
+		update[memLevels] = &head;
+
+	MemNode* node = new MemNode();
+	node->key = key;
+	node->value = value.substr(0, RecordFile::MAX_VALUE_LENGTH - 1);
+	node->next.resize(levels);
+	for (int level = 0; level < levels; level++) {
+		node->next[level] = update[level]->next[level];
+		update[level]->next[level] = node;
+	}
+
+	memBytes += TUPLE_HEADER + node->value.size();
+	if (memBytes >= MEMTABLE_SIZE) return flush();
+	return 0;
+}
+
+LsmTree::MemNode* LsmTree::findMem(int key)
+{
+	MemNode* x = &head;
+	for (int level = memLevels - 1; level >= 0; level--) {
+		while (x->next[level] != NULL && x->next[level]->key < key)
+			x = x->next[level];
+	}
+	return x->next[0];
+}
+
+void LsmTree::clearMemtable()
+{
+	MemNode* x = head.next[0];
+	while (x != NULL) {
+		MemNode* next = x->next[0];
+		delete x;
+		x = next;
+	}
+	head.next.assign(MAX_LEVEL, (MemNode*)NULL);
+	memLevels = 1;
+	memBytes = 0;
+}
+
+/*
+ * Write the memtable out as the newest run, then compact.
+ */
+RC LsmTree::flush()
+{
+	RC rc;
+	RunWriter writer;
+	int count = 0;
+
+	if (!isOpen || mode != 'w') return RC_INVALID_FILE_MODE;
+	if (head.next[0] == NULL) return 0;
+
+	for (MemNode* x = head.next[0]; x != NULL; x = x->next[0]) count++;
+
+	if ((rc = beginRun(writer, count)) < 0) return rc;
+	for (MemNode* x = head.next[0]; x != NULL; x = x->next[0]) {
+		if ((rc = addToRun(writer, x->key, x->value)) < 0) goto abort_run;
+	}
+	if ((rc = finishRun(writer)) < 0) goto abort_run;
+
+	runs.push_back(writer.info);
+	runFiles.push_back(writer.pf);
+	clearMemtable();
+	return compact();
+
+abort_run:
+	writer.pf->close();
+	delete writer.pf;
+	unlink(runName(writer.info.id).c_str());
+	return rc;
+}
+
+/*
+ * Create the file of a new run of count tuples.
+ */
+RC LsmTree::beginRun(RunWriter& writer, int count)
+{
+	RC rc;
+
+	memset(&writer.info, 0, sizeof(writer.info));
+	writer.info.id = nextRunId++;
+	writer.info.minKey = INT_MAX;
+	writer.info.maxKey = INT_MIN;
+
+	// A file left behind by a run that never made it into the manifest is replaced
+	unlink(runName(writer.info.id).c_str());
+	writer.pf = new PageFile();
+	if ((rc = writer.pf->open(runName(writer.info.id), 'w')) < 0) {
+		delete writer.pf;
+		return rc;
+	}
+
+	memset(writer.page, 0, sizeof(writer.page));
+	writer.offset = sizeof(int);
+	writer.firstKeys.clear();
+
+	long bits = (long)count * BLOOM_BITS_PER_KEY;
+	writer.info.bloomPages = (bits + BLOOM_PAGE_BITS - 1) / BLOOM_PAGE_BITS;
+	if (writer.info.bloomPages == 0) writer.info.bloomPages = 1;
+	writer.bloom.assign((size_t)writer.info.bloomPages * PageFile::PAGE_SIZE, 0);
+	return 0;
+}
+
+/*
+ * Append a tuple to a run. Tuples must come in key order.
+ */
+RC LsmTree::addToRun(RunWriter& writer, int key, const string& value)
+{
+	RC rc;
+	int size = TUPLE_HEADER + value.size();
+
+	// Write the data page out when the tuple does not fit
+	if (writer.offset + size > PageFile::PAGE_SIZE) {
+		if ((rc = writer.pf->write(writer.info.dataPages++, writer.page)) < 0) return rc;
+		memset(writer.page, 0, sizeof(writer.page));
+		writer.offset = sizeof(int);
+	}
+
+	int count = getCount(writer.page);
+	if (count == 0) writer.firstKeys.push_back(key);
+	memcpy(writer.page + writer.offset, &key, sizeof(int));
+	writer.page[writer.offset + sizeof(int)] = (char)value.size();
+	memcpy(writer.page + writer.offset + TUPLE_HEADER, value.data(), value.size());
+	writer.offset += size;
+	count++;
+	memcpy(writer.page, &count, sizeof(int));
+
+	unsigned char* bloom = &writer.bloom[(size_t)bloomPage(key, writer.info.bloomPages) * PageFile::PAGE_SIZE];
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		int bit = bloomBit(key, i);
+		bloom[bit >> 3] |= 1 << (bit & 7);
+	}
+
+	writer.info.count++;
+	if (key < writer.info.minKey) writer.info.minKey = key;
+	if (key > writer.info.maxKey) writer.info.maxKey = key;
+	return 0;
+}
+
+/*
+ * Write the last data page, the block index and the Bloom filter of a run.
+ */
+RC LsmTree::finishRun(RunWriter& writer)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+
+	if ((rc = writer.pf->write(writer.info.dataPages++, writer.page)) < 0) return rc;
+
+	// Each level of the block index holds the first key of every page of the
+	// level below, until a level fits in one page: the root
+	vector<int> keys = writer.firstKeys;
+	vector<PageId> pids(keys.size());
+	for (size_t i = 0; i < pids.size(); i++) pids[i] = i;
+
+	PageId pid = writer.info.dataPages;
+	do {
+		vector<int> upperKeys;
+		vector<PageId> upperPids;
+		for (size_t i = 0; i < keys.size(); i += INDEX_FANOUT) {
+			int count = min((size_t)INDEX_FANOUT, keys.size() - i);
+			memset(page, 0, sizeof(page));
+			memcpy(page, &count, sizeof(int));
+			for (int j = 0; j < count; j++) {
+				memcpy(page + sizeof(int) + j * INDEX_ENTRY, &keys[i + j], sizeof(int));
+				memcpy(page + sizeof(int) + j * INDEX_ENTRY + sizeof(int), &pids[i + j], sizeof(PageId));
+			}
+			if ((rc = writer.pf->write(pid, page)) < 0) return rc;
+			upperKeys.push_back(keys[i]);
+			upperPids.push_back(pid++);
+		}
+		keys.swap(upperKeys);
+		pids.swap(upperPids);
+		writer.info.indexLevels++;
+	} while (keys.size() > 1);
+	writer.info.rootPid = pids[0];
+
+	writer.info.bloomPid = pid;
+	for (int i = 0; i < writer.info.bloomPages; i++) {
+		if ((rc = writer.pf->write(pid++, &writer.bloom[(size_t)i * PageFile::PAGE_SIZE])) < 0) return rc;
+	}
+	return 0;
+}
+
+/*
+ * Merge runs first to last, which must be the newest ones, into one run.
+ * The merged run is listed in the manifest before the old runs are removed.
+ */
+RC LsmTree::mergeRuns(int first, int last)
+{
+	RC rc;
+	RunWriter writer;
+	int count = 0, key;
+	string value;
+
+	for (int i = first; i <= last; i++) count += runs[i].count;
+	if ((rc = beginRun(writer, count)) < 0) return rc;
+
+	{
+		LsmCursor cursor(*this, first, last, false);
+		if ((rc = cursor.seek(INT_MIN)) < 0) goto abort_merge;
+		while ((rc = cursor.next(key, value)) == 0) {
+			if ((rc = addToRun(writer, key, value)) < 0) goto abort_merge;
+		}
+		if (rc != RC_END_OF_TREE) goto abort_merge;
+	}
+	if ((rc = finishRun(writer)) < 0) goto abort_merge;
+
+	{
+		vector<LsmRunInfo> oldRuns(runs.begin() + first, runs.begin() + last + 1);
+		vector<PageFile*> oldFiles(runFiles.begin() + first, runFiles.begin() + last + 1);
+
+		runs.erase(runs.begin() + first, runs.begin() + last + 1);
+		runFiles.erase(runFiles.begin() + first, runFiles.begin() + last + 1);
+		runs.push_back(writer.info);
+		runFiles.push_back(writer.pf);
+		if ((rc = writeManifest()) < 0) return rc;
+
+		for (size_t i = 0; i < oldRuns.size(); i++) {
+			oldFiles[i]->close();
+			delete oldFiles[i];
+			unlink(runName(oldRuns[i].id).c_str());
+		}
+	}
+	return 0;
+
+abort_merge:
+	writer.pf->close();
+	delete writer.pf;
+	unlink(runName(writer.info.id).c_str());
+	return rc;
+}
+
+/*
+ * Merge the newest MERGE_FANOUT runs as long as they are in the same tier,
+ * or there are more runs than the manifest can list.
+ */
+RC LsmTree::compact()
+{
+	RC rc;
+	bool merged = false;
+
+	for (;;) {
+		// Runs are in non-increasing tier order, so when the newest run and
+		// the MERGE_FANOUT'th newest one match, the runs between them do too
+		int n = runs.size();
+		bool tierFull = n >= MERGE_FANOUT && tier(runs[n - MERGE_FANOUT]) == tier(runs[n - 1]);
+		if (!tierFull && n <= MAX_RUNS) break;
+		if ((rc = mergeRuns(n - MERGE_FANOUT, n - 1)) < 0) return rc;
+		merged = true;
+	}
+
+	// mergeRuns() has written the manifest already
+	return merged ? 0 : writeManifest();
+}
+
+/*
+ * Test the Bloom filter of a run: false if the run has no tuple with key.
+ */
+bool LsmTree::mayContain(int run, int key)
+{
+	const LsmRunInfo& info = runs[run];
+	unsigned char page[PageFile::PAGE_SIZE];
+
+	if (runFiles[run]->read(info.bloomPid + bloomPage(key, info.bloomPages), page) < 0) return true;
+	for (int i = 0; i < BLOOM_HASHES; i++) {
+		int bit = bloomBit(key, i);
+		if ((page[bit >> 3] & (1 << (bit & 7))) == 0) return false;
+	}
+	return true;
+}
+
+/*
+ * Find the data page of a run where the tuples with key, or else the tuples
+ * after it, start. Tuples with key may start in the page before the first
+ * one whose first key is key, so the descent follows the last entry with a
+ * smaller key.
+ */
+RC LsmTree::findDataPage(int run, int key, PageId& pid)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+
+	pid = runs[run].rootPid;
+	for (int level = 0; level < runs[run].indexLevels; level++) {
+		if ((rc = runFiles[run]->read(pid, page)) < 0) return rc;
+		int count = getCount(page);
+		int lo = 0, hi = count - 1;
+		while (lo < hi) {
+			int mid = (lo + hi + 1) / 2, midKey;
+			memcpy(&midKey, page + sizeof(int) + mid * INDEX_ENTRY, sizeof(int));
+			if (midKey < key) lo = mid;
+			else hi = mid - 1;
+		}
+		memcpy(&pid, page + sizeof(int) + lo * INDEX_ENTRY + sizeof(int), sizeof(PageId));
+	}
+	return 0;
+}
+
+/*
+ * Read the values of key from every run that may have it, oldest first,
+ * then from the memtable.
+ */
+RC LsmTree::lookup(int key, vector<string>& values)
+{
+	RC rc;
+	char page[PageFile::PAGE_SIZE];
+	PageId pid;
+	int tupleKey;
+	string value;
+
+	if (!isOpen) return RC_FILE_READ_FAILED;
+
+	for (size_t run = 0; run < runs.size(); run++) {
+		if (key < runs[run].minKey || key > runs[run].maxKey) continue;
+		if (!mayContain(run, key)) continue;
+		if ((rc = findDataPage(run, key, pid)) < 0) return rc;
+
+		for (bool done = false; !done && pid < runs[run].dataPages; pid++) {
+			if ((rc = runFiles[run]->read(pid, page)) < 0) return rc;
+			int count = getCount(page), offset = sizeof(int);
+			for (int i = 0; i < count; i++) {
+				offset = readTuple(page, offset, tupleKey, &value);
+				if (tupleKey > key) { done = true; break; }
+				if (tupleKey == key) values.push_back(value);
+			}
+		}
+	}
+
+	for (MemNode* x = findMem(key); x != NULL && x->key == key; x = x->next[0])
+		values.push_back(x->value);
+	return 0;
+}
+
+LsmCursor::LsmCursor(LsmTree& tree) : tree(tree)
+{
+	firstRun = 0;
+	lastRun = tree.runs.size() - 1;
+	memtable = true;
+	memNext = NULL;
+}
+
+LsmCursor::LsmCursor(LsmTree& tree, int firstRun, int lastRun, bool memtable) : tree(tree)
+{
+	this->firstRun = firstRun;
+	this->lastRun = lastRun;
+	this->memtable = memtable;
+	memNext = NULL;
+}
+
+RC LsmCursor::seek(int key)
+{
+	RC rc;
+
+	readers.clear();
+	for (int run = firstRun; run <= lastRun; run++) {
+		if (key > tree.runs[run].maxKey) continue;
+
+		readers.resize(readers.size() + 1);
+		RunReader& reader = readers.back();
+		reader.run = run;
+		if ((rc = seekRun(reader, key)) < 0) return rc;
+		if (reader.pid >= tree.runs[run].dataPages) readers.pop_back();
+	}
+	memNext = memtable ? tree.findMem(key) : NULL;
+	return 0;
+}
+
+/*
+ * Move a reader to the first tuple of its run with a key not smaller than key.
+ */
+RC LsmCursor::seekRun(RunReader& reader, int key)
+{
+	RC rc;
+	int tupleKey;
+
+	if ((rc = tree.findDataPage(reader.run, key, reader.pid)) < 0) return rc;
+	if ((rc = tree.runFiles[reader.run]->read(reader.pid, reader.page)) < 0) return rc;
+	reader.left = getCount(reader.page);
+	reader.offset = sizeof(int);
+
+	for (;;) {
+		if ((rc = skipEmpty(reader)) < 0) return rc;
+		if (reader.pid >= tree.runs[reader.run].dataPages) return 0;
+		int next = readTuple(reader.page, reader.offset, tupleKey, NULL);
+		if (tupleKey >= key) return 0;
+		reader.offset = next;
+		reader.left--;
+	}
+}
+
+/*
+ * Read the next data pages of a reader until it is at a tuple, or past the last one.
+ */
+RC LsmCursor::skipEmpty(RunReader& reader)
+{
+	RC rc;
+
+	while (reader.left == 0) {
+		if (++reader.pid >= tree.runs[reader.run].dataPages) return 0;
+		if ((rc = tree.runFiles[reader.run]->read(reader.pid, reader.page)) < 0) return rc;
+		reader.left = getCount(reader.page);
+		reader.offset = sizeof(int);
+	}
+	return 0;
+}
+
+/*
+ * Return the smallest tuple among the readers and the memtable. Ties go to
+ * the oldest run, and to the memtable last.
+ */
+RC LsmCursor::next(int& key, string& value)
+{
+	RC rc;
+	int best = -1, bestKey = 0, tupleKey;
+
+	for (size_t i = 0; i < readers.size(); i++) {
+		readTuple(readers[i].page, readers[i].offset, tupleKey, NULL);
+		if (best < 0 || tupleKey < bestKey) {
+			best = i;
+			bestKey = tupleKey;
+		}
+	}
+
+	if (memNext != NULL && (best < 0 || memNext->key < bestKey)) {
+		key = memNext->key;
+		value = memNext->value;
+		memNext = memNext->next[0];
+		return 0;
+	}
+	if (best < 0) return RC_END_OF_TREE;
+
+	RunReader& reader = readers[best];
+	reader.offset = readTuple(reader.page, reader.offset, key, &value);
+	reader.left--;
+	if ((rc = skipEmpty(reader)) < 0) return rc;
+	if (reader.pid >= tree.runs[reader.run].dataPages) readers.erase(readers.begin() + best);
+	return 0;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef LSMTREE_H
+#define LSMTREE_H
+
+#include <string>
+#include <vector>
+#include "Bruinbase.h"
+#include "PageFile.h"
+
+/**
+ * A sorted run of an LsmTree, as listed in the manifest.
+ */
+typedef struct {
+  int     id;           // the run is stored in <table>.lsm.<id>
+  int     count;        // the number of tuples in the run
+  int     minKey;       // the smallest key of the run
+  int     maxKey;       // the largest key of the run
+  PageId  dataPages;    // the tuples are in pages 0 to dataPages - 1
+  PageId  rootPid;      // the root page of the block index
+  int     indexLevels;  // the number of levels of the block index
+  PageId  bloomPid;     // the first page of the Bloom filter
+  int     bloomPages;   // the number of pages of the Bloom filter
+} LsmRunInfo;
+
+/**
+ * The start of page 0 of the manifest of an LsmTree; the LsmRunInfo of
+ * every run follows it, oldest run first.
+ */
+typedef struct {
+  int     magic;        // LsmTree::MAGIC
+  int     version;      // LsmTree::FORMAT_VERSION
+  int     runCount;     // the number of runs
+  int     nextRunId;    // the id of the next run written
+} LsmManifestHeader;
+
+class LsmCursor;
+
+/**
+ * A log-structured table of (key, value) tuples. A table loaded USING LSM
+ * is stored in an LsmTree instead of a RecordFile and a BTreeIndex.
+ *
+ * Inserted tuples go into the memtable, a skip list in memory. Once it holds
+ * MEMTABLE_SIZE bytes of tuples, it is written out in key order as a new
+ * sorted run: a PageFile of its own, written front to back. A run has data
+ * pages of packed tuples, a block index over them (the first key of every
+ * data page, in levels like the non-leaf levels of a B+tree) and a Bloom
+ * filter on its keys. The manifest, <table>.lsm, lists the runs from the
+ * oldest to the newest. Whenever the newest MERGE_FANOUT runs are in the same
+ * size tier, they are merged into one run of the next tier (size-tiered
+ * compaction), so that a table has a few runs per tier at most.
+ *
+ * Tuples are never changed or removed. Tuples with the same key come out
+ * in the order they were inserted. A point lookup reads one Bloom filter
+ * page of every run whose key range holds the key, and the index and data
+ * pages only of the runs whose filter may have it.
+ */
+class LsmTree {
+ public:
+  static const int MAGIC = 0x4c534d54;          // "LSMT"
+  static const int FORMAT_VERSION = 1;
+  static const int MEMTABLE_SIZE = 1 << 20;     // the bytes of tuples collected before a run is written
+  static const int MERGE_FANOUT = 4;            // the number of runs of a tier merged into one
+  static const int BLOOM_BITS_PER_KEY = 10;     // about 1% false positives
+  static const int BLOOM_HASHES = 6;
+  static const int MAX_RUNS = (PageFile::PAGE_SIZE - sizeof(LsmManifestHeader)) / sizeof(LsmRunInfo);
+
+  LsmTree();
+  ~LsmTree();
+
+  /**
+   * Open the LsmTree of a table in read or write mode.
+   * Under 'w' mode, the manifest is created if it does not exist.
+   * @param table[IN] the name of the table
+   * @param mode[IN] 'r' for read, 'w' for write
+   * @return error code. 0 if no error. RC_INVALID_FILE_FORMAT if the
+   *         manifest was written by another version of bruinbase
+   */
+  RC open(const std::string& table, char mode);
+
+  /**
+   * Write the tuples in the memtable out as a run, and close the files.
+   * @return error code. 0 if no error
+   */
+  RC close();
+
+  /**
+   * Insert a tuple into the memtable, and write the memtable out when it is full.
+   * Values longer than RecordFile::MAX_VALUE_LENGTH - 1 are truncated, as in a RecordFile.
+   * @param key[IN] the key of the tuple
+   * @param value[IN] the value of the tuple
+   * @return error code. 0 if no error
+   */
+  RC insert(int key, const std::string& value);
+
+  /**
+   * Write the tuples in the memtable out as a new run, and merge the
+   * newest runs if they fill up their tier.
+   * @return error code. 0 if no error
+   */
+  RC flush();
+
+  /**
+   * Find the values of every tuple with key, in insertion order.
+   * @param key[IN] the key to find
+   * @param values[OUT] the values found are appended to it
+   * @return error code. 0 if no error
+   */
+  RC lookup(int key, std::vector<std::string>& values);
+
+  /**
+   * @return the number of runs on disk
+   */
+  int getRunCount() const { return runs.size(); }
+
+ private:
+  friend class LsmCursor;
+
+  /**
+   * A tuple of the memtable. next[i] is the next node on level i of the skip list.
+   */
+  struct MemNode {
+    int key;
+    std::string value;
+    std::vector<MemNode*> next;
+  };
+
+  /**
+   * A run being written: the data page being filled, the first key of every
+   * data page written so far, and the Bloom filter.
+   */
+  struct RunWriter {
+    PageFile* pf;
+    LsmRunInfo info;
+    char page[PageFile::PAGE_SIZE];
+    int offset;                      // the end of the tuples in page
+    std::vector<int> firstKeys;      // the first key of every data page
+    std::vector<unsigned char> bloom;
+  };
+
+  static const int MAX_LEVEL = 16;   // of the skip list: enough for 4^16 tuples
+
+  std::string runName(int id) const;
+  RC writeManifest();
+  RC beginRun(RunWriter& writer, int count);
+  RC addToRun(RunWriter& writer, int key, const std::string& value);
+  RC finishRun(RunWriter& writer);
+  RC mergeRuns(int first, int last);
+  RC compact();
+  bool mayContain(int run, int key);
+  RC findDataPage(int run, int key, PageId& pid);
+  MemNode* findMem(int key);
+  void clearMemtable();
+
+  std::string name;                 /// the name of the manifest file
+  char mode;
+  bool isOpen;
+  PageFile pf;                      /// the manifest
+  int nextRunId;
+  std::vector<LsmRunInfo> runs;     /// the runs, oldest first
+  std::vector<PageFile*> runFiles;  /// the open run files, in the order of runs
+
+  MemNode head;                     /// the skip list head; head.next[i] is the first node of level i
+  int memLevels;                    /// the levels in use
+  int memBytes;                     /// the size of the tuples in the memtable
+  unsigned random;                  /// the state of the level generator
+};
+
+/**
+ * Reads the tuples of an LsmTree in key order, by merging the runs and the
+ * memtable. Tuples with the same key come in the order they were inserted:
+ * from the oldest run to the newest, then from the memtable.
+ */
+class LsmCursor {
+ public:
+  LsmCursor(LsmTree& tree);
+
+  /**
+   * Move the cursor to the first tuple with a key not smaller than key.
+   * @param key[IN] the key to find
+   * @return error code. 0 if no error
+   */
+  RC seek(int key);
+
+  /**
+   * Read the tuple at the cursor, and move the cursor to the next tuple.
+   * @param key[OUT] the key of the tuple
+   * @param value[OUT] the value of the tuple
+   * @return error code. 0 if no error. RC_END_OF_TREE after the last tuple
+   */
+  RC next(int& key, std::string& value);
+
+ private:
+  friend class LsmTree;
+
+  /**
+   * The read position in a run: a data page in memory and a tuple in it.
+   */
+  struct RunReader {
+    int run;         // the index of the run in LsmTree::runs
+    PageId pid;      // the data page in page; LsmRunInfo::dataPages past the last tuple
+    int left;        // the tuples of the page from offset on
+    int offset;      // the tuple at the cursor in page
+    char page[PageFile::PAGE_SIZE];
+  };
+
+  LsmCursor(LsmTree& tree, int firstRun, int lastRun, bool memtable);
+  RC seekRun(RunReader& reader, int key);
+  RC skipEmpty(RunReader& reader);
+
+  LsmTree& tree;
+  int firstRun, lastRun;            /// the runs merged
+  bool memtable;                    /// true to merge the memtable too
+  std::vector<RunReader> readers;
+  LsmTree::MemNode* memNext;        /// the next tuple of the memtable
+};
+
+#endif /* LSMTREE_H */
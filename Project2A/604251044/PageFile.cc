@@ -16,10 +16,9 @@
 
 using std::string;
 
-int PageFile::readCount = 0;
-int PageFile::writeCount = 0;
-int PageFile::cacheClock = 1;
-struct PageFile::cacheStruct PageFile::readCache[PageFile::CACHE_COUNT];
+std::atomic<int> PageFile::readCount(0);
+std::atomic<int> PageFile::writeCount(0);
+struct PageFile::cacheShard PageFile::readCache[PageFile::CACHE_SHARDS];
 
 PageFile::PageFile() 
 { 
@@ -76,11 +75,15 @@ RC PageFile::close()
   if (::close(fd) < 0) return RC_FILE_CLOSE_FAILED;
 
   // evict all cached pages for this file
-  for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+  for (int s = 0; s < CACHE_SHARDS; s++) {
+    std::lock_guard<std::mutex> guard(readCache[s].mutex);
+    for (int i = 0; i < CACHE_COUNT; i++) {
+      cacheStruct& page = readCache[s].pages[i];
+      if (page.fd == fd && page.lastAccessed != 0) {
+         page.fd = 0;
+         page.pid = 0;
+         page.lastAccessed = 0;
+      }
     }
   }
 
@@ -95,35 +98,51 @@ PageId PageFile::endPid() const
   return epid;
 }
 
-RC PageFile::seek(PageId pid) const
+RC PageFile::getStamp(FileStamp& stamp) const
 {
-  return (::lseek(fd, pid * PAGE_SIZE, SEEK_SET) < 0) ? RC_FILE_SEEK_FAILED : 0;
+  struct stat statbuf;
+
+  memset(&stamp, 0, sizeof(stamp));
+  if (::fstat(fd, &statbuf) < 0) return RC_FILE_READ_FAILED;
+  stamp.dev = statbuf.st_dev;
+  stamp.ino = statbuf.st_ino;
+  stamp.size = statbuf.st_size;
+  stamp.mtimeSec = statbuf.st_mtim.tv_sec;
+  stamp.mtimeNsec = statbuf.st_mtim.tv_nsec;
+  return 0;
+}
+
+PageFile::cacheShard& PageFile::shard(PageId pid) const
+{
+  // neighbouring pages of a file go to different shards
+  return readCache[((unsigned)pid * 2654435761u + (unsigned)fd) % CACHE_SHARDS];
 }
 
 RC PageFile::write(PageId pid, const void* buffer)
 {
-  RC rc;
   if (pid < 0) return RC_INVALID_PID; 
 
-  // seek to the location of the page
-  if ((rc = seek(pid)) < 0) return rc;
+  cacheShard& cache = shard(pid);
+  std::lock_guard<std::mutex> guard(cache.mutex);
 
   // write the buffer to the disk page
-  if (::write(fd, buffer, PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
+  if (::pwrite(fd, buffer, PAGE_SIZE, (off_t)pid * PAGE_SIZE) < 0) return RC_FILE_WRITE_FAILED;
 
   // if the page is in read cache, invalidate it
   for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid &&
-        readCache[i].lastAccessed != 0) {
-       readCache[i].fd = 0;
-       readCache[i].pid = 0;
-       readCache[i].lastAccessed = 0;
+    cacheStruct& page = cache.pages[i];
+    if (page.fd == fd && page.pid == pid && page.lastAccessed != 0) {
+       page.fd = 0;
+       page.pid = 0;
+       page.lastAccessed = 0;
        break;
     }
   }
 
   // if the written pid >= end pid, update the end pid
-  if (pid >= epid) epid = pid + 1;
+  PageId end = epid;
+  while (pid >= end && !epid.compare_exchange_weak(end, pid + 1))
+    ;
 
   // increase page write count
   writeCount++;
@@ -133,45 +152,45 @@ RC PageFile::write(PageId pid, const void* buffer)
 
 RC PageFile::read(PageId pid, void* buffer) const
 {
-  RC rc;
-
   if (pid < 0 || pid >= epid) return RC_INVALID_PID; 
 
+  cacheShard& cache = shard(pid);
+  std::lock_guard<std::mutex> guard(cache.mutex);
+
   //
   // if the page is in cache, read it from there
   //
   for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].fd == fd && readCache[i].pid == pid && 
-        readCache[i].lastAccessed != 0) {
-       memcpy(buffer, readCache[i].buffer, PAGE_SIZE);
-       readCache[i].lastAccessed = ++cacheClock;
+    cacheStruct& page = cache.pages[i];
+    if (page.fd == fd && page.pid == pid && page.lastAccessed != 0) {
+       memcpy(buffer, page.buffer, PAGE_SIZE);
+       page.lastAccessed = ++cache.cacheClock;
        return 0;
     }
   }
 
-  // seek to the page
-  if ((rc = seek(pid)) < 0) return rc;
-  
   // find the cache slot to evict
   int toEvict = 0; 
   for (int i = 0; i < CACHE_COUNT; i++) {
-    if (readCache[i].lastAccessed == 0) {
+    if (cache.pages[i].lastAccessed == 0) {
       toEvict = i;
       break;
     }
-    if (readCache[i].lastAccessed < readCache[toEvict].lastAccessed) {
+    if (cache.pages[i].lastAccessed < cache.pages[toEvict].lastAccessed) {
       toEvict = i;
     }
   }
-  readCache[toEvict].fd = fd;
-  readCache[toEvict].pid = pid;
-  readCache[toEvict].lastAccessed = ++cacheClock;
+  cacheStruct& page = cache.pages[toEvict];
  
   // read the page to cache first and copy it to the buffer
-  if (::read(fd, readCache[toEvict].buffer, PAGE_SIZE) < 0) {
+  if (::pread(fd, page.buffer, PAGE_SIZE, (off_t)pid * PAGE_SIZE) < 0) {
+    page.lastAccessed = 0;
     return RC_FILE_READ_FAILED;
   }
-  memcpy(buffer, readCache[toEvict].buffer, PAGE_SIZE);
+  page.fd = fd;
+  page.pid = pid;
+  page.lastAccessed = ++cache.cacheClock;
+  memcpy(buffer, page.buffer, PAGE_SIZE);
 
   // increase the page read count
   readCount++;
@@ -10,13 +10,32 @@
 #ifndef PAGEFILE_H
 #define PAGEFILE_H
 
+#include <atomic>
+#include <mutex>
 #include <string>
 #include "Bruinbase.h"
 
 typedef int PageId;
 
 /**
- * read/write a file in the unit of a page
+ * what tells whether a file changed: the file, its size and the time it
+ * was last written (see stat(2)).
+ */
+typedef struct {
+  long long  dev;        // the device of the file
+  long long  ino;        // its inode number
+  long long  size;       // its size in bytes
+  long long  mtimeSec;   // the time it was last written: seconds
+  long long  mtimeNsec;  // and nanoseconds
+} FileStamp;
+
+/**
+ * read/write a file in the unit of a page.
+ * read() and write() may be called from several threads at once. Pages
+ * are read and written with pread()/pwrite(), which share no file offset,
+ * and every page belongs to one shard of the cache, whose lock is held
+ * while the page is read or written: a page is never seen half written,
+ * and pages of different shards are read and written in parallel.
  */
 class PageFile {
  public:
@@ -66,6 +85,14 @@ class PageFile {
    */
   PageId endPid() const;
 
+  /**
+   * the stamp of the file changes whenever the file is written, so that
+   * what was read from it can be kept until then.
+   * @param stamp[OUT] the stamp of the file
+   * @return error code. 0 if no error
+   */
+  RC getStamp(FileStamp& stamp) const;
+
   /**
    * @return the total # of disk reads
    */
@@ -76,37 +103,39 @@ class PageFile {
    */
   static int getPageWriteCount() { return writeCount; }
 
- protected:
-  /**
-   * move the file cursor to the beginning of a page.
-   * this is an internal function not exposed to public.
-   * @param pid[IN] page to seek to
-   * @return error code. 0 if no error
-   */
-  RC seek(PageId pid) const;
-
  private:
-  int     fd;     // file descriptor of the associated unix file
-  PageId  epid;   // (last page id + 1) of the file
+  int                  fd;     // file descriptor of the associated unix file
+  std::atomic<PageId>  epid;   // (last page id + 1) of the file
 
   //
   // the following set of members implement LRU caching 
   //
-  static const int CACHE_COUNT = 10;
-
-  static int cacheClock; // clock tick counter for LRU policy
+  static const int CACHE_SHARDS = 8;   // the cache is split by page into shards
+  static const int CACHE_COUNT = 10;   // the pages cached in every shard
 
-  // the actual cache data structure
-  static struct cacheStruct {
+  // the cached pages
+  struct cacheStruct {
     int    fd;              // file id of the cached page
     PageId pid;             // page id of the cached page
     int    lastAccessed;    // the last time the cached page was accessed
                             //   (lastAccessed == 0) means that the buffer is empty
     char buffer[PAGE_SIZE]; // the buffer used for caching
-  } readCache[CACHE_COUNT];
+  };
+
+  // a shard of the cache, with its own LRU policy
+  static struct cacheShard {
+    std::mutex  mutex;               // guards the shard; held while its pages are read or written
+    int         cacheClock;          // clock tick counter for LRU policy
+    cacheStruct pages[CACHE_COUNT];
+  } readCache[CACHE_SHARDS];
+
+  /**
+   * @return the shard of the cache that the page pid of this file belongs to
+   */
+  cacheShard& shard(PageId pid) const;
 
-  static int readCount;  // total # of page reads 
-  static int writeCount; // total # of page writes 
+  static std::atomic<int> readCount;  // total # of page reads 
+  static std::atomic<int> writeCount; // total # of page writes 
 };
   
 #endif // PAGEFILE_H
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#include "PageVersions.h"
+#include <thread>
+
+PageVersions::PageVersions()
+{
+	chunks = new std::atomic<Counter*>[CHUNK_COUNT];
+	for (int i = 0; i < CHUNK_COUNT; i++)
+		chunks[i].store(NULL, std::memory_order_relaxed);
+}
+
+PageVersions::~PageVersions()
+{
+	for (int i = 0; i < CHUNK_COUNT; i++)
+		delete[] chunks[i].load(std::memory_order_relaxed);
+	delete[] chunks;
+}
+
+PageVersions::Counter& PageVersions::counter(PageId pid)
+{
+	std::atomic<Counter*>& slot = chunks[(unsigned)pid >> CHUNK_BITS];
+	Counter* chunk = slot.load(std::memory_order_acquire);
+
+	// The first thread to use the chunk allocates it; the others use its copy
+	if (chunk == NULL)
+	{
+		Counter* fresh = new Counter[CHUNK_SIZE];
+		for (int i = 0; i < CHUNK_SIZE; i++)
+			fresh[i].store(0, std::memory_order_relaxed);
+		if (slot.compare_exchange_strong(chunk, fresh, std::memory_order_acq_rel))
+			chunk = fresh;
+		else
+			delete[] fresh;
+	}
+
+	return chunk[pid & (CHUNK_SIZE - 1)];
+}
+
+PageVersions::Version PageVersions::readLock(PageId pid)
+{
+	Counter& c = counter(pid);
+	Version version;
+
+	while ((version = c.load(std::memory_order_acquire)) & 1)
+		std::this_thread::yield();
+	return version;
+}
+
+bool PageVersions::validate(PageId pid, Version version)
+{
+	return counter(pid).load(std::memory_order_acquire) == version;
+}
+
+bool PageVersions::upgrade(PageId pid, Version version)
+{
+	return counter(pid).compare_exchange_strong(version, version + 1, std::memory_order_acq_rel);
+}
+
+void PageVersions::lock(PageId pid)
+{
+	while (!upgrade(pid, readLock(pid)))
+		;
+}
+
+void PageVersions::unlock(PageId pid)
+{
+	counter(pid).fetch_add(1, std::memory_order_release);
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+#ifndef PAGEVERSIONS_H
+#define PAGEVERSIONS_H
+
+#include <atomic>
+#include "PageFile.h"
+
+/**
+ * A version counter for every page of a file, which doubles as its lock.
+ * The version of a page is even while nobody modifies it. A writer locks
+ * the page by making its version odd, and unlocks it by making it even
+ * again, one larger than before. A reader does not lock: it takes the
+ * version before reading a page (waiting while the page is locked) and
+ * checks it again afterwards. If the version changed, the page was
+ * modified in between, and the reader reads it again.
+ *
+ * BTreeIndexT locks the nodes it changes with lock() and unlock(). Its
+ * readers move right along the B-link pointers by default, and read only
+ * the root pointer and the height, under page 0, with readLock() and
+ * validate(); in optimistic read mode, they validate every node they
+ * pass (optimistic lock coupling).
+ *
+ * Every page has its own counter, so locking two pages never waits on
+ * itself. The counters are kept in chunks allocated on first use.
+ */
+class PageVersions {
+ public:
+  typedef unsigned long long Version;
+
+  PageVersions();
+  ~PageVersions();
+
+  /**
+   * Wait until the page is not locked, and return its version.
+   * @param pid[IN] the page
+   * @return the version of the page
+   */
+  Version readLock(PageId pid);
+
+  /**
+   * Check that the page was not modified since readLock() returned version.
+   * @param pid[IN] the page
+   * @param version[IN] the version returned by readLock()
+   * @return true if the page still has that version
+   */
+  bool validate(PageId pid, Version version);
+
+  /**
+   * Lock the page for writing, if it still has the version read.
+   * @param pid[IN] the page
+   * @param version[IN] the version returned by readLock()
+   * @return true if the page is now locked; false if it was modified
+   *         (or locked) since, in which case the caller starts over
+   */
+  bool upgrade(PageId pid, Version version);
+
+  /**
+   * Wait until the page can be locked, and lock it for writing.
+   * @param pid[IN] the page
+   */
+  void lock(PageId pid);
+
+  /**
+   * Unlock a page locked by upgrade() or lock(), giving it a new version.
+   * @param pid[IN] the page
+   */
+  void unlock(PageId pid);
+
+ private:
+  static const int CHUNK_BITS = 16;
+  static const int CHUNK_SIZE = 1 << CHUNK_BITS;  // the counters of 64K pages
+  static const int CHUNK_COUNT = 1 << 15;         // enough chunks for every PageId
+
+  typedef std::atomic<Version> Counter;
+
+  /**
+   * Return the counter of the page, allocating its chunk if needed.
+   */
+  Counter& counter(PageId pid);
+
+  std::atomic<Counter*>* chunks;
+
+  // Not copyable: the counters belong to one open index
+  PageVersions(const PageVersions&);
+  PageVersions& operator=(const PageVersions&);
+};
+
+#endif /* PAGEVERSIONS_H */
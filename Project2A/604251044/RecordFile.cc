@@ -13,6 +13,9 @@
 
 using std::string;
 
+std::map<string, RecordFile::ClosedFile> RecordFile::closedFiles;
+std::mutex RecordFile::closedMutex;
+
 //
 // helper functions for page manipultation
 //
@@ -107,10 +110,18 @@ RecordFile::RecordFile()
 {
   erid.pid = 0;
   erid.sid = 0;
+  writable = false;
+  memset(&openStamp, 0, sizeof(openStamp));
+  openWriters = 0;
 }
 
 RecordFile::RecordFile(const string& filename, char mode)
 {
+  erid.pid = 0;
+  erid.sid = 0;
+  writable = false;
+  memset(&openStamp, 0, sizeof(openStamp));
+  openWriters = 0;
   open(filename, mode);
 }
 
@@ -121,11 +132,29 @@ RC RecordFile::open(const string& filename, char mode)
 
   // open the page file
   if ((rc = pf.open(filename, mode)) < 0) return rc;
+  name = filename;
+  writable = (mode == 'w' || mode == 'W');
+  pf.getStamp(openStamp);
   
   //
   // in the rest of this function, we set the end record id
   //
 
+  // take the end record id from the last close() of the file, if the file
+  // did not change since. once the file is open for writing, it may.
+  {
+    std::lock_guard<std::mutex> guard(closedMutex);
+    ClosedFile& closed = closedFiles[filename];
+    bool cached = closed.valid && memcmp(&closed.stamp, &openStamp, sizeof(openStamp)) == 0;
+    if (cached) erid = closed.erid;
+    if (writable) {
+      closed.writers++;
+      closed.valid = false;
+    }
+    openWriters = closed.writers;
+    if (cached) return 0;
+  }
+
   // get the end pid of the file
   erid.pid = pf.endPid();
 
@@ -159,6 +188,21 @@ RC RecordFile::open(const string& filename, char mode)
 
 RC RecordFile::close()
 {
+  FileStamp stamp;
+
+  // leave the end record id for the next open() of the file, unless the
+  // file was opened for writing since, or changed under a reader
+  if (pf.getStamp(stamp) == 0) {
+    std::lock_guard<std::mutex> guard(closedMutex);
+    ClosedFile& closed = closedFiles[name];
+    if (closed.writers == openWriters
+        && (writable || memcmp(&stamp, &openStamp, sizeof(stamp)) == 0)) {
+      closed.valid = true;
+      closed.stamp = stamp;
+      closed.erid = erid;
+    }
+  }
+
   erid.pid = 0;
   erid.sid = 0;
 
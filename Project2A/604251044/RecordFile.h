@@ -10,6 +10,8 @@
 #ifndef RECORDFILE_H
 #define RECORDFILE_H
 
+#include <map>
+#include <mutex>
 #include <string>
 #include "PageFile.h"
 
@@ -58,6 +60,8 @@ class RecordFile {
   /**
    * open a file in read or write mode.
    * when opened in 'w' mode, if the file does not exist, it is created.
+   * the end record id is read from the last page of the file, unless the
+   * file was closed by this process and did not change since.
    * @param filename[IN] the name of the file to open
    * @param mode[IN] 'r' for read, 'w' for write
    * @return error code. 0 if no error
@@ -99,6 +103,21 @@ class RecordFile {
  private:
   PageFile pf;     // the PageFile used to store the records
   RecordId erid;   // the last record id of the file + 1
+
+  // what close() leaves in memory for the next open() of the same file
+  struct ClosedFile {
+    bool          valid;    // true if erid is the end of the file stamp describes
+    FileStamp     stamp;    // the file, as close() left it
+    RecordId      erid;     // its last record id + 1
+    unsigned long writers;  // the opens of the file for writing so far
+  };
+  static std::map<std::string, ClosedFile> closedFiles;  // by file name
+  static std::mutex closedMutex;                          // guards closedFiles
+
+  std::string   name;         // the name of the open file
+  bool          writable;     // true if the file is open for writing
+  FileStamp     openStamp;    // the file, as open() found it
+  unsigned long openWriters;  // ClosedFile::writers, as open() found it
 };
 
 #endif // RECORDFILE_H
@@ -7,15 +7,21 @@
 * @date 3/24/2008
 */
 
+#include <algorithm>
 #include <cstdio>
 #include <cstring>
 #include <cstdlib>
+#include <climits>
 #include <iostream>
 #include <fstream>
 #include "Bruinbase.h"
 #include "SqlEngine.h"
 #include "BTreeNode.h"
 #include "BTreeIndex.h"
+#include "ExternalSort.h"
+#include "HashIndex.h"
+#include "LsmTree.h"
+#include <unistd.h>
 
 using namespace std;
 
@@ -23,6 +29,67 @@ using namespace std;
 extern FILE* sqlin;
 int sqlparse(void);
 
+// compare two keys without overflowing on (key1 - key2)
+static int compareKey(int key1, int key2)
+{
+	return (key1 > key2) - (key1 < key2);
+}
+
+// check a tuple against every condition of the WHERE clause
+static bool matchConds(const vector<SelCond>& cond, int key, const string& value)
+{
+	for (unsigned i = 0; i < cond.size(); i++) {
+		int diff = (cond[i].attr == 1) ? compareKey(key, atoi(cond[i].value))
+			: strcmp(value.c_str(), cond[i].value);
+
+		switch (cond[i].comp) {
+		case SelCond::EQ: if (diff != 0) return false; break;
+		case SelCond::NE: if (diff == 0) return false; break;
+		case SelCond::GT: if (diff <= 0) return false; break;
+		case SelCond::LT: if (diff >= 0) return false; break;
+		case SelCond::GE: if (diff < 0) return false; break;
+		case SelCond::LE: if (diff > 0) return false; break;
+		}
+	}
+	return true;
+}
+
+// print a tuple for the SELECT clause
+static void printTuple(int attr, int key, const string& value)
+{
+	switch (attr) {
+	case 1:  // SELECT key
+		fprintf(stdout, "%d\n", key);
+		break;
+	case 2:  // SELECT value
+		fprintf(stdout, "%s\n", value.c_str());
+		break;
+	case 3:  // SELECT *
+		fprintf(stdout, "%d '%s'\n", key, value.c_str());
+		break;
+	}
+}
+
+// keep the smallest (SELECT MIN key) or the largest (SELECT MAX key) key of
+// the matching tuples in extreme; count is the number of them so far
+static void aggregateKey(int attr, int key, int count, int& extreme)
+{
+	if ((attr == 5 && (count == 1 || key < extreme)) || (attr == 6 && (count == 1 || key > extreme)))
+		extreme = key;
+}
+
+// estimate the entries of an index with a key from lo to hi (both included)
+// from its statistics, as if the keys were spread evenly from the smallest
+// key of the index to the largest
+static double estimateRange(const BTreeStatistics<int>& stats, long long lo, long long hi)
+{
+	lo = max(lo, (long long)stats.minKey);
+	hi = min(hi, (long long)stats.maxKey);
+	if (stats.entryCount == 0 || hi < lo)
+		return 0;
+	return (double)stats.entryCount * (hi - lo + 1) / ((long long)stats.maxKey - stats.minKey + 1);
+}
+
 
 RC SqlEngine::run(FILE* commandline)
 {
@@ -89,32 +156,60 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 	RecordFile rf;   // RecordFile containing the table
 	RecordId   rid;  // record cursor for table scanning
 	BTreeIndex bTree; // B+Tree to hold index
-	IndexCursor cursor; // Cursor to traverse the B+Tree
+	BTreeCursor cursor(bTree); // Cursor to traverse the B+Tree
+	LsmTree    lsm;  // the tuples of a table loaded USING LSM
+	ValueIndex vIndex; // index on the value column
+	HashIndex  hIndex; // hash index on the key column
+	CoveringIndex cIndex; // covering index
+	CoveringCursor coveringCursor(cIndex); // Cursor to traverse the covering index
 
 	RC     rc;
 	int    key;
 	string value;
 	int    count;
-	int    diff;
+	int    extreme = 0; // the key of SELECT MIN key or SELECT MAX key
 
-	// open the table file
+	// open the table file, or the LsmTree of a table loaded USING LSM
+	bool isLsm = false;
 	if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
-		fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
-		return rc;
+		RC lsmRc = lsm.open(table, 'r');
+		if (lsmRc == RC_INVALID_FILE_FORMAT) {
+			fprintf(stderr, "Error: table %s.lsm has an old format\n", table.c_str());
+			return lsmRc;
+		}
+		if (lsmRc < 0) {
+			fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+			return rc;
+		}
+		isLsm = true;
 	}
 
 	SelCond tempCond; // stores selection conditions when checking cond vector
 	bool hasIndex = false; // to check for closing the tree file later if we have B+tree index
+	bool hasValueIndex = false; // to check for closing the index on the value column
+	bool hasHashIndex = false; // to check for closing the hash index
+	bool hasCoveringIndex = false; // to check for closing the covering index
+	bool valueScan = false; // true -> the value range is too wide for the index on the value column
+	bool keyScan = false; // true -> the key range is too wide for the index on the key column
+	bool aggregate = (attr == 4 || attr == 5 || attr == 6); // count(*), MIN key or MAX key: no tuple is printed
+	BTreeStatistics<int> stats; // the statistics of the index on the key column
+	bool indexCurrent = false; // true -> the statistics count every tuple of the table
 	bool hasKeyCond = false; // to check for key conditions
 	bool hasValueCond = false; // to check for value conditions
 
-	int equalValue = -1; // keeps track of equality conditions for keys
- 	int minKey = -1; 
-	int maxKey = -1;
+	// Key range implied by the conditions; any int (including 0 and negatives) is a valid key
+	bool hasMin = false; // true -> key is bounded below by minKey
+	bool hasMax = false; // true -> key is bounded above by maxKey
+	int minKey = 0;
+	int maxKey = 0;
 	bool geCond = false; // true -> key >= minKey
 	bool leCond = false; // true -> key <= maxKey
 	bool wrongValue = false;
-	string valueCheck = "";
+	const char* valueCheck = NULL; // value that an equality condition requires
+	const char* valueLo = NULL; // the largest lower bound on the value, if any
+	const char* valueHi = NULL; // the smallest upper bound on the value, if any
+
+	count = 0;
 
 	int condPos = 0;
 	int numCond = cond.size();
@@ -127,43 +222,45 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 		if (tempCond.attr == 1 && tempCond.comp != SelCond::NE)
 		{
 			hasKeyCond = true; // found a valid key condition
-			if (tempCond.comp == SelCond::EQ) // key = curKey, break out for select condition
-			{
-				equalValue = tempValue;
-				break;
-			}
-			else if (tempCond.comp == SelCond::LT) // key < maxKey
+
+			// key < maxKey, key <= maxKey or key = maxKey
+			if (tempCond.comp == SelCond::LT)
 			{
-				if (maxKey == -1 || tempValue <= maxKey)
+				if (!hasMax || tempValue <= maxKey)
 				{
 					maxKey = tempValue;
 					leCond = false;
 				}
+				hasMax = true;
 			}
-			else if (tempCond.comp == SelCond::GT) // key > minKey
+			else if (tempCond.comp == SelCond::LE || tempCond.comp == SelCond::EQ)
 			{
-				if (minKey == -1 || tempValue >= minKey)
+				if (!hasMax || tempValue < maxKey)
 				{
-					minKey = tempValue;
-					geCond = false;
+					maxKey = tempValue;
+					leCond = true;
 				}
-
+				hasMax = true;
 			}
-			else if (tempCond.comp == SelCond::LE) // key <= maxKey
+
+			// key > minKey, key >= minKey or key = minKey
+			if (tempCond.comp == SelCond::GT)
 			{
-				if (maxKey == -1 || tempValue < maxKey)
+				if (!hasMin || tempValue >= minKey)
 				{
-					maxKey = tempValue;
-					leCond = true;
+					minKey = tempValue;
+					geCond = false;
 				}
+				hasMin = true;
 			}
-			else if (tempCond.comp == SelCond::GE)
+			else if (tempCond.comp == SelCond::GE || tempCond.comp == SelCond::EQ)
 			{
-				if (minKey == -1 || tempValue > minKey)
+				if (!hasMin || tempValue > minKey)
 				{
 					minKey = tempValue;
 					geCond = true;
 				}
+				hasMin = true;
 			}
 		} // check value conditions
 		else if (tempCond.attr == 2) 
@@ -173,140 +270,384 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 			// check matching value
 			if (tempCond.comp == SelCond::EQ)
 			{
-				if (valueCheck == "" || strcmp(value.c_str(), tempCond.value) == 0)
-					valueCheck = tempValue;
+				if (valueCheck == NULL || strcmp(valueCheck, tempCond.value) == 0)
+					valueCheck = tempCond.value;
 				else
 					wrongValue = true;
 			}
+
+			// bounds on the value, for the index on the value column
+			if (tempCond.comp == SelCond::GT || tempCond.comp == SelCond::GE || tempCond.comp == SelCond::EQ)
+			{
+				if (valueLo == NULL || strcmp(tempCond.value, valueLo) > 0)
+					valueLo = tempCond.value;
+			}
+			if (tempCond.comp == SelCond::LT || tempCond.comp == SelCond::LE || tempCond.comp == SelCond::EQ)
+			{
+				if (valueHi == NULL || strcmp(tempCond.value, valueHi) < 0)
+					valueHi = tempCond.value;
+			}
 		}
 
 		condPos++;
 	}
 
-	// Check for early select aborts
-	if ((maxKey != -1 && minKey != -1 && maxKey < minKey) || wrongValue)
+	// Check for early select aborts: an empty key range or conflicting values
+	if (hasMin && hasMax && (maxKey < minKey || (maxKey == minKey && !(geCond && leCond))))
 		goto abort_select;
-
-	/*
-	if (!geCond && !leCond && maxKey != -1 && minKey != -1 && maxKey == minKey)
+	if (hasMin && !geCond && minKey == INT_MAX)
 		goto abort_select;
-	*/
-	// Use normal select if no index tree or when using count(*) without conditions
-	if ((rc = bTree.open(table + ".idx", 'r') != 0) || (attr != 4 && !hasKeyCond))
+	if (wrongValue)
+		goto abort_select;
+
+	// An LsmTree answers a key equality with a point lookup, which skips the
+	// runs whose Bloom filter rules the key out; other conditions are checked
+	// on the tuples that a cursor merges from the runs, from the first key in range
+	if (isLsm)
 	{
-		// scan the table file from the beginning
-		rid.pid = rid.sid = 0;
-		count = 0;
-		while (rid < rf.endRid()) {
-			// read the tuple
-			if ((rc = rf.read(rid, key, value)) < 0) {
+		if (hasMin && hasMax && geCond && leCond && minKey == maxKey)
+		{
+			vector<string> values;
+			if ((rc = lsm.lookup(minKey, values)) < 0) {
 				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
 				goto exit_select;
 			}
-
-			// check the conditions on the tuple
-			for (unsigned i = 0; i < cond.size(); i++) {
-				// compute the difference between the tuple value and the condition value
-				switch (cond[i].attr) {
-				case 1:
-					diff = key - atoi(cond[i].value);
-					break;
-				case 2:
-					diff = strcmp(value.c_str(), cond[i].value);
-					break;
+			for (unsigned i = 0; i < values.size(); i++) {
+				if (matchConds(cond, minKey, values[i])) {
+					count++;
+					printTuple(attr, minKey, values[i]);
+					aggregateKey(attr, minKey, count, extreme);
 				}
+			}
+		}
+		else
+		{
+			LsmCursor lsmCursor(lsm);
+			if (!hasMin)
+				rc = lsmCursor.seek(INT_MIN);
+			else
+				rc = lsmCursor.seek(geCond ? minKey : minKey + 1);
 
-				// skip the tuple if any condition is not met
-				switch (cond[i].comp) {
-				case SelCond::EQ:
-					if (diff != 0) goto next_tuple;
-					break;
-				case SelCond::NE:
-					if (diff == 0) goto next_tuple;
-					break;
-				case SelCond::GT:
-					if (diff <= 0) goto next_tuple;
-					break;
-				case SelCond::LT:
-					if (diff >= 0) goto next_tuple;
-					break;
-				case SelCond::GE:
-					if (diff < 0) goto next_tuple;
-					break;
-				case SelCond::LE:
-					if (diff > 0) goto next_tuple;
+			while (rc == 0 && (rc = lsmCursor.next(key, value)) == 0)
+			{
+				if (hasMax && (leCond ? key > maxKey : key >= maxKey))
 					break;
+				if (matchConds(cond, key, value)) {
+					count++;
+					printTuple(attr, key, value);
+					aggregateKey(attr, key, count, extreme);
 				}
 			}
+			if (rc < 0 && rc != RC_END_OF_TREE) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				goto exit_select;
+			}
+		}
+		goto abort_select;
+	}
 
-			// the condition is met for the tuple. 
-			// increase matching tuple counter
-			count++;
+	// A key equality is looked up in the hash index, if the table has one:
+	// one bucket page, then the pages of the matching tuples in table order.
+	// The tuples are read only if a value is printed or checked
+	if (hasMin && hasMax && geCond && leCond && minKey == maxKey)
+	{
+		rc = hIndex.open(table + ".hidx", 'r');
+		if (rc == RC_INVALID_FILE_FORMAT)
+			fprintf(stderr, "Warning: index %s.hidx has an old format and is ignored; reload the table WITH HASH INDEX to rebuild it\n", table.c_str());
+		hasHashIndex = (rc == 0);
+
+		// an index that missed tuples (a load that failed part of the way,
+		// or a later load without it) would miss their keys too
+		if (hasHashIndex && hIndex.getEntryCount()
+		    != (long long)rf.endRid().pid * RecordFile::RECORDS_PER_PAGE + rf.endRid().sid) {
+			fprintf(stderr, "Warning: index %s.hidx does not cover every tuple and is ignored; reload the table WITH HASH INDEX to rebuild it\n", table.c_str());
+			hIndex.close();
+			hasHashIndex = false;
+		}
+	}
+	if (hasHashIndex)
+	{
+		vector<RecordId> rids;
+		if ((rc = hIndex.lookup(minKey, rids)) < 0) {
+			fprintf(stderr, "Error: while reading index %s.hidx\n", table.c_str());
+			goto exit_select;
+		}
 
-			// print the tuple 
-			switch (attr) {
-			case 1:  // SELECT key
-				fprintf(stdout, "%d\n", key);
+		sort(rids.begin(), rids.end());
+		for (unsigned i = 0; i < rids.size(); i++)
+		{
+			key = minKey;
+			value.erase();
+			if ((hasValueCond || attr == 2 || attr == 3) && (rc = rf.read(rids[i], key, value)) < 0) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				goto exit_select;
+			}
+			if (matchConds(cond, key, value)) {
+				count++;
+				printTuple(attr, key, value);
+				aggregateKey(attr, key, count, extreme);
+			}
+		}
+		goto abort_select;
+	}
+
+	// Use normal select if no index tree or when using count(*) without conditions.
+	// Opening the index reads page 0 alone, or nothing if it is still in memory
+	rc = bTree.open(table + ".idx", 'r');
+	if (rc == RC_INVALID_FILE_FORMAT)
+		fprintf(stderr, "Warning: index %s.idx has an old format and is ignored; reload the table WITH INDEX to rebuild it\n", table.c_str());
+	hasIndex = (rc == 0);
+	if (hasIndex && (rc = bTree.getStatistics(stats)) < 0) {
+		fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+		goto exit_select;
+	}
+
+	// The statistics answer for the table only if the index has an entry for
+	// every tuple of it: then count(*), MIN key and MAX key of the whole table
+	// are in them, and a key range outside of the smallest and the largest key
+	// matches nothing
+	indexCurrent = hasIndex && stats.entryCount
+		== (long long)rf.endRid().pid * RecordFile::RECORDS_PER_PAGE + rf.endRid().sid;
+	if (indexCurrent && aggregate && cond.empty())
+	{
+		count = stats.entryCount;
+		extreme = (attr == 5) ? stats.minKey : stats.maxKey;
+		goto abort_select;
+	}
+	if (indexCurrent && hasKeyCond && (stats.entryCount == 0
+	    || (hasMin && (long long)minKey + !geCond > stats.maxKey)
+	    || (hasMax && (long long)maxKey - !leCond < stats.minKey)))
+		goto abort_select;
+
+	// An aggregate reads the tuples in range through the index one at a time
+	// when it has value conditions; a range estimated to hold more tuples than
+	// the table has pages costs fewer page reads by scanning the table. (Tuples
+	// that are printed keep coming out in key order.)
+	if (hasIndex && aggregate && hasValueCond
+	    && estimateRange(stats, hasMin ? (long long)minKey + !geCond : INT_MIN,
+	                     hasMax ? (long long)maxKey - !leCond : INT_MAX) > rf.endRid().pid)
+		keyScan = true;
+
+	// Without a key range to use the index on, a bounded value is looked up
+	// in the index on the value column. Its keys are value prefixes, so the
+	// scan covers the prefixes of the bounds and checks the tuples it reads.
+	// The tuples are read in table order, so that each page is read once at
+	// most; a range with more tuples than the table has pages is scanned instead
+	if ((!hasIndex || !hasKeyCond) && (valueLo != NULL || valueHi != NULL))
+	{
+		rc = vIndex.open(table + ".vidx", 'r');
+		if (rc == RC_INVALID_FILE_FORMAT)
+			fprintf(stderr, "Warning: index %s.vidx has an old format and is ignored; run CREATE INDEX ON %s value to rebuild it\n", table.c_str(), table.c_str());
+		hasValueIndex = (rc == 0);
+	}
+	if (hasValueIndex)
+	{
+		ValueCursor valueCursor(vIndex);
+		ValueKey valueKey;
+		ValueKey hiKey = (valueHi != NULL) ? ValueKey(valueHi) : ValueKey();
+
+		// count(*) of a value shorter than the prefix needs no tuple reads:
+		// the value is its own index key
+		bool keyOnly = (attr == 4);
+		for (unsigned i = 0; i < cond.size(); i++) {
+			if (cond[i].attr != 2 || cond[i].comp != SelCond::EQ || strlen(cond[i].value) >= (size_t)VALUE_PREFIX)
+				keyOnly = false;
+		}
+
+		vector<RecordId> rids;
+		int maxRids = rf.endRid().pid;
+		rc = valueCursor.seek(valueLo != NULL ? ValueKey(valueLo) : ValueKey());
+		if (rc == RC_NO_SUCH_RECORD)
+			rc = 0;
+		while (rc == 0 && (rc = valueCursor.next(valueKey, rid)) == 0)
+		{
+			if (valueHi != NULL && KeyTraits<ValueKey>::less(hiKey, valueKey))
 				break;
-			case 2:  // SELECT value
-				fprintf(stdout, "%s\n", value.c_str());
+			if (keyOnly)
+				count++;
+			else if ((int)rids.size() < maxRids)
+				rids.push_back(rid);
+			else {
+				valueScan = true;
 				break;
-			case 3:  // SELECT *
-				fprintf(stdout, "%d '%s'\n", key, value.c_str());
+			}
+		}
+		if (rc < 0 && rc != RC_END_OF_TREE) {
+			fprintf(stderr, "Error: while reading index %s.vidx\n", table.c_str());
+			goto exit_select;
+		}
+
+		if (!valueScan)
+		{
+			sort(rids.begin(), rids.end());
+			for (unsigned i = 0; i < rids.size(); i++)
+			{
+				if ((rc = rf.read(rids[i], key, value)) < 0) {
+					fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+					goto exit_select;
+				}
+				if (matchConds(cond, key, value)) {
+					count++;
+					printTuple(attr, key, value);
+					aggregateKey(attr, key, count, extreme);
+				}
+			}
+			goto abort_select;
+		}
+	}
+
+	// Values are read from the leaves of the covering index, if the table has
+	// one, instead of the table: the key range is scanned in key order, and
+	// only a value that fills the whole prefix may go on in the table
+	if (attr == 2 || attr == 3 || hasValueCond || !hasIndex)
+	{
+		rc = cIndex.open(table + ".cidx", 'r');
+		if (rc == RC_INVALID_FILE_FORMAT)
+			fprintf(stderr, "Warning: index %s.cidx has an old format and is ignored; reload the table WITH COVERING INDEX to rebuild it\n", table.c_str());
+		hasCoveringIndex = (rc == 0);
+	}
+	if (hasCoveringIndex)
+	{
+		CoveringKey entryKey;
+
+		if (!hasMin)
+			rc = coveringCursor.seek(CoveringKey(INT_MIN, ""));
+		else
+			rc = coveringCursor.seek(CoveringKey(geCond ? minKey : minKey + 1, ""));
+		if (rc == RC_NO_SUCH_RECORD)
+			rc = 0;
+		while (rc == 0 && (rc = coveringCursor.next(entryKey, rid)) == 0)
+		{
+			key = entryKey.key;
+			if (hasMax && (leCond ? key > maxKey : key >= maxKey))
 				break;
+
+			value = entryKey.value.str();
+			if (value.size() == (size_t)COVERED_VALUE && (attr == 2 || attr == 3 || hasValueCond)
+			    && (rc = rf.read(rid, key, value)) < 0) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				goto exit_select;
+			}
+			if (matchConds(cond, key, value)) {
+				count++;
+				printTuple(attr, key, value);
+				aggregateKey(attr, key, count, extreme);
+			}
+		}
+		if (rc < 0 && rc != RC_END_OF_TREE) {
+			fprintf(stderr, "Error: while reading index %s.cidx\n", table.c_str());
+			goto exit_select;
+		}
+		goto abort_select;
+	}
+
+	if (!hasIndex || (!aggregate && !hasKeyCond) || valueScan || keyScan)
+	{
+		// scan the table file from the beginning
+		rid.pid = rid.sid = 0;
+		while (rid < rf.endRid()) {
+			// read the tuple
+			if ((rc = rf.read(rid, key, value)) < 0) {
+				fprintf(stderr, "Error: while reading a tuple from table %s\n", table.c_str());
+				goto exit_select;
+			}
+
+			// print the tuple if every condition is met
+			if (matchConds(cond, key, value)) {
+				count++;
+				printTuple(attr, key, value);
+				aggregateKey(attr, key, count, extreme);
 			}
 
 			// move to the next tuple
-		next_tuple:
 			++rid;
 		}
 	}
 	else // use the index file
 	{
 		rid.pid = rid.sid = 0;
-		count = 0;
-		hasIndex = true;
 
-		// Set cursor position
-		if (equalValue != -1) // key is equal to certain value
-			bTree.locate(equalValue, cursor);
-		else if (minKey != -1 && geCond)
-			bTree.locate(minKey, cursor);
-		else if (minKey != -1 && !geCond)
-			bTree.locate(minKey + 1, cursor);
-		else
-			bTree.locate(0, cursor);
+		bool hasNE = false;
+		for (unsigned i = 0; i < cond.size(); i++) {
+			if (cond[i].comp == SelCond::NE)
+				hasNE = true;
+		}
 
-		// Traverse through tree
-		while (bTree.readForward(cursor, key, rid) == 0)
+		// count(*) over a key range is the difference of two ranks, which the
+		// non-leaf nodes give from the entry counts of their children:
+		// no leaf in between is read
+		if (attr == 4 && !hasValueCond && !hasNE)
 		{
-			if (!hasValueCond && attr == 4)
-			{
-				// Key equality failure
-				if (equalValue != -1 && key != equalValue)
-					goto abort_select;
+			int n;
+			if ((rc = bTree.countRange(hasMin ? &minKey : NULL, geCond, hasMax ? &maxKey : NULL, leCond, n)) < 0) {
+				fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+				goto exit_select;
+			}
+			count += n;
+			goto abort_select;
+		}
 
-				// check GT or GE failures
-				if (minKey != -1)
-				{
-					if (geCond && key < minKey)
-						goto abort_select;
-					else if (!geCond && key <= minKey)
-						goto abort_select;
+		// Set cursor position to the first key in range; key > INT_MAX was
+		// left above as an empty range, so minKey + 1 does not overflow.
+		// A seek past the last key leaves the cursor at the end
+		if (!hasMin)
+			rc = cursor.seek(INT_MIN);
+		else
+			rc = cursor.seek(geCond ? minKey : minKey + 1);
+		if (rc < 0 && rc != RC_NO_SUCH_RECORD) {
+			fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+			goto exit_select;
+		}
+
+		// Without value conditions, count(*) and key selection are answered
+		// from the index alone; checking the keys here saves the tuple reads
+		if (!hasValueCond && (attr == 1 || aggregate))
+		{
+			int hi = hasMax ? maxKey : INT_MAX;
+			bool hiInclusive = hasMax ? leCond : true;
+
+			// The keys in range come a batch at a time
+			const int BATCH_SIZE = 128;
+			IndexEntry<int> batch[BATCH_SIZE];
+			int n;
+			do {
+				if ((rc = cursor.scanBatch(hi, hiInclusive, batch, BATCH_SIZE, n)) < 0) {
+					fprintf(stderr, "Error: while reading index %s.idx\n", table.c_str());
+					goto exit_select;
 				}
 
-				// check LE or LT failures
-				if (maxKey != -1)
-				{
-					if (leCond && key > maxKey)
-						goto abort_select;
-					else if (!leCond && key >= maxKey)
+				for (int j = 0; j < n; j++) {
+					for (unsigned i = 0; i < cond.size(); i++) {
+						if (cond[i].comp == SelCond::NE && batch[j].key == atoi(cond[i].value))
+							goto next_entry;
+					}
+
+					count++;
+					aggregateKey(attr, batch[j].key, count, extreme);
+					if (attr == 1)
+						fprintf(stdout, "%d\n", batch[j].key);
+
+					// the keys come in order: the first one is the smallest
+					if (attr == 5)
 						goto abort_select;
+				next_entry:
+					;
 				}
+			} while (n == BATCH_SIZE);
 
-				// checking for failures as we traverse saves from extraneous reads
-				count++;
-				continue;
+			goto abort_select;
+		}
+
+		// Traverse through tree; the cursor reads each leaf once
+		while (cursor.next(key, rid) == 0)
+		{
+			// Keys come out of the index sorted, so stop at the first key past the range
+			if (hasMax)
+			{
+				if (leCond && key > maxKey)
+					goto abort_select;
+				else if (!leCond && key >= maxKey)
+					goto abort_select;
 			}
 
 			// read the tuple
@@ -315,78 +656,13 @@ RC SqlEngine::select(int attr, const string& table, const vector<SelCond>& cond)
 				goto exit_select;
 			}
 
-			// check the conditions on the tuple
-			for (unsigned i = 0; i < cond.size(); i++) {
-				// compute the difference between the tuple value and the condition value
-				switch (cond[i].attr) {
-				case 1:
-					diff = key - atoi(cond[i].value);
-					break;
-				case 2:
-					diff = strcmp(value.c_str(), cond[i].value);
-					break;
-				}
-
-				// skip the tuple if any condition is not met
-				// after LE,LT,EQ fails, abort select since index tree is sorted
-				switch (cond[i].comp) {
-				case SelCond::EQ:
-					if (diff != 0)
-					{
-						if (cond[i].attr == 1)
-							goto abort_select;
-						goto continue_loop;
-					}
-					break;
-				case SelCond::NE:
-					if (diff == 0) goto continue_loop;
-					break;
-				case SelCond::GT:
-					if (diff <= 0) goto continue_loop;
-					break;
-				case SelCond::LT:
-					if (diff >= 0)
-					{
-						if (cond[i].attr == 1)
-							goto abort_select;
-						goto continue_loop;
-					}
-					break;
-				case SelCond::GE:
-					if (diff < 0) goto continue_loop;
-					break;
-				case SelCond::LE:
-					if (diff > 0)
-					{
-						if (cond[i].attr == 1)
-							goto abort_select;
-						goto continue_loop;
-					}
-					break;
-				}
-			}
-
-			// the condition is met for the tuple. 
-			// increase matching tuple counter
-			count++;
-
-			// print the tuple 
-			switch (attr) {
-			case 1:  // SELECT key
-				fprintf(stdout, "%d\n", key);
-				break;
-			case 2:  // SELECT value
-				fprintf(stdout, "%s\n", value.c_str());
-				break;
-			case 3:  // SELECT *
-				fprintf(stdout, "%d '%s'\n", key, value.c_str());
-				break;
+			// print the tuple if every condition is met; the keys past
+			// maxKey, where no tuple can match any more, end the loop above
+			if (matchConds(cond, key, value)) {
+				count++;
+				printTuple(attr, key, value);
+				aggregateKey(attr, key, count, extreme);
 			}
-
-			// move to the next tuple
-		continue_loop:
-			cout << "";
-
 		}
 	}
 
@@ -397,27 +673,54 @@ abort_select:
 	if (attr == 4) {
 		fprintf(stdout, "%d\n", count);
 	}
+
+	// print the key of "select min key" or "select max key", if a tuple matched
+	if ((attr == 5 || attr == 6) && count > 0) {
+		fprintf(stdout, "%d\n", extreme);
+	}
 	rc = 0;
 
 	// close the table file and return
 exit_select:
 	if (hasIndex)
 		bTree.close();
-	rf.close();
+	if (hasValueIndex)
+		vIndex.close();
+	if (hasHashIndex)
+		hIndex.close();
+	if (hasCoveringIndex)
+		cIndex.close();
+	if (isLsm)
+		lsm.close();
+	else
+		rf.close();
 	return rc;
 }
 
-RC SqlEngine::load(const string& table, const string& loadfile, bool index)
+RC SqlEngine::load(const string& table, const string& loadfile, bool index, int indexes)
 {
 	RecordFile rf;   // RecordFile containing the table
 	RecordId   rid;  // record cursor for table scanning
 	BTreeIndex bTree; // B+ tree to hold index
+	ValueIndex vIndex; // index on the value column
+	HashIndex  hIndex; // hash index on the key column
+	CoveringIndex cIndex; // covering index
+	ifstream   infile; // the load file
 
 	RC     rc;
 	int    key;
 	string value;
 	string line;
 	int linecount = 1;
+	bool hasIndex = false;
+	bool bulk = false;
+	bool hasValueIndex = false;
+	bool hasHashIndex = false;
+	bool hasCoveringIndex = false;
+
+	// A table loaded USING LSM takes later loads into its LsmTree too
+	if (access((table + ".lsm").c_str(), F_OK) == 0)
+		return loadLsm(table, loadfile);
 
 	// create the table file if it doesn't exist
 	if ((rc = rf.open(table + ".tbl", 'w')) < 0) {
@@ -425,41 +728,132 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 		return rc;
 	}
 
+	// An index on the value column gets the new tuples inserted into it;
+	// one asked for by this load is built from the whole table at the end
+	if (access((table + ".vidx").c_str(), F_OK) == 0)
+	{
+		if ((rc = vIndex.open(table + ".vidx", 'w')) < 0)
+		{
+			if (rc == RC_INVALID_FILE_FORMAT)
+				fprintf(stderr, "Error: index %s.vidx has an old format; run CREATE INDEX ON %s value to rebuild it\n", table.c_str(), table.c_str());
+			goto exit_load;
+		}
+		hasValueIndex = true;
+	}
+
+	// Likewise for a hash index on the key column
+	if (access((table + ".hidx").c_str(), F_OK) == 0)
+	{
+		if ((rc = hIndex.open(table + ".hidx", 'w')) < 0)
+		{
+			if (rc == RC_INVALID_FILE_FORMAT)
+				fprintf(stderr, "Error: index %s.hidx has an old format; remove it and reload the table WITH HASH INDEX\n", table.c_str());
+			goto exit_load;
+		}
+		hasHashIndex = true;
+	}
+
+	// and for a covering index
+	if (access((table + ".cidx").c_str(), F_OK) == 0)
+	{
+		if ((rc = cIndex.open(table + ".cidx", 'w')) < 0)
+		{
+			if (rc == RC_INVALID_FILE_FORMAT)
+				fprintf(stderr, "Error: index %s.cidx has an old format; remove it and reload the table WITH COVERING INDEX\n", table.c_str());
+			goto exit_load;
+		}
+		hasCoveringIndex = true;
+	}
+
+	// An index on the key column that the table already has is kept up to
+	// date by every load, whether or not this one asks for it
+	if (access((table + ".idx").c_str(), F_OK) == 0)
+		index = true;
+
 	// open the load file and parse line by line
 	// insert the tuples into the table file
-	ifstream infile(loadfile.c_str());
+	infile.open(loadfile.c_str());
 	if (index)
 	{
 		// Open index file
 		if ((rc = bTree.open(table + ".idx", 'w')) < 0)
 		{
-			return rc;
+			if (rc == RC_INVALID_FILE_FORMAT)
+				fprintf(stderr, "Error: index %s.idx has an old format; remove it and reload the table\n", table.c_str());
+			goto exit_load;
 		}
+		hasIndex = true;
+
+		// A new index is built bottom-up from the key-rid pairs, sorted with
+		// a bounded buffer that spills sorted runs next to the index file;
+		// an index that already has entries gets them inserted one by one.
+		// The sorter removes its run files when it goes out of scope
+		bulk = (bTree.getHeight() == 0);
+		ExternalSort< IndexEntry<int> > sorter(table + ".idx");
+		IndexEntry<int> entry;
 
 		while (getline(infile, line))
 		{
 			if ((rc = parseLoadLine(line, key, value)) < 0)
 			{
 				fprintf(stderr, "Error: table %s could not parse line %d \n", table.c_str(), linecount);
-				return rc;
+				goto exit_load;
 			}
 			if ((rc = rf.append(key, value, rid)) < 0)
 			{
 				fprintf(stderr, "Error: table %s could not append line %d \n", table.c_str(), linecount);
-				return rc;
+				goto exit_load;
 			}
+			if (hasValueIndex && (rc = vIndex.insert(ValueKey(value), rid)) < 0)
+				goto exit_load;
+			if (hasHashIndex && (rc = hIndex.insert(key, rid)) < 0)
+				goto exit_load;
+			if (hasCoveringIndex && (rc = cIndex.insert(CoveringKey(key, value), rid)) < 0)
+				goto exit_load;
 
 			// Insert key-rid pair into bTree to index
-			if ((rc = bTree.insert(key, rid)) < 0)
+			if (bulk)
+			{
+				entry.key = key;
+				entry.rid = rid;
+				if ((rc = sorter.add(entry)) < 0)
+				{
+					fprintf(stderr, "Error: could not sort the keys of table %s\n", table.c_str());
+					goto exit_load;
+				}
+			}
+			else if ((rc = bTree.insert(key, rid)) < 0)
 			{
-				return rc;
+				goto exit_load;
 			}
 
 			linecount++;
 		}
+
+		if (bulk)
+		{
+			if ((rc = sorter.sort()) < 0)
+			{
+				fprintf(stderr, "Error: could not sort the keys of table %s\n", table.c_str());
+				goto exit_load;
+			}
+
+			if ((rc = bTree.beginBulkLoad()) < 0)
+				goto exit_load;
+			while ((rc = sorter.next(entry)) == 0)
+			{
+				if ((rc = bTree.bulkInsert(entry.key, entry.rid)) < 0)
+					goto exit_load;
+			}
+			if (rc != RC_NO_SUCH_RECORD)
+			{
+				fprintf(stderr, "Error: could not read the sorted keys of table %s\n", table.c_str());
+				goto exit_load;
+			}
+			if ((rc = bTree.endBulkLoad()) < 0)
+				goto exit_load;
+		}
 		//bTree.print();
-		// Close index tree file
-		bTree.close();
 	}
 	else
 	{
@@ -468,20 +862,216 @@ RC SqlEngine::load(const string& table, const string& loadfile, bool index)
 			if ((rc = parseLoadLine(line, key, value)) < 0)
 			{
 				fprintf(stderr, "Error: table %s could not parse line %d \n", table.c_str(), linecount);
-				return rc;
+				goto exit_load;
 			}
 			if ((rc = rf.append(key, value, rid)) < 0)
 			{
 				fprintf(stderr, "Error: table %s could not append line %d \n", table.c_str(), linecount);
-				return rc;
+				goto exit_load;
 			}
+			if (hasValueIndex && (rc = vIndex.insert(ValueKey(value), rid)) < 0)
+				goto exit_load;
+			if (hasHashIndex && (rc = hIndex.insert(key, rid)) < 0)
+				goto exit_load;
+			if (hasCoveringIndex && (rc = cIndex.insert(CoveringKey(key, value), rid)) < 0)
+				goto exit_load;
 
 			linecount++;
 		}
 	}
+	rc = 0;
 
+	// close the load file, the table and its indexes, also after an error:
+	// the tuples appended so far stay in the table and in the indexes that
+	// took them one by one. A key index built from scratch gets none of
+	// them, so it is removed, and the table is read without it
+exit_load:
 	infile.close();
+	if (hasIndex) {
+		bTree.close();
+		if (rc < 0 && bulk)
+			remove((table + ".idx").c_str());
+	}
+	if (hasValueIndex)
+		vIndex.close();
+	if (hasHashIndex)
+		hIndex.close();
+	if (hasCoveringIndex)
+		cIndex.close();
+	rf.close();
+	if (rc < 0)
+		return rc;
+
+	if ((indexes & VALUE_INDEX) && !hasValueIndex && (rc = createIndex(table, 2)) < 0)
+		return rc;
+	if ((indexes & HASH_INDEX) && !hasHashIndex && (rc = createHashIndex(table)) < 0)
+		return rc;
+	if ((indexes & COVERING_INDEX) && !hasCoveringIndex && (rc = createIndex(table, 3)) < 0)
+		return rc;
+	return 0;
+}
+
+// the key of a tuple in the index on each column
+static int keyColumn(int key, const string&) { return key; }
+static ValueKey valueColumn(int, const string& value) { return ValueKey(value); }
+static CoveringKey bothColumns(int key, const string& value) { return CoveringKey(key, value); }
+
+// build an index from scratch on the column that keyOf() picks out of a tuple,
+// bulk loading the entries after sorting them
+template <class KeyType>
+static RC buildIndex(RecordFile& rf, const string& indexName, KeyType (*keyOf)(int, const string&))
+{
+	BTreeIndexT<KeyType> index;
+	IndexEntry<KeyType> entry;
+	RecordId rid;
+	RC rc;
+	int key;
+	string value;
+
+	remove(indexName.c_str());
+	if ((rc = index.open(indexName, 'w')) < 0)
+		return rc;
+
+	ExternalSort< IndexEntry<KeyType> > sorter(indexName);
+	for (rid.pid = rid.sid = 0; rid < rf.endRid(); ++rid)
+	{
+		if ((rc = rf.read(rid, key, value)) < 0)
+			return rc;
+		entry.key = keyOf(key, value);
+		entry.rid = rid;
+		if ((rc = sorter.add(entry)) < 0)
+			return rc;
+	}
+	if ((rc = sorter.sort()) < 0)
+		return rc;
+
+	if ((rc = index.beginBulkLoad()) < 0)
+		return rc;
+	while ((rc = sorter.next(entry)) == 0)
+	{
+		if ((rc = index.bulkInsert(entry.key, entry.rid)) < 0)
+			return rc;
+	}
+	if (rc != RC_NO_SUCH_RECORD)
+		return rc;
+	if ((rc = index.endBulkLoad()) < 0)
+		return rc;
+	return index.close();
+}
+
+RC SqlEngine::createHashIndex(const string& table)
+{
+	RecordFile rf;   // RecordFile containing the table
+	RecordId   rid;  // record cursor for table scanning
+	HashIndex  hIndex; // hash index on the key column
+	RC     rc;
+	int    key;
+	string value;
+
+	if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+		fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+		return rc;
+	}
+
+	// the buckets are sized for the table, and each is written once
+	remove((table + ".hidx").c_str());
+	remove((table + ".hidx.ovf").c_str());
+	if ((rc = hIndex.open(table + ".hidx", 'w')) < 0)
+		goto exit_create;
+
+	rid = rf.endRid();
+	if ((rc = hIndex.beginBulkLoad(rid.pid * RecordFile::RECORDS_PER_PAGE + rid.sid)) < 0)
+		goto exit_create;
+	for (rid.pid = rid.sid = 0; rid < rf.endRid(); ++rid)
+	{
+		if ((rc = rf.read(rid, key, value)) < 0 || (rc = hIndex.bulkInsert(key, rid)) < 0)
+			goto exit_create;
+	}
+	if ((rc = hIndex.endBulkLoad()) < 0)
+		goto exit_create;
+	rc = hIndex.close();
+
+exit_create:
+	if (rc < 0)
+		fprintf(stderr, "Error: could not build the hash index of table %s\n", table.c_str());
+	rf.close();
+	return rc;
+}
+
+RC SqlEngine::createIndex(const string& table, int attr)
+{
+	RecordFile rf;   // RecordFile containing the table
+	RC rc;
+
+	if ((rc = rf.open(table + ".tbl", 'r')) < 0) {
+		if (access((table + ".lsm").c_str(), F_OK) == 0)
+			fprintf(stderr, "Error: table %s is stored USING LSM and cannot be indexed\n", table.c_str());
+		else
+			fprintf(stderr, "Error: table %s does not exist\n", table.c_str());
+		return rc;
+	}
+
+	if (attr == 1)
+		rc = buildIndex(rf, table + ".idx", keyColumn);
+	else if (attr == 2)
+		rc = buildIndex(rf, table + ".vidx", valueColumn);
+	else
+		rc = buildIndex(rf, table + ".cidx", bothColumns);
+	if (rc < 0)
+		fprintf(stderr, "Error: could not build the %s index of table %s\n", attr == 1 ? "key" : attr == 2 ? "value" : "covering", table.c_str());
+
 	rf.close();
+	return rc;
+}
+
+RC SqlEngine::loadLsm(const string& table, const string& loadfile)
+{
+	LsmTree lsm;     // LsmTree containing the table
+	RC     rc;
+	int    key;
+	string value;
+	string line;
+	int linecount = 1;
+
+	// the tuples of a table are either in a table file or in an LsmTree
+	if (access((table + ".tbl").c_str(), F_OK) == 0) {
+		fprintf(stderr, "Error: table %s is already stored in %s.tbl\n", table.c_str(), table.c_str());
+		return RC_INVALID_FILE_MODE;
+	}
+
+	// create the LsmTree if it doesn't exist
+	if ((rc = lsm.open(table, 'w')) < 0) {
+		if (rc == RC_INVALID_FILE_FORMAT)
+			fprintf(stderr, "Error: table %s.lsm has an old format; remove it and reload the table\n", table.c_str());
+		else
+			fprintf(stderr, "Error: table %s could not be created\n", table.c_str());
+		return rc;
+	}
+
+	// the LsmTree sorts the tuples in its memtable and writes them out a run at a time
+	ifstream infile(loadfile.c_str());
+	while (getline(infile, line))
+	{
+		if ((rc = parseLoadLine(line, key, value)) < 0)
+		{
+			fprintf(stderr, "Error: table %s could not parse line %d \n", table.c_str(), linecount);
+			return rc;
+		}
+		if ((rc = lsm.insert(key, value)) < 0)
+		{
+			fprintf(stderr, "Error: table %s could not append line %d \n", table.c_str(), linecount);
+			return rc;
+		}
+
+		linecount++;
+	}
+
+	infile.close();
+	if ((rc = lsm.close()) < 0)
+	{
+		fprintf(stderr, "Error: table %s could not be written\n", table.c_str());
+		return rc;
+	}
 	return 0;
 }
 
@@ -28,6 +28,15 @@ struct SelCond {
  */
 class SqlEngine {
  public:
+  /**
+   * the indexes that a LOAD builds besides the B+tree on the key column
+   * (see load()), or keeps up to date once a table has them.
+   */
+  enum {
+    VALUE_INDEX = 1,     // "WITH INDEX ON value": a B+tree on the value column, <table>.vidx
+    HASH_INDEX = 2,      // "WITH HASH INDEX": a hash index on the key column, <table>.hidx
+    COVERING_INDEX = 4   // "WITH COVERING INDEX": a B+tree on the key and the value, <table>.cidx
+  };
     
   /**
    * takes the user commands from commandline and executes them.
@@ -43,7 +52,7 @@ class SqlEngine {
    * all conditions in conds must be ANDed together.
    * the result of the SELECT is printed on screen.
    * @param attr[IN] attribute in the SELECT clause
-   * (1: key, 2: value, 3: *, 4: count(*))
+   * (1: key, 2: value, 3: *, 4: count(*), 5: min key, 6: max key)
    * @param table[IN] the table name in the FROM clause
    * @param conds[IN] list of conditions in the WHERE clause
    * @return error code. 0 if no error
@@ -54,10 +63,39 @@ class SqlEngine {
    * load a table from a load file.
    * @param table[IN] the table name in the LOAD command
    * @param loadfile[IN] the file name of the load file
-   * @param index[IN] true if "WITH INDEX" option was specified
+   * @param index[IN] true if "WITH INDEX" option was specified. an index on the key column
+   * that the table already has is updated either way
+   * @param indexes[IN] the other indexes to build (VALUE_INDEX, HASH_INDEX,
+   * COVERING_INDEX). those a table has already are kept up to date on every load.
+   * @return error code. 0 if no error
+   */
+  static RC load(const std::string& table, const std::string& loadfile, bool index, int indexes = 0);
+
+  /**
+   * build an index on a column of a table from the tuples in the table,
+   * as with "CREATE INDEX ON table column". an existing index is rebuilt.
+   * @param table[IN] the table name
+   * @param attr[IN] the column to index (1: key, 2: value, 3: both, in a covering index)
+   * @return error code. 0 if no error
+   */
+  static RC createIndex(const std::string& table, int attr);
+
+  /**
+   * build a hash index on the key column of a table from the tuples in the
+   * table. an existing hash index is rebuilt.
+   * @param table[IN] the table name
+   * @return error code. 0 if no error
+   */
+  static RC createHashIndex(const std::string& table);
+
+  /**
+   * load a table from a load file into an LsmTree, as with "USING LSM".
+   * the table is created if it does not exist, and must not have a table file.
+   * @param table[IN] the table name in the LOAD command
+   * @param loadfile[IN] the file name of the load file
    * @return error code. 0 if no error
    */
-  static RC load(const std::string& table, const std::string& loadfile, bool index);
+  static RC loadLsm(const std::string& table, const std::string& loadfile);
 
   /**
    * parse a line from the load file into the (key, value) pair.
@@ -55,12 +55,25 @@ commands:
 
 command:
         load_command { fprintf(stdout, "Bruinbase> "); }
+	| create_command { fprintf(stdout, "Bruinbase> "); }
 	| select_command { fprintf(stdout, "Bruinbase> "); }
 	| quit_command
 	| error LF { fprintf(stdout, "Bruinbase> "); }
 	| LF { fprintf(stdout, "Bruinbase> "); }
 	;
 
+create_command:
+	ID INDEX ID table attribute LF {
+	  if (strcasecmp($1, "create") != 0 || strcasecmp($3, "on") != 0)
+	    sqlerror("syntax error. expected CREATE INDEX ON table key or value");
+	  else if ($5 == 1 || $5 == 2)
+	    SqlEngine::createIndex(std::string($4), $5);
+	  free($1);
+	  free($3);
+	  free($4);
+	}
+	;
+
 quit_command:
 	QUIT { return 0; }
 	;
@@ -76,6 +89,33 @@ load_command:
 	  free($2);
 	  free($4);
 	}
+	| LOAD table FROM STRING WITH ID INDEX LF {
+	  if (strcasecmp($6, "hash") == 0)
+	    SqlEngine::load(std::string($2), std::string($4), false, SqlEngine::HASH_INDEX);
+	  else if (strcasecmp($6, "covering") == 0)
+	    SqlEngine::load(std::string($2), std::string($4), false, SqlEngine::COVERING_INDEX);
+	  else sqlerror("syntax error. expected WITH HASH INDEX or WITH COVERING INDEX");
+	  free($2);
+	  free($4);
+	  free($6);
+	}
+	| LOAD table FROM STRING WITH INDEX ID attribute LF {
+	  if (strcasecmp($7, "on") != 0) sqlerror("syntax error. expected WITH INDEX ON key or value");
+	  else if ($8 == 1) SqlEngine::load(std::string($2), std::string($4), true);
+	  else if ($8 == 2) SqlEngine::load(std::string($2), std::string($4), false, SqlEngine::VALUE_INDEX);
+	  free($2);
+	  free($4);
+	  free($7);
+	}
+	| LOAD table FROM STRING ID ID LF {
+	  if (strcasecmp($5, "using") == 0 && strcasecmp($6, "lsm") == 0)
+	    SqlEngine::loadLsm(std::string($2), std::string($4));
+	  else sqlerror("syntax error. expected USING LSM");
+	  free($2);
+	  free($4);
+	  free($5);
+	  free($6);
+	}
 	;
 
 select_command:
@@ -122,6 +162,19 @@ attributes:
 	attribute { $$ = $1; }
 	| STAR  { $$ = 3; }
 	| COUNT { $$ = 4; }
+	/* MIN key and MAX key. The lexer matches COUNT(*) as a whole and has no
+	   rule for parentheses, so these are written without them */
+	| ID attribute {
+	  int aggregate = 0;
+	  if (strcasecmp($1, "min") == 0 && $2 == 1) aggregate = 5;
+	  else if (strcasecmp($1, "max") == 0 && $2 == 1) aggregate = 6;
+	  free($1);
+	  if (aggregate == 0) {
+	    sqlerror("syntax error. expected MIN key or MAX key");
+	    YYERROR;
+	  }
+	  $$ = aggregate;
+	}
 	;
 
 attribute:
@@ -0,0 +1,155 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Microbenchmark of the search for a key inside a node (run by "make bench").
+ *
+ * Prints the ns per lookup in a sorted array of int keys for
+ *  - the linear scan the nodes used before, one memcpy per key up to the
+ *    first key not smaller than the one sought;
+ *  - the branch-free binary search;
+ *  - the SSE4.2 and AVX2 searches, on CPUs that have them (the three
+ *    come from findKeySearch());
+ *  - countKeysBelow(), which the nodes call, with the search it picked;
+ * and the ns per BTLeafNode::locate() in a full leaf, which adds the
+ * packed leaf format on top. The arrays are as large as a few keys, the
+ * keys of a non-leaf node of a 1KB page, and the keys of larger pages.
+ *
+ * usage: bench_search [lookups]
+ */
+
+#include "KeySearch.h"
+#include "BTreeNode.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <chrono>
+
+using namespace std;
+
+/*
+ * The search of the nodes before the binary search: read the keys one at a
+ * time until the first one not smaller than bound.
+ */
+static int countBelowLinear(const char* keys, int count, int bound)
+{
+	int eid;
+
+	for (eid = 0; eid < count; eid++)
+	{
+		int key;
+		memcpy(&key, keys + eid * sizeof(int), sizeof(int));
+		if (key >= bound)
+			break;
+	}
+
+	return eid;
+}
+
+static int countBelowPicked(const char* keys, int count, int bound)
+{
+	return countKeysBelow(keys, count, bound, false);
+}
+
+/*
+ * Time search over the lookups in searchKeys.
+ * @return ns per lookup; sink collects the results, so that none is left out
+ */
+static double timeSearch(CountBelowFunc search, const vector<int>& keys, const vector<int>& searchKeys, long long& sink)
+{
+	const char* array = (const char*)&keys[0];
+	int count = keys.size();
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (size_t i = 0; i < searchKeys.size(); i++)
+		sink += search(array, count, searchKeys[i]);
+	double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+	return elapsed / searchKeys.size();
+}
+
+/*
+ * Time BTLeafNode::locate() in a leaf filled with the keys 0, 2, 4, ...
+ */
+static void timeLeafLocate(int lookups, long long& sink)
+{
+	BTLeafNode leaf;
+	vector<int> searchKeys(lookups);
+	int count = 0;
+
+	for (RecordId rid = { 1, 0 }; leaf.insert(2 * count, rid) == 0; count++)
+		;
+	for (int i = 0; i < lookups; i++)
+		searchKeys[i] = rand() % (2 * count + 1);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int i = 0; i < lookups; i++)
+	{
+		int eid;
+		leaf.locate(searchKeys[i], eid);
+		sink += eid;
+	}
+	double elapsed = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
+
+	printf("BTLeafNode::locate() in a full leaf of %d keys: %.1f ns\n", count, elapsed / lookups);
+}
+
+int main(int argc, char** argv)
+{
+	int lookups = (argc > 1) ? atoi(argv[1]) : 2000000;
+	const int counts[] = { 16, BTNonLeafNode::getMaxKeys(), 256, 1024, 4096 };
+	vector<const char*> names;
+	vector<CountBelowFunc> searches;
+	long long sink = 0;
+
+	if (lookups <= 0)
+	{
+		fprintf(stderr, "usage: %s [lookups]\n", argv[0]);
+		return 1;
+	}
+
+	names.push_back("linear");
+	searches.push_back(countBelowLinear);
+	const char* picks[] = { "binary", "sse4.2", "avx2" };
+	for (size_t p = 0; p < sizeof(picks) / sizeof(picks[0]); p++)
+	{
+		CountBelowFunc search = findKeySearch(picks[p]);
+		if (search != NULL)
+		{
+			names.push_back(picks[p]);
+			searches.push_back(search);
+		}
+	}
+	names.push_back("picked");
+	searches.push_back(countBelowPicked);
+
+	printf("ns per lookup, %d lookups of random keys\n", lookups);
+	printf("%6s", "keys");
+	for (size_t s = 0; s < names.size(); s++)
+		printf(" %9s", names[s]);
+	printf("\n");
+
+	srand(1);
+	for (size_t c = 0; c < sizeof(counts) / sizeof(counts[0]); c++)
+	{
+		vector<int> keys(counts[c]);
+		vector<int> searchKeys(lookups);
+		for (int i = 0; i < counts[c]; i++)
+			keys[i] = 2 * i;
+		for (int i = 0; i < lookups; i++)
+			searchKeys[i] = rand() % (2 * counts[c] + 1);
+
+		printf("%6d", counts[c]);
+		for (size_t s = 0; s < searches.size(); s++)
+			printf(" %9.1f", timeSearch(searches[s], keys, searchKeys, sink));
+		printf("\n");
+	}
+	timeLeafLocate(lookups, sink);
+
+	// Keeps the compiler from dropping the searches
+	return sink == 42 ? 2 : 0;
+}
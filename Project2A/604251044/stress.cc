@@ -0,0 +1,683 @@
+/*
+ * Copyright (C) 2008 by The Regents of the University of California
+ * Redistribution of this file is permitted under the terms of the GNU
+ * Public License (GPL).
+ */
+
+/*
+ * Multithreaded stress test of BTreeIndex (run by "make stress").
+ *
+ * First, on their own thread, the lookups that read many entries at once
+ * or go backward are checked against the plain ones, on an index built by
+ * inserts (again with optimistic reads), a bulk loaded one, one whose keys
+ * have posting lists (again once its entry counts are counted anew), a
+ * buffered one and one whose inserts keep the entry counts up to date:
+ *  - locateMany() must return what a locate() (or a seek()) of each key
+ *    and a forward scan from there return;
+ *  - a backward scan from locateLast() with readBackward(), and from
+ *    seekLast() with prev(), must return the entries of a forward scan,
+ *    in descending key order;
+ *  - locateBefore() and seekBefore() must stop on the entry in front of
+ *    the one locate() and seek() stop on;
+ *  - rank() and the countRange() of the index and of the cursor must
+ *    count the entries of the forward scan.
+ * The functions on an IndexCursor only see the leaves, so they are not
+ * checked on the buffered index, whose inserts are still in the buffers.
+ *
+ * The index then starts with the keys 0, 4, 8, ... bulk loaded into it. Every
+ * thread then inserts its share of the keys 1, 5, 9, ..., which splits the
+ * leaves under the other threads, and every few inserts adds a RecordId to
+ * the posting list of key 2. Meanwhile each thread checks that
+ *  - seek() stops on the first key not smaller than the key sought: the
+ *    bulk loaded keys are always there, so it is the next multiple of 4
+ *    at the latest, and the multiple of 4 itself if one is sought;
+ *  - a scan over a range returns its keys in order, once each, and misses
+ *    none of the bulk loaded keys.
+ * Once the threads are done, a scan of the whole index must return every
+ * key inserted exactly once, with its RecordId.
+ *
+ * The same work is done with 1, 2, 4 and 8 threads in each mode of the
+ * index (in place, in place with optimistic reads, in place with entry
+ * counts, copy-on-write and buffered), and the time it takes is printed,
+ * so the output also shows how the inserts scale with the threads.
+ *
+ * Last, the lookups alone are timed on an index built the same way: 1, 2,
+ * 4 and 8 threads seek() random keys, then scan random ranges, with
+ * B-link reads and with optimistic reads, each checked as above. The
+ * lookups and scans per second are printed, with the speedup over one
+ * thread; it cannot go past the number of CPUs, which is printed too.
+ *
+ * usage: stress [keys]
+ */
+
+#include "BTreeIndex.h"
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+#include <unistd.h>
+
+using namespace std;
+
+static const char* INDEX_FILE = "stress.idx";
+static const int DUP_KEY = 2;       // the key whose RecordIds go to a posting list
+static const int DUP_EVERY = 10;    // a thread adds to it once every DUP_EVERY inserts
+static const int SEEK_EVERY = 4;    // checks seek() once every SEEK_EVERY inserts
+static const int SCAN_EVERY = 500;  // scans a range once every SCAN_EVERY inserts
+static const int SCAN_LENGTH = 4000;
+static const int READ_SCANS = 1000; // the ranges scanned for the timing of the scans
+
+static atomic<int> errors(0);
+
+/*
+ * Report a failed check; only the first few are printed.
+ */
+static void fail(const char* what, int thread, int key, int got)
+{
+	if (errors++ < 10)
+		fprintf(stderr, "thread %d: %s %d, got %d\n", thread, what, key, got);
+}
+
+/*
+ * Check that seek(key) stops on the first key not smaller than key.
+ * No key is ever removed, and the multiples of 4 are all there from the start.
+ */
+static void checkSeek(BTreeIndex& index, int thread, int key, int keys)
+{
+	BTreeCursor cursor(index);
+	RecordId rid;
+	int found;
+	int bound = (key + 3) / 4 * 4;
+
+	RC rc = cursor.seek(key);
+	if (cursor.next(found, rid) < 0)
+	{
+		if (bound < 4 * keys)
+			fail("seek ran off the end looking for", thread, key, 0);
+		return;
+	}
+	if (found < key || found > bound)
+		fail("seek out of bounds for", thread, key, found);
+	if ((rc == 0) != (found == key))
+		fail("seek returned the wrong code for", thread, key, found);
+}
+
+/*
+ * Scan the keys from lo up to lo + SCAN_LENGTH: they must come in order,
+ * once each, with every multiple of 4 in the range among them.
+ */
+static void checkScan(BTreeIndex& index, int thread, int lo, int keys)
+{
+	BTreeCursor cursor(index);
+	RecordId rid;
+	int key, last = INT_MIN;
+	int expect = lo; // the next multiple of 4 to come
+	int hi = min(lo + SCAN_LENGTH, 4 * keys);
+
+	cursor.seek(lo);
+	while (cursor.next(key, rid) == 0 && key < hi)
+	{
+		if (key < last || (key == last && key != DUP_KEY))
+			fail("scan out of order at", thread, last, key);
+		if (key % 4 == 0)
+		{
+			if (key != expect)
+				fail("scan lost key", thread, expect, key);
+			expect = key + 4;
+		}
+		last = key;
+	}
+	if (expect < hi)
+		fail("scan stopped before key", thread, expect, last);
+}
+
+/*
+ * The keys inserted by thread: 4 * i + 1 for every i < keys with i % threads == thread.
+ */
+static void insertKeys(BTreeIndex* index, int thread, int threads, int keys)
+{
+	unsigned seed = 17 + thread;
+	int done = 0;
+
+	for (int i = thread; i < keys; i += threads, done++)
+	{
+		RecordId rid;
+		rid.pid = 4 * i + 1;
+		rid.sid = thread;
+		if (index->insert(4 * i + 1, rid) < 0)
+			fail("insert failed for", thread, 4 * i + 1, 0);
+
+		if (done % DUP_EVERY == 0)
+		{
+			rid.pid = done;
+			if (index->insert(DUP_KEY, rid) < 0)
+				fail("insert failed for", thread, DUP_KEY, 0);
+		}
+
+		seed = seed * 1103515245 + 12345;
+		if (done % SEEK_EVERY == 0)
+			checkSeek(*index, thread, (seed >> 8) % (4 * keys), keys);
+		if (done % SCAN_EVERY == 0)
+			checkScan(*index, thread, (seed >> 8) % keys * 4, keys);
+	}
+}
+
+/*
+ * Seek random keys, or scan random ranges, with thread's share of count.
+ */
+static void readKeys(BTreeIndex* index, int thread, int threads, int keys, bool scan, int count)
+{
+	unsigned seed = 31 + thread;
+
+	for (int i = thread; i < count; i += threads)
+	{
+		seed = seed * 1103515245 + 12345;
+		if (scan)
+			checkScan(*index, thread, (seed >> 8) % keys * 4, keys);
+		else
+			checkSeek(*index, thread, (seed >> 8) % (4 * keys), keys);
+	}
+}
+
+/*
+ * Scan the whole index: every key must be there once, with its RecordId,
+ * and key 2 once per RecordId added to it.
+ */
+static void checkIndex(BTreeIndex& index, int threads, int keys)
+{
+	BTreeCursor cursor(index);
+	RecordId rid;
+	int key;
+	int dups = 0, wantDups = 0;
+	vector<int> got;
+
+	cursor.seek(INT_MIN);
+	while (cursor.next(key, rid) == 0)
+	{
+		if (key == DUP_KEY)
+		{
+			dups++;
+			continue;
+		}
+		if (rid.pid != key)
+			fail("wrong RecordId for key", -1, key, rid.pid);
+		got.push_back(key);
+	}
+
+	if (got.size() != 2 * (size_t)keys)
+		fail("entries in the index, expected", -1, 2 * keys, (int)got.size());
+	for (size_t i = 0; i < got.size() && i < 2 * (size_t)keys; i++)
+	{
+		int want = (i % 2 == 0) ? 2 * i : 2 * i - 1;
+		if (got[i] != want)
+		{
+			fail("lost or duplicated key", -1, want, got[i]);
+			break;
+		}
+	}
+
+	for (int t = 0; t < threads; t++)
+	{
+		int inserted = (keys - t + threads - 1) / threads;
+		wantDups += (inserted + DUP_EVERY - 1) / DUP_EVERY;
+	}
+	if (dups != wantDups)
+		fail("RecordIds of the duplicate key, expected", -1, wantDups, dups);
+}
+
+typedef vector< IndexEntry<int> > Entries;
+
+/*
+ * Report a failed check of the index called name.
+ */
+static void failLookup(const char* name, const char* what, int key, int got)
+{
+	if (errors++ < 10)
+		fprintf(stderr, "%s: %s %d, got %d\n", name, what, key, got);
+}
+
+static bool sameEntry(const IndexEntry<int>& a, const IndexEntry<int>& b)
+{
+	return a.key == b.key && a.rid == b.rid;
+}
+
+/*
+ * @return the number of entries of a forward scan with a key smaller than key
+ */
+static int entriesBelow(const Entries& forward, int key)
+{
+	int lo = 0, hi = forward.size();
+
+	while (lo < hi)
+	{
+		int mid = (lo + hi) / 2;
+		if (forward[mid].key < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/*
+ * Check that a backward scan returned the entries of the forward scan all
+ * in descending key order. The RecordIds of a posting list come in the
+ * order of the list both ways, so the entries of a key are compared sorted.
+ */
+static void checkBackward(const char* name, const char* what, const Entries& forward, Entries backward)
+{
+	Entries sorted(forward);
+
+	for (size_t i = 1; i < backward.size(); i++)
+	{
+		if (backward[i].key > backward[i - 1].key)
+		{
+			failLookup(name, what, backward[i - 1].key, backward[i].key);
+			return;
+		}
+	}
+
+	sort(sorted.begin(), sorted.end());
+	sort(backward.begin(), backward.end());
+	if (backward.size() != sorted.size() || !equal(backward.begin(), backward.end(), sorted.begin(), sameEntry))
+		failLookup(name, what, (int)sorted.size(), (int)backward.size());
+}
+
+/*
+ * Run the lookup checks on index, whose keys lie from lo to hi.
+ * @param leavesOnly[IN] true if the leaves hold every entry, so that the
+ *                       functions on an IndexCursor see all of them
+ */
+static void checkLookups(BTreeIndex& index, const char* name, int lo, int hi, bool leavesOnly)
+{
+	BTreeCursor cursor(index);
+	IndexCursor ic;
+	RecordId rid;
+	int key;
+	Entries forward, found, many;
+	vector<int> keys;
+
+	// The reference: a forward scan of the whole index
+	cursor.seek(INT_MIN);
+	IndexEntry<int> entry;
+	while (cursor.next(entry.key, entry.rid) == 0)
+		forward.push_back(entry);
+	for (size_t i = 1; i < forward.size(); i++)
+	{
+		if (forward[i].key < forward[i - 1].key)
+			failLookup(name, "forward scan out of order at", forward[i - 1].key, forward[i].key);
+	}
+
+	// Every key from below lo to past hi, present or not, with some twice
+	for (int k = lo - 3; k <= hi + 3; k++)
+	{
+		keys.push_back(k);
+		if (k % 97 == 0)
+			keys.push_back(k);
+	}
+
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		int k = keys[i];
+
+		// seek() and a forward scan from there; locate() and readForward()
+		found.clear();
+		RC rc = cursor.seek(k);
+		while (cursor.next(entry.key, entry.rid) == 0 && entry.key == k)
+			found.push_back(entry);
+		if ((rc == 0) != !found.empty())
+			failLookup(name, "seek returned the wrong code for", k, rc);
+		if (i == 0 || keys[i - 1] != k)
+			many.insert(many.end(), found.begin(), found.end());
+		if (leavesOnly)
+		{
+			Entries located;
+			rc = index.locate(k, ic);
+			while (ic.pid > 0 && index.readForward(ic, entry.key, entry.rid) == 0 && entry.key == k)
+				located.push_back(entry);
+			if ((rc == 0) != !located.empty() || located.size() != found.size()
+			    || !equal(located.begin(), located.end(), found.begin(), sameEntry))
+				failLookup(name, "locate and seek differ for", k, (int)located.size());
+		}
+
+		// seekBefore() and locateBefore() stop in front of the first entry
+		// not smaller than k (or, inclusive, greater than it)
+		for (int inclusive = 0; inclusive < 2; inclusive++)
+		{
+			int bound = inclusive ? entriesBelow(forward, k + 1) : entriesBelow(forward, k);
+			int want = (bound == 0) ? INT_MIN : forward[bound - 1].key;
+
+			cursor.seekBefore(k, inclusive);
+			if (cursor.peek(key, rid) != 0)
+				key = INT_MIN;
+			if (key != want)
+				failLookup(name, inclusive ? "seekBefore (inclusive) wrong for" : "seekBefore wrong for", k, key);
+
+			if (leavesOnly)
+			{
+				index.locateBefore(k, inclusive, ic);
+				if (ic.pid <= 0 || index.readBackward(ic, key, rid) != 0)
+					key = INT_MIN;
+				if (key != want)
+					failLookup(name, inclusive ? "locateBefore (inclusive) wrong for" : "locateBefore wrong for", k, key);
+			}
+		}
+	}
+
+	// locateMany() of every key at once finds what the seeks found one by one
+	found.clear();
+	if (index.locateMany(&keys[0], keys.size(), found) < 0)
+		failLookup(name, "locateMany failed for keys", (int)keys.size(), 0);
+	if (found.size() != many.size() || !equal(found.begin(), found.end(), many.begin(), sameEntry))
+		failLookup(name, "locateMany and seek differ, entries", (int)many.size(), (int)found.size());
+	if (many.size() != forward.size())
+		failLookup(name, "seeks found entries, expected", (int)forward.size(), (int)many.size());
+
+	// scanBatch() in small batches returns the forward scan, and the cursor
+	// and the index count the entries of a range like it
+	Entries batched;
+	IndexEntry<int> batch[7];
+	int n, count;
+	cursor.seek(INT_MIN);
+	do {
+		if (cursor.scanBatch(INT_MAX, true, batch, 7, n) < 0)
+			break;
+		batched.insert(batched.end(), batch, batch + n);
+	} while (n == 7);
+	if (batched.size() != forward.size() || !equal(batched.begin(), batched.end(), forward.begin(), sameEntry))
+		failLookup(name, "scanBatch and next differ, entries", (int)forward.size(), (int)batched.size());
+
+	for (int k = lo; k <= hi; k += (hi - lo) / 5 + 1)
+	{
+		int want = entriesBelow(forward, k);
+		cursor.seek(k);
+		if (cursor.countRange(INT_MAX, true, count) < 0 || count != (int)forward.size() - want)
+			failLookup(name, "cursor countRange wrong from", k, count);
+		if (index.rank(k, false, count) < 0 || count != want)
+			failLookup(name, "rank wrong for", k, count);
+
+		int end = k + (hi - lo) / 7;
+		if (index.countRange(&k, true, &end, false, count) < 0 || count != entriesBelow(forward, end) - want)
+			failLookup(name, "countRange wrong from", k, count);
+		if (index.countRange(NULL, false, &end, true, count) < 0 || count != entriesBelow(forward, end + 1))
+			failLookup(name, "countRange wrong up to", end, count);
+	}
+
+	// Backward scans from the last entry
+	Entries backward;
+	cursor.seekLast();
+	while (cursor.prev(entry.key, entry.rid) == 0)
+		backward.push_back(entry);
+	checkBackward(name, "prev() out of order or wrong, entries", forward, backward);
+	if (leavesOnly)
+	{
+		backward.clear();
+		index.locateLast(ic);
+		while (ic.pid > 0 && index.readBackward(ic, entry.key, entry.rid) == 0)
+			backward.push_back(entry);
+		checkBackward(name, "readBackward() out of order or wrong, entries", forward, backward);
+	}
+}
+
+/*
+ * The keys 3 * i bulk loaded into the buffered index of the lookup checks:
+ * every other one, except at the start, so that inserts go in front of the
+ * first leaf as well as into every leaf.
+ */
+static bool bulkLoaded(int i, int keys)
+{
+	return i % 2 == 0 && i >= keys / 10;
+}
+
+/*
+ * Build the indexes of the lookup checks and check them: keys 0, 3, 6, ...
+ * inserted in a scrambled order, the same keys bulk loaded, a few keys with
+ * many RecordIds each (so that they move to posting lists) among single
+ * ones, and the rest of the keys buffered on top of a bulk load of some.
+ */
+static void runLookups(int keys)
+{
+	const char* names[] = { "inserted", "bulk loaded", "posting lists", "buffered", "counted" };
+	const int DUP_KEYS = 50;
+
+	for (int kind = 0; kind < 5; kind++)
+	{
+		BTreeIndex index;
+		RecordId rid;
+		unsigned seed = 7;
+		int hi = 3 * (keys - 1);
+
+		unlink(INDEX_FILE);
+		if (index.open(INDEX_FILE, 'w') < 0)
+		{
+			fprintf(stderr, "cannot open %s\n", INDEX_FILE);
+			exit(1);
+		}
+
+		if (kind == 1 || kind == 3)
+		{
+			index.beginBulkLoad(0.7);
+			for (int i = 0; i < keys; i++)
+			{
+				if (kind == 3 && !bulkLoaded(i, keys))
+					continue;
+				rid.pid = 3 * i;
+				rid.sid = 0;
+				index.bulkInsert(3 * i, rid);
+			}
+			index.endBulkLoad();
+			if (kind == 3)
+				index.enableBuffering();
+		}
+		if (kind == 4)
+			index.enableEntryCounts();
+
+		// A scrambled order: i * step modulo keys visits every i once. The
+		// buffered inserts come in descending order instead, so the last
+		// ones wait in a buffer with keys in front of every leaf
+		int step = 7919;
+		while (gcd(step, keys) != 1)
+			step++;
+		for (int n = 0; n < keys && kind != 1; n++)
+		{
+			int i = (kind == 3) ? keys - 1 - n : (int)((long long)n * step % keys);
+			if (kind == 3 && bulkLoaded(i, keys))
+				continue;
+
+			int key = 3 * i;
+			if (kind == 2)
+			{
+				// One entry in four goes to one of a few keys, many times over
+				seed = seed * 1103515245 + 12345;
+				if ((seed >> 8) % 4 == 0)
+					key = 3 * (int)((seed >> 12) % DUP_KEYS);
+			}
+			rid.pid = 3 * i;
+			rid.sid = 1;
+			if (index.insert(key, rid) < 0)
+				failLookup(names[kind], "insert failed for", key, 0);
+
+			// Some RecordIds of a bulk loaded key reach its leaf (and its
+			// posting list) while others still wait in a buffer
+			if (kind == 3 && n % 5 == 0)
+			{
+				rid.sid = 2;
+				if (index.insert(3 * (keys / 4 * 2), rid) < 0)
+					failLookup(names[kind], "insert failed for", 3 * (keys / 4 * 2), 0);
+			}
+		}
+
+		checkLookups(index, names[kind], 0, hi, kind != 3);
+
+		// The same lookups with optimistic reads
+		if (kind == 0)
+		{
+			index.setReadMode(BTreeIndex::OPTIMISTIC_READS);
+			checkLookups(index, "optimistic", 0, hi, true);
+		}
+
+		// The entry counts that the inserts left stale, counted again
+		if (kind == 2)
+		{
+			if (index.recountEntries() < 0)
+				failLookup("recounted", "recountEntries failed, keys", keys, 0);
+			checkLookups(index, "recounted", 0, hi, true);
+		}
+		index.close();
+	}
+	unlink(INDEX_FILE);
+}
+
+/*
+ * Create the index file anew, and bulk load the keys 0, 4, 8, ... into it.
+ */
+static void loadIndex(BTreeIndex& index, int keys)
+{
+	unlink(INDEX_FILE);
+	if (index.open(INDEX_FILE, 'w') < 0)
+	{
+		fprintf(stderr, "cannot open %s\n", INDEX_FILE);
+		exit(1);
+	}
+	index.beginBulkLoad(0.7);
+	for (int i = 0; i < keys; i++)
+	{
+		RecordId rid;
+		rid.pid = 4 * i;
+		rid.sid = 0;
+		index.bulkInsert(4 * i, rid);
+	}
+	index.endBulkLoad();
+}
+
+/*
+ * Load keys keys into a new index in mode, insert as many again from threads
+ * threads, and check the result.
+ * @return the time the inserts took, in milliseconds
+ */
+static double run(char mode, int threads, int keys)
+{
+	BTreeIndex index;
+	vector<thread> workers;
+
+	loadIndex(index, keys);
+	if (mode == 'c')
+		index.enableCopyOnWrite();
+	else if (mode == 'b')
+		index.enableBuffering();
+	else if (mode == 'n')
+		index.enableEntryCounts();
+	else if (mode == 'o')
+		index.setReadMode(BTreeIndex::OPTIMISTIC_READS);
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+		workers.push_back(thread(insertKeys, &index, t, threads, keys));
+	for (int t = 0; t < threads; t++)
+		workers[t].join();
+	double elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+
+	checkIndex(index, threads, keys);
+	index.close();
+	unlink(INDEX_FILE);
+
+	return elapsed;
+}
+
+/*
+ * Seek count random keys, or scan count random ranges, of the index from
+ * threads threads.
+ * @return the time it took, in milliseconds
+ */
+static double timeReads(BTreeIndex& index, int threads, int keys, bool scan, int count)
+{
+	vector<thread> workers;
+
+	chrono::steady_clock::time_point start = chrono::steady_clock::now();
+	for (int t = 0; t < threads; t++)
+		workers.push_back(thread(readKeys, &index, t, threads, keys, scan, count));
+	for (int t = 0; t < threads; t++)
+		workers[t].join();
+	return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+/*
+ * Time the lookups and the scans of an index built like the ones of run(),
+ * in both read modes, with 1, 2, 4 and 8 threads.
+ */
+static void runReads(int keys)
+{
+	BTreeIndex index;
+	const int modes[] = { BTreeIndex::B_LINK_READS, BTreeIndex::OPTIMISTIC_READS };
+	const char* names[] = { "B-link", "optimistic" };
+	int lookups = 4 * keys;
+
+	loadIndex(index, keys);
+	insertKeys(&index, 0, 1, keys);
+	timeReads(index, 1, keys, false, lookups);
+
+	printf("%d lookups, %d scans of %d keys, %u CPUs\n", lookups, READ_SCANS, SCAN_LENGTH, thread::hardware_concurrency());
+	printf("%-14s %8s %12s %8s %12s %8s\n", "read mode", "threads", "lookups/s", "speedup", "scans/s", "speedup");
+	for (int m = 0; m < 2; m++)
+	{
+		double seekRate = 0, scanRate = 0;
+
+		index.setReadMode(modes[m]);
+		for (int threads = 1; threads <= 8; threads *= 2)
+		{
+			double seeks = lookups / timeReads(index, threads, keys, false, lookups) * 1000;
+			double scans = READ_SCANS / timeReads(index, threads, keys, true, READ_SCANS) * 1000;
+			if (threads == 1)
+			{
+				seekRate = seeks;
+				scanRate = scans;
+			}
+			printf("%-14s %8d %12.0f %7.2fx %12.0f %7.2fx\n", names[m], threads, seeks, seeks / seekRate, scans, scans / scanRate);
+		}
+	}
+
+	index.close();
+	unlink(INDEX_FILE);
+}
+
+int main(int argc, char** argv)
+{
+	int keys = (argc > 1) ? atoi(argv[1]) : 50000;
+	const char modes[] = { 'i', 'o', 'n', 'c', 'b' };
+	const char* names[] = { "in place", "optimistic", "counted", "copy-on-write", "buffered" };
+
+	if (keys <= 0)
+	{
+		fprintf(stderr, "usage: %s [keys]\n", argv[0]);
+		return 1;
+	}
+
+	runLookups(keys / 2);
+	printf("lookups checked on %d keys\n", keys / 2);
+
+	printf("%d keys loaded, %d inserted\n", keys, keys);
+	printf("%-14s %8s %10s %14s\n", "mode", "threads", "ms", "inserts/s");
+	for (int m = 0; m < 5; m++)
+	{
+		for (int threads = 1; threads <= 8; threads *= 2)
+		{
+			double elapsed = run(modes[m], threads, keys);
+			printf("%-14s %8d %10.0f %14.0f\n", names[m], threads, elapsed, keys / elapsed * 1000);
+		}
+	}
+
+	runReads(keys);
+
+	if (errors > 0)
+	{
+		printf("FAILED: %d errors\n", (int)errors);
+		return 1;
+	}
+	printf("passed\n");
+	return 0;
+}